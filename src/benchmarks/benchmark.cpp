@@ -0,0 +1,224 @@
+#include "fakeircserver.hpp"
+#include "../client.hpp"
+#include "../exception.hpp"
+#include "../logging/logger.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <converter.hpp>
+
+// End to end benchmark: a real Client against a local FakeIrcServer. The
+// bot repeats every "bench <n>" line it sees, the server times the repeats.
+
+const char* USAGE =
+    "Usage: benchmark [options]\n"
+    "  -c <channels>   channels to spread the traffic over (10)\n"
+    "  -n <nicks>      nicks in each channel (50)\n"
+    "  -r <rate>       lines per second (1000)\n"
+    "  -d <seconds>    length of the flood (10)\n"
+    "  -f <fraction>   part of the lines that are commands (0.1)\n"
+    "  -s <file>       scenario to play instead of a single flood\n"
+    "  -S <directory>  extra Lua scripts to load next to the bench script\n";
+
+// Answers the commands, the reply goes to the channel the command came from
+const char* BENCH_SCRIPT =
+    "function Bench_Reply(server, fromNick, fromUser, fromHost, to, message)\n"
+    "   return message\n"
+    "end\n"
+    "RegisterBlockingCall(\"^bench [0-9]+$\", Bench_Reply, false)\n";
+
+static double Percentile(const std::vector<double>& sorted, double percentile)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    std::size_t index = static_cast<std::size_t>(percentile / 100.0
+                                                 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+static void WriteConfig(const boost::filesystem::path& workDirectory,
+                        unsigned short port,
+                        unsigned int channels)
+{
+    std::ofstream config((workDirectory / "config.xml").string().c_str());
+    config << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+           << "<config>\n"
+           << "  <general>\n"
+           << "    <scripts>" << (workDirectory / "scripts").string()
+           << "</scripts>\n"
+           << "    <logs>" << (workDirectory / "logs").string() << "</logs>\n"
+           << "    <regexps>" << (workDirectory / "regexps.xml").string()
+           << "</regexps>\n"
+           << "    <reminders>" << (workDirectory / "reminders.xml").string()
+           << "</reminders>\n"
+           << "    <namedpipe>" << (workDirectory / "pipe").string()
+           << "</namedpipe>\n"
+           << "    <locale>C</locale>\n"
+           << "  </general>\n"
+           << "  <servers>\n"
+           << "    <server type=\"irc\" id=\"bench\" host=\"127.0.0.1\" port=\""
+           << port << "\">\n"
+           << "      <nick>benchbot</nick>\n"
+           << "      <flood lines=\"0\" bytes=\"0\"/>\n"
+           << "      <channels>\n";
+    for (unsigned int i = 0; i < channels; ++i)
+    {
+        config << "        <channel>#bench" << i << "</channel>\n";
+    }
+    config << "      </channels>\n"
+           << "    </server>\n"
+           << "  </servers>\n"
+           << "</config>\n";
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned int channels = 10;
+    unsigned int nicks = 50;
+    double rate = 1000;
+    double seconds = 10;
+    double fraction = 0.1;
+    std::string scenarioFile;
+    std::string scriptsDirectory;
+
+    try
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string option = argv[i];
+            if (i + 1 >= argc || option.size() != 2 || option[0] != '-')
+            {
+                std::cerr << USAGE;
+                return 1;
+            }
+            std::string value = argv[++i];
+            switch (option[1])
+            {
+            case 'c': channels = boost::lexical_cast<unsigned int>(value); break;
+            case 'n': nicks = boost::lexical_cast<unsigned int>(value); break;
+            case 'r': rate = boost::lexical_cast<double>(value); break;
+            case 'd': seconds = boost::lexical_cast<double>(value); break;
+            case 'f': fraction = boost::lexical_cast<double>(value); break;
+            case 's': scenarioFile = value; break;
+            case 'S': scriptsDirectory = value; break;
+            default:
+                std::cerr << USAGE;
+                return 1;
+            }
+        }
+    } catch (boost::bad_lexical_cast&)
+    {
+        std::cerr << USAGE;
+        return 1;
+    }
+    channels = std::max(channels, 1u);
+
+    FakeIrcServer::Scenario scenario;
+    try
+    {
+        std::stringstream defaultScenario;
+        defaultScenario.imbue(std::locale::classic());
+        defaultScenario << "flood " << rate << " " << seconds << " "
+                        << fraction << "\n";
+        if (scenarioFile.empty())
+        {
+            scenario = FakeIrcServer::ParseScenario(defaultScenario);
+        }
+        else
+        {
+            std::ifstream input(scenarioFile.c_str());
+            if (!input)
+            {
+                std::cerr << "Unable to open " << scenarioFile << "\n";
+                return 1;
+            }
+            scenario = FakeIrcServer::ParseScenario(input);
+        }
+    } catch (Exception& e)
+    {
+        std::cerr << AsUtf8(e.GetMessage()) << "\n";
+        return 1;
+    }
+
+    namespace fs = boost::filesystem;
+    fs::path workDirectory = fs::temp_directory_path()
+        / fs::unique_path("ircbot-benchmark-%%%%-%%%%");
+    fs::create_directories(workDirectory / "scripts");
+    fs::create_directories(workDirectory / "logs");
+    {
+        std::ofstream script((workDirectory / "scripts" / "bench.lua")
+                             .string().c_str());
+        script << BENCH_SCRIPT;
+    }
+    if (!scriptsDirectory.empty())
+    {
+        for (fs::directory_iterator i(scriptsDirectory);
+             i != fs::directory_iterator();
+             ++i)
+        {
+            if (fs::is_regular_file(i->status()))
+            {
+                fs::copy_file(i->path(),
+                              workDirectory / "scripts" / i->path().filename());
+            }
+        }
+    }
+
+    FakeIrcServer::Results results;
+    bool finished = false;
+    bool replied = false;
+    {
+        FakeIrcServer server(0, channels, nicks);
+        WriteConfig(workDirectory, server.GetPort(), channels);
+        server.Start(scenario);
+
+        Client client(AsUnicode((workDirectory / "config.xml").string()));
+
+        double scenarioSeconds = 0;
+        for (FakeIrcServer::Scenario::const_iterator step = scenario.begin();
+             step != scenario.end();
+             ++step)
+        {
+            scenarioSeconds += step->Seconds;
+        }
+        // Leave time to connect and join before the scenario starts
+        finished = server.WaitForFinish(boost::posix_time::seconds(
+            static_cast<long>(scenarioSeconds) + 30));
+        replied = server.WaitForReplies(boost::posix_time::seconds(10));
+        results = server.GetResults();
+    }
+    fs::remove_all(workDirectory);
+
+    std::vector<double>& latencies = results.LatenciesMicroseconds;
+    std::sort(latencies.begin(), latencies.end());
+
+    std::printf("scenario:        %s\n", finished ? "finished" : "timed out");
+    std::printf("lines sent:      %lu (%.0f/s)\n", results.LinesSent,
+                results.Seconds > 0 ? results.LinesSent / results.Seconds : 0);
+    std::printf("lines received:  %lu\n", results.LinesReceived);
+    std::printf("commands:        %lu sent, %lu replied%s\n",
+                results.CommandsSent, results.RepliesReceived,
+                replied ? "" : " (some replies missing)");
+    std::printf("throughput:      %.0f replies/s\n",
+                results.Seconds > 0
+                ? results.RepliesReceived / results.Seconds : 0);
+    std::printf("latency (ms):    p50 %.3f  p99 %.3f  p999 %.3f  max %.3f\n",
+                Percentile(latencies, 50) / 1000,
+                Percentile(latencies, 99) / 1000,
+                Percentile(latencies, 99.9) / 1000,
+                latencies.empty() ? 0 : latencies.back() / 1000);
+
+    return finished && replied ? 0 : 1;
+}
@@ -0,0 +1,537 @@
+#include "fakeircserver.hpp"
+#include "../exception.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+
+using boost::asio::ip::tcp;
+using boost::posix_time::ptime;
+using boost::posix_time::microsec_clock;
+
+const std::string SERVER_NAME = "bench.local";
+// How often a flood wakes up to write the lines that are due
+const long FLOOD_TICK_MICROSECONDS = 1000;
+// Cap on lines written in one tick so a slow reader can not make us buffer
+// the whole flood at once
+const unsigned long MAX_LINES_PER_TICK = 10000;
+
+FakeIrcServer::Scenario FakeIrcServer::ParseScenario(std::istream& input)
+{
+    Scenario scenario;
+    std::string line;
+    unsigned int lineNumber = 0;
+    while (std::getline(input, line))
+    {
+        ++lineNumber;
+        std::stringstream ss(line);
+        ss.imbue(std::locale::classic());
+        std::string action;
+        ss >> action;
+        if (action.empty() || action[0] == '#')
+        {
+            continue;
+        }
+
+        Step step = { Step::Wait, 0, 0, 0, 0, std::string() };
+        bool valid = true;
+        if (action == "wait")
+        {
+            valid = !(ss >> step.Seconds).fail();
+        }
+        else if (action == "flood")
+        {
+            step.Action = Step::Flood;
+            step.CommandFraction = 1;
+            valid = !(ss >> step.Rate >> step.Seconds).fail();
+            double fraction = 0;
+            if (valid && ss >> fraction)
+            {
+                step.CommandFraction = std::min(std::max(fraction, 0.0), 1.0);
+            }
+        }
+        else if (action == "join" || action == "part" || action == "quit")
+        {
+            step.Action = action == "join" ? Step::Join
+                : action == "part" ? Step::Part : Step::Quit;
+            valid = !(ss >> step.Count).fail();
+        }
+        else if (action == "raw")
+        {
+            step.Action = Step::Raw;
+            std::getline(ss >> std::ws, step.Line);
+            valid = !step.Line.empty();
+        }
+        else
+        {
+            valid = false;
+        }
+
+        if (!valid)
+        {
+            throw Exception(__FILE__, __LINE__,
+                            ("Invalid scenario step on line "
+                             + boost::lexical_cast<std::string>(lineNumber))
+                            .c_str());
+        }
+        scenario.push_back(step);
+    }
+    return scenario;
+}
+
+FakeIrcServer::FakeIrcServer(unsigned short port,
+                             unsigned int channels,
+                             unsigned int nicksPerChannel)
+    : channels_(channels)
+    , nicksPerChannel_(nicksPerChannel)
+    , acceptor_(ioService_, tcp::endpoint(
+                    boost::asio::ip::address_v4::loopback(), port))
+    , socket_(ioService_)
+    , stepTimer_(ioService_)
+    , nextGuest_(0)
+    , started_(false)
+    , step_(0)
+    , stepLines_(0)
+    , commandCredit_(0)
+    , nextCommand_(0)
+{
+    results_.LinesSent = 0;
+    results_.CommandsSent = 0;
+    results_.LinesReceived = 0;
+    results_.RepliesReceived = 0;
+    results_.Seconds = 0;
+
+    StartAccept();
+    thread_ = boost::thread(boost::bind(&boost::asio::io_service::run,
+                                        &ioService_));
+}
+
+FakeIrcServer::~FakeIrcServer()
+{
+    ioService_.stop();
+    thread_.join();
+}
+
+unsigned short FakeIrcServer::GetPort() const
+{
+    return acceptor_.local_endpoint().port();
+}
+
+void FakeIrcServer::Start(const Scenario& scenario)
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    scenario_ = scenario;
+    step_ = 0;
+    if (joined_.size() >= channels_ && !started_)
+    {
+        started_ = true;
+        ioService_.post(boost::bind(&FakeIrcServer::StartStep, this));
+    }
+}
+
+bool FakeIrcServer::WaitForFinish(
+    const boost::posix_time::time_duration& timeout)
+{
+    ptime deadline = microsec_clock::universal_time() + timeout;
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (finished_.is_not_a_date_time())
+    {
+        if (!condition_.timed_wait(lock, deadline))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FakeIrcServer::WaitForReplies(
+    const boost::posix_time::time_duration& timeout)
+{
+    ptime deadline = microsec_clock::universal_time() + timeout;
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    while (!outstanding_.empty())
+    {
+        if (!condition_.timed_wait(lock, deadline))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+FakeIrcServer::Results FakeIrcServer::GetResults() const
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    Results results = results_;
+    if (!firstFlood_.is_not_a_date_time())
+    {
+        ptime end = finished_.is_not_a_date_time()
+            ? microsec_clock::universal_time() : finished_;
+        results.Seconds = (end - firstFlood_).total_microseconds() / 1000000.0;
+    }
+    return results;
+}
+
+void FakeIrcServer::StartAccept()
+{
+    acceptor_.async_accept(socket_, boost::bind(&FakeIrcServer::OnAccept,
+                                                this, _1));
+}
+
+void FakeIrcServer::OnAccept(const boost::system::error_code& error)
+{
+    if (!error)
+    {
+        StartRead();
+    }
+}
+
+void FakeIrcServer::StartRead()
+{
+    boost::asio::async_read_until(socket_, readBuffer_, '\n',
+                                  boost::bind(&FakeIrcServer::OnRead, this,
+                                              _1, _2));
+}
+
+void FakeIrcServer::OnRead(const boost::system::error_code& error,
+                           std::size_t /*bytes*/)
+{
+    if (error)
+    {
+        return;
+    }
+    std::istream input(&readBuffer_);
+    std::string line;
+    while (readBuffer_.size() > 0 && std::getline(input, line))
+    {
+        if (input.eof())
+        {
+            // Not a whole line yet, put it back
+            std::ostream output(&readBuffer_);
+            output << line;
+            break;
+        }
+        if (!line.empty() && line[line.size() - 1] == '\r')
+        {
+            line.erase(line.size() - 1);
+        }
+        HandleLine(line);
+    }
+    StartRead();
+}
+
+void FakeIrcServer::HandleLine(const std::string& line)
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    ++results_.LinesReceived;
+
+    std::string::size_type commandEnd = line.find(' ');
+    std::string command = line.substr(0, commandEnd);
+    std::string parameters = commandEnd == std::string::npos
+        ? std::string() : line.substr(commandEnd + 1);
+    std::string::size_type textStart = parameters.find(':');
+    std::string text = textStart == std::string::npos
+        ? std::string() : parameters.substr(textStart + 1);
+
+    if (command == "NICK")
+    {
+        nick_ = parameters;
+    }
+    else if (command == "USER")
+    {
+        Write(":" + SERVER_NAME + " 001 " + nick_ + " :Welcome to the bench");
+        Write(":" + SERVER_NAME + " 005 " + nick_
+              + " CHANTYPES=#& PREFIX=(ov)@+ CASEMAPPING=rfc1459"
+              " NETWORK=Bench :are supported by this server");
+        Write(":" + SERVER_NAME + " 376 " + nick_ + " :End of /MOTD command.");
+    }
+    else if (command == "PING")
+    {
+        Write(":" + SERVER_NAME + " PONG " + SERVER_NAME + " :"
+              + (text.empty() ? parameters : text));
+    }
+    else if (command == "JOIN")
+    {
+        HandleJoin(parameters.substr(0, parameters.find(' ')));
+    }
+    else if (command == "PART")
+    {
+        std::string channel = parameters.substr(0, parameters.find(' '));
+        joined_.erase(channel);
+        Write(":" + nick_ + "!bot@localhost PART " + channel);
+    }
+    else if (command == "QUIT")
+    {
+        boost::system::error_code closeError;
+        socket_.close(closeError);
+    }
+    else if (command == "PRIVMSG")
+    {
+        OnReply(text);
+    }
+}
+
+void FakeIrcServer::HandleJoin(const std::string& channels)
+{
+    std::stringstream ss(channels);
+    std::string channel;
+    while (std::getline(ss, channel, ','))
+    {
+        joined_.insert(channel);
+        Write(":" + nick_ + "!bot@localhost JOIN " + channel);
+
+        // Names in lines of a few hundred bytes like a real server
+        std::string names = "@" + nick_;
+        for (unsigned int i = 0; i < nicksPerChannel_; ++i)
+        {
+            names += " user" + boost::lexical_cast<std::string>(i);
+            if (names.size() > 400 || i + 1 == nicksPerChannel_)
+            {
+                Write(":" + SERVER_NAME + " 353 " + nick_ + " = " + channel
+                      + " :" + names);
+                names.clear();
+            }
+        }
+        if (!names.empty())
+        {
+            Write(":" + SERVER_NAME + " 353 " + nick_ + " = " + channel
+                  + " :" + names);
+        }
+        Write(":" + SERVER_NAME + " 366 " + nick_ + " " + channel
+              + " :End of /NAMES list.");
+    }
+
+    if (joined_.size() >= channels_ && !started_ && !scenario_.empty())
+    {
+        started_ = true;
+        ioService_.post(boost::bind(&FakeIrcServer::StartStep, this));
+    }
+}
+
+void FakeIrcServer::OnReply(const std::string& text)
+{
+    const std::string command = "bench ";
+    if (text.compare(0, command.size(), command) != 0)
+    {
+        return;
+    }
+    unsigned long sequence = 0;
+    try
+    {
+        sequence = boost::lexical_cast<unsigned long>(
+            text.substr(command.size()));
+    } catch (boost::bad_lexical_cast&)
+    {
+        return;
+    }
+    std::map<unsigned long, ptime>::iterator sent =
+        outstanding_.find(sequence);
+    if (sent != outstanding_.end())
+    {
+        results_.LatenciesMicroseconds.push_back(static_cast<double>(
+            (microsec_clock::universal_time() - sent->second)
+            .total_microseconds()));
+        ++results_.RepliesReceived;
+        outstanding_.erase(sent);
+        if (outstanding_.empty())
+        {
+            condition_.notify_all();
+        }
+    }
+}
+
+void FakeIrcServer::Write(const std::string& line)
+{
+    writeQueue_ += line;
+    writeQueue_ += "\r\n";
+    if (writing_.empty())
+    {
+        StartWrite();
+    }
+}
+
+void FakeIrcServer::StartWrite()
+{
+    writing_.swap(writeQueue_);
+    writeQueue_.clear();
+    if (!writing_.empty() && socket_.is_open())
+    {
+        boost::asio::async_write(socket_, boost::asio::buffer(writing_),
+                                 boost::bind(&FakeIrcServer::OnWrite, this,
+                                             _1));
+    }
+    else
+    {
+        writing_.clear();
+    }
+}
+
+void FakeIrcServer::OnWrite(const boost::system::error_code& error)
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    writing_.clear();
+    if (!error && !writeQueue_.empty())
+    {
+        StartWrite();
+    }
+}
+
+void FakeIrcServer::StartStep()
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    while (step_ < scenario_.size())
+    {
+        const Step& step = scenario_[step_];
+        stepStarted_ = microsec_clock::universal_time();
+        stepLines_ = 0;
+        switch (step.Action)
+        {
+        case Step::Wait:
+            stepTimer_.expires_from_now(boost::posix_time::microseconds(
+                static_cast<long>(step.Seconds * 1000000)));
+            stepTimer_.async_wait(boost::bind(&FakeIrcServer::OnStepTimer,
+                                              this, _1));
+            return;
+        case Step::Flood:
+            if (firstFlood_.is_not_a_date_time())
+            {
+                firstFlood_ = stepStarted_;
+            }
+            stepTimer_.expires_from_now(boost::posix_time::microseconds(
+                FLOOD_TICK_MICROSECONDS));
+            stepTimer_.async_wait(boost::bind(&FakeIrcServer::OnStepTimer,
+                                              this, _1));
+            return;
+        case Step::Join:
+            JoinNicks(step.Count);
+            break;
+        case Step::Part:
+            PartNicks(step.Count, false);
+            break;
+        case Step::Quit:
+            PartNicks(step.Count, true);
+            break;
+        case Step::Raw:
+            Write(step.Line);
+            break;
+        default:
+            // The scenario parser makes no other steps
+            break;
+        }
+        ++step_;
+    }
+    Finish();
+}
+
+void FakeIrcServer::OnStepTimer(const boost::system::error_code& error)
+{
+    if (error)
+    {
+        return;
+    }
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        const Step& step = scenario_[step_];
+        ptime now = microsec_clock::universal_time();
+        if (step.Action == Step::Flood)
+        {
+            Flood(now);
+            if (now - stepStarted_ < boost::posix_time::microseconds(
+                    static_cast<long>(step.Seconds * 1000000)))
+            {
+                stepTimer_.expires_from_now(boost::posix_time::microseconds(
+                    FLOOD_TICK_MICROSECONDS));
+                stepTimer_.async_wait(boost::bind(
+                    &FakeIrcServer::OnStepTimer, this, _1));
+                return;
+            }
+        }
+        ++step_;
+    }
+    StartStep();
+}
+
+void FakeIrcServer::Flood(const ptime& now)
+{
+    const Step& step = scenario_[step_];
+    double seconds = (now - stepStarted_).total_microseconds() / 1000000.0;
+    unsigned long due = static_cast<unsigned long>(
+        std::min(seconds, step.Seconds) * step.Rate);
+    unsigned long lines = std::min(due - std::min(due, stepLines_),
+                                   MAX_LINES_PER_TICK);
+    for (unsigned long i = 0; i < lines; ++i, ++stepLines_)
+    {
+        std::string nick = "user" + boost::lexical_cast<std::string>(
+            stepLines_ % std::max(nicksPerChannel_, 1u));
+        std::string channel = GetChannelName(stepLines_ % channels_);
+        std::string prefix = ":" + nick + "!" + nick + "@" + SERVER_NAME
+            + " PRIVMSG " + channel + " :";
+
+        commandCredit_ += step.CommandFraction;
+        if (commandCredit_ >= 1)
+        {
+            commandCredit_ -= 1;
+            unsigned long sequence = nextCommand_++;
+            outstanding_[sequence] = now;
+            ++results_.CommandsSent;
+            Write(prefix + "bench "
+                  + boost::lexical_cast<std::string>(sequence));
+        }
+        else
+        {
+            Write(prefix + "just some chatter to log and match against, "
+                  "line " + boost::lexical_cast<std::string>(stepLines_));
+        }
+        ++results_.LinesSent;
+    }
+}
+
+void FakeIrcServer::JoinNicks(unsigned int count)
+{
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        std::string nick = "guest" + boost::lexical_cast<std::string>(
+            nextGuest_++);
+        guests_.push_back(nick);
+        for (unsigned int channel = 0; channel < channels_; ++channel)
+        {
+            Write(":" + nick + "!" + nick + "@" + SERVER_NAME + " JOIN "
+                  + GetChannelName(channel));
+            ++results_.LinesSent;
+        }
+    }
+}
+
+void FakeIrcServer::PartNicks(unsigned int count, bool quit)
+{
+    for (unsigned int i = 0; i < count && !guests_.empty(); ++i)
+    {
+        std::string nick = guests_.back();
+        guests_.pop_back();
+        std::string prefix = ":" + nick + "!" + nick + "@" + SERVER_NAME;
+        if (quit)
+        {
+            Write(prefix + " QUIT :Leaving");
+            ++results_.LinesSent;
+            continue;
+        }
+        for (unsigned int channel = 0; channel < channels_; ++channel)
+        {
+            Write(prefix + " PART " + GetChannelName(channel));
+            ++results_.LinesSent;
+        }
+    }
+}
+
+std::string FakeIrcServer::GetChannelName(unsigned int channel) const
+{
+    return "#bench" + boost::lexical_cast<std::string>(channel);
+}
+
+void FakeIrcServer::Finish()
+{
+    finished_ = microsec_clock::universal_time();
+    condition_.notify_all();
+}
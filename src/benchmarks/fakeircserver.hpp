@@ -0,0 +1,158 @@
+#pragma once
+
+#include <istream>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <boost/utility.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+/**
+ * A local IRC server to benchmark the bot against. It accepts one client,
+ * registers it, answers PING, JOIN, PART and QUIT and, once the client has
+ * joined its channels, plays a scenario of channel traffic at it. Lines
+ * saying "bench <n>" are commands the client is expected to repeat back,
+ * the time until the repeat arrives is the command-to-reply latency.
+ */
+class FakeIrcServer : boost::noncopyable
+{
+public:
+    struct Step
+    {
+	enum Type
+	{
+	    Wait,
+	    Flood,
+	    Join,
+	    Part,
+	    Quit,
+	    Raw
+	};
+
+	Type Action;
+	double Seconds;
+	// Lines per second for a flood
+	double Rate;
+	// Part of the flood that are commands, 0 to 1
+	double CommandFraction;
+	// Number of nicks to join, part or quit
+	unsigned int Count;
+	std::string Line;
+    };
+    typedef std::vector<Step> Scenario;
+
+    /**
+     * Read a scenario, one step per line:
+     *   wait <seconds>
+     *   flood <lines per second> <seconds> [part of lines that are commands]
+     *   join <nicks>    join that many new nicks to every channel
+     *   part <nicks>    part that many nicks from every channel
+     *   quit <nicks>    quit that many nicks
+     *   raw <line>      send a line as it is
+     * Empty lines and lines starting with # are ignored.
+     * @throw Exception if a line can not be understood
+     */
+    static Scenario ParseScenario(std::istream& input);
+
+    /**
+     * @param port 0 picks a free port, see GetPort
+     * @param channels number of channels to wait for the client to join,
+     *        traffic is spread over them
+     * @param nicksPerChannel members of each channel besides the client
+     */
+    FakeIrcServer(unsigned short port,
+                  unsigned int channels,
+                  unsigned int nicksPerChannel);
+    ~FakeIrcServer();
+
+    unsigned short GetPort() const;
+
+    /**
+     * Play the scenario as soon as the client has joined the channels.
+     */
+    void Start(const Scenario& scenario);
+
+    /**
+     * Wait for the scenario to be played to the end.
+     * @return false if it did not finish in time
+     */
+    bool WaitForFinish(const boost::posix_time::time_duration& timeout);
+
+    /**
+     * Wait until every command has been replied to.
+     * @return false if some were not replied to in time
+     */
+    bool WaitForReplies(const boost::posix_time::time_duration& timeout);
+
+    struct Results
+    {
+	unsigned long LinesSent;
+	unsigned long CommandsSent;
+	unsigned long LinesReceived;
+	unsigned long RepliesReceived;
+	// From the first flood line to the end of the scenario
+	double Seconds;
+	std::vector<double> LatenciesMicroseconds;
+    };
+    Results GetResults() const;
+
+private:
+    void StartAccept();
+    void OnAccept(const boost::system::error_code& error);
+    void StartRead();
+    void OnRead(const boost::system::error_code& error, std::size_t bytes);
+    void HandleLine(const std::string& line);
+    void HandleJoin(const std::string& channels);
+    void OnReply(const std::string& text);
+
+    void Write(const std::string& line);
+    void StartWrite();
+    void OnWrite(const boost::system::error_code& error);
+
+    void StartStep();
+    void OnStepTimer(const boost::system::error_code& error);
+    void Flood(const boost::posix_time::ptime& now);
+    void JoinNicks(unsigned int count);
+    void PartNicks(unsigned int count, bool quit);
+    std::string GetChannelName(unsigned int channel) const;
+    void Finish();
+
+    unsigned int channels_;
+    unsigned int nicksPerChannel_;
+
+    boost::asio::io_service ioService_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    boost::asio::ip::tcp::socket socket_;
+    boost::asio::streambuf readBuffer_;
+    std::string writeQueue_;
+    std::string writing_;
+    boost::asio::deadline_timer stepTimer_;
+
+    std::string nick_;
+    std::set<std::string> joined_;
+    // Nicks made up by join steps, taken out again by part and quit
+    std::vector<std::string> guests_;
+    unsigned long nextGuest_;
+
+    Scenario scenario_;
+    bool started_;
+    std::size_t step_;
+    boost::posix_time::ptime stepStarted_;
+    unsigned long stepLines_;
+    double commandCredit_;
+    unsigned long nextCommand_;
+    boost::posix_time::ptime firstFlood_;
+    boost::posix_time::ptime finished_;
+
+    // Commands waiting for a reply and when they were sent
+    std::map<unsigned long, boost::posix_time::ptime> outstanding_;
+    Results results_;
+    mutable boost::mutex mutex_;
+    boost::condition_variable condition_;
+
+    boost::thread thread_;
+};
@@ -0,0 +1,212 @@
+#include "../logscanner.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+// Looks for the last lines of nicks that only spoke at the start of a large
+// chat log, so the whole log has to be read, the way searchidle did it and
+// with the log scanner, one nick at a time and all at once.
+
+using boost::posix_time::microsec_clock;
+
+const char* USAGE =
+    "Usage: logscannerbenchmark [options]\n"
+    "  -f <file>       the log, made if it does not exist\n"
+    "                  (/tmp/logscannerbenchmark.log)\n"
+    "  -s <megabytes>  size of a new log (3072)\n"
+    "  -n <nicks>      nicks talking in a new log (2000)\n"
+    "  -b <nicks>      nicks looked for at once (20)\n";
+
+static std::string GetSeenNick(unsigned int i)
+{
+    return "seen" + boost::lexical_cast<std::string>(i);
+}
+
+static bool MakeLog(const std::string& path,
+                    unsigned long long size,
+                    unsigned int nicks,
+                    unsigned int batch)
+{
+    FILE* log = std::fopen(path.c_str(), "w");
+    if (log == 0)
+    {
+        std::perror(path.c_str());
+        return false;
+    }
+    std::srand(1);
+    unsigned long long written = 0;
+    unsigned long time = 1000000000;
+    unsigned long line = 0;
+    for (unsigned int i = 0; i < batch; ++i)
+    {
+        written += std::fprintf(log, "%lu #channel: <%s> first and last\n",
+                                time++, GetSeenNick(i).c_str());
+    }
+    while (written < size)
+    {
+        written += std::fprintf(log,
+                                "%lu #channel: <nick%u> line %lu of the log "
+                                "with some words in it\n",
+                                time++, std::rand() % nicks, ++line);
+    }
+    return std::fclose(log) == 0;
+}
+
+// What searchidle did, with 64 bit offsets and the whole log mapped
+static bool ByteAtATime(const std::string& path, const char* nick,
+                        long& timestamp)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat status;
+    if (fd == -1 || fstat(fd, &status) == -1)
+    {
+        return false;
+    }
+    std::size_t size = status.st_size;
+    const char* map = static_cast<const char*>(
+        mmap(0, size, PROT_READ, MAP_SHARED, fd, 0));
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+    bool found = false;
+    for (std::size_t i = size; i-- > 0 && !found;)
+    {
+        if (map[i] != '\n' && i != 0)
+        {
+            continue;
+        }
+        std::size_t begin = i == 0 ? 0 : i + 1;
+        std::size_t j = begin;
+        while (j + 1 < size && map[j] != '\n'
+               && !(map[j] == ':' && map[j + 1] == ' '))
+        {
+            ++j;
+        }
+        j += 2;
+        if (j + std::strlen(nick) + 1 < size && map[j] == '<'
+            && std::strncmp(nick, &map[j + 1], std::strlen(nick)) == 0
+            && map[j + 1 + std::strlen(nick)] == '>')
+        {
+            timestamp = std::atol(&map[begin]);
+            found = true;
+        }
+    }
+    munmap(const_cast<char*>(map), size);
+    return found;
+}
+
+static void Report(const char* name,
+                   const boost::posix_time::ptime& start,
+                   unsigned long long bytes,
+                   std::size_t found,
+                   std::size_t nicks)
+{
+    double microseconds = (microsec_clock::universal_time() - start)
+        .total_microseconds();
+    std::printf("%-32s %10.0f ms %8.2f GB/s  %lu/%lu found\n", name,
+                microseconds / 1000,
+                microseconds > 0 ? bytes / microseconds / 1000 : 0,
+                static_cast<unsigned long>(found),
+                static_cast<unsigned long>(nicks));
+}
+
+int main(int argc, char* argv[])
+{
+    std::string path = "/tmp/logscannerbenchmark.log";
+    unsigned long long megabytes = 3072;
+    unsigned int nicks = 2000;
+    unsigned int batch = 20;
+
+    try
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string option = argv[i];
+            if (i + 1 >= argc || option.size() != 2 || option[0] != '-')
+            {
+                std::cerr << USAGE;
+                return 1;
+            }
+            std::string value = argv[++i];
+            switch (option[1])
+            {
+            case 'f': path = value; break;
+            case 's': megabytes = boost::lexical_cast<unsigned long long>(value); break;
+            case 'n': nicks = boost::lexical_cast<unsigned int>(value); break;
+            case 'b': batch = boost::lexical_cast<unsigned int>(value); break;
+            default:
+                std::cerr << USAGE;
+                return 1;
+            }
+        }
+    } catch (boost::bad_lexical_cast&)
+    {
+        std::cerr << USAGE;
+        return 1;
+    }
+    nicks = std::max(nicks, 1u);
+    batch = std::max(batch, 1u);
+
+    struct stat status;
+    if (stat(path.c_str(), &status) == -1)
+    {
+        std::printf("Writing %llu MB to %s\n", megabytes, path.c_str());
+        if (!MakeLog(path, megabytes << 20, nicks, batch)
+            || stat(path.c_str(), &status) == -1)
+        {
+            return 1;
+        }
+    }
+    unsigned long long size = status.st_size;
+    std::printf("%s is %llu MB\n", path.c_str(), size >> 20);
+
+    std::vector<std::string> seen;
+    for (unsigned int i = 0; i < batch; ++i)
+    {
+        seen.push_back(GetSeenNick(i));
+    }
+
+    boost::posix_time::ptime start = microsec_clock::universal_time();
+    long timestamp = 0;
+    Report("byte at a time, 1 nick", start, size,
+           ByteAtATime(path, seen[0].c_str(), timestamp), 1);
+
+    start = microsec_clock::universal_time();
+    LogScanner::Match match;
+    Report("LogScanner, 1 nick", start, size,
+           LogScanner::FindLastLine(path, seen[0], match), 1);
+
+    start = microsec_clock::universal_time();
+    std::size_t found = 0;
+    for (unsigned int i = 0; i < batch; ++i)
+    {
+        found += LogScanner::FindLastLine(path, seen[i], match);
+    }
+    Report("LogScanner, one nick a pass", start, size * batch, found, batch);
+
+    start = microsec_clock::universal_time();
+    LogScanner::MatchContainer matches;
+    LogScanner::FindLastLines(path, seen, matches);
+    found = 0;
+    for (std::size_t i = 0; i < matches.size(); ++i)
+    {
+        found += matches[i].Found;
+    }
+    Report("LogScanner, all nicks one pass", start, size, found, batch);
+    return 0;
+}
@@ -0,0 +1,189 @@
+#include "../channelmembers.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+// Replays a netsplit, the quits and the joins when the servers link again,
+// against the channel membership store and the map of sets it replaced.
+
+using boost::posix_time::microsec_clock;
+
+const char* USAGE =
+    "Usage: membershipbenchmark [options]\n"
+    "  -c <channels>   channels we are in (150)\n"
+    "  -n <nicks>      nicks on the network we share a channel with (20000)\n"
+    "  -m <channels>   most channels a nick is in (5)\n"
+    "  -s <fraction>   part of the nicks that split (0.3)\n";
+
+// What Server used to do
+class MapOfSets
+{
+public:
+    void Add(const std::string& channel, const std::string& nick)
+    {
+        channels_[channel].insert(nick);
+    }
+
+    void RemoveNick(const std::string& nick)
+    {
+        for (Channels::iterator channel = channels_.begin();
+             channel != channels_.end();
+             ++channel)
+        {
+            channel->second.erase(nick);
+        }
+    }
+
+    void RenameNick(const std::string& oldNick, const std::string& newNick)
+    {
+        for (Channels::iterator channel = channels_.begin();
+             channel != channels_.end();
+             ++channel)
+        {
+            channel->second.erase(oldNick);
+            channel->second.insert(newNick);
+        }
+    }
+
+private:
+    typedef std::map<std::string, std::set<std::string> > Channels;
+    Channels channels_;
+};
+
+struct Member
+{
+    std::string Nick;
+    std::vector<std::string> Channels;
+};
+typedef std::vector<Member> MemberContainer;
+
+static MemberContainer MakeMembers(unsigned int channels,
+                                   unsigned int nicks,
+                                   unsigned int maxChannels)
+{
+    std::srand(1);
+    MemberContainer members(nicks);
+    for (unsigned int i = 0; i < nicks; ++i)
+    {
+        members[i].Nick = "nick" + boost::lexical_cast<std::string>(i);
+        unsigned int count = 1 + std::rand() % maxChannels;
+        for (unsigned int j = 0; j < count; ++j)
+        {
+            // Skewed so that some channels are much bigger than others
+            unsigned int channel = (std::rand() % channels)
+                * (std::rand() % channels) / channels;
+            members[i].Channels.push_back(
+                "#channel" + boost::lexical_cast<std::string>(channel));
+        }
+    }
+    return members;
+}
+
+static void Report(const char* name,
+                   const char* operation,
+                   const boost::posix_time::ptime& start,
+                   std::size_t operations)
+{
+    double microseconds = (microsec_clock::universal_time() - start)
+        .total_microseconds();
+    std::printf("%-16s %-6s %10.0f ns/line\n", name, operation,
+                operations > 0 ? microseconds * 1000 / operations : 0);
+}
+
+template<class Store>
+static void Replay(const char* name,
+                   const MemberContainer& members,
+                   std::size_t split)
+{
+    Store store;
+    for (MemberContainer::const_iterator member = members.begin();
+         member != members.end();
+         ++member)
+    {
+        for (std::size_t i = 0; i < member->Channels.size(); ++i)
+        {
+            store.Add(member->Channels[i], member->Nick);
+        }
+    }
+
+    boost::posix_time::ptime start = microsec_clock::universal_time();
+    for (std::size_t i = 0; i < split; ++i)
+    {
+        store.RemoveNick(members[i].Nick);
+    }
+    Report(name, "QUIT", start, split);
+
+    start = microsec_clock::universal_time();
+    std::size_t joins = 0;
+    for (std::size_t i = 0; i < split; ++i)
+    {
+        for (std::size_t j = 0; j < members[i].Channels.size(); ++j, ++joins)
+        {
+            store.Add(members[i].Channels[j], members[i].Nick);
+        }
+    }
+    Report(name, "JOIN", start, joins);
+
+    start = microsec_clock::universal_time();
+    for (std::size_t i = 0; i < split; ++i)
+    {
+        store.RenameNick(members[i].Nick, members[i].Nick + "_");
+    }
+    Report(name, "NICK", start, split);
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned int channels = 150;
+    unsigned int nicks = 20000;
+    unsigned int maxChannels = 5;
+    double fraction = 0.3;
+
+    try
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string option = argv[i];
+            if (i + 1 >= argc || option.size() != 2 || option[0] != '-')
+            {
+                std::cerr << USAGE;
+                return 1;
+            }
+            std::string value = argv[++i];
+            switch (option[1])
+            {
+            case 'c': channels = boost::lexical_cast<unsigned int>(value); break;
+            case 'n': nicks = boost::lexical_cast<unsigned int>(value); break;
+            case 'm': maxChannels = boost::lexical_cast<unsigned int>(value); break;
+            case 's': fraction = boost::lexical_cast<double>(value); break;
+            default:
+                std::cerr << USAGE;
+                return 1;
+            }
+        }
+    } catch (boost::bad_lexical_cast&)
+    {
+        std::cerr << USAGE;
+        return 1;
+    }
+    channels = std::max(channels, 1u);
+    maxChannels = std::max(maxChannels, 1u);
+
+    MemberContainer members = MakeMembers(channels, nicks, maxChannels);
+    std::size_t split = static_cast<std::size_t>(nicks * fraction);
+    std::printf("%u channels, %u nicks, %lu split\n", channels, nicks,
+                static_cast<unsigned long>(split));
+
+    Replay<MapOfSets>("map of sets", members, split);
+    Replay<ChannelMembers>("ChannelMembers", members, split);
+    return 0;
+}
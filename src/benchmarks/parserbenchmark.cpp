@@ -0,0 +1,177 @@
+#include "../irc/ircmessage.hpp"
+#include "../irc/messageparser.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/regex.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+// Compares the hand written parser with the regular expressions it
+// replaced, on a corpus of recorded lines (one per line, as received).
+
+using boost::posix_time::microsec_clock;
+
+const int DEFAULT_ROUNDS = 20000;
+
+struct RegexParsed
+{
+    std::string Nick;
+    std::string User;
+    std::string Host;
+    std::string Command;
+    std::vector<std::string> Parameters;
+};
+
+// What Irc::IrcMessage used to do
+static bool RegexParse(const std::string& line, RegexParsed& parsed)
+{
+    static const boost::regex dataRegex(
+        "(?::([^ ]+) )?([^ ]+)(?: ([^:]+))?(?: :(.*))?");
+    static const boost::regex prefixRegex("([^!]+)(?:!([^@]+)@(.+))?");
+
+    boost::smatch matches;
+    if (!boost::regex_match(line, matches, dataRegex))
+    {
+        return false;
+    }
+    boost::smatch prefixMatches;
+    std::string prefix = matches[1].str();
+    if (boost::regex_match(prefix, prefixMatches, prefixRegex))
+    {
+        parsed.Nick = prefixMatches[1];
+        parsed.User = prefixMatches[2];
+        parsed.Host = prefixMatches[3];
+    }
+    parsed.Command = matches[2].str();
+    parsed.Parameters.clear();
+    std::stringstream stream(matches[3].str());
+    std::copy(std::istream_iterator<std::string>(stream),
+              std::istream_iterator<std::string>(),
+              std::back_inserter(parsed.Parameters));
+    if (matches[4].matched)
+    {
+        parsed.Parameters.push_back(matches[4].str());
+    }
+    return true;
+}
+
+static void Report(const char* name, const boost::posix_time::ptime& start,
+                   std::size_t lines, std::size_t bytes)
+{
+    double seconds = (microsec_clock::universal_time() - start)
+        .total_microseconds() / 1000000.0;
+    std::printf("%-22s %8.1f ns/line %8.1f MB/s\n", name,
+                seconds * 1e9 / lines, bytes / seconds / 1e6);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: parserbenchmark <corpus> [rounds]\n";
+        return 1;
+    }
+    std::ifstream input(argv[1]);
+    std::vector<std::string> corpus;
+    std::string line;
+    std::size_t corpusBytes = 0;
+    while (std::getline(input, line))
+    {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+        {
+            line.erase(line.size() - 1);
+        }
+        if (!line.empty())
+        {
+            corpus.push_back(line);
+            corpusBytes += line.size();
+        }
+    }
+    if (corpus.empty())
+    {
+        std::cerr << "No lines in " << argv[1] << "\n";
+        return 1;
+    }
+    int rounds = argc >= 3 ? std::atoi(argv[2]) : DEFAULT_ROUNDS;
+
+    // Where the two disagree, the regular expressions did not allow a colon
+    // inside a middle parameter and did not know about tags
+    std::size_t differences = 0;
+    for (std::vector<std::string>::const_iterator i = corpus.begin();
+         i != corpus.end();
+         ++i)
+    {
+        RegexParsed old;
+        Irc::ParsedLine parsed;
+        bool oldOk = RegexParse(*i, old);
+        bool newOk = Irc::ParseLine(*i, parsed);
+        bool same = oldOk == newOk;
+        if (same && newOk)
+        {
+            same = old.Nick == parsed.Nick && old.User == parsed.User
+                && old.Host == parsed.Host && old.Command == parsed.Command
+                && old.Parameters.size() == parsed.ParameterCount;
+            for (std::size_t p = 0; same && p < parsed.ParameterCount; ++p)
+            {
+                same = old.Parameters[p] == parsed.Parameters[p];
+            }
+        }
+        if (!same)
+        {
+            ++differences;
+            std::printf("differs: %s\n", i->c_str());
+        }
+    }
+
+    std::size_t lines = corpus.size() * rounds;
+    std::size_t bytes = corpusBytes * rounds;
+    std::size_t checksum = 0;
+
+    boost::posix_time::ptime start = microsec_clock::universal_time();
+    RegexParsed old;
+    for (int round = 0; round < rounds; ++round)
+    {
+        for (std::size_t i = 0; i < corpus.size(); ++i)
+        {
+            RegexParse(corpus[i], old);
+            checksum += old.Parameters.size();
+        }
+    }
+    Report("regex", start, lines, bytes);
+
+    start = microsec_clock::universal_time();
+    Irc::ParsedLine parsed;
+    for (int round = 0; round < rounds; ++round)
+    {
+        for (std::size_t i = 0; i < corpus.size(); ++i)
+        {
+            Irc::ParseLine(corpus[i], parsed);
+            checksum += parsed.ParameterCount;
+        }
+    }
+    Report("Irc::ParseLine", start, lines, bytes);
+
+    start = microsec_clock::universal_time();
+    for (int round = 0; round < rounds; ++round)
+    {
+        for (std::size_t i = 0; i < corpus.size(); ++i)
+        {
+            Irc::IrcMessage message(corpus[i]);
+            checksum += message.size();
+        }
+    }
+    Report("Irc::IrcMessage", start, lines, bytes);
+
+    std::printf("%lu lines, %lu differences, checksum %lu\n",
+                static_cast<unsigned long>(corpus.size()),
+                static_cast<unsigned long>(differences),
+                static_cast<unsigned long>(checksum));
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "casemapping.hpp"
+
+namespace
+{
+
+struct FoldTables
+{
+    FoldTables()
+    {
+	for (int c = 0; c < 256; ++c)
+	{
+	    Tables[CaseMapping::Ascii][c] =
+		c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+	}
+	for (int c = 0; c < 256; ++c)
+	{
+	    Tables[CaseMapping::StrictRfc1459][c] =
+		c >= 'A' && c <= ']' ? c - 'A' + 'a' : c;
+	    Tables[CaseMapping::Rfc1459][c] =
+		c >= 'A' && c <= '^' ? c - 'A' + 'a' : c;
+	}
+    }
+
+    unsigned char Tables[CaseMapping::StrictRfc1459 + 1][256];
+};
+
+const FoldTables tables;
+
+} // namespace
+
+bool CaseMapping::FromString(boost::string_ref name, CaseMapping& mapping)
+{
+    if (name == "ascii")
+    {
+	mapping = Ascii;
+    }
+    else if (name == "rfc1459")
+    {
+	mapping = Rfc1459;
+    }
+    else if (name == "strict-rfc1459")
+    {
+	mapping = StrictRfc1459;
+    }
+    else
+    {
+	return false;
+    }
+    return true;
+}
+
+char CaseMapping::Fold(char c, CaseMapping mapping)
+{
+    return tables.Tables[mapping][static_cast<unsigned char>(c)];
+}
+
+bool CaseMapping::Fold(boost::string_ref text, CaseMapping mapping,
+                       char* buffer, std::size_t size)
+{
+    if (text.size() > size)
+    {
+	return false;
+    }
+    const unsigned char* table = tables.Tables[mapping];
+    for (std::size_t i = 0; i < text.size(); ++i)
+    {
+	buffer[i] = table[static_cast<unsigned char>(text[i])];
+    }
+    return true;
+}
+
+std::string CaseMapping::Fold(boost::string_ref text, CaseMapping mapping)
+{
+    std::string folded(text.begin(), text.end());
+    const unsigned char* table = tables.Tables[mapping];
+    for (std::string::iterator c = folded.begin(); c != folded.end(); ++c)
+    {
+	*c = table[static_cast<unsigned char>(*c)];
+    }
+    return folded;
+}
+
+bool CaseMapping::Equals(boost::string_ref a, boost::string_ref b,
+                         CaseMapping mapping)
+{
+    if (a.size() != b.size())
+    {
+	return false;
+    }
+    const unsigned char* table = tables.Tables[mapping];
+    for (std::size_t i = 0; i < a.size(); ++i)
+    {
+	if (table[static_cast<unsigned char>(a[i])]
+	    != table[static_cast<unsigned char>(b[i])])
+	{
+	    return false;
+	}
+    }
+    return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+
+#include <boost/utility/string_ref.hpp>
+
+namespace CaseMapping
+{
+    /**
+     * How a server compares nicks and channels, as given by CASEMAPPING in
+     * RPL_ISUPPORT. RFC 1459 has []\~ as the lower case of {}|^, strict
+     * RFC 1459 leaves out ~ and ^.
+     */
+    enum CaseMapping
+    {
+	Ascii,
+	Rfc1459,
+	StrictRfc1459
+    };
+
+    /**
+     * @return false if the name is not one of ascii, rfc1459 and
+     *         strict-rfc1459
+     */
+    bool FromString(boost::string_ref name, CaseMapping& mapping);
+
+    /**
+     * The lower case of a character.
+     */
+    char Fold(char c, CaseMapping mapping);
+
+    /**
+     * Fold into a buffer without allocating.
+     * @return false if the text does not fit
+     */
+    bool Fold(boost::string_ref text, CaseMapping mapping,
+              char* buffer, std::size_t size);
+
+    std::string Fold(boost::string_ref text, CaseMapping mapping);
+
+    bool Equals(boost::string_ref a, boost::string_ref b,
+                CaseMapping mapping);
+} // namespace CaseMapping
@@ -0,0 +1,516 @@
+#include "channelmembers.hpp"
+
+#include <algorithm>
+
+const std::size_t ChannelMembers::MAX_PREFIXES;
+
+ChannelMembers::ChannelMembers()
+    : prefixSymbols_("~&@%+")
+{
+}
+
+void ChannelMembers::SetCaseMapping(CaseMapping::CaseMapping mapping)
+{
+    nickIds_.SetCaseMapping(mapping);
+    channelIds_.SetCaseMapping(mapping);
+}
+
+void ChannelMembers::SetPrefixSymbols(const std::string& symbols)
+{
+    prefixSymbols_ = symbols.substr(0, MAX_PREFIXES);
+}
+
+void ChannelMembers::Add(const std::string& channel, const std::string& nick)
+{
+    Id channelId = InternChannel(channel);
+    Id nickId = InternNick(nick);
+    if (channelNicks_[channelId].insert(
+            MemberMap::value_type(nickId, 0)).second)
+    {
+        nickChannels_[nickId].push_back(channelId);
+        MarkChanged(channelId);
+    }
+}
+
+void ChannelMembers::Remove(const std::string& channel,
+                            const std::string& nick)
+{
+    Id channelId = channelIds_.Find(channel);
+    Id nickId = nickIds_.Find(nick);
+    if (channelId != IdentifierTable::NO_ID
+        && nickId != IdentifierTable::NO_ID)
+    {
+        RemoveMember(channelId, nickId);
+        ReleaseNick(nickId);
+    }
+}
+
+void ChannelMembers::RemoveNick(const std::string& nick)
+{
+    Id nickId = nickIds_.Find(nick);
+    if (nickId == IdentifierTable::NO_ID)
+    {
+        return;
+    }
+    IdContainer& channels = nickChannels_[nickId];
+    for (IdContainer::const_iterator channel = channels.begin();
+         channel != channels.end();
+         ++channel)
+    {
+        channelNicks_[*channel].erase(nickId);
+        MarkChanged(*channel);
+    }
+    channels.clear();
+    ReleaseNick(nickId);
+}
+
+void ChannelMembers::RenameNick(const std::string& oldNick,
+                                const std::string& newNick)
+{
+    Id oldId = nickIds_.Find(oldNick);
+    if (oldId == IdentifierTable::NO_ID)
+    {
+        return;
+    }
+    MarkChannelsOf(oldId);
+    // Members refer to the id, usually only the name changes
+    if (nickIds_.Rename(oldId, newNick))
+    {
+        return;
+    }
+
+    // Both are known, which happens if we missed a part or quit
+    Id newId = nickIds_.Find(newNick);
+    IdContainer channels;
+    channels.swap(nickChannels_[oldId]);
+    for (IdContainer::const_iterator channel = channels.begin();
+         channel != channels.end();
+         ++channel)
+    {
+        MemberMap& members = channelNicks_[*channel];
+        PrefixBits prefixes = members[oldId];
+        members.erase(oldId);
+        std::pair<MemberMap::iterator, bool> inserted =
+            members.insert(MemberMap::value_type(newId, prefixes));
+        if (inserted.second)
+        {
+            nickChannels_[newId].push_back(*channel);
+        }
+        else
+        {
+            inserted.first->second |= prefixes;
+        }
+    }
+    // The old nick's user and host are the ones that are up to date
+    NickInfo& oldInfo = nickInfo_[oldId];
+    NickInfo& newInfo = nickInfo_[newId];
+    if (!oldInfo.Host.empty())
+    {
+        newInfo = oldInfo;
+    }
+    ReleaseNick(oldId);
+}
+
+void ChannelMembers::ClearChannel(const std::string& channel)
+{
+    MemberMap nicks;
+    DetachMembers(InternChannel(channel), nicks);
+    ReleaseNicks(nicks);
+}
+
+void ChannelMembers::ReplaceChannel(const std::string& channel,
+                                    const NamesContainer& entries)
+{
+    Id channelId = InternChannel(channel);
+    // What is known about nicks that stay is kept, so they are only let go
+    // of once the new members are in
+    MemberMap oldMembers;
+    DetachMembers(channelId, oldMembers);
+    MemberMap& members = channelNicks_[channelId];
+    members.reserve(entries.size());
+    for (NamesContainer::const_iterator entry = entries.begin();
+         entry != entries.end();
+         ++entry)
+    {
+        Id nickId = InternNick(entry->Nick);
+        std::pair<MemberMap::iterator, bool> inserted =
+            members.insert(MemberMap::value_type(nickId, entry->Prefixes));
+        if (inserted.second)
+        {
+            nickChannels_[nickId].push_back(channelId);
+        }
+        else
+        {
+            inserted.first->second |= entry->Prefixes;
+        }
+        NickInfo& info = nickInfo_[nickId];
+        if (!entry->Host.empty())
+        {
+            info.User = entry->User;
+            info.Host = entry->Host;
+        }
+    }
+    ReleaseNicks(oldMembers);
+}
+
+void ChannelMembers::RemoveChannel(const std::string& channel)
+{
+    if (HasChannel(channel))
+    {
+        ClearChannel(channel);
+        Id channelId = channelIds_.Find(channel);
+        channelIds_.Forget(channelId);
+        channelInfo_[channelId] = ChannelInfo();
+        // The name is already taken note of, the id can be given again
+        isChanged_[channelId] = false;
+    }
+}
+
+void ChannelMembers::SetPrefix(const std::string& channel,
+                               const std::string& nick,
+                               std::size_t prefix,
+                               bool set)
+{
+    Id channelId = channelIds_.Find(channel);
+    Id nickId = nickIds_.Find(nick);
+    if (prefix >= prefixSymbols_.size()
+        || channelId == IdentifierTable::NO_ID
+        || nickId == IdentifierTable::NO_ID)
+    {
+        return;
+    }
+    MemberMap::iterator member = channelNicks_[channelId].find(nickId);
+    if (member != channelNicks_[channelId].end())
+    {
+        PrefixBits bit = static_cast<PrefixBits>(1 << prefix);
+        PrefixBits prefixes = set ? (member->second | bit)
+                                  : (member->second & ~bit);
+        if (prefixes != member->second)
+        {
+            member->second = prefixes;
+            MarkChanged(channelId);
+        }
+    }
+}
+
+void ChannelMembers::SetUserAndHost(const std::string& nick,
+                                    const std::string& user,
+                                    const std::string& host)
+{
+    Id nickId = nickIds_.Find(nick);
+    if (nickId == IdentifierTable::NO_ID)
+    {
+        return;
+    }
+    NickInfo& info = nickInfo_[nickId];
+    bool changed = false;
+    if (!user.empty() && user != info.User)
+    {
+        info.User = user;
+        changed = true;
+    }
+    if (!host.empty() && host != info.Host)
+    {
+        info.Host = host;
+        changed = true;
+    }
+    if (changed)
+    {
+        MarkChannelsOf(nickId);
+    }
+}
+
+void ChannelMembers::SetAccount(const std::string& nick,
+                                const std::string& account)
+{
+    Id nickId = nickIds_.Find(nick);
+    if (nickId != IdentifierTable::NO_ID
+        && nickInfo_[nickId].Account != account)
+    {
+        nickInfo_[nickId].Account = account;
+        MarkChannelsOf(nickId);
+    }
+}
+
+void ChannelMembers::SetTopic(const std::string& channel,
+                              const std::string& topic)
+{
+    if (ChannelInfo* info = FindChannelInfo(channel))
+    {
+        info->Topic = topic;
+    }
+}
+
+void ChannelMembers::SetTopicSetter(const std::string& channel,
+                                    const std::string& setBy,
+                                    std::time_t setAt)
+{
+    if (ChannelInfo* info = FindChannelInfo(channel))
+    {
+        info->TopicSetBy = setBy;
+        info->TopicSetAt = setAt;
+    }
+}
+
+void ChannelMembers::SetMode(const std::string& channel,
+                             char mode,
+                             const std::string& parameter)
+{
+    if (ChannelInfo* info = FindChannelInfo(channel))
+    {
+        info->Modes[mode] = parameter;
+    }
+}
+
+void ChannelMembers::UnsetMode(const std::string& channel, char mode)
+{
+    if (ChannelInfo* info = FindChannelInfo(channel))
+    {
+        info->Modes.erase(mode);
+    }
+}
+
+void ChannelMembers::ClearModes(const std::string& channel)
+{
+    if (ChannelInfo* info = FindChannelInfo(channel))
+    {
+        info->Modes.clear();
+    }
+}
+
+bool ChannelMembers::HasChannel(boost::string_ref channel) const
+{
+    return channelIds_.Find(channel) != IdentifierTable::NO_ID;
+}
+
+bool ChannelMembers::GetChannelName(boost::string_ref channel,
+                                    std::string& name) const
+{
+    Id channelId = channelIds_.Find(channel);
+    if (channelId == IdentifierTable::NO_ID)
+    {
+        return false;
+    }
+    name = channelIds_.GetName(channelId);
+    return true;
+}
+
+bool ChannelMembers::GetNicks(boost::string_ref channel,
+                              NickContainer& nicks) const
+{
+    nicks.clear();
+    Id channelId = channelIds_.Find(channel);
+    if (channelId == IdentifierTable::NO_ID)
+    {
+        return false;
+    }
+    const MemberMap& members = channelNicks_[channelId];
+    nicks.reserve(members.size());
+    for (MemberMap::const_iterator nick = members.begin();
+         nick != members.end();
+         ++nick)
+    {
+        nicks.push_back(nickIds_.GetName(nick->first));
+    }
+    std::sort(nicks.begin(), nicks.end());
+    return true;
+}
+
+bool ChannelMembers::GetSnapshot(boost::string_ref channel,
+                                 ChannelSnapshot& snapshot) const
+{
+    Id channelId = channelIds_.Find(channel);
+    if (channelId == IdentifierTable::NO_ID)
+    {
+        return false;
+    }
+    snapshot.Name = channelIds_.GetName(channelId);
+    snapshot.Mapping = GetCaseMapping();
+
+    const MemberMap& members = channelNicks_[channelId];
+    snapshot.Nicks.clear();
+    snapshot.Nicks.reserve(members.size());
+    snapshot.Members.clear();
+    snapshot.Members.reserve(members.size());
+    for (MemberMap::const_iterator member = members.begin();
+         member != members.end();
+         ++member)
+    {
+        const NickInfo& info = nickInfo_[member->first];
+        ChannelSnapshot::Member entry;
+        entry.Nick = nickIds_.GetName(member->first);
+        for (std::size_t i = 0; i < prefixSymbols_.size(); ++i)
+        {
+            if (member->second & (1 << i))
+            {
+                entry.Prefixes += prefixSymbols_[i];
+            }
+        }
+        entry.User = info.User;
+        entry.Host = info.Host;
+        entry.Account = info.Account;
+        snapshot.Nicks.push_back(entry.Nick);
+        snapshot.Members.insert(ChannelSnapshot::MemberMap::value_type(
+            CaseMapping::Fold(entry.Nick, snapshot.Mapping), entry));
+    }
+    std::sort(snapshot.Nicks.begin(), snapshot.Nicks.end());
+
+    const ChannelInfo& info = channelInfo_[channelId];
+    snapshot.Topic = info.Topic;
+    snapshot.TopicSetBy = info.TopicSetBy;
+    snapshot.TopicSetAt = info.TopicSetAt;
+    snapshot.Modes = info.Modes;
+    return true;
+}
+
+void ChannelMembers::GetChannels(std::vector<std::string>& channels) const
+{
+    channels.clear();
+    for (Id channel = 0; channel < channelIds_.GetIdLimit(); ++channel)
+    {
+        const std::string& name = channelIds_.GetName(channel);
+        // Forgotten ids have no name
+        if (!name.empty())
+        {
+            channels.push_back(name);
+        }
+    }
+}
+
+void ChannelMembers::TakeChangedChannels(std::vector<std::string>& channels)
+{
+    channels.clear();
+    channels.swap(changedNames_);
+    for (IdContainer::const_iterator channel = changedIds_.begin();
+         channel != changedIds_.end();
+         ++channel)
+    {
+        isChanged_[*channel] = false;
+    }
+    changedIds_.clear();
+}
+
+std::size_t ChannelMembers::GetChannelCount(boost::string_ref nick) const
+{
+    Id nickId = nickIds_.Find(nick);
+    return nickId == IdentifierTable::NO_ID
+        ? 0 : nickChannels_[nickId].size();
+}
+
+void ChannelMembers::GetNickChannels(boost::string_ref nick,
+                                     std::vector<std::string>& channels) const
+{
+    channels.clear();
+    Id nickId = nickIds_.Find(nick);
+    if (nickId == IdentifierTable::NO_ID)
+    {
+        return;
+    }
+    const IdContainer& ids = nickChannels_[nickId];
+    channels.reserve(ids.size());
+    for (IdContainer::const_iterator channel = ids.begin();
+         channel != ids.end();
+         ++channel)
+    {
+        channels.push_back(channelIds_.GetName(*channel));
+    }
+}
+
+ChannelMembers::Id ChannelMembers::InternNick(const std::string& nick)
+{
+    Id nickId = nickIds_.Intern(nick);
+    if (nickChannels_.size() < nickIds_.GetIdLimit())
+    {
+        nickChannels_.resize(nickIds_.GetIdLimit());
+        nickInfo_.resize(nickIds_.GetIdLimit());
+    }
+    return nickId;
+}
+
+ChannelMembers::Id ChannelMembers::InternChannel(const std::string& channel)
+{
+    Id channelId = channelIds_.Intern(channel);
+    if (channelNicks_.size() < channelIds_.GetIdLimit())
+    {
+        channelNicks_.resize(channelIds_.GetIdLimit());
+        channelInfo_.resize(channelIds_.GetIdLimit());
+        isChanged_.resize(channelIds_.GetIdLimit(), false);
+    }
+    return channelId;
+}
+
+void ChannelMembers::ReleaseNick(Id nick)
+{
+    if (nickChannels_[nick].empty())
+    {
+        nickIds_.Forget(nick);
+        nickInfo_[nick] = NickInfo();
+    }
+}
+
+void ChannelMembers::DetachMembers(Id channel, MemberMap& nicks)
+{
+    MarkChanged(channel);
+    nicks.clear();
+    nicks.swap(channelNicks_[channel]);
+    for (MemberMap::const_iterator nick = nicks.begin();
+         nick != nicks.end();
+         ++nick)
+    {
+        IdContainer& channels = nickChannels_[nick->first];
+        channels.erase(std::find(channels.begin(), channels.end(), channel));
+    }
+}
+
+void ChannelMembers::ReleaseNicks(const MemberMap& nicks)
+{
+    for (MemberMap::const_iterator nick = nicks.begin();
+         nick != nicks.end();
+         ++nick)
+    {
+        ReleaseNick(nick->first);
+    }
+}
+
+void ChannelMembers::RemoveMember(Id channel, Id nick)
+{
+    if (channelNicks_[channel].erase(nick) > 0)
+    {
+        IdContainer& channels = nickChannels_[nick];
+        channels.erase(std::find(channels.begin(), channels.end(), channel));
+        MarkChanged(channel);
+    }
+}
+
+void ChannelMembers::MarkChanged(Id channel)
+{
+    if (!isChanged_[channel])
+    {
+        isChanged_[channel] = true;
+        changedIds_.push_back(channel);
+        changedNames_.push_back(channelIds_.GetName(channel));
+    }
+}
+
+void ChannelMembers::MarkChannelsOf(Id nick)
+{
+    const IdContainer& channels = nickChannels_[nick];
+    for (IdContainer::const_iterator channel = channels.begin();
+         channel != channels.end();
+         ++channel)
+    {
+        MarkChanged(*channel);
+    }
+}
+
+ChannelMembers::ChannelInfo* ChannelMembers::FindChannelInfo(
+    const std::string& channel)
+{
+    Id channelId = channelIds_.Find(channel);
+    if (channelId == IdentifierTable::NO_ID)
+    {
+        return 0;
+    }
+    MarkChanged(channelId);
+    return &channelInfo_[channelId];
+}
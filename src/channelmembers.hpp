@@ -0,0 +1,224 @@
+#pragma once
+
+#include "identifiertable.hpp"
+#include "channelsnapshot.hpp"
+
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+#include <boost/utility/string_ref.hpp>
+
+/**
+ * Who is in which channel and what is known about the channels and their
+ * members. Nicks and channels are interned to small ids with the server's
+ * case mapping, each channel has a hash map from nick ids to the member's
+ * modes and each nick knows the channels it is in, so a nick quitting or
+ * changing nick only touches the channels it is actually in.
+ * Not thread safe, the owner has to lock around it.
+ */
+class ChannelMembers
+{
+public:
+    typedef IdentifierTable::Id Id;
+    typedef std::vector<std::string> NickContainer;
+    // Bit i is set if the member has the mode of the i:th prefix symbol
+    typedef unsigned char PrefixBits;
+    static const std::size_t MAX_PREFIXES = 8;
+
+    struct NamesEntry
+    {
+        NamesEntry() : Prefixes(0) {}
+
+        std::string Nick;
+        PrefixBits Prefixes;
+        // Empty when not known
+        std::string User;
+        std::string Host;
+    };
+    typedef std::vector<NamesEntry> NamesContainer;
+
+    ChannelMembers();
+
+    /**
+     * Nicks and channels that were equal before and are not with the new
+     * case mapping stay one.
+     */
+    void SetCaseMapping(CaseMapping::CaseMapping mapping);
+    CaseMapping::CaseMapping GetCaseMapping() const
+    {
+        return channelIds_.GetCaseMapping();
+    }
+
+    /**
+     * The symbols members can have in front of their nick, most powerful
+     * first, as given by PREFIX in RPL_ISUPPORT. Only the first
+     * MAX_PREFIXES are used.
+     */
+    void SetPrefixSymbols(const std::string& symbols);
+    const std::string& GetPrefixSymbols() const { return prefixSymbols_; }
+
+    /**
+     * Add a nick to a channel, the channel is made if it is not known.
+     */
+    void Add(const std::string& channel, const std::string& nick);
+    void Remove(const std::string& channel, const std::string& nick);
+
+    /**
+     * Remove a nick from all channels it is in.
+     */
+    void RemoveNick(const std::string& nick);
+
+    /**
+     * Give a nick a new name in all channels it is in.
+     */
+    void RenameNick(const std::string& oldNick, const std::string& newNick);
+
+    /**
+     * Remove all nicks from a channel but keep knowing the channel.
+     */
+    void ClearChannel(const std::string& channel);
+
+    /**
+     * Make the nicks the only members of the channel, the channel is made
+     * if it is not known.
+     */
+    void ReplaceChannel(const std::string& channel,
+                        const NamesContainer& members);
+    void RemoveChannel(const std::string& channel);
+
+    /**
+     * Give or take a member's mode, nothing happens if the nick is not in
+     * the channel.
+     * @param prefix index of the mode's symbol in the prefix symbols
+     */
+    void SetPrefix(const std::string& channel, const std::string& nick,
+                   std::size_t prefix, bool set);
+
+    /**
+     * Nothing happens for nicks that are not in any channel. Empty values
+     * are not known and leave what is known alone.
+     */
+    void SetUserAndHost(const std::string& nick,
+                        const std::string& user,
+                        const std::string& host);
+    /**
+     * @param account empty when logged out
+     */
+    void SetAccount(const std::string& nick, const std::string& account);
+
+    /**
+     * Nothing happens for channels that are not known.
+     */
+    void SetTopic(const std::string& channel, const std::string& topic);
+    void SetTopicSetter(const std::string& channel,
+                        const std::string& setBy,
+                        std::time_t setAt);
+    /**
+     * @param parameter empty for modes without one
+     */
+    void SetMode(const std::string& channel, char mode,
+                 const std::string& parameter);
+    void UnsetMode(const std::string& channel, char mode);
+    void ClearModes(const std::string& channel);
+
+    bool HasChannel(boost::string_ref channel) const;
+
+    /**
+     * The channel as it was first written, whatever case it is asked for
+     * in.
+     * @return false if the channel is not known
+     */
+    bool GetChannelName(boost::string_ref channel, std::string& name) const;
+
+    /**
+     * @param nicks gets the nicks in the channel sorted, empty if the
+     *        channel is not known
+     * @return false if the channel is not known
+     */
+    bool GetNicks(boost::string_ref channel, NickContainer& nicks) const;
+
+    /**
+     * Fill in everything that is known about a channel.
+     * @return false if the channel is not known
+     */
+    bool GetSnapshot(boost::string_ref channel,
+                     ChannelSnapshot& snapshot) const;
+
+    /**
+     * Number of channels a nick is in.
+     */
+    std::size_t GetChannelCount(boost::string_ref nick) const;
+
+    std::size_t GetNickCount() const { return nickIds_.size(); }
+
+    /**
+     * @param channels gets the channels the nick is in, as first written
+     */
+    void GetNickChannels(boost::string_ref nick,
+                         std::vector<std::string>& channels) const;
+
+    /**
+     * @param channels gets every channel, as first written
+     */
+    void GetChannels(std::vector<std::string>& channels) const;
+
+    /**
+     * Take the channels that have changed since the last time, as they
+     * were written when they changed. A channel that is no longer known
+     * has been removed.
+     */
+    void TakeChangedChannels(std::vector<std::string>& channels);
+
+private:
+    typedef std::vector<Id> IdContainer;
+    typedef boost::unordered_map<Id, PrefixBits> MemberMap;
+
+    struct NickInfo
+    {
+        std::string User;
+        std::string Host;
+        std::string Account;
+    };
+
+    struct ChannelInfo
+    {
+        ChannelInfo() : TopicSetAt(0) {}
+
+        std::string Topic;
+        std::string TopicSetBy;
+        std::time_t TopicSetAt;
+        std::map<char, std::string> Modes;
+    };
+
+    Id InternNick(const std::string& nick);
+    Id InternChannel(const std::string& channel);
+    // Forget the nick if it is no longer in any channel
+    void ReleaseNick(Id nick);
+    void RemoveMember(Id channel, Id nick);
+    // Take all members out of a channel without letting go of the nicks
+    void DetachMembers(Id channel, MemberMap& nicks);
+    void ReleaseNicks(const MemberMap& nicks);
+    void MarkChanged(Id channel);
+    void MarkChannelsOf(Id nick);
+    // Null if the channel is not known, else it is marked as changed
+    ChannelInfo* FindChannelInfo(const std::string& channel);
+
+    IdentifierTable nickIds_;
+    // Indexed by nick id, channels are few per nick so a vector beats a set
+    std::vector<IdContainer> nickChannels_;
+    std::vector<NickInfo> nickInfo_;
+
+    IdentifierTable channelIds_;
+    // Indexed by channel id
+    std::vector<MemberMap> channelNicks_;
+    std::vector<ChannelInfo> channelInfo_;
+
+    std::string prefixSymbols_;
+
+    std::vector<bool> isChanged_;
+    IdContainer changedIds_;
+    std::vector<std::string> changedNames_;
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "casemapping.hpp"
+
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/utility/string_ref.hpp>
+
+/**
+ * A channel as it was after a received line had been handled. Snapshots
+ * are never changed once published, a change publishes a new one, so they
+ * can be read from any thread for as long as they are held.
+ */
+struct ChannelSnapshot
+{
+    ChannelSnapshot() : Mapping(CaseMapping::Rfc1459), TopicSetAt(0) {}
+
+    struct Member
+    {
+	// As the nick is written
+	std::string Nick;
+	// Symbols for the member's modes, most powerful first, like @+
+	std::string Prefixes;
+	// Empty when not known
+	std::string User;
+	std::string Host;
+	std::string Account;
+    };
+
+    /**
+     * Look a member up, in whatever case the nick is written.
+     * @return null if the nick is not in the channel
+     */
+    const Member* FindMember(boost::string_ref nick) const
+    {
+	MemberMap::const_iterator member =
+	    Members.find(CaseMapping::Fold(nick, Mapping));
+	return member == Members.end() ? 0 : &member->second;
+    }
+
+    // As first written
+    std::string Name;
+    // Sorted
+    std::vector<std::string> Nicks;
+    CaseMapping::CaseMapping Mapping;
+    // By folded nick
+    typedef boost::unordered_map<std::string, Member> MemberMap;
+    MemberMap Members;
+
+    std::string Topic;
+    std::string TopicSetBy;
+    // 0 when not known
+    std::time_t TopicSetAt;
+
+    // Modes that are set, with their parameter if they have one. List
+    // modes such as bans are not kept.
+    std::map<char, std::string> Modes;
+};
+
+typedef boost::shared_ptr<const ChannelSnapshot> ChannelSnapshotPtr;
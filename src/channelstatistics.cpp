@@ -0,0 +1,301 @@
+#include "channelstatistics.hpp"
+#include "logging/logger.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+#include <boost/bind.hpp>
+
+// Checkpoints start with this, a new layout gets a new number
+static const char CHECKPOINT_MAGIC[4] = { 'C', 'S', 'T', '1' };
+
+namespace
+{
+    struct MoreMessages
+    {
+        bool operator()(const ChannelStatistics::Talker& lhs,
+                        const ChannelStatistics::Talker& rhs) const
+        {
+            return lhs.Messages > rhs.Messages;
+        }
+    };
+} // namespace
+
+static void Add(ChannelStatistics::Counters& counters,
+                const ChannelStatistics::Counters& more)
+{
+    if (counters.Messages == 0 || more.FirstSeen < counters.FirstSeen)
+    {
+        counters.FirstSeen = more.FirstSeen;
+    }
+    counters.LastSeen = std::max(counters.LastSeen, more.LastSeen);
+    counters.Messages += more.Messages;
+    counters.Words += more.Words;
+    counters.Characters += more.Characters;
+    for (std::size_t hour = 0; hour < ChannelStatistics::HOURS; ++hour)
+    {
+        counters.Hours[hour] += more.Hours[hour];
+    }
+}
+
+ChannelStatistics::Counters::Counters()
+    : Messages(0)
+    , Words(0)
+    , Characters(0)
+    , FirstSeen(0)
+    , LastSeen(0)
+{
+    std::fill(Hours, Hours + HOURS, 0);
+}
+
+ChannelStatistics::ChannelStatistics(const std::string& checkpoint,
+                                     unsigned int checkpointIntervalMilliseconds)
+    : checkpoint_(checkpoint,
+                  checkpointIntervalMilliseconds,
+                  boost::bind(&ChannelStatistics::Serialize, this, _1))
+{
+    Load();
+    checkpoint_.Start();
+}
+
+ChannelStatistics::~ChannelStatistics()
+{
+    checkpoint_.Stop();
+    Save();
+}
+
+void ChannelStatistics::Update(const std::string& logFile,
+                               const std::string& nick,
+                               std::time_t time,
+                               boost::string_ref text)
+{
+    // Counted before the lock is taken
+    Counters message;
+    message.Messages = 1;
+    message.FirstSeen = time;
+    message.LastSeen = time;
+    bool inWord = false;
+    for (boost::string_ref::const_iterator c = text.begin();
+         c != text.end();
+         ++c)
+    {
+        bool space = *c == ' ' || *c == '\t';
+        message.Words += !space && !inWord;
+        inWord = !space;
+        // UTF-8 continuation bytes are part of the character before
+        message.Characters += (*c & 0xc0) != 0x80;
+    }
+    struct tm local;
+    if (localtime_r(&time, &local))
+    {
+        message.Hours[local.tm_hour] = 1;
+    }
+
+    boost::unique_lock<boost::shared_mutex> lock(logsMutex_);
+    LogCounters& log = logs_[logFile];
+    std::pair<NickMap::iterator, bool> inserted =
+        log.Nicks.insert(std::make_pair(nick, Counters()));
+    Counters& counters = inserted.first->second;
+    Add(counters, message);
+    Add(log.Summary.Total, message);
+    log.Summary.Nicks += inserted.second;
+    Promote(log.Summary, nick, counters.Messages);
+}
+
+bool ChannelStatistics::FindChannel(const std::string& logFile,
+                                    Channel& channel) const
+{
+    boost::shared_lock<boost::shared_mutex> lock(logsMutex_);
+    LogMap::const_iterator log = logs_.find(logFile);
+    if (log == logs_.end())
+    {
+        return false;
+    }
+    channel = log->second.Summary;
+    return true;
+}
+
+bool ChannelStatistics::FindNick(const std::string& logFile,
+                                 const std::string& nick,
+                                 Counters& counters) const
+{
+    boost::shared_lock<boost::shared_mutex> lock(logsMutex_);
+    LogMap::const_iterator log = logs_.find(logFile);
+    if (log == logs_.end())
+    {
+        return false;
+    }
+    NickMap::const_iterator found = log->second.Nicks.find(nick);
+    if (found == log->second.Nicks.end())
+    {
+        return false;
+    }
+    counters = found->second;
+    return true;
+}
+
+void ChannelStatistics::Save()
+{
+    checkpoint_.Save();
+}
+
+bool ChannelStatistics::Serialize(std::string& data) const
+{
+    // Copied so that counting does not wait for the whole checkpoint
+    std::vector<std::pair<std::string, NickMap> > logs;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(logsMutex_);
+        logs.reserve(logs_.size());
+        for (LogMap::const_iterator log = logs_.begin();
+             log != logs_.end();
+             ++log)
+        {
+            logs.push_back(std::make_pair(log->first, log->second.Nicks));
+        }
+    }
+
+    data.assign(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    Checkpoint::WriteNumber(data, logs.size());
+    for (std::vector<std::pair<std::string, NickMap> >::const_iterator log =
+             logs.begin();
+         log != logs.end();
+         ++log)
+    {
+        Checkpoint::WriteString(data, log->first);
+        Checkpoint::WriteNumber(data, log->second.size());
+        for (NickMap::const_iterator nick = log->second.begin();
+             nick != log->second.end();
+             ++nick)
+        {
+            const Counters& counters = nick->second;
+            Checkpoint::WriteString(data, nick->first);
+            Checkpoint::WriteNumber(data, counters.Messages);
+            Checkpoint::WriteNumber(data, counters.Words);
+            Checkpoint::WriteNumber(data, counters.Characters);
+            Checkpoint::WriteNumber(data, counters.FirstSeen);
+            Checkpoint::WriteNumber(data, counters.LastSeen);
+            data.append(reinterpret_cast<const char*>(counters.Hours),
+                        sizeof(counters.Hours));
+        }
+    }
+    return true;
+}
+
+void ChannelStatistics::Load()
+{
+    if (checkpoint_.GetPath().empty())
+    {
+        return;
+    }
+    std::ifstream in(checkpoint_.GetPath().c_str(), std::ios::binary);
+    if (!in)
+    {
+        Log << LogLevel::Info
+            << "No channel statistics checkpoint, counting from now";
+        return;
+    }
+
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    boost::uint64_t logCount = 0;
+    bool valid = in.read(magic, sizeof(magic))
+        && std::equal(magic, magic + sizeof(magic), CHECKPOINT_MAGIC)
+        && Checkpoint::ReadNumber(in, logCount);
+    std::size_t nicks = 0;
+    boost::unique_lock<boost::shared_mutex> lock(logsMutex_);
+    for (boost::uint64_t i = 0; valid && i < logCount; ++i)
+    {
+        std::string path;
+        boost::uint64_t nickCount = 0;
+        valid = Checkpoint::ReadString(in, path)
+            && Checkpoint::ReadNumber(in, nickCount);
+        LogCounters log;
+        for (boost::uint64_t j = 0; valid && j < nickCount; ++j)
+        {
+            std::string nick;
+            Counters counters;
+            boost::uint64_t firstSeen = 0;
+            boost::uint64_t lastSeen = 0;
+            valid = Checkpoint::ReadString(in, nick)
+                && Checkpoint::ReadNumber(in, counters.Messages)
+                && Checkpoint::ReadNumber(in, counters.Words)
+                && Checkpoint::ReadNumber(in, counters.Characters)
+                && Checkpoint::ReadNumber(in, firstSeen)
+                && Checkpoint::ReadNumber(in, lastSeen)
+                && in.read(reinterpret_cast<char*>(counters.Hours),
+                           sizeof(counters.Hours));
+            counters.FirstSeen = static_cast<std::time_t>(firstSeen);
+            counters.LastSeen = static_cast<std::time_t>(lastSeen);
+            log.Nicks[nick] = counters;
+        }
+        if (valid)
+        {
+            Summarize(log);
+            nicks += log.Nicks.size();
+            logs_[path] = log;
+        }
+    }
+    if (!valid)
+    {
+        // The logs read so far are still right
+        Log << LogLevel::Warning << "Channel statistics checkpoint '"
+            << checkpoint_.GetPath()
+            << "' is broken, only some logs were loaded";
+    }
+    Log << LogLevel::Info << "Loaded channel statistics of " << nicks
+        << " nicks in " << logs_.size() << " logs";
+}
+
+void ChannelStatistics::Promote(Channel& summary,
+                                const std::string& nick,
+                                boost::uint64_t messages)
+{
+    TalkerContainer& top = summary.Top;
+    TalkerContainer::iterator talker = top.begin();
+    while (talker != top.end() && talker->Nick != nick)
+    {
+        ++talker;
+    }
+    if (talker == top.end())
+    {
+        // Counts only ever go up by one, a nick that was not among the top
+        // nicks gets in by passing the last of them
+        if (top.size() < TOP_NICKS)
+        {
+            top.push_back(Talker());
+        }
+        else if (messages <= top.back().Messages)
+        {
+            return;
+        }
+        talker = top.end() - 1;
+        talker->Nick = nick;
+    }
+    talker->Messages = messages;
+    for (; talker != top.begin() && (talker - 1)->Messages < messages; --talker)
+    {
+        std::swap(*talker, *(talker - 1));
+    }
+}
+
+void ChannelStatistics::Summarize(LogCounters& log)
+{
+    Channel& summary = log.Summary;
+    summary = Channel();
+    summary.Nicks = log.Nicks.size();
+    for (NickMap::const_iterator nick = log.Nicks.begin();
+         nick != log.Nicks.end();
+         ++nick)
+    {
+        Add(summary.Total, nick->second);
+        Talker talker;
+        talker.Nick = nick->first;
+        talker.Messages = nick->second.Messages;
+        summary.Top.push_back(talker);
+    }
+    std::size_t kept = std::min(summary.Top.size(), TOP_NICKS);
+    std::partial_sort(summary.Top.begin(),
+                      summary.Top.begin() + kept,
+                      summary.Top.end(),
+                      MoreMessages());
+    summary.Top.resize(kept);
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "checkpoint.hpp"
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/utility.hpp>
+#include <boost/utility/string_ref.hpp>
+
+/**
+ * How much each nick talks in each chat log, counted as messages arrive
+ * so nobody has to read the logs for it. Every count and the most talkative
+ * nicks of each log are kept up to date as they change, looking them up
+ * does not depend on how much has been said. The counts are saved to a
+ * checkpoint now and then and loaded on start, messages since the last
+ * save are lost in a crash.
+ */
+class ChannelStatistics : boost::noncopyable
+{
+public:
+    static const std::size_t HOURS = 24;
+    // How many of the most talkative nicks each log keeps
+    static const std::size_t TOP_NICKS = 10;
+
+    struct Counters
+    {
+	Counters();
+
+	boost::uint64_t Messages;
+	boost::uint64_t Words;
+	// Characters, not bytes
+	boost::uint64_t Characters;
+	// Messages in each hour of the day, local time
+	boost::uint32_t Hours[HOURS];
+	std::time_t FirstSeen;
+	std::time_t LastSeen;
+    };
+
+    struct Talker
+    {
+	std::string Nick;
+	boost::uint64_t Messages;
+    };
+    typedef std::vector<Talker> TalkerContainer;
+
+    struct Channel
+    {
+	Channel() : Nicks(0) {}
+
+	// Everybody together
+	Counters Total;
+	std::size_t Nicks;
+	// Most messages first, at most TOP_NICKS
+	TalkerContainer Top;
+    };
+
+    /**
+     * @param checkpoint where the counts are saved, empty to never save them
+     * @param checkpointIntervalMilliseconds zero only saves them when the
+     *        statistics go away
+     */
+    ChannelStatistics(const std::string& checkpoint,
+		      unsigned int checkpointIntervalMilliseconds);
+    /**
+     * Saves the counts.
+     */
+    ~ChannelStatistics();
+
+    /**
+     * Count a message.
+     * @param text what the nick said, in UTF-8
+     */
+    void Update(const std::string& logFile,
+		const std::string& nick,
+		std::time_t time,
+		boost::string_ref text);
+
+    /**
+     * @return false if nobody has said anything in the log
+     */
+    bool FindChannel(const std::string& logFile, Channel& channel) const;
+
+    /**
+     * @return false if the nick has said nothing in the log
+     */
+    bool FindNick(const std::string& logFile,
+		  const std::string& nick,
+		  Counters& counters) const;
+
+    /**
+     * Save the checkpoint now.
+     */
+    void Save();
+
+private:
+    typedef boost::unordered_map<std::string, Counters> NickMap;
+    struct LogCounters
+    {
+	Channel Summary;
+	NickMap Nicks;
+    };
+    typedef boost::unordered_map<std::string, LogCounters> LogMap;
+
+    void Load();
+    // Move the nick up the log's top nicks if it has passed someone
+    static void Promote(Channel& summary,
+			const std::string& nick,
+			boost::uint64_t messages);
+    // From the nicks, after loading
+    static void Summarize(LogCounters& log);
+    bool Serialize(std::string& data) const;
+
+    LogMap logs_;
+    mutable boost::shared_mutex logsMutex_;
+
+    Checkpoint checkpoint_;
+};
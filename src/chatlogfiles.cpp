@@ -0,0 +1,76 @@
+#include "chatlogfiles.hpp"
+#include "logging/logger.hpp"
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/filesystem/exception.hpp>
+
+bool ChatLogFiles::ParseLine(boost::string_ref line,
+                             std::time_t& time,
+                             boost::string_ref& nick,
+                             boost::string_ref& text)
+{
+    std::size_t position = 0;
+    time = 0;
+    while (position < line.size() && line[position] >= '0'
+           && line[position] <= '9')
+    {
+        time = time * 10 + (line[position] - '0');
+        ++position;
+    }
+    // Very old logs have only the time of day, that can not be placed
+    if (position == 0 || position >= line.size() || line[position] != ' ')
+    {
+        return false;
+    }
+
+    std::size_t nickBegin = line.substr(position).find(": <");
+    if (nickBegin == boost::string_ref::npos)
+    {
+        return false;
+    }
+    nickBegin += position + 3;
+    std::size_t nickEnd = line.substr(nickBegin).find('>');
+    if (nickEnd == boost::string_ref::npos)
+    {
+        return false;
+    }
+    nickEnd += nickBegin;
+    if (nickEnd == nickBegin
+        || nickEnd + 1 >= line.size() || line[nickEnd + 1] != ' ')
+    {
+        return false;
+    }
+    nick = line.substr(nickBegin, nickEnd - nickBegin);
+    text = line.substr(nickEnd + 2);
+    return true;
+}
+
+void ChatLogFiles::List(const std::string& directory,
+                        std::vector<std::string>& paths)
+{
+    try
+    {
+        boost::filesystem::recursive_directory_iterator end;
+        for (boost::filesystem::recursive_directory_iterator file(directory);
+             file != end;
+             ++file)
+        {
+            std::string name = file->path().filename().string();
+            if (!name.empty() && name[0] == '.')
+            {
+                if (boost::filesystem::is_directory(file->status()))
+                {
+                    file.no_push();
+                }
+            }
+            else if (boost::filesystem::is_regular_file(file->status()))
+            {
+                paths.push_back(file->path().string());
+            }
+        }
+    } catch (boost::filesystem::filesystem_error& e)
+    {
+        Log << LogLevel::Warning << "Could not list the logs in '"
+            << directory << "': " << e.what();
+    }
+}
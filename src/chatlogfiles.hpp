@@ -0,0 +1,30 @@
+#pragma once
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <boost/utility/string_ref.hpp>
+
+/**
+ * Reading the chat logs the bot writes, one file for each server and target
+ * with lines like "1234567890 #channel: <nick> text".
+ */
+namespace ChatLogFiles
+{
+    /**
+     * Split a chat log line.
+     * @return false if it is not such a line
+     */
+    bool ParseLine(boost::string_ref line,
+		   std::time_t& time,
+		   boost::string_ref& nick,
+		   boost::string_ref& text);
+
+    /**
+     * Every chat log under a directory. Files and directories whose name
+     * starts with a dot are not logs, indexes and closed segments are kept
+     * there.
+     */
+    void List(const std::string& directory, std::vector<std::string>& paths);
+} // namespace ChatLogFiles
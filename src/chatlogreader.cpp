@@ -0,0 +1,230 @@
+#include "chatlogreader.hpp"
+#include "exception.hpp"
+#include "logging/logger.hpp"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A segment closed while the reader looks at the log is looked at again,
+// that happens once a day or so for a log
+const int MAX_OPEN_ATTEMPTS = 3;
+
+namespace
+{
+    struct BeginsAfter
+    {
+        template<class Part>
+        bool operator()(unsigned long long offset, const Part& part) const
+        {
+            return offset < part.Segment.Begin;
+        }
+    };
+} // namespace
+
+ChatLogReader::ChatLogReader(const std::string& log)
+    : log_(log)
+    , liveFd_(-1)
+    , liveBegin_(0)
+{
+    for (int attempt = 1; !Open() && attempt < MAX_OPEN_ATTEMPTS; ++attempt)
+    {
+        Close();
+    }
+}
+
+ChatLogReader::~ChatLogReader()
+{
+    Close();
+}
+
+bool ChatLogReader::Exists() const
+{
+    return liveFd_ >= 0 || !parts_.empty();
+}
+
+unsigned long long ChatLogReader::GetSize() const
+{
+    struct stat status;
+    if (liveFd_ < 0 || fstat(liveFd_, &status) != 0)
+    {
+        return liveBegin_;
+    }
+    return liveBegin_ + status.st_size;
+}
+
+std::size_t ChatLogReader::Read(unsigned long long offset,
+                                char* buffer,
+                                std::size_t size)
+{
+    std::size_t read = 0;
+    while (read < size)
+    {
+        unsigned long long position = offset + read;
+        if (position >= liveBegin_)
+        {
+            if (liveFd_ < 0)
+            {
+                break;
+            }
+            ssize_t count = pread(liveFd_, buffer + read, size - read,
+                                  position - liveBegin_);
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (count <= 0)
+            {
+                break;
+            }
+            read += count;
+            continue;
+        }
+
+        // The last segment that starts at or before the position
+        std::vector<Part>::iterator part = std::upper_bound(
+            parts_.begin(), parts_.end(), position, BeginsAfter());
+        if (part == parts_.begin())
+        {
+            // Segments that have been removed by hand
+            break;
+        }
+        --part;
+        std::size_t wanted = std::min<unsigned long long>(
+            size - read, part->End - position);
+        std::size_t count = ReadPart(*part, position, buffer + read, wanted);
+        read += count;
+        if (count < wanted)
+        {
+            break;
+        }
+    }
+    return read;
+}
+
+bool ChatLogReader::Open()
+{
+    unsigned long long liveBegin = ChatLogSegments::GetLiveBegin(log_);
+    liveFd_ = open(log_.c_str(), O_RDONLY | O_CLOEXEC);
+    ChatLogSegments::SegmentContainer segments;
+    ChatLogSegments::List(log_, segments);
+    // Had the live segment been closed since it was opened it would start
+    // somewhere else now
+    if (ChatLogSegments::GetLiveBegin(log_) != liveBegin)
+    {
+        return false;
+    }
+
+    liveBegin_ = liveBegin;
+    parts_.resize(segments.size());
+    for (std::size_t i = 0; i < segments.size(); ++i)
+    {
+        Part& part = parts_[i];
+        part.Segment = segments[i];
+        part.End = i + 1 < segments.size() ? segments[i + 1].Begin : liveBegin;
+        part.Fd = -1;
+    }
+    return true;
+}
+
+void ChatLogReader::Close()
+{
+    for (std::vector<Part>::iterator part = parts_.begin();
+         part != parts_.end();
+         ++part)
+    {
+        if (part->Fd >= 0)
+        {
+            close(part->Fd);
+        }
+    }
+    parts_.clear();
+    if (liveFd_ >= 0)
+    {
+        close(liveFd_);
+        liveFd_ = -1;
+    }
+}
+
+bool ChatLogReader::OpenPart(Part& part)
+{
+    if (part.Fd >= 0 || part.Compressed)
+    {
+        return true;
+    }
+    if (!part.Segment.Compressed)
+    {
+        part.Fd = open(part.Segment.Path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (part.Fd >= 0)
+        {
+            return true;
+        }
+        // It has been compressed since it was listed
+        ChatLogSegments::SegmentContainer segments;
+        ChatLogSegments::List(log_, segments);
+        for (std::size_t i = 0; i < segments.size(); ++i)
+        {
+            if (segments[i].Begin == part.Segment.Begin)
+            {
+                part.Segment = segments[i];
+            }
+        }
+        if (!part.Segment.Compressed)
+        {
+            Log << LogLevel::Error << "Could not open '"
+                << part.Segment.Path << "'";
+            return false;
+        }
+    }
+    try
+    {
+        part.Compressed.reset(new CompressedSegment(part.Segment.Path));
+    } catch (Exception& e)
+    {
+        Log << LogLevel::Error << e.GetMessage();
+        return false;
+    }
+    return true;
+}
+
+std::size_t ChatLogReader::ReadPart(Part& part,
+                                    unsigned long long offset,
+                                    char* buffer,
+                                    std::size_t size)
+{
+    if (!OpenPart(part))
+    {
+        return 0;
+    }
+    offset -= part.Segment.Begin;
+    if (part.Compressed)
+    {
+        try
+        {
+            return part.Compressed->Read(offset, buffer, size);
+        } catch (Exception& e)
+        {
+            Log << LogLevel::Error << e.GetMessage();
+            return 0;
+        }
+    }
+    std::size_t read = 0;
+    while (read < size)
+    {
+        ssize_t count = pread(part.Fd, buffer + read, size - read,
+                              offset + read);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            break;
+        }
+        read += count;
+    }
+    return read;
+}
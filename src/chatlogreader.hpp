@@ -0,0 +1,63 @@
+#pragma once
+
+#include "chatlogsegments.hpp"
+
+#include <string>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+/**
+ * Reads a chat log as one file whether it is in segments or not, closed
+ * segments are opened when they are first read from. Segments closed
+ * after the reader was made are still read as they were, and lines
+ * written since are read from the live segment as they come.
+ * Not thread safe, each reader has its own.
+ */
+class ChatLogReader : boost::noncopyable
+{
+public:
+    explicit ChatLogReader(const std::string& log);
+    ~ChatLogReader();
+
+    /**
+     * @return false if the log has never been written
+     */
+    bool Exists() const;
+
+    /**
+     * Everything written to the log so far.
+     */
+    unsigned long long GetSize() const;
+
+    /**
+     * @return bytes read, less than asked for only at the end of the log
+     *         or if a segment can not be read
+     */
+    std::size_t Read(unsigned long long offset, char* buffer, std::size_t size);
+
+private:
+    struct Part
+    {
+	ChatLogSegments::Segment Segment;
+	unsigned long long End;
+	// Uncompressed segments are read with this, -1 until opened
+	int Fd;
+	CompressedSegmentPtr Compressed;
+    };
+
+    // @return false if the segments changed while they were looked at
+    bool Open();
+    void Close();
+    // @return false if the part can not be read
+    bool OpenPart(Part& part);
+    std::size_t ReadPart(Part& part,
+			 unsigned long long offset,
+			 char* buffer,
+			 std::size_t size);
+
+    std::string log_;
+    std::vector<Part> parts_;
+    int liveFd_;
+    unsigned long long liveBegin_;
+};
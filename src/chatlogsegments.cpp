@@ -0,0 +1,543 @@
+#include "chatlogsegments.hpp"
+#include "exception.hpp"
+#include "logging/logger.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+
+#include <boost/filesystem/convenience.hpp>
+#include <boost/filesystem/exception.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+static const char SEGMENT_MAGIC[4] = { 'C', 'L', 'Z', '1' };
+static const char SEGMENTS_DIRECTORY[] = ".segments";
+static const char UNCOMPRESSED_EXTENSION[] = ".log";
+static const char COMPRESSED_EXTENSION[] = ".logz";
+// Sixteen hex digits of where the segment starts
+const std::size_t SEGMENT_NAME_SIZE = 16;
+// Magic, block count, begin, size, first time, last time, table offset
+const std::size_t TRAILER_SIZE = 48;
+// Offset, compressed offset, compressed size, size, first time
+const std::size_t BLOCK_ENTRY_SIZE = 32;
+
+namespace
+{
+    void AppendNumber(std::string& data, boost::uint64_t number,
+                      std::size_t bytes)
+    {
+        for (std::size_t i = 0; i < bytes; ++i)
+        {
+            data += static_cast<char>(number & 0xff);
+            number >>= 8;
+        }
+    }
+
+    boost::uint64_t ReadNumber(const char* data, std::size_t bytes)
+    {
+        boost::uint64_t number = 0;
+        for (std::size_t i = bytes; i > 0; --i)
+        {
+            number = number << 8 | static_cast<unsigned char>(data[i - 1]);
+        }
+        return number;
+    }
+
+    // @return false if the line does not start with a time
+    bool ParseTime(const char* begin, const char* end, std::time_t& time)
+    {
+        const char* position = begin;
+        time = 0;
+        while (position != end && *position >= '0' && *position <= '9')
+        {
+            time = time * 10 + (*position - '0');
+            ++position;
+        }
+        return position != begin && position != end && *position == ' ';
+    }
+
+    // Time of the last line in the data that has one
+    bool ParseLastTime(const char* begin, const char* end, std::time_t& time)
+    {
+        while (end != begin)
+        {
+            const char* lineEnd = end;
+            while (end != begin && end[-1] != '\n')
+            {
+                --end;
+            }
+            if (ParseTime(end, lineEnd, time))
+            {
+                return true;
+            }
+            if (end != begin)
+            {
+                --end;
+            }
+        }
+        return false;
+    }
+
+    // @return false if it is not a segment's name
+    bool ParseName(const std::string& name, unsigned long long& begin,
+                   bool& compressed)
+    {
+        std::string extension = name.size() > SEGMENT_NAME_SIZE
+            ? name.substr(SEGMENT_NAME_SIZE) : std::string();
+        if (extension == UNCOMPRESSED_EXTENSION)
+        {
+            compressed = false;
+        }
+        else if (extension == COMPRESSED_EXTENSION)
+        {
+            compressed = true;
+        }
+        else
+        {
+            return false;
+        }
+        begin = 0;
+        for (std::size_t i = 0; i < SEGMENT_NAME_SIZE; ++i)
+        {
+            char c = name[i];
+            int digit = c >= '0' && c <= '9' ? c - '0'
+                : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+            if (digit < 0)
+            {
+                return false;
+            }
+            begin = begin << 4 | digit;
+        }
+        return true;
+    }
+
+    // @throw boost::filesystem::filesystem_error if a segment is gone
+    unsigned long long GetEnd(const ChatLogSegments::Segment& segment)
+    {
+        if (!segment.Compressed)
+        {
+            return segment.Begin + boost::filesystem::file_size(segment.Path);
+        }
+        try
+        {
+            CompressedSegment compressed(segment.Path);
+            return compressed.GetBegin() + compressed.GetSize();
+        } catch (Exception& e)
+        {
+            Log << LogLevel::Error << e.GetMessage();
+            return segment.Begin;
+        }
+    }
+} // namespace
+
+std::string ChatLogSegments::GetDirectory(const std::string& log)
+{
+    boost::filesystem::path path(log);
+    return (path.parent_path() / SEGMENTS_DIRECTORY / path.filename())
+        .string() + "/";
+}
+
+void ChatLogSegments::List(const std::string& log,
+                           SegmentContainer& segments)
+{
+    std::string directory = GetDirectory(log);
+    std::map<unsigned long long, Segment> found;
+    try
+    {
+        if (!boost::filesystem::is_directory(directory))
+        {
+            return;
+        }
+        boost::filesystem::directory_iterator end;
+        for (boost::filesystem::directory_iterator file(directory);
+             file != end;
+             ++file)
+        {
+            Segment segment;
+            if (!ParseName(file->path().filename().string(), segment.Begin,
+                           segment.Compressed))
+            {
+                continue;
+            }
+            segment.Path = file->path().string();
+            // Both are there between a segment being compressed and the
+            // uncompressed one being removed
+            std::pair<std::map<unsigned long long, Segment>::iterator,
+                      bool> inserted = found.insert(
+                          std::make_pair(segment.Begin, segment));
+            if (!inserted.second && segment.Compressed)
+            {
+                inserted.first->second = segment;
+            }
+        }
+    } catch (boost::filesystem::filesystem_error& e)
+    {
+        Log << LogLevel::Warning << "Could not list the segments of '"
+            << log << "': " << e.what();
+    }
+    for (std::map<unsigned long long, Segment>::const_iterator segment =
+             found.begin();
+         segment != found.end();
+         ++segment)
+    {
+        segments.push_back(segment->second);
+    }
+}
+
+unsigned long long ChatLogSegments::GetLiveBegin(const std::string& log)
+{
+    // The last segment can be compressed while it is looked at, a second
+    // look sees it compressed
+    for (int attempt = 0; ; ++attempt)
+    {
+        SegmentContainer segments;
+        List(log, segments);
+        if (segments.empty())
+        {
+            return 0;
+        }
+        try
+        {
+            return GetEnd(segments.back());
+        } catch (boost::filesystem::filesystem_error& e)
+        {
+            if (attempt > 0)
+            {
+                Log << LogLevel::Error << "Could not read the segments of '"
+                    << log << "': " << e.what();
+                return segments.back().Begin;
+            }
+        }
+    }
+}
+
+unsigned long long ChatLogSegments::GetSize(const std::string& log)
+{
+    boost::system::error_code error;
+    boost::uintmax_t size = boost::filesystem::file_size(log, error);
+    return GetLiveBegin(log) + (error ? 0 : size);
+}
+
+bool ChatLogSegments::GetLiveStart(const std::string& log, std::time_t& time)
+{
+    std::ifstream in(log.c_str(), std::ios::binary);
+    char start[32];
+    in.read(start, sizeof(start));
+    return ParseTime(start, start + in.gcount(), time);
+}
+
+std::string ChatLogSegments::Close(const std::string& log,
+                                   unsigned long long begin)
+{
+    std::string directory = GetDirectory(log);
+    char name[SEGMENT_NAME_SIZE + 1];
+    std::snprintf(name, sizeof(name), "%016llx", begin);
+    std::string segment = directory + name + UNCOMPRESSED_EXTENSION;
+    try
+    {
+        boost::filesystem::create_directories(directory);
+    } catch (boost::filesystem::filesystem_error& e)
+    {
+        Log << LogLevel::Error << "Could not create '" << directory << "': "
+            << e.what();
+        return std::string();
+    }
+    if (std::rename(log.c_str(), segment.c_str()) != 0)
+    {
+        Log << LogLevel::Error << "Could not move '" << log << "' to '"
+            << segment << "': " << strerror(errno);
+        return std::string();
+    }
+    return segment;
+}
+
+void ChatLogSegments::Compress(const std::string& segment,
+                               unsigned long long& size,
+                               unsigned long long& compressedSize)
+{
+    unsigned long long begin = 0;
+    bool compressed = false;
+    std::string name = boost::filesystem::path(segment).filename().string();
+    if (!ParseName(name, begin, compressed) || compressed)
+    {
+        throw Exception(__FILE__, __LINE__,
+                        ("'" + segment + "' is not an uncompressed segment")
+                        .c_str());
+    }
+    std::ifstream in(segment.c_str(), std::ios::binary);
+    if (!in)
+    {
+        throw Exception(__FILE__, __LINE__,
+                        ("Could not open '" + segment + "'").c_str());
+    }
+    std::string target = segment.substr(
+        0, segment.size() - std::strlen(UNCOMPRESSED_EXTENSION))
+        + COMPRESSED_EXTENSION;
+    std::string temporary = target + ".tmp";
+    std::FILE* out = std::fopen(temporary.c_str(), "wb");
+    if (!out)
+    {
+        throw Exception(__FILE__, __LINE__,
+                        ("Could not create '" + temporary + "': "
+                         + strerror(errno)).c_str());
+    }
+
+    std::string table;
+    boost::uint32_t blocks = 0;
+    std::time_t firstTime = 0;
+    std::time_t lastTime = 0;
+    size = 0;
+    compressedSize = 0;
+    std::vector<char> input(CompressedSegment::BLOCK_SIZE);
+    std::vector<unsigned char> output(compressBound(input.size()));
+    std::size_t kept = 0;
+    bool failed = false;
+    while (!failed)
+    {
+        in.read(&input[kept], input.size() - kept);
+        std::size_t filled = kept + in.gcount();
+        if (filled == 0)
+        {
+            break;
+        }
+        // Blocks end with a line, unless a line is longer than a block
+        std::size_t cut = filled;
+        if (filled == input.size())
+        {
+            std::vector<char>::reverse_iterator newline =
+                std::find(input.rbegin(), input.rend(), '\n');
+            if (newline != input.rend())
+            {
+                cut = input.rend() - newline;
+            }
+        }
+
+        uLongf outputSize = output.size();
+        failed = compress2(&output[0], &outputSize,
+                           reinterpret_cast<const Bytef*>(&input[0]), cut,
+                           Z_BEST_COMPRESSION) != Z_OK
+            || std::fwrite(&output[0], 1, outputSize, out) != outputSize;
+
+        std::time_t blockTime = 0;
+        if (ParseTime(&input[0], &input[0] + cut, blockTime)
+            && firstTime == 0)
+        {
+            firstTime = blockTime;
+        }
+        std::time_t time = 0;
+        if (ParseLastTime(&input[0], &input[0] + cut, time))
+        {
+            lastTime = time;
+        }
+        AppendNumber(table, size, 8);
+        AppendNumber(table, compressedSize, 8);
+        AppendNumber(table, outputSize, 4);
+        AppendNumber(table, cut, 4);
+        AppendNumber(table, blockTime, 8);
+        ++blocks;
+        size += cut;
+        compressedSize += outputSize;
+
+        kept = filled - cut;
+        std::copy(input.begin() + cut, input.begin() + filled, input.begin());
+    }
+
+    std::string trailer(SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+    AppendNumber(trailer, blocks, 4);
+    AppendNumber(trailer, begin, 8);
+    AppendNumber(trailer, size, 8);
+    AppendNumber(trailer, firstTime, 8);
+    AppendNumber(trailer, lastTime, 8);
+    AppendNumber(trailer, compressedSize, 8);
+    table += trailer;
+    failed = failed || in.bad()
+        || std::fwrite(table.data(), 1, table.size(), out) != table.size();
+    failed = std::fflush(out) != 0 || failed;
+    failed = fsync(fileno(out)) != 0 || failed;
+    failed = std::fclose(out) != 0 || failed;
+    if (failed || std::rename(temporary.c_str(), target.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        throw Exception(__FILE__, __LINE__,
+                        ("Could not compress '" + segment + "'").c_str());
+    }
+    compressedSize += table.size();
+    std::remove(segment.c_str());
+}
+
+void ChatLogSegments::ListUncompressed(const std::string& logsDirectory,
+                                       std::vector<std::string>& segments)
+{
+    try
+    {
+        boost::filesystem::recursive_directory_iterator end;
+        for (boost::filesystem::recursive_directory_iterator file(
+                 logsDirectory);
+             file != end;
+             ++file)
+        {
+            const boost::filesystem::path& path = file->path();
+            std::string name = path.filename().string();
+            if (boost::filesystem::is_directory(file->status()))
+            {
+                // Indexes keep their files in other directories with dots
+                if (!name.empty() && name[0] == '.'
+                    && name != SEGMENTS_DIRECTORY)
+                {
+                    file.no_push();
+                }
+                continue;
+            }
+            unsigned long long begin = 0;
+            bool compressed = false;
+            if (path.parent_path().parent_path().filename()
+                    == SEGMENTS_DIRECTORY
+                && ParseName(name, begin, compressed) && !compressed)
+            {
+                segments.push_back(path.string());
+            }
+        }
+    } catch (boost::filesystem::filesystem_error& e)
+    {
+        Log << LogLevel::Warning << "Could not list the segments in '"
+            << logsDirectory << "': " << e.what();
+    }
+}
+
+const std::size_t CompressedSegment::BLOCK_SIZE;
+
+CompressedSegment::CompressedSegment(const std::string& path)
+    : path_(path)
+    , fd_(open(path.c_str(), O_RDONLY | O_CLOEXEC))
+    , begin_(0)
+    , size_(0)
+    , firstTime_(0)
+    , lastTime_(0)
+    , loadedBlock_(static_cast<std::size_t>(-1))
+{
+    if (fd_ < 0)
+    {
+        throw Exception(__FILE__, __LINE__,
+                        ("Could not open '" + path + "': "
+                         + strerror(errno)).c_str());
+    }
+    struct stat status;
+    char trailer[TRAILER_SIZE];
+    bool valid = fstat(fd_, &status) == 0
+        && static_cast<unsigned long long>(status.st_size) >= TRAILER_SIZE
+        && pread(fd_, trailer, sizeof(trailer), status.st_size - TRAILER_SIZE)
+           == static_cast<ssize_t>(sizeof(trailer))
+        && std::equal(SEGMENT_MAGIC, SEGMENT_MAGIC + sizeof(SEGMENT_MAGIC),
+                      trailer);
+    boost::uint64_t blocks = valid ? ReadNumber(trailer + 4, 4) : 0;
+    boost::uint64_t tableOffset = valid ? ReadNumber(trailer + 40, 8) : 0;
+    valid = valid && tableOffset + blocks * BLOCK_ENTRY_SIZE + TRAILER_SIZE
+        == static_cast<unsigned long long>(status.st_size);
+    std::vector<char> table(blocks * BLOCK_ENTRY_SIZE);
+    valid = valid && (table.empty()
+        || pread(fd_, &table[0], table.size(), tableOffset)
+           == static_cast<ssize_t>(table.size()));
+    if (!valid)
+    {
+        close(fd_);
+        throw Exception(__FILE__, __LINE__,
+                        ("'" + path + "' is not a compressed segment")
+                        .c_str());
+    }
+    begin_ = ReadNumber(trailer + 8, 8);
+    size_ = ReadNumber(trailer + 16, 8);
+    firstTime_ = static_cast<std::time_t>(ReadNumber(trailer + 24, 8));
+    lastTime_ = static_cast<std::time_t>(ReadNumber(trailer + 32, 8));
+
+    blocks_.resize(blocks);
+    for (std::size_t i = 0; i < blocks_.size(); ++i)
+    {
+        const char* entry = &table[i * BLOCK_ENTRY_SIZE];
+        Block& block = blocks_[i];
+        block.Offset = ReadNumber(entry, 8);
+        block.CompressedOffset = ReadNumber(entry + 8, 8);
+        block.CompressedSize = ReadNumber(entry + 16, 4);
+        block.Size = ReadNumber(entry + 20, 4);
+        block.FirstTime = ReadNumber(entry + 24, 8);
+    }
+}
+
+CompressedSegment::~CompressedSegment()
+{
+    close(fd_);
+}
+
+std::size_t CompressedSegment::Read(unsigned long long offset,
+                                    char* buffer,
+                                    std::size_t size)
+{
+    std::size_t read = 0;
+    while (read < size && offset < size_)
+    {
+        if (loadedBlock_ >= blocks_.size()
+            || offset < blocks_[loadedBlock_].Offset
+            || offset >= blocks_[loadedBlock_].Offset
+                         + blocks_[loadedBlock_].Size)
+        {
+            // The last block that starts at or before the offset
+            std::size_t low = 0;
+            std::size_t high = blocks_.size();
+            while (high - low > 1)
+            {
+                std::size_t middle = low + (high - low) / 2;
+                if (blocks_[middle].Offset <= offset)
+                {
+                    low = middle;
+                }
+                else
+                {
+                    high = middle;
+                }
+            }
+            LoadBlock(low);
+        }
+        const Block& block = blocks_[loadedBlock_];
+        std::size_t start = offset - block.Offset;
+        std::size_t count = std::min<std::size_t>(size - read,
+                                                  block.Size - start);
+        if (count == 0)
+        {
+            break;
+        }
+        std::memcpy(buffer + read, &loaded_[start], count);
+        read += count;
+        offset += count;
+    }
+    return read;
+}
+
+void CompressedSegment::LoadBlock(std::size_t index)
+{
+    const Block& block = blocks_[index];
+    compressed_.resize(block.CompressedSize);
+    loaded_.resize(block.Size);
+    uLongf size = block.Size;
+    if (block.Size == 0
+        || pread(fd_, &compressed_[0], compressed_.size(),
+                 block.CompressedOffset)
+           != static_cast<ssize_t>(compressed_.size())
+        || uncompress(reinterpret_cast<Bytef*>(&loaded_[0]), &size,
+                      reinterpret_cast<const Bytef*>(&compressed_[0]),
+                      compressed_.size()) != Z_OK
+        || size != block.Size)
+    {
+        loadedBlock_ = static_cast<std::size_t>(-1);
+        throw Exception(__FILE__, __LINE__,
+                        ("Broken block in compressed segment '" + path_
+                         + "'").c_str());
+    }
+    loadedBlock_ = index;
+}
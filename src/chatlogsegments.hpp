@@ -0,0 +1,145 @@
+#pragma once
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+/**
+ * A chat log can be kept in segments. The file the writer appends to is
+ * the live segment, and when it has grown large or old enough it is
+ * closed, moved to the log's segment directory and later compressed. The
+ * log is all of its segments one after the other, offsets into a log
+ * count from the start of its oldest segment, and each closed segment is
+ * named after the offset it starts at.
+ *
+ * The closed segments of logs/server/#channel are in
+ * logs/server/.segments/#channel/.
+ */
+namespace ChatLogSegments
+{
+    struct Segment
+    {
+	std::string Path;
+	// Where in the log the segment starts
+	unsigned long long Begin;
+	bool Compressed;
+    };
+    typedef std::vector<Segment> SegmentContainer;
+
+    std::string GetDirectory(const std::string& log);
+
+    /**
+     * @param segments gets the closed segments, oldest first. A segment
+     *        that is being compressed is listed compressed once it is.
+     */
+    void List(const std::string& log, SegmentContainer& segments);
+
+    /**
+     * Where the live segment starts, zero for logs that have never been
+     * closed.
+     */
+    unsigned long long GetLiveBegin(const std::string& log);
+
+    /**
+     * Everything written to the log, the live segment included.
+     */
+    unsigned long long GetSize(const std::string& log);
+
+    /**
+     * Time of the live segment's first line.
+     * @return false if it is empty or has no time
+     */
+    bool GetLiveStart(const std::string& log, std::time_t& time);
+
+    /**
+     * Close the live segment, which the writer must no longer have open.
+     * @param begin where the live segment starts
+     * @return the closed segment, empty if it could not be moved
+     */
+    std::string Close(const std::string& log, unsigned long long begin);
+
+    /**
+     * Compress a closed segment and remove it once the compressed one is
+     * on disk.
+     * @param size gets the size of the segment
+     * @param compressedSize gets the size of the compressed segment
+     * @throw Exception if it can not be compressed
+     */
+    void Compress(const std::string& segment,
+		  unsigned long long& size,
+		  unsigned long long& compressedSize);
+
+    /**
+     * Closed segments under a directory that have not been compressed,
+     * such as those left when the bot stopped.
+     */
+    void ListUncompressed(const std::string& logsDirectory,
+			  std::vector<std::string>& segments);
+} // namespace ChatLogSegments
+
+/**
+ * A compressed segment, read a block at a time.
+ *
+ * The file is zlib streams of whole lines, each about BLOCK_SIZE bytes
+ * uncompressed, then a table with where each block is and the time of its
+ * first line, then a trailer with where the segment starts, its size, the
+ * times of its first and last lines and where the table is. Numbers are
+ * little endian.
+ */
+class CompressedSegment : boost::noncopyable
+{
+public:
+    static const std::size_t BLOCK_SIZE = 64 << 10;
+
+    /**
+     * @throw Exception if it is not a compressed segment
+     */
+    explicit CompressedSegment(const std::string& path);
+    ~CompressedSegment();
+
+    unsigned long long GetBegin() const { return begin_; }
+    // Uncompressed
+    unsigned long long GetSize() const { return size_; }
+    // Zero when not known
+    std::time_t GetFirstTime() const { return firstTime_; }
+    std::time_t GetLastTime() const { return lastTime_; }
+
+    /**
+     * The block last read is kept, reading on from where the last read
+     * ended does not uncompress it again.
+     * @param offset from the start of the segment
+     * @return bytes read, less than asked for only at the end
+     * @throw Exception if the segment is broken
+     */
+    std::size_t Read(unsigned long long offset, char* buffer, std::size_t size);
+
+private:
+    struct Block
+    {
+	boost::uint64_t Offset;
+	boost::uint64_t CompressedOffset;
+	boost::uint32_t CompressedSize;
+	boost::uint32_t Size;
+	boost::int64_t FirstTime;
+    };
+
+    void LoadBlock(std::size_t index);
+
+    std::string path_;
+    int fd_;
+    unsigned long long begin_;
+    unsigned long long size_;
+    std::time_t firstTime_;
+    std::time_t lastTime_;
+    std::vector<Block> blocks_;
+
+    std::size_t loadedBlock_;
+    std::vector<char> loaded_;
+    std::vector<char> compressed_;
+};
+
+typedef boost::shared_ptr<CompressedSegment> CompressedSegmentPtr;
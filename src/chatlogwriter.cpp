@@ -0,0 +1,566 @@
+#include "chatlogwriter.hpp"
+#include "chatlogsegments.hpp"
+#include "exception.hpp"
+#include "logging/logger.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <boost/bind.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using boost::posix_time::ptime;
+using boost::posix_time::microsec_clock;
+using boost::posix_time::milliseconds;
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// Until configured otherwise lines wait at most this long, syncing is left
+// to the operating system and files are closed after half an hour of quiet
+const unsigned int DEFAULT_FLUSH_INTERVAL = 200;
+const std::size_t DEFAULT_MAX_OPEN_FILES = 64;
+const unsigned int DEFAULT_IDLE_FILE_TIME = 30 * 60 * 1000;
+
+struct ChatLogWriter::Node
+{
+    Node() : Next(0) {}
+
+    boost::atomic<Node*> Next;
+    std::string Path;
+    // With the line ending
+    std::string Line;
+    ptime Queued;
+};
+
+bool SyncPolicy::FromString(const std::string& name, SyncPolicy& policy)
+{
+    if (name == "never")
+    {
+        policy = Never;
+    }
+    else if (name == "batch")
+    {
+        policy = EveryBatch;
+    }
+    else if (name == "periodic")
+    {
+        policy = Periodic;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+ChatLogWriter& ChatLogWriter::Instance()
+{
+    static ChatLogWriter instance;
+    return instance;
+}
+
+ChatLogWriter::ChatLogWriter()
+    : head_(0)
+    , tail_(0)
+    , queueDepth_(0)
+    , queuedLines_(0)
+    , files_(DEFAULT_MAX_OPEN_FILES,
+             DEFAULT_IDLE_FILE_TIME,
+             boost::bind(&ChatLogWriter::OnCloseFile, this, _1, _2))
+    , lastSync_(microsec_clock::universal_time())
+    , totalLatencyMilliseconds_(0)
+    , writtenLines_(0)
+    , flushRequested_(false)
+    , stopping_(false)
+    , compressorStopping_(false)
+{
+    // The queue always has a node that has been taken at its tail
+    Node* stub = new Node();
+    head_.store(stub);
+    tail_ = stub;
+
+    settings_.FlushIntervalMilliseconds = DEFAULT_FLUSH_INTERVAL;
+    settings_.Sync = SyncPolicy::Never;
+    settings_.SyncIntervalMilliseconds = 0;
+    settings_.MaxOpenFiles = DEFAULT_MAX_OPEN_FILES;
+    settings_.IdleFileMilliseconds = DEFAULT_IDLE_FILE_TIME;
+    settings_.SegmentBytes = 0;
+    settings_.SegmentSeconds = 0;
+
+    statistics_.QueueDepth = 0;
+    statistics_.MaxQueueDepth = 0;
+    statistics_.Lines = 0;
+    statistics_.Batches = 0;
+    statistics_.Writes = 0;
+    statistics_.Syncs = 0;
+    statistics_.Errors = 0;
+    statistics_.AverageLatencyMilliseconds = 0;
+    statistics_.MaxLatencyMilliseconds = 0;
+    statistics_.OpenFiles = 0;
+    statistics_.FileHits = 0;
+    statistics_.FileMisses = 0;
+    statistics_.FileEvictions = 0;
+    statistics_.IdleFileCloses = 0;
+    statistics_.SegmentsClosed = 0;
+    statistics_.SegmentsCompressed = 0;
+    statistics_.UncompressedBytes = 0;
+    statistics_.CompressedBytes = 0;
+
+    thread_ = boost::thread(boost::bind(&ChatLogWriter::Run, this));
+    compressThread_ = boost::thread(
+        boost::bind(&ChatLogWriter::RunCompressor, this));
+}
+
+ChatLogWriter::~ChatLogWriter()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    thread_.join();
+
+    // Segments still waiting are compressed after the next start
+    {
+        boost::lock_guard<boost::mutex> lock(compressMutex_);
+        compressorStopping_ = true;
+    }
+    compressWake_.notify_all();
+    compressThread_.join();
+
+    // The files are closed, and synced if need be, by the cache
+    delete tail_;
+}
+
+void ChatLogWriter::SetSettings(const Settings& settings)
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    settings_ = settings;
+}
+
+void ChatLogWriter::SetLineObserver(LineObserver observer)
+{
+    boost::lock_guard<boost::mutex> lock(observerMutex_);
+    observer_ = observer;
+}
+
+void ChatLogWriter::Append(const std::string& path, const std::string& line)
+{
+    Node* node = new Node();
+    node->Path = path;
+    node->Line.reserve(line.size() + 1);
+    node->Line = line;
+    node->Line += '\n';
+    node->Queued = microsec_clock::universal_time();
+
+    ++queuedLines_;
+    ++queueDepth_;
+    Node* previous = head_.exchange(node, boost::memory_order_acq_rel);
+    // Until this the writer sees the queue end at previous
+    previous->Next.store(node, boost::memory_order_release);
+}
+
+void ChatLogWriter::Flush()
+{
+    unsigned long queued = queuedLines_.load();
+    boost::unique_lock<boost::mutex> lock(mutex_);
+    flushRequested_ = true;
+    wake_.notify_all();
+    while (writtenLines_ < queued)
+    {
+        written_.wait(lock);
+    }
+}
+
+ChatLogWriter::Statistics ChatLogWriter::GetStatistics() const
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    Statistics statistics = statistics_;
+    statistics.QueueDepth = queueDepth_.load();
+    statistics.AverageLatencyMilliseconds = statistics_.Lines > 0
+        ? totalLatencyMilliseconds_ / statistics_.Lines : 0;
+    return statistics;
+}
+
+void ChatLogWriter::CompressLeftovers(const std::string& logsDirectory)
+{
+    std::vector<std::string> segments;
+    ChatLogSegments::ListUncompressed(logsDirectory, segments);
+    if (segments.empty())
+    {
+        return;
+    }
+    Log << LogLevel::Info << "Compressing " << segments.size()
+        << " closed chat log segments";
+    boost::lock_guard<boost::mutex> lock(compressMutex_);
+    compressQueue_.insert(compressQueue_.end(),
+                          segments.begin(), segments.end());
+    compressWake_.notify_all();
+}
+
+void ChatLogWriter::AppendTimestamp(std::string& text, std::time_t time)
+{
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    char* begin = end;
+    bool negative = time < 0;
+    // Digit by digit, negative times only ever come from broken clocks
+    do
+    {
+        long digit = static_cast<long>(time % 10);
+        *--begin = static_cast<char>('0' + (digit < 0 ? -digit : digit));
+        time /= 10;
+    } while (time != 0);
+    if (negative)
+    {
+        *--begin = '-';
+    }
+    text.append(begin, end);
+}
+
+void ChatLogWriter::TakeQueued(std::vector<Node*>& nodes,
+                               std::vector<Node*>& retired)
+{
+    for (Node* next = tail_->Next.load(boost::memory_order_acquire);
+         next;
+         next = tail_->Next.load(boost::memory_order_acquire))
+    {
+        // The line is in the next node, which becomes the taken tail
+        nodes.push_back(next);
+        retired.push_back(tail_);
+        tail_ = next;
+    }
+    queueDepth_ -= nodes.size();
+}
+
+void ChatLogWriter::Run()
+{
+    std::vector<Node*> batch;
+    std::vector<Node*> retired;
+    Settings settings;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        settings = settings_;
+    }
+    for (;;)
+    {
+        files_.SetLimits(settings.MaxOpenFiles, settings.IdleFileMilliseconds);
+
+        batch.clear();
+        retired.clear();
+        TakeQueued(batch, retired);
+        if (!batch.empty())
+        {
+            Write(batch, settings);
+        }
+        for (std::vector<Node*>::iterator node = retired.begin();
+             node != retired.end();
+             ++node)
+        {
+            delete *node;
+        }
+        // The tail is kept, but its line is written
+        std::string().swap(tail_->Line);
+        // Waking up every flush interval is what closes idle files
+        files_.CloseIdle(microsec_clock::universal_time());
+
+        boost::unique_lock<boost::mutex> lock(mutex_);
+        const LogFileCache::Statistics& fileStatistics = files_.GetStatistics();
+        statistics_.OpenFiles = fileStatistics.OpenFiles;
+        statistics_.FileHits = fileStatistics.Hits;
+        statistics_.FileMisses = fileStatistics.Misses;
+        statistics_.FileEvictions = fileStatistics.Evictions;
+        statistics_.IdleFileCloses = fileStatistics.IdleCloses;
+        writtenLines_ += batch.size();
+        written_.notify_all();
+        if (stopping_ && !tail_->Next.load(boost::memory_order_acquire))
+        {
+            break;
+        }
+        // Lines gather in the queue meanwhile and are written together
+        if (!flushRequested_ && !stopping_)
+        {
+            wake_.timed_wait(lock,
+                             milliseconds(settings_.FlushIntervalMilliseconds));
+        }
+        flushRequested_ = false;
+        settings = settings_;
+    }
+}
+
+void ChatLogWriter::Write(const std::vector<Node*>& batch,
+                          const Settings& settings)
+{
+    boost::lock_guard<boost::mutex> observerLock(observerMutex_);
+    ptime now = microsec_clock::universal_time();
+    std::time_t time = std::time(0);
+
+    // Lines for the same file keep their order
+    typedef boost::unordered_map<std::string, std::vector<Node*> > FileLines;
+    FileLines fileLines;
+    for (std::vector<Node*>::const_iterator node = batch.begin();
+         node != batch.end();
+         ++node)
+    {
+        fileLines[(*node)->Path].push_back(*node);
+    }
+
+    unsigned long writes = 0;
+    unsigned long errors = 0;
+    unsigned long segmentsClosed = 0;
+    for (FileLines::const_iterator file = fileLines.begin();
+         file != fileLines.end();
+         ++file)
+    {
+        int fd = files_.Get(file->first, now);
+        if (fd >= 0 && IsSegmentDone(GetLiveSegment(file->first, fd),
+                                     settings, time))
+        {
+            if (CloseSegment(file->first, time))
+            {
+                ++segmentsClosed;
+            }
+            fd = files_.Get(file->first, now);
+        }
+        // Appending, so the lines start where the file ends
+        off_t offset = fd >= 0 ? lseek(fd, 0, SEEK_END) : 0;
+        if (fd < 0 || offset < 0 || !WriteFile(fd, file->second))
+        {
+            ++errors;
+            files_.Close(file->first);
+            continue;
+        }
+        LiveSegment& segment = GetLiveSegment(file->first, fd);
+        unsigned long long logOffset = segment.Begin + offset;
+        for (std::vector<Node*>::const_iterator node = file->second.begin();
+             node != file->second.end();
+             ++node)
+        {
+            const std::string& line = (*node)->Line;
+            if (observer_)
+            {
+                observer_(file->first, logOffset,
+                          boost::string_ref(line.data(), line.size() - 1));
+            }
+            logOffset += line.size();
+        }
+        segment.Size = logOffset - segment.Begin;
+        writes += (file->second.size() + IOV_MAX - 1) / IOV_MAX;
+        if (settings.Sync != SyncPolicy::Never)
+        {
+            unsyncedFiles_.insert(file->first);
+        }
+    }
+
+    now = microsec_clock::universal_time();
+    unsigned long syncs = unsyncedFiles_.size();
+    if (settings.Sync == SyncPolicy::EveryBatch
+        || (settings.Sync == SyncPolicy::Periodic
+            && now - lastSync_
+               >= milliseconds(settings.SyncIntervalMilliseconds)))
+    {
+        SyncFiles();
+        lastSync_ = now;
+    }
+    else
+    {
+        syncs = 0;
+    }
+
+    double totalLatency = 0;
+    long maxLatency = 0;
+    for (std::vector<Node*>::const_iterator node = batch.begin();
+         node != batch.end();
+         ++node)
+    {
+        long latency = (now - (*node)->Queued).total_milliseconds();
+        totalLatency += latency;
+        maxLatency = std::max(maxLatency, latency);
+    }
+
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    statistics_.MaxQueueDepth = std::max(statistics_.MaxQueueDepth,
+                                         batch.size());
+    statistics_.Lines += batch.size();
+    ++statistics_.Batches;
+    statistics_.Writes += writes;
+    statistics_.Syncs += syncs;
+    statistics_.Errors += errors;
+    statistics_.SegmentsClosed += segmentsClosed;
+    statistics_.MaxLatencyMilliseconds =
+        std::max(statistics_.MaxLatencyMilliseconds, maxLatency);
+    totalLatencyMilliseconds_ += totalLatency;
+}
+
+bool ChatLogWriter::WriteFile(int fd, const std::vector<Node*>& lines)
+{
+    std::vector<iovec> buffers(lines.size());
+    for (std::size_t i = 0; i < lines.size(); ++i)
+    {
+        buffers[i].iov_base = const_cast<char*>(lines[i]->Line.data());
+        buffers[i].iov_len = lines[i]->Line.size();
+    }
+
+    iovec* buffer = &buffers[0];
+    iovec* end = buffer + buffers.size();
+    while (buffer != end)
+    {
+        int count = static_cast<int>(std::min<std::ptrdiff_t>(end - buffer,
+                                                              IOV_MAX));
+        ssize_t written = writev(fd, buffer, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            Log << LogLevel::Error << "Could not write chat log: "
+                << strerror(errno);
+            return false;
+        }
+        // Skip what was written, a short write leaves part of a line
+        while (buffer != end && static_cast<std::size_t>(written)
+               >= buffer->iov_len)
+        {
+            written -= buffer->iov_len;
+            ++buffer;
+        }
+        if (buffer != end)
+        {
+            buffer->iov_base = static_cast<char*>(buffer->iov_base) + written;
+            buffer->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+void ChatLogWriter::SyncFiles()
+{
+    for (boost::unordered_set<std::string>::const_iterator path =
+             unsyncedFiles_.begin();
+         path != unsyncedFiles_.end();
+         ++path)
+    {
+        int fd = files_.Find(*path);
+        if (fd >= 0 && fdatasync(fd) != 0)
+        {
+            Log << LogLevel::Warning << "Could not sync '" << *path << "': "
+                << strerror(errno);
+        }
+    }
+    unsyncedFiles_.clear();
+}
+
+void ChatLogWriter::OnCloseFile(const std::string& path, int fd)
+{
+    liveSegments_.erase(path);
+    if (unsyncedFiles_.erase(path) > 0 && fdatasync(fd) != 0)
+    {
+        Log << LogLevel::Warning << "Could not sync '" << path << "': "
+            << strerror(errno);
+    }
+}
+
+ChatLogWriter::LiveSegment& ChatLogWriter::GetLiveSegment(
+    const std::string& path, int fd)
+{
+    boost::unordered_map<std::string, LiveSegment>::iterator found =
+        liveSegments_.find(path);
+    if (found != liveSegments_.end())
+    {
+        return found->second;
+    }
+    LiveSegment& segment = liveSegments_[path];
+    segment.Begin = ChatLogSegments::GetLiveBegin(path);
+    struct stat status;
+    segment.Size = fstat(fd, &status) == 0 ? status.st_size : 0;
+    if (segment.Size == 0
+        || !ChatLogSegments::GetLiveStart(path, segment.Started))
+    {
+        segment.Started = std::time(0);
+    }
+    return segment;
+}
+
+bool ChatLogWriter::IsSegmentDone(const LiveSegment& segment,
+                                  const Settings& settings,
+                                  std::time_t now) const
+{
+    return segment.Size > 0
+        && ((settings.SegmentBytes > 0
+             && segment.Size >= settings.SegmentBytes)
+            || (settings.SegmentSeconds > 0
+                && now - segment.Started >= settings.SegmentSeconds));
+}
+
+bool ChatLogWriter::CloseSegment(const std::string& path, std::time_t now)
+{
+    LiveSegment closed = liveSegments_[path];
+    // Which forgets the live segment
+    files_.Close(path);
+    std::string segment = ChatLogSegments::Close(path, closed.Begin);
+    if (segment.empty())
+    {
+        return false;
+    }
+    Log << LogLevel::Debug << "Closed chat log segment '" << segment << "'";
+
+    LiveSegment& live = liveSegments_[path];
+    live.Begin = closed.Begin + closed.Size;
+    live.Size = 0;
+    live.Started = now;
+
+    boost::lock_guard<boost::mutex> lock(compressMutex_);
+    compressQueue_.push_back(segment);
+    compressWake_.notify_all();
+    return true;
+}
+
+void ChatLogWriter::RunCompressor()
+{
+    for (;;)
+    {
+        std::string segment;
+        {
+            boost::unique_lock<boost::mutex> lock(compressMutex_);
+            while (compressQueue_.empty() && !compressorStopping_)
+            {
+                compressWake_.wait(lock);
+            }
+            if (compressorStopping_)
+            {
+                return;
+            }
+            segment = compressQueue_.front();
+            compressQueue_.pop_front();
+        }
+
+        unsigned long long size = 0;
+        unsigned long long compressedSize = 0;
+        try
+        {
+            ChatLogSegments::Compress(segment, size, compressedSize);
+        } catch (Exception& e)
+        {
+            Log << LogLevel::Error << e.GetMessage();
+            boost::lock_guard<boost::mutex> lock(mutex_);
+            ++statistics_.Errors;
+            continue;
+        }
+        Log << LogLevel::Debug << "Compressed chat log segment '" << segment
+            << "' from " << size << " to " << compressedSize << " bytes";
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        ++statistics_.SegmentsCompressed;
+        statistics_.UncompressedBytes += size;
+        statistics_.CompressedBytes += compressedSize;
+    }
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+#include "logfilecache.hpp"
+
+#include <ctime>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/utility.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace SyncPolicy
+{
+    /**
+     * When written chat logs are forced to disk.
+     */
+    enum SyncPolicy
+    {
+	// Left to the operating system
+	Never,
+	// After each batch of writes
+	EveryBatch,
+	// At most once every sync interval
+	Periodic
+    };
+
+    /**
+     * @return false if the name is not one of never, batch and periodic
+     */
+    bool FromString(const std::string& name, SyncPolicy& policy);
+} // namespace SyncPolicy
+
+/**
+ * Appends lines to the chat logs on a thread of its own. Lines are handed
+ * over through a lock-free queue so the network threads never wait for the
+ * disk, and the writer takes whatever has been queued every flush interval
+ * and writes it with one writev for each file. Only so many files are
+ * kept open, the least recently written is closed to make room and files
+ * nobody has written to for a while are closed.
+ *
+ * Logs can be kept in segments, see ChatLogSegments. A log whose live
+ * segment has grown large or old enough has it closed before more lines
+ * are written, and closed segments are compressed on another thread.
+ */
+class ChatLogWriter : boost::noncopyable
+{
+public:
+    struct Settings
+    {
+	// Longest time a line waits in the queue
+	unsigned int FlushIntervalMilliseconds;
+	SyncPolicy::SyncPolicy Sync;
+	// Only used with SyncPolicy::Periodic
+	unsigned int SyncIntervalMilliseconds;
+	std::size_t MaxOpenFiles;
+	// Zero keeps files open until there are too many
+	unsigned int IdleFileMilliseconds;
+	// Live segments are closed at this size or age, zero for both keeps
+	// each log in one file
+	unsigned long long SegmentBytes;
+	unsigned int SegmentSeconds;
+    };
+
+    struct Statistics
+    {
+	// Lines queued and not yet written
+	std::size_t QueueDepth;
+	std::size_t MaxQueueDepth;
+	unsigned long Lines;
+	unsigned long Batches;
+	// Calls to writev
+	unsigned long Writes;
+	unsigned long Syncs;
+	unsigned long Errors;
+	// From being queued to being written
+	double AverageLatencyMilliseconds;
+	long MaxLatencyMilliseconds;
+	std::size_t OpenFiles;
+	// Lines written to a file that was already open
+	unsigned long FileHits;
+	unsigned long FileMisses;
+	// Files closed to make room for another
+	unsigned long FileEvictions;
+	unsigned long IdleFileCloses;
+	unsigned long SegmentsClosed;
+	unsigned long SegmentsCompressed;
+	// Of the compressed segments, before and after
+	unsigned long long UncompressedBytes;
+	unsigned long long CompressedBytes;
+    };
+
+    /**
+     * Told about every line once it is written, on the writer thread.
+     * @param offset where in the log the line starts, closed segments
+     *        included
+     * @param line without the line ending
+     */
+    typedef boost::function<void (const std::string& path,
+				  unsigned long long offset,
+				  boost::string_ref line)> LineObserver;
+
+    static ChatLogWriter& Instance();
+
+    void SetSettings(const Settings& settings);
+
+    /**
+     * Waits for the writer to be done with the old observer, an empty one
+     * stops the calls.
+     */
+    void SetLineObserver(LineObserver observer);
+
+    /**
+     * Queue a line for the end of a file, the directory is made if needed.
+     * Never waits.
+     * @param line without the line ending
+     */
+    void Append(const std::string& path, const std::string& line);
+
+    /**
+     * Wait until every line queued before the call has been written.
+     */
+    void Flush();
+
+    Statistics GetStatistics() const;
+
+    /**
+     * Compress closed segments that were left uncompressed, as they are
+     * when the bot stops before it is done with them.
+     */
+    void CompressLeftovers(const std::string& logsDirectory);
+
+    /**
+     * Add a time as seconds since the epoch, the way the chat logs have
+     * them, without going through a locale.
+     */
+    static void AppendTimestamp(std::string& text, std::time_t time);
+
+private:
+    ChatLogWriter();
+    ~ChatLogWriter();
+
+    struct Node;
+    /**
+     * @param nodes gets the queued lines, oldest first
+     * @param retired gets nodes that can be deleted once the lines have
+     *        been written
+     */
+    void TakeQueued(std::vector<Node*>& nodes, std::vector<Node*>& retired);
+    void Run();
+    void Write(const std::vector<Node*>& batch, const Settings& settings);
+    // @return false if the file could not be written
+    bool WriteFile(int fd, const std::vector<Node*>& lines);
+    void SyncFiles();
+    // Files are synced before they are closed so no line is left behind
+    void OnCloseFile(const std::string& path, int fd);
+
+    struct LiveSegment
+    {
+	// Where in the log it starts
+	unsigned long long Begin;
+	unsigned long long Size;
+	std::time_t Started;
+    };
+    // Looked up when the file is opened
+    LiveSegment& GetLiveSegment(const std::string& path, int fd);
+    bool IsSegmentDone(const LiveSegment& segment,
+		       const Settings& settings,
+		       std::time_t now) const;
+    // @return false if the live segment is still open
+    bool CloseSegment(const std::string& path, std::time_t now);
+    void RunCompressor();
+
+    // Producers swap themselves in at the head, the writer takes from the
+    // tail, which is a node that has already been taken
+    boost::atomic<Node*> head_;
+    Node* tail_;
+    boost::atomic<std::size_t> queueDepth_;
+    boost::atomic<unsigned long> queuedLines_;
+
+    // Only used by the writer thread
+    // Before the files, which are synced and forgotten when they are closed
+    boost::unordered_set<std::string> unsyncedFiles_;
+    boost::unordered_map<std::string, LiveSegment> liveSegments_;
+    LogFileCache files_;
+    boost::posix_time::ptime lastSync_;
+
+    Settings settings_;
+    Statistics statistics_;
+    double totalLatencyMilliseconds_;
+    unsigned long writtenLines_;
+    bool flushRequested_;
+    bool stopping_;
+    mutable boost::mutex mutex_;
+    // Wakes the writer early, and those waiting in Flush
+    boost::condition_variable wake_;
+    boost::condition_variable written_;
+
+    LineObserver observer_;
+    // Held while a batch is written
+    boost::mutex observerMutex_;
+
+    boost::thread thread_;
+
+    // Closed segments waiting to be compressed
+    std::deque<std::string> compressQueue_;
+    bool compressorStopping_;
+    boost::mutex compressMutex_;
+    boost::condition_variable compressWake_;
+    boost::thread compressThread_;
+};
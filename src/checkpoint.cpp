@@ -0,0 +1,136 @@
+#include "checkpoint.hpp"
+#include "logging/logger.hpp"
+
+#include <cstdio>
+#include <fstream>
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+using boost::posix_time::milliseconds;
+
+// No nick, line or path comes close, anything longer is a broken file
+static const boost::uint32_t MAX_CHECKPOINT_STRING = 1 << 20;
+
+Checkpoint::Checkpoint(const std::string& path,
+                       unsigned int intervalMilliseconds,
+                       Serializer serialize)
+    : path_(path)
+    , intervalMilliseconds_(intervalMilliseconds)
+    , serialize_(serialize)
+    , timer_(IoServicePool::Instance().GetIoService())
+    , running_(false)
+{
+}
+
+Checkpoint::~Checkpoint()
+{
+    Stop();
+}
+
+void Checkpoint::Start()
+{
+    boost::lock_guard<boost::mutex> lock(timerMutex_);
+    running_ = true;
+    Arm();
+}
+
+void Checkpoint::Stop()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(timerMutex_);
+        running_ = false;
+        boost::system::error_code error;
+        timer_.cancel(error);
+    }
+    pending_.WaitForAll();
+}
+
+bool Checkpoint::Save()
+{
+    if (path_.empty())
+    {
+        return false;
+    }
+    boost::lock_guard<boost::mutex> saveLock(saveMutex_);
+    std::string data;
+    if (!serialize_(data))
+    {
+        return false;
+    }
+
+    // Written next to it and moved in place so a crash never leaves half
+    std::string temporary = path_ + ".tmp";
+    {
+        std::ofstream out(temporary.c_str(),
+                          std::ios::binary | std::ios::trunc);
+        out.write(data.data(), data.size());
+        if (!out)
+        {
+            Log << LogLevel::Error << "Could not write checkpoint '"
+                << temporary << "'";
+            return false;
+        }
+    }
+    if (std::rename(temporary.c_str(), path_.c_str()) != 0)
+    {
+        Log << LogLevel::Error << "Could not replace checkpoint '" << path_
+            << "'";
+        return false;
+    }
+    Log << LogLevel::Debug << "Saved " << data.size()
+        << " bytes to checkpoint '" << path_ << "'";
+    return true;
+}
+
+void Checkpoint::WriteNumber(std::string& data, boost::uint64_t number)
+{
+    data.append(reinterpret_cast<const char*>(&number), sizeof(number));
+}
+
+void Checkpoint::WriteString(std::string& data, const std::string& text)
+{
+    boost::uint32_t size = text.size();
+    data.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    data += text;
+}
+
+bool Checkpoint::ReadNumber(std::istream& in, boost::uint64_t& number)
+{
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&number),
+                                     sizeof(number)));
+}
+
+bool Checkpoint::ReadString(std::istream& in, std::string& text)
+{
+    boost::uint32_t size = 0;
+    if (!in.read(reinterpret_cast<char*>(&size), sizeof(size))
+        || size > MAX_CHECKPOINT_STRING)
+    {
+        return false;
+    }
+    text.resize(size);
+    return size == 0 || static_cast<bool>(in.read(&text[0], size));
+}
+
+void Checkpoint::Arm()
+{
+    if (!running_ || intervalMilliseconds_ == 0 || path_.empty())
+    {
+        return;
+    }
+    timer_.expires_from_now(milliseconds(intervalMilliseconds_));
+    pending_.Begin();
+    timer_.async_wait(boost::bind(&Checkpoint::OnTimer, this, _1));
+}
+
+void Checkpoint::OnTimer(const boost::system::error_code& error)
+{
+    if (!error)
+    {
+        Save();
+        boost::lock_guard<boost::mutex> lock(timerMutex_);
+        Arm();
+    }
+    pending_.End();
+}
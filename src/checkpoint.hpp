@@ -0,0 +1,80 @@
+#pragma once
+
+#include "connection/ioservicepool.hpp"
+
+#include <istream>
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/utility.hpp>
+
+/**
+ * A file an index is saved to now and then so it does not have to be
+ * built again on start. The index only turns itself into bytes, the file
+ * is replaced as a whole so a crash leaves either the old or the new one.
+ * Numbers and strings are in the byte order of the machine, checkpoints
+ * are not meant to be moved between machines.
+ */
+class Checkpoint : boost::noncopyable
+{
+public:
+    /**
+     * Called to get what is saved, never for two saves at a time.
+     * @return false to save nothing this time
+     */
+    typedef boost::function<bool (std::string& data)> Serializer;
+
+    /**
+     * @param path empty to never save
+     * @param intervalMilliseconds zero only saves when asked to
+     */
+    Checkpoint(const std::string& path,
+	       unsigned int intervalMilliseconds,
+	       Serializer serialize);
+    /**
+     * Stops saving but does not save.
+     */
+    ~Checkpoint();
+
+    const std::string& GetPath() const { return path_; }
+
+    /**
+     * Save every interval from now on.
+     */
+    void Start();
+
+    /**
+     * Stop saving every interval, waits for a save that is going on.
+     */
+    void Stop();
+
+    /**
+     * Save now, failures are logged.
+     * @return false if nothing was saved
+     */
+    bool Save();
+
+    static void WriteNumber(std::string& data, boost::uint64_t number);
+    static void WriteString(std::string& data, const std::string& text);
+    static bool ReadNumber(std::istream& in, boost::uint64_t& number);
+    // @return false if it is longer than any string saved, a broken file
+    static bool ReadString(std::istream& in, std::string& text);
+
+private:
+    void Arm();
+    void OnTimer(const boost::system::error_code& error);
+
+    std::string path_;
+    unsigned int intervalMilliseconds_;
+    Serializer serialize_;
+    // Only one save at a time, they share the temporary file
+    boost::mutex saveMutex_;
+
+    boost::asio::deadline_timer timer_;
+    bool running_;
+    PendingOperations pending_;
+    boost::mutex timerMutex_;
+};
@@ -1,36 +1,96 @@
 #include "client.hpp"
 #include "exception.hpp"
-#include "searchidle.h"
+#include "chatlogwriter.hpp"
 #include "glue/gluemanager.hpp"
+#include "logscanner.hpp"
 #include "irc/ircserver.hpp"
 #include "message.hpp"
 #include "server.hpp"
 #include "lua/lua.hpp"
 #include "logging/logger.hpp"
 
-#include <fstream>
 #include <sstream>
 #include <locale>
 
 #include <boost/bind.hpp>
-#include <boost/filesystem/convenience.hpp>
-#include <boost/filesystem/exception.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 Client::Client(const UnicodeString& config) :
     config_(config), run_(false)
 {
+    const Config::ChatLog& chatLog = config_.GetChatLog();
+    ChatLogWriter::Settings chatLogSettings;
+    chatLogSettings.FlushIntervalMilliseconds =
+        static_cast<unsigned int>(chatLog.FlushInterval * 1000);
+    chatLogSettings.Sync = chatLog.Sync;
+    chatLogSettings.SyncIntervalMilliseconds =
+        static_cast<unsigned int>(chatLog.SyncInterval * 1000);
+    chatLogSettings.MaxOpenFiles = chatLog.MaxOpenFiles;
+    chatLogSettings.IdleFileMilliseconds =
+        static_cast<unsigned int>(chatLog.IdleTimeout * 1000);
+    chatLogSettings.SegmentBytes =
+        static_cast<unsigned long long>(chatLog.SegmentSize) << 20;
+    chatLogSettings.SegmentSeconds =
+        static_cast<unsigned int>(chatLog.SegmentAge);
+    ChatLogWriter::Instance().SetSettings(chatLogSettings);
+
+    std::string logsDirectory = GetLogsDirectory();
+    ChatLogWriter::Instance().CompressLeftovers(logsDirectory);
+    std::string lastSeenFilename = AsUtf8(config_.GetLastSeenFilename());
+    if (lastSeenFilename.empty())
+    {
+        lastSeenFilename = logsDirectory + ".lastseen";
+    }
+    lastSeen_.reset(new LastSeenIndex(lastSeenFilename,
+        static_cast<unsigned int>(config_.GetLastSeenInterval() * 1000)));
+    lastSeen_->Rebuild(logsDirectory);
+
+    std::string statisticsFilename =
+        AsUtf8(config_.GetChannelStatisticsFilename());
+    if (statisticsFilename.empty())
+    {
+        statisticsFilename = logsDirectory + ".channelstats";
+    }
+    statistics_.reset(new ChannelStatistics(statisticsFilename,
+        static_cast<unsigned int>(
+            config_.GetChannelStatisticsInterval() * 1000)));
+
+    const Config::ScrollbackLimits& scrollback = config_.GetScrollbackLimits();
+    scrollback_.reset(new Scrollback(
+        scrollback.Lines,
+        static_cast<std::size_t>(scrollback.ChannelSize) << 10,
+        static_cast<std::size_t>(scrollback.Size) << 10));
+
+    std::string searchDirectory = AsUtf8(config_.GetSearchIndexDirectory());
+    if (searchDirectory.empty())
+    {
+        searchDirectory = logsDirectory + ".search/";
+    }
+    search_.reset(new LogSearchIndex(searchDirectory));
+    ChatLogWriter::Instance().SetLineObserver(
+        boost::bind(&LogSearchIndex::AddLine, search_.get(), _1, _2, _3));
+    search_->CatchUp(logsDirectory);
+
+    boost::posix_time::ptime started =
+        boost::posix_time::microsec_clock::universal_time();
     InitLua();
-    try
+    boost::posix_time::ptime luaStarted =
+        boost::posix_time::microsec_clock::universal_time();
+
+    int numServers = std::distance(config_.GetServersBegin(),
+                                   config_.GetServersEnd());
+    if (numServers == 0)
     {
-        int numServers = std::distance(config_.GetServersBegin(),
-                                       config_.GetServersEnd());
-        if (numServers == 0)
-        {
-            Log << LogLevel::Warning << "No servers configured, nothing to do";
-        }
-        for (Config::ServerIterator i = config_.GetServersBegin(); i
-                != config_.GetServersEnd(); ++i)
+        Log << LogLevel::Warning << "No servers configured, nothing to do";
+    }
+    // Connecting only starts the name lookups, every server resolves and
+    // connects on the I/O pool without waiting for the others
+    int numStarted = 0;
+    for (Config::ServerIterator i = config_.GetServersBegin(); i
+            != config_.GetServersEnd(); ++i)
+    {
+        try
         {
             serverSettings_[i->GetId()] = *i;
             Connect(i->GetServerType(),
@@ -39,12 +99,20 @@ Client::Client(const UnicodeString& config) :
                     i->GetPort(),
                     i->GetNick(),
                     i->GetPassword());
+            ++numStarted;
+        } catch (Exception& e)
+        {
+            Log << LogLevel::Error << e.GetMessage();
         }
-        run_ = true;
-    } catch (Exception& e)
-    {
-        Log << LogLevel::Error << e.GetMessage();
     }
+    run_ = numServers == 0 || numStarted > 0;
+
+    boost::posix_time::ptime now =
+        boost::posix_time::microsec_clock::universal_time();
+    Log << LogLevel::Info << "Started " << numStarted << " of " << numServers
+        << " servers, " << (luaStarted - started).total_milliseconds()
+        << " ms loading scripts and "
+        << (now - luaStarted).total_milliseconds() << " ms starting servers";
 
     try
     {
@@ -57,6 +125,13 @@ Client::Client(const UnicodeString& config) :
     }
 }
 
+Client::~Client()
+{
+    // Lines logged from here on are read from the logs on the next start
+    ChatLogWriter::Instance().Flush();
+    ChatLogWriter::Instance().SetLineObserver(ChatLogWriter::LineObserver());
+}
+
 void Client::Run()
 {
     if (run_)
@@ -73,7 +148,7 @@ void Client::Receive(Server& server, const Message& message)
 
     if (!OnPrivMsg(server, message))
     {
-        if (server.GetNick().caseCompare(AsUnicode(message.GetPrefix().GetNick()), 0) == 0)
+        if (server.IsOwnNick(message.GetNickRef()))
         {
             // We do not process messages from ourself
             return;
@@ -91,6 +166,23 @@ void Client::Receive(Server& server, const Message& message)
     }
 }
 
+void Client::ReceiveBurst(Server& server, const NetBurst& burst)
+{
+    currentServer_ = server.GetId();
+    currentReplyTo_.clear();
+
+    boost::shared_lock<boost::shared_mutex> lock(receiverMutex_);
+    for (BurstReceiverContainer::iterator i = burstReceivers_.begin();
+         i != burstReceivers_.end();
+         ++i)
+    {
+        if (BurstReceiverHandle receiver = i->lock())
+        {
+            (*receiver)(server.GetId(), burst);
+        }
+    }
+}
+
 void Client::JoinChannel(const std::string& channel,
         const UnicodeString& key, const UnicodeString& serverId)
 {
@@ -117,6 +209,13 @@ void Client::SendMessage(const UnicodeString& message,
     GetServerFromId(serverId).SendMessage(to, message);
 }
 
+void Client::SendLowPriorityMessage(const UnicodeString& message,
+        const std::string& target, const UnicodeString& serverId)
+{
+    const std::string& to = target.empty() ? currentReplyTo_ : target;
+    GetServerFromId(serverId).SendLowPriorityMessage(to, message);
+}
+
 Client::EventReceiverHandle Client::RegisterForEvent(EventReceiver receiver)
 {
     boost::upgrade_lock<boost::shared_mutex> lock(receiverMutex_);
@@ -125,6 +224,14 @@ Client::EventReceiverHandle Client::RegisterForEvent(EventReceiver receiver)
     return handle;
 }
 
+Client::BurstReceiverHandle Client::RegisterForBursts(BurstReceiver receiver)
+{
+    boost::upgrade_lock<boost::shared_mutex> lock(receiverMutex_);
+    BurstReceiverHandle handle(new BurstReceiver(receiver));
+    burstReceivers_.push_back(BurstReceiverPtr(handle));
+    return handle;
+}
+
 const Config& Client::GetConfig() const
 {
     return config_;
@@ -143,22 +250,73 @@ UnicodeString Client::GetLastLine(const std::string& nick, long& timestamp,
     const std::string& to = channel.empty() ? currentReplyTo_ : channel;
     std::string logName = GetServerFromId(serverId).GetLogName(to);
 
-    std::vector<char> buffer(1024, 0);
-
-    int res = searchidle(logName.c_str(), nick.c_str(),
-            &timestamp, &buffer[0], buffer.size());
-
-    UnicodeString result;
-    if (res == 0)
+    if (lastSeen_->IsReady())
     {
-      result = AsUnicode(&buffer[0]);
+        LastSeenIndex::Entry entry;
+        if (!lastSeen_->Find(logName, nick, entry))
+        {
+            timestamp = -1;
+            return UnicodeString();
+        }
+        timestamp = entry.Time;
+        return AsUnicode(entry.Line);
     }
-    else
+
+    // Until the index has read the logs they are searched. Waiting for the
+    // writer blocks this thread, but only until the index is ready after a
+    // start and scanning the log reads far more from disk anyway.
+    ChatLogWriter::Instance().Flush();
+    LogScanner::Match match;
+    if (!LogScanner::FindLastLine(logName, nick, match))
     {
         timestamp = -1;
+        return UnicodeString();
     }
+    timestamp = match.Time;
+    return AsUnicode(match.Line);
+}
+
+void Client::SearchLogs(const std::string& query,
+                        std::size_t limit,
+                        LogSearchIndex::HitContainer& hits,
+                        const std::string& channel,
+                        const UnicodeString& serverId) const
+{
+    const std::string& to = channel.empty() ? currentReplyTo_ : channel;
+    std::string logName = to == "*"
+        ? std::string() : GetServerFromId(serverId).GetLogName(to);
+    // Lines are indexed once they are written, the writer is not waited for
+    // so the ones from the last flush interval may be missing
+    search_->Search(query, logName, limit, hits);
+}
+
+bool Client::GetChannelStatistics(ChannelStatistics::Channel& statistics,
+                                  const std::string& channel,
+                                  const UnicodeString& serverId) const
+{
+    const std::string& to = channel.empty() ? currentReplyTo_ : channel;
+    return statistics_->FindChannel(GetServerFromId(serverId).GetLogName(to),
+                                    statistics);
+}
+
+bool Client::GetNickStatistics(const std::string& nick,
+                               ChannelStatistics::Counters& statistics,
+                               const std::string& channel,
+                               const UnicodeString& serverId) const
+{
+    const std::string& to = channel.empty() ? currentReplyTo_ : channel;
+    return statistics_->FindNick(GetServerFromId(serverId).GetLogName(to),
+                                 nick,
+                                 statistics);
+}
 
-    return result;
+const Scrollback& Client::GetScrollback(std::string& name,
+                                        const std::string& channel,
+                                        const UnicodeString& serverId) const
+{
+    const std::string& to = channel.empty() ? currentReplyTo_ : channel;
+    name = GetServerFromId(serverId).GetLogName(to);
+    return *scrollback_;
 }
 
 const UnicodeString& Client::GetNick(const UnicodeString& serverId)
@@ -166,12 +324,34 @@ const UnicodeString& Client::GetNick(const UnicodeString& serverId)
     return GetServerFromId(serverId).GetNick();
 }
 
-const std::set<std::string>&
-Client::GetChannelNicks(const std::string& channel,
+long Client::GetLag(const UnicodeString& serverId)
+{
+    return GetServerFromId(serverId).GetLag();
+}
+
+const Irc::IrcServer& Client::GetIrcServer(const UnicodeString& serverId) const
+{
+    const Irc::IrcServer* server =
+        dynamic_cast<const Irc::IrcServer*>(&GetServerFromId(serverId));
+    if (!server)
+    {
+        throw Exception(__FILE__, __LINE__,
+                        "Server '" + serverId + "' is not an IRC server");
+    }
+    return *server;
+}
+
+ChannelSnapshotPtr Client::GetChannel(const std::string& channel,
         const UnicodeString& serverId)
 {
     const std::string& to = channel.empty() ? currentReplyTo_ : channel;
-    return GetServerFromId(serverId).GetChannelNicks(to);
+    ChannelSnapshotPtr snapshot = GetServerFromId(serverId).GetChannel(to);
+    if (!snapshot)
+    {
+        throw Exception(__FILE__, __LINE__, AsUnicode(
+                "Not in channel '" + to + "'"));
+    }
+    return snapshot;
 }
 
 Server& Client::GetServerFromId(const UnicodeString& id)
@@ -223,6 +403,8 @@ Server& Client::Connect(Config::Server::Type serverType,
                                     password);
     Server::ReceiverHandle handle =
         server->RegisterReceiver(boost::bind(&Client::Receive, this, _1, _2));
+    burstHandles_.push_back(server->RegisterBurstReceiver(
+        boost::bind(&Client::ReceiveBurst, this, _1, _2)));
 
     std::pair<ServerHandleMap::iterator, bool> inserted =
         servers_.insert(ServerHandleMap::value_type(id,
@@ -241,25 +423,60 @@ Client::ServerPtr Client::CreateServer(Config::Server::Type serverType,
                                        const UnicodeString& nick,
                                        const UnicodeString& password)
 {
-    std::string logDirectory = AsUtf8(config_.GetLogsDirectory());
-    if (logDirectory.rfind('/') != logDirectory.size() - 1)
-    {
-        logDirectory += '/';
-    }
-    logDirectory += AsUtf8(id) + '/';
+    std::string logDirectory = GetLogsDirectory() + AsUtf8(id) + '/';
+
+    const Config::Server& settings = serverSettings_[id];
 
     ServerPtr server;
     switch (serverType)
     {
     case Config::Server::IrcServer:
+    {
         Log << LogLevel::Info << "Creating IRC server for " << host << ":" << port;
-        server.reset(new Irc::IrcServer(id,
-                                        host,
-                                        port,
-                                        logDirectory,
-                                        nick,
-                                        password));
+        Irc::IrcServer* ircServer = new Irc::IrcServer(id,
+                                                       host,
+                                                       port,
+                                                       logDirectory,
+                                                       nick,
+                                                       password);
+        server.reset(ircServer);
+
+        const Config::Server::FloodControl& flood = settings.GetFloodControl();
+        Irc::SendScheduler::Limits limits = { flood.LinesPerSecond,
+                                              flood.BytesPerSecond,
+                                              flood.BurstLines,
+                                              flood.BurstBytes };
+        ircServer->SetFloodControl(limits);
+
+        const Config::Server::LagControl& lag = settings.GetLagControl();
+        Irc::LagMonitor::Settings lagSettings =
+            { static_cast<unsigned int>(lag.PingInterval * 1000),
+              static_cast<unsigned int>(lag.MaxLag * 1000) };
+        ircServer->SetLagSettings(lagSettings);
+
+        const Config::Server::KeepAlive& tcp = settings.GetKeepAlive();
+        Connection::KeepAlive keepAlive =
+            { tcp.Idle,
+              tcp.Interval,
+              tcp.Probes,
+              static_cast<unsigned int>(tcp.UserTimeout * 1000) };
+        ircServer->SetKeepAlive(keepAlive);
+
+        const Config::Server::NetsplitControl& netsplit =
+            settings.GetNetsplitControl();
+        Irc::BurstAggregator::Settings burstSettings =
+            { static_cast<unsigned int>(netsplit.BurstWindow * 1000),
+              static_cast<unsigned int>(netsplit.NetjoinWindow * 1000) };
+        ircServer->SetBurstSettings(burstSettings);
+
+        for (Config::Server::HostIterator i = settings.GetFallbackHostsBegin();
+             i != settings.GetFallbackHostsEnd();
+             ++i)
+        {
+            ircServer->AddFallbackHost(i->first, i->second);
+        }
         break;
+    }
     case Config::Server::MatrixServer:
     default:
         throw Exception(__FILE__, __LINE__, "Invalid server type");
@@ -280,9 +497,22 @@ Client::ServerPtr Client::CreateServer(Config::Server::Type serverType,
             }
         }
     }
+    server->SetLastSeenIndex(lastSeen_);
+    server->SetChannelStatistics(statistics_);
+    server->SetScrollback(scrollback_);
     return server;
 }
 
+std::string Client::GetLogsDirectory() const
+{
+    std::string logsDirectory = AsUtf8(config_.GetLogsDirectory());
+    if (logsDirectory.rfind('/') != logsDirectory.size() - 1)
+    {
+        logsDirectory += '/';
+    }
+    return logsDirectory;
+}
+
 bool Client::OnPrivMsg(Server& server, const Message& message)
 {
     std::string fromNick = message.GetPrefix().GetNick();
@@ -308,7 +538,33 @@ void Client::ReceivePipeMessage(const std::string& line)
 {
     std::stringstream ss(line);
     std::string command, server, channel, message;
-    ss >> command >> server >> channel;
+    ss >> command;
+    if (boost::iequals(command, "loglevel"))
+    {
+        std::string name;
+        ss >> name;
+        LogLevel::LogLevel level;
+        if (!LogLevel::FromString(name, level))
+        {
+            Log << LogLevel::Error << "Named pipe gave unknown log level '"
+                << name << "'";
+            return;
+        }
+        // Logged at whichever of the two levels lets the line through
+        bool raising = level > LogLevel::Info;
+        if (!raising)
+        {
+            LogManager::Instance().SetLevel(level);
+        }
+        Log << LogLevel::Info << "Log level is now "
+            << LogLevel::ToString(level);
+        if (raising)
+        {
+            LogManager::Instance().SetLevel(level);
+        }
+        return;
+    }
+    ss >> server >> channel;
     if (ss.peek() == ' ')
     {
         ss.get();
@@ -328,56 +584,6 @@ void Client::ReceivePipeMessage(const std::string& line)
     }
 }
 
-void Client::LogMessage(Server& server, const UnicodeString& target,
-        const UnicodeString& text)
-{
-    UnicodeString logFile = config_.GetLogsDirectory();
-    if (logFile.lastIndexOf(AsUnicode("/")) != logFile.length() - 1)
-    {
-        logFile += "/";
-    }
-    logFile += server.GetHostName() + "/";
-    logFile += target;
-
-    time_t currentTime = time(0);
-    LogStreamMap::iterator stream = logStreams_.find(logFile);
-    if (stream == logStreams_.end())
-    {
-        Log << LogLevel::Debug << "Creating '" << logFile << "' log stream";
-        OfstreamPtr
-                newStream(new std::ofstream(AsUtf8(logFile).c_str(), std::ios::app));
-        logStreams_[logFile] = OfstreamAndTimestamp(newStream, currentTime);
-        stream = logStreams_.find(logFile);
-    }
-    if (stream != logStreams_.end())
-    {
-        (*stream->second.first) << AsUtf8(text) << std::endl;
-        stream->second.second = currentTime;
-    }
-
-}
-
-void Client::ManageLogStreams()
-{
-    time_t currentTime = time(0);
-    for (LogStreamMap::iterator i = logStreams_.begin(); i != logStreams_.end();)
-    {
-        // Only keep logstreams alive for a certain amount of time
-        if (i->second.second + 30 * 60 < currentTime)
-        {
-            Log << LogLevel::Debug << "Closing '" << i->first << "' log stream";
-            LogStreamMap::iterator next = i;
-            std::advance(next, 1);
-            logStreams_.erase(i);
-            i = next;
-        }
-        else
-        {
-            ++i;
-        }
-    }
-}
-
 void Client::InitLua()
 {
     lua_.reset(new Lua(config_.GetScriptsDirectory()));
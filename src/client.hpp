@@ -1,7 +1,12 @@
 #pragma once
 
 #include "server.fwd.hpp"
+#include "channelstatistics.hpp"
+#include "lastseenindex.hpp"
+#include "logsearchindex.hpp"
+#include "scrollback.hpp"
 #include "message.fwd.hpp"
+#include "channelsnapshot.hpp"
 #include "irc/command.hpp"
 #include "config.hpp"
 #include "lua/lua.fwd.hpp"
@@ -10,20 +15,28 @@
 #include <string>
 #include <map>
 #include <set>
+#include <vector>
 
 #include <unicode/unistr.h>
 
 #include <boost/shared_ptr.hpp>
 #include <boost/unordered_map.hpp>
 
+namespace Irc
+{
+class IrcServer;
+}
+
 class Client
 {
 public:
     Client(const UnicodeString& config);
+    ~Client();
 
     void Run();
 
     void Receive(Server& server, const Message& message);
+    void ReceiveBurst(Server& server, const NetBurst& burst);
 
     /**
      * @throw Exception if no matching server found
@@ -48,6 +61,13 @@ public:
     void SendMessage(const UnicodeString& message,
              const std::string& target = std::string(),
              const UnicodeString& serverId = UnicodeString());
+    /**
+     * Like SendMessage but the message is sent after all other traffic
+     * @throw Exception if no matching server found
+     */
+    void SendLowPriorityMessage(const UnicodeString& message,
+                const std::string& target = std::string(),
+                const UnicodeString& serverId = UnicodeString());
 
     /**
      * @throw Exception if no matching server found
@@ -62,16 +82,62 @@ public:
                 long& timestamp,
                 const std::string& channel = std::string(),
                 const UnicodeString& serverId = UnicodeString()) const;
+    /**
+     * Search the logs, newest first among equally good hits. Lines that
+     * the chat log writer has not written yet are not found.
+     * @param channel the channel or nick whose log is searched, "*" for
+     *        all logs
+     * @throw Exception if no matching server found
+     */
+    void SearchLogs(const std::string& query,
+                    std::size_t limit,
+                    LogSearchIndex::HitContainer& hits,
+                    const std::string& channel = std::string(),
+                    const UnicodeString& serverId = UnicodeString()) const;
+    /**
+     * @param channel the channel or nick whose log is looked at
+     * @return false if nobody has said anything there
+     * @throw Exception if no matching server found
+     */
+    bool GetChannelStatistics(ChannelStatistics::Channel& statistics,
+                              const std::string& channel = std::string(),
+                              const UnicodeString& serverId = UnicodeString()) const;
+    /**
+     * @return false if the nick has said nothing in the channel
+     * @throw Exception if no matching server found
+     */
+    bool GetNickStatistics(const std::string& nick,
+                           ChannelStatistics::Counters& statistics,
+                           const std::string& channel = std::string(),
+                           const UnicodeString& serverId = UnicodeString()) const;
+    /**
+     * The lines of the channel are in the scrollback under the given name.
+     * @param name gets the name
+     * @throw Exception if no matching server found
+     */
+    const Scrollback& GetScrollback(std::string& name,
+                                    const std::string& channel = std::string(),
+                                    const UnicodeString& serverId = UnicodeString()) const;
     /**
      * @throw Exception if no matching server found
      */
     const UnicodeString& GetNick(const UnicodeString& serverId = UnicodeString());
+    /**
+     * Round trip time in milliseconds, negative if not known yet
+     * @throw Exception if no matching server found
+     */
+    long GetLag(const UnicodeString& serverId = UnicodeString());
+    /**
+     * The IRC server behind a server id, for statistics only IRC has
+     * @throw Exception if no matching IRC server found
+     */
+    const Irc::IrcServer& GetIrcServer(const UnicodeString& serverId = UnicodeString()) const;
 
     /**
      * @throw Exception if no matching server or channel found
      */
-    const std::set<std::string>& GetChannelNicks(const std::string& channel = std::string(),
-                         const UnicodeString& serverid = UnicodeString());
+    ChannelSnapshotPtr GetChannel(const std::string& channel = std::string(),
+                                  const UnicodeString& serverid = UnicodeString());
 
     // void (server, message)
     typedef boost::function<void (const UnicodeString&,
@@ -79,6 +145,12 @@ public:
     typedef boost::shared_ptr<EventReceiver> EventReceiverHandle;
     EventReceiverHandle RegisterForEvent(EventReceiver receiver);
 
+    // void (server, burst), for netsplits and netjoins
+    typedef boost::function<void (const UnicodeString&,
+                  const NetBurst&)> BurstReceiver;
+    typedef boost::shared_ptr<BurstReceiver> BurstReceiverHandle;
+    BurstReceiverHandle RegisterForBursts(BurstReceiver receiver);
+
     const Config& GetConfig() const;
 
 private:
@@ -116,31 +188,33 @@ private:
 
     void ReceivePipeMessage(const std::string& line);
 
-    void LogMessage(Server& server,
-            const UnicodeString& target,
-            const UnicodeString& text);
+    void InitLua();
 
-    void ManageLogStreams();
+    // The logs directory from the configuration, ending with a slash
+    std::string GetLogsDirectory() const;
 
-    void InitLua();
+    // Before the servers, which keep them up to date
+    boost::shared_ptr<LastSeenIndex> lastSeen_;
+    boost::shared_ptr<LogSearchIndex> search_;
+    boost::shared_ptr<ChannelStatistics> statistics_;
+    boost::shared_ptr<Scrollback> scrollback_;
 
     typedef std::pair<ServerPtr, ServerReceiverHandle> ServerAndHandle;
     typedef std::map<UnicodeString,ServerAndHandle> ServerHandleMap;
     ServerHandleMap servers_;
+    std::vector<ServerBurstReceiverHandle> burstHandles_;
     mutable boost::shared_mutex serverMutex_;
     Config config_;
 
     typedef std::map<UnicodeString, Config::Server> ServerIdMap;
     ServerIdMap serverSettings_;
 
-    typedef boost::shared_ptr<std::ofstream> OfstreamPtr;
-    typedef std::pair<OfstreamPtr,time_t> OfstreamAndTimestamp;
-    typedef std::map<UnicodeString, OfstreamAndTimestamp> LogStreamMap;
-    LogStreamMap logStreams_;
-
     typedef boost::weak_ptr<EventReceiver> EventReceiverPtr;
     typedef std::list<EventReceiverPtr> EventReceiverContainer;
     EventReceiverContainer eventReceivers_;
+    typedef boost::weak_ptr<BurstReceiver> BurstReceiverPtr;
+    typedef std::list<BurstReceiverPtr> BurstReceiverContainer;
+    BurstReceiverContainer burstReceivers_;
     boost::shared_mutex receiverMutex_;
 
     boost::shared_ptr<Lua> lua_;
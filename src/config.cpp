@@ -4,16 +4,78 @@
 #include "xml/xmlutil.hpp"
 #include "logging/logger.hpp"
 
+#include <limits>
+
 #include <boost/lexical_cast.hpp>
 #include <converter.hpp>
 
+// Default flood control, five lines at once and then one line every two
+// seconds which is what most servers tolerate
+const double DEFAULT_FLOOD_LINES_PER_SECOND = 0.5;
+const unsigned int DEFAULT_FLOOD_BURST_LINES = 5;
+// Default lag monitoring, a dead connection is noticed within a minute and
+// a half instead of the five minutes it takes for the connection to time out
+const double DEFAULT_PING_INTERVAL = 30;
+const double DEFAULT_MAX_LAG = 60;
+// Lines of a netsplit arrive back to back, a second of quiet ends it. Split
+// servers are usually back well within half an hour.
+const double DEFAULT_BURST_WINDOW = 1;
+const double DEFAULT_NETJOIN_WINDOW = 1800;
+// Chat log lines are written five times a second at most and syncing them
+// to disk is left to the operating system
+const double DEFAULT_CHATLOG_FLUSH_INTERVAL = 0.2;
+const double DEFAULT_CHATLOG_SYNC_INTERVAL = 5;
+// Plenty for the channels, private messages from many nicks will not run
+// the bot out of file descriptors
+const unsigned int DEFAULT_CHATLOG_MAX_OPEN_FILES = 64;
+const double DEFAULT_CHATLOG_IDLE_TIMEOUT = 1800;
+// Logs are kept in one file each unless configured otherwise
+const unsigned int DEFAULT_CHATLOG_SEGMENT_SIZE = 0;
+const double DEFAULT_CHATLOG_SEGMENT_AGE = 0;
+// A couple of screens of each channel, a busy channel does not push the
+// quiet ones out until there are hundreds of them
+const unsigned int DEFAULT_SCROLLBACK_LINES = 200;
+const unsigned int DEFAULT_SCROLLBACK_CHANNEL_SIZE = 64;
+const unsigned int DEFAULT_SCROLLBACK_SIZE = 8192;
+// Losing five minutes of last seen lines in a crash only means reading
+// five minutes of logs on the next start
+const double DEFAULT_LAST_SEEN_INTERVAL = 300;
+// Channel statistics are only counted as messages arrive, what a crash
+// loses is lost for good
+const double DEFAULT_CHANNEL_STATISTICS_INTERVAL = 60;
+
+// Intervals are given in seconds and counted in milliseconds in an unsigned
+// int, a little under 50 days
+const double MIN_INTERVAL = 0.001;
+const double MAX_INTERVAL = std::numeric_limits<unsigned int>::max() / 1000;
+
+/**
+ * @param canBeOff Zero turns the setting off
+ * @throw boost::bad_lexical_cast if value is not a number of seconds in range
+ */
+static double ParseInterval(const std::string& value, bool canBeOff)
+{
+    double seconds = boost::lexical_cast<double>(value);
+    if (canBeOff && seconds == 0)
+    {
+        return seconds;
+    }
+    // Also catches not-a-number which compares false to everything
+    if (!(seconds >= MIN_INTERVAL && seconds <= MAX_INTERVAL))
+    {
+        throw boost::bad_lexical_cast();
+    }
+    return seconds;
+}
+
 bool operator==(const std::string& lhs, const xmlChar* rhs)
 {
     return lhs == reinterpret_cast<const char*> (rhs);
 }
 
 Config::Config(const UnicodeString& path) :
-    path_(path)
+    path_(path), lastSeenInterval_(DEFAULT_LAST_SEEN_INTERVAL),
+    channelStatisticsInterval_(DEFAULT_CHANNEL_STATISTICS_INTERVAL)
 {
     try
     {
@@ -69,6 +131,152 @@ void Config::ParseGeneral(xmlNode* node)
         {
             locale_ = AsUnicode(GetXmlNodeTextContent(child));
         }
+        else if (std::string("chatlog") == child->name)
+        {
+            ParseChatLog(child);
+        }
+        else if (std::string("scrollback") == child->name)
+        {
+            ParseScrollback(child);
+        }
+        else if (std::string("searchindex") == child->name)
+        {
+            searchIndexDirectory_ = AsUnicode(GetXmlNodeTextContent(child));
+        }
+        else if (std::string("lastseen") == child->name)
+        {
+            lastSeenFilename_ = AsUnicode(GetXmlNodeTextContent(child));
+            try
+            {
+                lastSeenInterval_ = ParseInterval(
+                    GetXmlNodeAttribute(child, "interval"), false);
+            } catch (Exception&)
+            {
+            } catch (boost::bad_lexical_cast&)
+            {
+                throw Exception(__FILE__, __LINE__,
+                                "Invalid last seen interval in configuration");
+            }
+        }
+        else if (std::string("channelstats") == child->name)
+        {
+            channelStatisticsFilename_ =
+                AsUnicode(GetXmlNodeTextContent(child));
+            try
+            {
+                channelStatisticsInterval_ = ParseInterval(
+                    GetXmlNodeAttribute(child, "interval"), false);
+            } catch (Exception&)
+            {
+            } catch (boost::bad_lexical_cast&)
+            {
+                throw Exception(__FILE__, __LINE__,
+                    "Invalid channel statistics interval in configuration");
+            }
+        }
+    }
+}
+
+void Config::ParseChatLog(xmlNode* node)
+{
+    try
+    {
+        std::string value;
+        try
+        {
+            value = GetXmlNodeAttribute(node, "flush");
+            chatLog_.FlushInterval = ParseInterval(value, false);
+        } catch (Exception&)
+        {
+        }
+        try
+        {
+            value = GetXmlNodeAttribute(node, "syncinterval");
+            chatLog_.SyncInterval = ParseInterval(value, false);
+        } catch (Exception&)
+        {
+        }
+        try
+        {
+            value = GetXmlNodeAttribute(node, "files");
+            chatLog_.MaxOpenFiles = boost::lexical_cast<unsigned int>(value);
+        } catch (Exception&)
+        {
+        }
+        try
+        {
+            value = GetXmlNodeAttribute(node, "idle");
+            chatLog_.IdleTimeout = ParseInterval(value, false);
+        } catch (Exception&)
+        {
+        }
+        try
+        {
+            value = GetXmlNodeAttribute(node, "segmentsize");
+            chatLog_.SegmentSize = boost::lexical_cast<unsigned int>(value);
+        } catch (Exception&)
+        {
+        }
+        try
+        {
+            value = GetXmlNodeAttribute(node, "segmentage");
+            chatLog_.SegmentAge = ParseInterval(value, true);
+        } catch (Exception&)
+        {
+        }
+    } catch (boost::bad_lexical_cast&)
+    {
+        throw Exception(__FILE__, __LINE__,
+                        "Invalid chat log settings in configuration");
+    }
+
+    std::string sync;
+    try
+    {
+        sync = GetXmlNodeAttribute(node, "sync");
+    } catch (Exception&)
+    {
+        return;
+    }
+    if (!SyncPolicy::FromString(sync, chatLog_.Sync))
+    {
+        throw Exception(__FILE__, __LINE__,
+                        ("Invalid chat log sync policy '" + sync
+                         + "' in configuration").c_str());
+    }
+}
+
+void Config::ParseScrollback(xmlNode* node)
+{
+    try
+    {
+        std::string value;
+        try
+        {
+            value = GetXmlNodeAttribute(node, "lines");
+            scrollbackLimits_.Lines = boost::lexical_cast<unsigned int>(value);
+        } catch (Exception&)
+        {
+        }
+        try
+        {
+            value = GetXmlNodeAttribute(node, "channelsize");
+            scrollbackLimits_.ChannelSize =
+                boost::lexical_cast<unsigned int>(value);
+        } catch (Exception&)
+        {
+        }
+        try
+        {
+            value = GetXmlNodeAttribute(node, "size");
+            scrollbackLimits_.Size = boost::lexical_cast<unsigned int>(value);
+        } catch (Exception&)
+        {
+        }
+    } catch (boost::bad_lexical_cast&)
+    {
+        throw Exception(__FILE__, __LINE__,
+                        "Invalid scrollback settings in configuration");
     }
 }
 
@@ -124,6 +332,11 @@ void Config::ParseServers(xmlNode* node)
             }
 
             Server::ChannelContainer channels;
+            Server::FloodControl floodControl;
+            Server::HostContainer fallbackHosts;
+            Server::LagControl lagControl;
+            Server::KeepAlive keepAlive;
+            Server::NetsplitControl netsplitControl;
 
             for (xmlNodePtr subChild = child->children; subChild; subChild
                     = subChild->next)
@@ -132,6 +345,26 @@ void Config::ParseServers(xmlNode* node)
                 {
                     nick = AsUnicode(GetXmlNodeTextContent(subChild));
                 }
+                else if (std::string("flood") == subChild->name)
+                {
+                    ParseFloodControl(subChild, rawId, floodControl);
+                }
+                else if (std::string("lag") == subChild->name)
+                {
+                    ParseLagControl(subChild, rawId, lagControl);
+                }
+                else if (std::string("keepalive") == subChild->name)
+                {
+                    ParseKeepAlive(subChild, rawId, keepAlive);
+                }
+                else if (std::string("netsplit") == subChild->name)
+                {
+                    ParseNetsplitControl(subChild, rawId, netsplitControl);
+                }
+                else if (std::string("fallback") == subChild->name)
+                {
+                    ParseFallbackHost(subChild, rawId, port, fallbackHosts);
+                }
                 else if (std::string("channels") == subChild->name)
                 {
                     for (xmlNodePtr channel = subChild->children; channel; channel
@@ -165,11 +398,241 @@ void Config::ParseServers(xmlNode* node)
             {
                 server.AddChannel(i->first, i->second);
             }
+            for (Server::HostIterator i = fallbackHosts.begin(); i
+                    != fallbackHosts.end(); ++i)
+            {
+                server.AddFallbackHost(i->first, i->second);
+            }
+            server.SetFloodControl(floodControl);
+            server.SetLagControl(lagControl);
+            server.SetKeepAlive(keepAlive);
+            server.SetNetsplitControl(netsplitControl);
             servers_.push_back(server);
         }
     }
 }
 
+void Config::ParseFloodControl(xmlNode* node, const std::string& serverId,
+                               Server::FloodControl& floodControl)
+{
+    try
+    {
+        std::string value;
+        try
+        {
+            value = GetXmlNodeAttribute(node, "lines");
+            floodControl.LinesPerSecond = boost::lexical_cast<double>(value);
+        } catch (Exception&)
+        {
+        }
+        try
+        {
+            value = GetXmlNodeAttribute(node, "bytes");
+            floodControl.BytesPerSecond = boost::lexical_cast<double>(value);
+        } catch (Exception&)
+        {
+        }
+        try
+        {
+            value = GetXmlNodeAttribute(node, "burstlines");
+            floodControl.BurstLines = boost::lexical_cast<unsigned int>(value);
+        } catch (Exception&)
+        {
+        }
+        try
+        {
+            value = GetXmlNodeAttribute(node, "burstbytes");
+            floodControl.BurstBytes = boost::lexical_cast<unsigned int>(value);
+        } catch (Exception&)
+        {
+        }
+    } catch (boost::bad_lexical_cast&)
+    {
+        throw Exception(__FILE__, __LINE__,
+                        ("Invalid flood control in configuration for server "
+                         + serverId).c_str());
+    }
+    // A bucket that is refilled but never holds a whole token lets nothing
+    // out and the bot goes silent
+    if (!(floodControl.LinesPerSecond >= 0)
+        || !(floodControl.BytesPerSecond >= 0)
+        || (floodControl.LinesPerSecond > 0 && floodControl.BurstLines < 1)
+        || (floodControl.BytesPerSecond > 0 && floodControl.BurstBytes < 1))
+    {
+        throw Exception(__FILE__, __LINE__,
+                        ("Invalid flood control in configuration for server "
+                         + serverId).c_str());
+    }
+}
+
+void Config::ParseLagControl(xmlNode* node, const std::string& serverId,
+                             Server::LagControl& lagControl)
+{
+    try
+    {
+        std::string value;
+        try
+        {
+            value = GetXmlNodeAttribute(node, "ping");
+            lagControl.PingInterval = ParseInterval(value, true);
+        } catch (Exception&)
+        {
+        }
+        try
+        {
+            value = GetXmlNodeAttribute(node, "max");
+            lagControl.MaxLag = ParseInterval(value, false);
+        } catch (Exception&)
+        {
+        }
+    } catch (boost::bad_lexical_cast&)
+    {
+        throw Exception(__FILE__, __LINE__,
+                        ("Invalid lag control in configuration for server "
+                         + serverId).c_str());
+    }
+}
+
+void Config::ParseKeepAlive(xmlNode* node, const std::string& serverId,
+                            Server::KeepAlive& keepAlive)
+{
+    try
+    {
+        std::string value;
+        try
+        {
+            value = GetXmlNodeAttribute(node, "idle");
+            keepAlive.Idle = boost::lexical_cast<unsigned int>(value);
+        } catch (Exception&)
+        {
+        }
+        try
+        {
+            value = GetXmlNodeAttribute(node, "interval");
+            keepAlive.Interval = boost::lexical_cast<unsigned int>(value);
+        } catch (Exception&)
+        {
+        }
+        try
+        {
+            value = GetXmlNodeAttribute(node, "probes");
+            keepAlive.Probes = boost::lexical_cast<unsigned int>(value);
+        } catch (Exception&)
+        {
+        }
+        try
+        {
+            value = GetXmlNodeAttribute(node, "usertimeout");
+            keepAlive.UserTimeout = ParseInterval(value, true);
+        } catch (Exception&)
+        {
+        }
+    } catch (boost::bad_lexical_cast&)
+    {
+        throw Exception(__FILE__, __LINE__,
+                        ("Invalid keepalive in configuration for server "
+                         + serverId).c_str());
+    }
+}
+
+void Config::ParseNetsplitControl(xmlNode* node, const std::string& serverId,
+                                  Server::NetsplitControl& netsplitControl)
+{
+    try
+    {
+        std::string value;
+        try
+        {
+            value = GetXmlNodeAttribute(node, "window");
+            netsplitControl.BurstWindow = ParseInterval(value, true);
+        } catch (Exception&)
+        {
+        }
+        try
+        {
+            value = GetXmlNodeAttribute(node, "netjoin");
+            netsplitControl.NetjoinWindow = ParseInterval(value, true);
+        } catch (Exception&)
+        {
+        }
+    } catch (boost::bad_lexical_cast&)
+    {
+        throw Exception(__FILE__, __LINE__,
+                        ("Invalid netsplit control in configuration for server "
+                         + serverId).c_str());
+    }
+}
+
+void Config::ParseFallbackHost(xmlNode* node, const std::string& serverId,
+                               unsigned int defaultPort,
+                               Server::HostContainer& fallbackHosts)
+{
+    UnicodeString host = AsUnicode(GetXmlNodeAttribute(node, "host"));
+    unsigned int port = defaultPort;
+    try
+    {
+        port = boost::lexical_cast<unsigned int>(GetXmlNodeAttribute(node,
+            "port"));
+    }
+    catch (Exception&)
+    {
+        // Same port as the main host
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+        throw Exception(__FILE__, __LINE__,
+                        ("Invalid fallback port in configuration for server "
+                         + serverId).c_str());
+    }
+    fallbackHosts.push_back(Server::HostAndPort(host, port));
+}
+
+Config::Server::FloodControl::FloodControl()
+    : LinesPerSecond(DEFAULT_FLOOD_LINES_PER_SECOND)
+    , BytesPerSecond(0)
+    , BurstLines(DEFAULT_FLOOD_BURST_LINES)
+    , BurstBytes(0)
+{
+}
+
+Config::Server::LagControl::LagControl()
+    : PingInterval(DEFAULT_PING_INTERVAL)
+    , MaxLag(DEFAULT_MAX_LAG)
+{
+}
+
+Config::Server::KeepAlive::KeepAlive()
+    : Idle(0)
+    , Interval(0)
+    , Probes(0)
+    , UserTimeout(0)
+{
+}
+
+Config::Server::NetsplitControl::NetsplitControl()
+    : BurstWindow(DEFAULT_BURST_WINDOW)
+    , NetjoinWindow(DEFAULT_NETJOIN_WINDOW)
+{
+}
+
+Config::ChatLog::ChatLog()
+    : FlushInterval(DEFAULT_CHATLOG_FLUSH_INTERVAL)
+    , Sync(SyncPolicy::Never)
+    , SyncInterval(DEFAULT_CHATLOG_SYNC_INTERVAL)
+    , MaxOpenFiles(DEFAULT_CHATLOG_MAX_OPEN_FILES)
+    , IdleTimeout(DEFAULT_CHATLOG_IDLE_TIMEOUT)
+    , SegmentSize(DEFAULT_CHATLOG_SEGMENT_SIZE)
+    , SegmentAge(DEFAULT_CHATLOG_SEGMENT_AGE)
+{
+}
+
+Config::ScrollbackLimits::ScrollbackLimits()
+    : Lines(DEFAULT_SCROLLBACK_LINES)
+    , ChannelSize(DEFAULT_SCROLLBACK_CHANNEL_SIZE)
+    , Size(DEFAULT_SCROLLBACK_SIZE)
+{
+}
+
 Config::Server::Server() :
     port_(0)
 {
@@ -194,3 +657,8 @@ void Config::Server::AddChannel(const std::string& name, const UnicodeString& ke
 {
     channels_.push_back(ChannelAndKey(name, key));
 }
+
+void Config::Server::AddFallbackHost(const UnicodeString& host, unsigned int port)
+{
+    fallbackHosts_.push_back(HostAndPort(host, port));
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "chatlogwriter.hpp"
+
 #include <string>
 #include <vector>
 
@@ -29,6 +31,89 @@ public:
                const UnicodeString& password);
 
         void AddChannel(const std::string& name, const UnicodeString& key);
+        void AddFallbackHost(const UnicodeString& host, unsigned int port);
+
+        // Limits on outgoing traffic, a rate of zero means no limit
+        struct FloodControl
+        {
+            FloodControl();
+
+            double LinesPerSecond;
+            double BytesPerSecond;
+            unsigned int BurstLines;
+            unsigned int BurstBytes;
+        };
+
+        // Our own PINGs to measure the lag, times in seconds. An interval
+        // of zero turns them off.
+        struct LagControl
+        {
+            LagControl();
+
+            double PingInterval;
+            // Reconnect when a PONG is later than this
+            double MaxLag;
+        };
+
+        // TCP level detection of dead connections, zero leaves the system
+        // default in place
+        struct KeepAlive
+        {
+            KeepAlive();
+
+            unsigned int Idle;
+            unsigned int Interval;
+            unsigned int Probes;
+            double UserTimeout;
+        };
+
+        // Netsplits and netjoins handled as one event, times in seconds. A
+        // burst window of zero handles every QUIT and JOIN by itself.
+        struct NetsplitControl
+        {
+            NetsplitControl();
+
+            // A burst ends when no line has been added to it for this long
+            double BurstWindow;
+            // How long after a split JOINs of the nicks that left are taken
+            // as the netjoin
+            double NetjoinWindow;
+        };
+
+        void SetLagControl(const LagControl& lagControl)
+        {
+            lagControl_ = lagControl;
+        }
+        const LagControl& GetLagControl() const
+        {
+            return lagControl_;
+        }
+        void SetKeepAlive(const KeepAlive& keepAlive)
+        {
+            keepAlive_ = keepAlive;
+        }
+        const KeepAlive& GetKeepAlive() const
+        {
+            return keepAlive_;
+        }
+
+        void SetNetsplitControl(const NetsplitControl& netsplitControl)
+        {
+            netsplitControl_ = netsplitControl;
+        }
+        const NetsplitControl& GetNetsplitControl() const
+        {
+            return netsplitControl_;
+        }
+
+        void SetFloodControl(const FloodControl& floodControl)
+        {
+            floodControl_ = floodControl;
+        }
+        const FloodControl& GetFloodControl() const
+        {
+            return floodControl_;
+        }
 
         Type GetServerType() const
         {
@@ -68,6 +153,20 @@ public:
             return channels_.end();
         }
 
+        // Hosts raced against the main one, the first to answer is used
+        typedef std::pair<UnicodeString, unsigned int> HostAndPort;
+        typedef std::vector<HostAndPort> HostContainer;
+        typedef HostContainer::const_iterator HostIterator;
+
+        HostIterator GetFallbackHostsBegin() const
+        {
+            return fallbackHosts_.begin();
+        }
+        HostIterator GetFallbackHostsEnd() const
+        {
+            return fallbackHosts_.end();
+        }
+
     private:
         Type type_;
         UnicodeString id_;
@@ -76,8 +175,83 @@ public:
         UnicodeString nick_;
         UnicodeString password_;
         ChannelContainer channels_;
+        HostContainer fallbackHosts_;
+        FloodControl floodControl_;
+        LagControl lagControl_;
+        KeepAlive keepAlive_;
+        NetsplitControl netsplitControl_;
     };
 
+    // How the chat logs are written, times in seconds
+    struct ChatLog
+    {
+        ChatLog();
+
+        // Longest time a line waits before it is written
+        double FlushInterval;
+        SyncPolicy::SyncPolicy Sync;
+        double SyncInterval;
+        // Files kept open at most, the least recently written is closed
+        unsigned int MaxOpenFiles;
+        // Files nobody has written to for this long are closed, zero
+        // keeps them open
+        double IdleTimeout;
+        // Live segments are closed at this many megabytes or this age,
+        // zero for both keeps each log in one file
+        unsigned int SegmentSize;
+        double SegmentAge;
+    };
+
+    const ChatLog& GetChatLog() const
+    {
+        return chatLog_;
+    }
+
+    // How much of each channel is kept in memory, sizes in kilobytes
+    struct ScrollbackLimits
+    {
+        ScrollbackLimits();
+
+        // Lines of each channel, zero keeps none
+        unsigned int Lines;
+        // Text of each channel
+        unsigned int ChannelSize;
+        // Everything for all channels together
+        unsigned int Size;
+    };
+
+    const ScrollbackLimits& GetScrollbackLimits() const
+    {
+        return scrollbackLimits_;
+    }
+
+    // Where the last line of each nick is saved, and how often in seconds.
+    // An empty file is the default in the logs directory.
+    const UnicodeString& GetLastSeenFilename() const
+    {
+        return lastSeenFilename_;
+    }
+    double GetLastSeenInterval() const
+    {
+        return lastSeenInterval_;
+    }
+    // Where the channel statistics are saved, and how often in seconds.
+    // An empty file is the default in the logs directory.
+    const UnicodeString& GetChannelStatisticsFilename() const
+    {
+        return channelStatisticsFilename_;
+    }
+    double GetChannelStatisticsInterval() const
+    {
+        return channelStatisticsInterval_;
+    }
+    // Where the full text index of the logs is kept, empty for the default
+    // in the logs directory
+    const UnicodeString& GetSearchIndexDirectory() const
+    {
+        return searchIndexDirectory_;
+    }
+
     typedef std::vector<Server> ServerContainer;
     typedef ServerContainer::const_iterator ServerIterator;
 
@@ -117,7 +291,20 @@ public:
 
 private:
     void ParseGeneral(xmlNode* node);
+    void ParseChatLog(xmlNode* node);
+    void ParseScrollback(xmlNode* node);
     void ParseServers(xmlNode* node);
+    void ParseFloodControl(xmlNode* node, const std::string& serverId,
+                           Server::FloodControl& floodControl);
+    void ParseLagControl(xmlNode* node, const std::string& serverId,
+                         Server::LagControl& lagControl);
+    void ParseKeepAlive(xmlNode* node, const std::string& serverId,
+                        Server::KeepAlive& keepAlive);
+    void ParseNetsplitControl(xmlNode* node, const std::string& serverId,
+                              Server::NetsplitControl& netsplitControl);
+    void ParseFallbackHost(xmlNode* node, const std::string& serverId,
+                           unsigned int defaultPort,
+                           Server::HostContainer& fallbackHosts);
 
     UnicodeString path_;
     UnicodeString scriptsDirectory_;
@@ -126,5 +313,12 @@ private:
     UnicodeString remindersFilename_;
     UnicodeString namedPipeName_;
     UnicodeString locale_;
+    ChatLog chatLog_;
+    ScrollbackLimits scrollbackLimits_;
+    UnicodeString lastSeenFilename_;
+    double lastSeenInterval_;
+    UnicodeString channelStatisticsFilename_;
+    double channelStatisticsInterval_;
+    UnicodeString searchIndexDirectory_;
     std::vector<Server> servers_;
 };
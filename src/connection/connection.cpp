@@ -7,95 +7,188 @@
 #include <limits>
 #include <sstream>
 
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
 #include <boost/weak_ptr.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/bind.hpp>
 #include <boost/algorithm/string/regex.hpp>
 #include <boost/regex.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 const time_t CONNECTION_TIMEOUT_SECONDS = 300;
-// Number of seconds before attempting a new reconnect
+// Number of seconds to wait before attempting a new reconnect
 const int RECONNECT_TIMEOUT = 30;
 
-Connection::Connection() :
-	socket_(ioService_), timer_(ioService_), port_(0), lastReception_(0),
-			connected_(false), run_(true)
+static long ElapsedMilliseconds(const boost::posix_time::ptime& since)
+{
+	return (boost::posix_time::microsec_clock::universal_time() - since)
+			.total_milliseconds();
+}
 
+static std::string PortToString(unsigned short port)
 {
-	boost::lock_guard<boost::mutex> lock(constructorMutex_);
-	thread_.reset(new boost::thread(boost::bind(&Connection::Loop, this)));
+	// Convert port number to string and remove all non-digits from the
+	// string. Certain locales will insert non-digits in numeric strings
+	return boost::erase_all_regex_copy(boost::lexical_cast<std::string>(
+			port), boost::regex("[^[:digit:]]"));
 }
 
-Connection::Connection(const UnicodeString& host, const unsigned short port) :
-	socket_(ioService_), timer_(ioService_), port_(0), lastReception_(0),
-			connected_(false), run_(true)
+static void SetSocketOption(int socket, int level, int option, int value,
+		const char* name)
 {
-	boost::lock_guard<boost::mutex> lock(constructorMutex_);
-	thread_.reset(new boost::thread(boost::bind(&Connection::Loop, this)));
-	Connect(host, port);
+	if (setsockopt(socket, level, option, &value, sizeof(value)) != 0)
+	{
+		Log << LogLevel::Warning << "Unable to set " << name << ": "
+				<< strerror(errno);
+	}
 }
 
-Connection::~Connection()
+static void ApplyKeepAlive(boost::asio::ip::tcp::socket& socket,
+		const Connection::KeepAlive& keepAlive)
 {
-	boost::lock_guard<boost::mutex> lock(constructorMutex_);
+	int handle = socket.native_handle();
+	if (keepAlive.IdleSeconds > 0)
 	{
-		boost::lock_guard<boost::mutex> lock(socketMutex_);
-		boost::system::error_code error;
-		socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, error);
-		socket_.close(error);
+		SetSocketOption(handle, SOL_SOCKET, SO_KEEPALIVE, 1, "SO_KEEPALIVE");
+		SetSocketOption(handle, IPPROTO_TCP, TCP_KEEPIDLE,
+				keepAlive.IdleSeconds, "TCP_KEEPIDLE");
+		if (keepAlive.IntervalSeconds > 0)
+		{
+			SetSocketOption(handle, IPPROTO_TCP, TCP_KEEPINTVL,
+					keepAlive.IntervalSeconds, "TCP_KEEPINTVL");
+		}
+		if (keepAlive.Probes > 0)
+		{
+			SetSocketOption(handle, IPPROTO_TCP, TCP_KEEPCNT, keepAlive.Probes,
+					"TCP_KEEPCNT");
+		}
 	}
+#ifdef TCP_USER_TIMEOUT
+	if (keepAlive.UserTimeoutMilliseconds > 0)
 	{
-		boost::unique_lock<boost::mutex> lock(workAvailableMutex_);
-		run_ = false;
-		workAvailable_.notify_all();
-		// Wait for the loop to signal that it's done and then join with that thread to make
-		// absolutely sure it finished in an orderly manner.
-		workAvailable_.wait(lock);
-		thread_->join();
+		SetSocketOption(handle, IPPROTO_TCP, TCP_USER_TIMEOUT,
+				keepAlive.UserTimeoutMilliseconds, "TCP_USER_TIMEOUT");
 	}
+#endif
 }
 
-void Connection::Connect(const UnicodeString& host, const unsigned short port)
+static unsigned long long GetThreadCpuMicroseconds()
 {
-	try
+	timespec cpuTime;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuTime) != 0)
 	{
-		host_ = host;
-		port_ = port;
+		return 0;
+	}
+	return static_cast<unsigned long long> (cpuTime.tv_sec) * 1000000
+			+ cpuTime.tv_nsec / 1000;
+}
+
+Connection::Connection() :
+	ioService_(IoServicePool::Instance().GetIoService()), strand_(ioService_),
+			socket_(ioService_), timer_(ioService_), reconnectTimer_(
+					ioService_), closing_(false), buffer_(RECEIVE_BUFFER_SIZE,
+					MAX_RECEIVE_LINE_LENGTH), attemptTimer_(ioService_),
+			attemptTimerArmed_(false), connectGeneration_(0),
+			resolvesPending_(0), preferIpv6_(true), port_(0),
+			lastReception_(0),
+			connected_(false), linesInFlight_(0), writing_(false),
+			maxSendQueueLines_(MAX_SEND_QUEUE_LINES), overflowPolicy_(
+					RejectNewest)
+{
+	statistics_.Wakeups = 0;
+	statistics_.CpuMicroseconds = 0;
+	statistics_.DroppedLines = 0;
+	keepAlive_.IdleSeconds = 0;
+	keepAlive_.IntervalSeconds = 0;
+	keepAlive_.Probes = 0;
+	keepAlive_.UserTimeoutMilliseconds = 0;
+}
+
+Connection::Connection(const UnicodeString& host, const unsigned short port) :
+	ioService_(IoServicePool::Instance().GetIoService()), strand_(ioService_),
+			socket_(ioService_), timer_(ioService_), reconnectTimer_(
+					ioService_), closing_(false), buffer_(RECEIVE_BUFFER_SIZE,
+					MAX_RECEIVE_LINE_LENGTH), attemptTimer_(ioService_),
+			attemptTimerArmed_(false), connectGeneration_(0),
+			resolvesPending_(0), preferIpv6_(true), port_(0),
+			lastReception_(0),
+			connected_(false), linesInFlight_(0), writing_(false),
+			maxSendQueueLines_(MAX_SEND_QUEUE_LINES), overflowPolicy_(
+					RejectNewest)
+{
+	statistics_.Wakeups = 0;
+	statistics_.CpuMicroseconds = 0;
+	statistics_.DroppedLines = 0;
+	keepAlive_.IdleSeconds = 0;
+	keepAlive_.IntervalSeconds = 0;
+	keepAlive_.Probes = 0;
+	keepAlive_.UserTimeoutMilliseconds = 0;
+	Connect(host, port);
+}
 
+Connection::~Connection()
+{
+	{
+		boost::lock_guard<boost::mutex> lock(socketMutex_);
+		closing_ = true;
 		boost::system::error_code error;
 		socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, error);
 		socket_.close(error);
+		timer_.cancel(error);
+		reconnectTimer_.cancel(error);
+		CancelConnectAttempts();
+	}
+	// The handlers are bound to this object so wait for the pool to run the
+	// ones that are still queued before we go away.
+	pending_.WaitForAll();
 
-		// Convert port number to string and remove all non-digits from the
-		// string. Certain locales will insert non-digits in numeric strings
-		std::string portString = boost::erase_all_regex_copy(
-				boost::lexical_cast<std::string>(port_), boost::regex(
-						"[^[:digit:]]"));
-		Log << LogLevel::Info << "Connecting to " << host_ << ":" << portString
-				<< "...";
-		// Create a resolver and a query for the supplied host and port
-		using namespace boost::asio::ip;
-		tcp::resolver resolver(ioService_);
-		tcp::resolver::query query(AsUtf8(host_), portString);
+	Statistics statistics = GetStatistics();
+	Log << LogLevel::Info << "Connection to " << host_ << ":" << port_
+			<< " closed after " << statistics.Wakeups << " wakeups using "
+			<< statistics.CpuMicroseconds << " us CPU";
+}
 
-		tcp::resolver::iterator endpointIt = resolver.resolve(query);
-		tcp::endpoint endpoint = *endpointIt;
-		socket_.async_connect(endpoint, boost::bind(&Connection::OnConnect,
-				this, boost::asio::placeholders::error, ++endpointIt));
-		workAvailable_.notify_all();
-	} catch (boost::bad_lexical_cast& e)
+void Connection::Connect(const UnicodeString& host, const unsigned short port)
+{
+	Connect(HostContainer(1, Host(host, port)));
+}
+
+void Connection::Connect(const HostContainer& hosts)
+{
+	if (hosts.empty())
 	{
-		throw Exception(__FILE__, __LINE__, e.what());
-	} catch (std::exception& e)
+		throw Exception(__FILE__, __LINE__, "No host to connect to");
+	}
+	boost::unique_lock<boost::mutex> lock(socketMutex_);
+	if (closing_)
 	{
-		throw Exception(__FILE__, __LINE__, e.what());
+		return;
 	}
+	hosts_ = hosts;
+	host_ = hosts.front().first;
+	port_ = hosts.front().second;
+	// The resolvers and sockets may only be used from within the strand
+	pending_.Begin();
+	strand_.post(boost::bind(&Connection::OnStartConnect, this));
+	lock.unlock();
+	OnDisconnect();
 }
 
 void Connection::Reconnect()
 {
-	assert(port_ != 0 && !host_.isEmpty());
-	Connect(host_, port_);
+	HostContainer hosts;
+	{
+		boost::lock_guard<boost::mutex> lock(socketMutex_);
+		hosts = hosts_;
+	}
+	assert(!hosts.empty());
+	Connect(hosts);
 }
 
 Connection::ReceiverHandle Connection::RegisterReceiver(Receiver r)
@@ -106,33 +199,60 @@ Connection::ReceiverHandle Connection::RegisterReceiver(Receiver r)
 	return handle;
 }
 
-void Connection::Send(const std::vector<char>& data)
+void Connection::Send(boost::string_ref line)
 {
 	boost::lock_guard<boost::mutex> lock(sendMutex_);
-	if (socket_.is_open() && *connected_)
+	if (!*connected_)
+	{
+		throw Exception(__FILE__, __LINE__,
+				"Attempting to send on invalid connection");
+	}
+
+	if (sendQueue_.size() >= maxSendQueueLines_)
 	{
-		try
 		{
-			std::size_t bytes = boost::asio::write(socket_,
-					boost::asio::buffer(data));
-			if (bytes != data.size())
-			{
-				Log << LogLevel::Error << "Unable to write on connection";
-				throw Exception(__FILE__, __LINE__,
-						"Unable to send the correct amount of data");
-			}
-		} catch (boost::system::system_error& e)
+			boost::lock_guard<boost::mutex> lock(statisticsMutex_);
+			++statistics_.DroppedLines;
+		}
+		if (overflowPolicy_ != DropOldest || sendQueue_.size()
+				<= linesInFlight_)
 		{
-			throw Exception(__FILE__, __LINE__, e.what());
+			throw Exception(__FILE__, __LINE__, "Send queue is full");
 		}
+		SendQueue::iterator oldest = sendQueue_.begin();
+		std::advance(oldest, linesInFlight_);
+		sendQueue_.erase(oldest);
 	}
-	else
+
+	sendQueue_.push_back(std::string());
+	std::string& data = sendQueue_.back();
+	data.reserve(line.size() + 2);
+	data.append(line.begin(), line.end());
+	data += "\r\n";
+
+	if (!writing_)
 	{
-		throw Exception(__FILE__, __LINE__,
-				"Attempting to send on invalid connection");
+		// The socket may only be used from within the strand
+		writing_ = true;
+		pending_.Begin();
+		strand_.post(boost::bind(&Connection::OnStartWrite, this));
 	}
 }
 
+void Connection::SetSendQueuePolicy(std::size_t maxLines,
+		OverflowPolicy policy)
+{
+	boost::lock_guard<boost::mutex> lock(sendMutex_);
+	maxSendQueueLines_ = maxLines;
+	overflowPolicy_ = policy;
+}
+
+void Connection::SetKeepAlive(const KeepAlive& keepAlive)
+{
+	boost::lock_guard<boost::mutex> lock(socketMutex_);
+	keepAlive_ = keepAlive;
+}
+
 Connection::OnConnectHandle Connection::RegisterOnConnectCallback(
 		OnConnectCallback c)
 {
@@ -142,6 +262,15 @@ Connection::OnConnectHandle Connection::RegisterOnConnectCallback(
 	return handle;
 }
 
+Connection::OnConnectHandle Connection::RegisterOnDisconnectCallback(
+		OnConnectCallback c)
+{
+	OnConnectHandle handle(new OnConnectCallback(c));
+	boost::upgrade_lock<boost::shared_mutex> lock(callbacksMutex_);
+	onDisconnectCallbacks_.push_back(OnConnectCallbackPtr(handle));
+	return handle;
+}
+
 bool Connection::IsTimedOut() const
 {
 	return lastReception_ + CONNECTION_TIMEOUT_SECONDS <= time(0);
@@ -152,58 +281,355 @@ bool Connection::IsConnected() const
 	return *connected_;
 }
 
-void Connection::OnConnect(const boost::system::error_code& error,
-		boost::asio::ip::tcp::resolver::iterator endpointIt)
+Connection::Statistics Connection::GetStatistics() const
 {
-	if (!error)
+	Statistics statistics;
 	{
-		connected_ = true;
-		lastReception_ = time(0);
+		boost::lock_guard<boost::mutex> lock(statisticsMutex_);
+		statistics = statistics_;
+	}
+	boost::lock_guard<boost::mutex> lock(sendMutex_);
+	statistics.QueuedLines = sendQueue_.size();
+	statistics.QueuedBytes = 0;
+	statistics.BytesInFlight = 0;
+	std::size_t line = 0;
+	for (SendQueue::const_iterator data = sendQueue_.begin(); data
+			!= sendQueue_.end(); ++data, ++line)
+	{
+		statistics.QueuedBytes += data->size();
+		if (line < linesInFlight_)
+		{
+			statistics.BytesInFlight += data->size();
+		}
+	}
+	return statistics;
+}
+
+Connection::HandlerScope::HandlerScope(Connection& connection) :
+	connection_(connection), start_(GetThreadCpuMicroseconds())
+{
+}
+
+Connection::HandlerScope::~HandlerScope()
+{
+	unsigned long long cpuTime = GetThreadCpuMicroseconds() - start_;
+	{
+		boost::lock_guard<boost::mutex> lock(connection_.statisticsMutex_);
+		++connection_.statistics_.Wakeups;
+		connection_.statistics_.CpuMicroseconds += cpuTime;
+	}
+	// Must be last, the connection may be destroyed as soon as this is done
+	connection_.pending_.End();
+}
+
+void Connection::OnStartConnect()
+{
+	HandlerScope scope(*this);
+	boost::lock_guard<boost::mutex> lock(socketMutex_);
+	if (closing_)
+	{
+		return;
+	}
+	// Forget about whatever an earlier connect was doing, a reconnect
+	// that was scheduled is this one
+	CancelConnectAttempts();
+	boost::system::error_code error;
+	reconnectTimer_.cancel(error);
+	socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, error);
+	socket_.close(error);
+	++connectGeneration_;
+	ipv6Candidates_.clear();
+	ipv4Candidates_.clear();
+	preferIpv6_ = true;
+	connectStarted_ = boost::posix_time::microsec_clock::universal_time();
+
+	using namespace boost::asio::ip;
+	resolvesPending_ = hosts_.size();
+	for (std::size_t i = 0; i < hosts_.size(); ++i)
+	{
+		std::string port = PortToString(hosts_[i].second);
+		Log << LogLevel::Info << "Connecting to " << hosts_[i].first << ":"
+				<< port << "...";
+		ResolverPtr resolver(new tcp::resolver(ioService_));
+		resolvers_.push_back(resolver);
+		tcp::resolver::query query(AsUtf8(hosts_[i].first), port);
+		pending_.Begin();
+		resolver->async_resolve(query, strand_.wrap(boost::bind(
+				&Connection::OnResolve, this, _1, _2, resolver,
+				connectGeneration_, i)));
+	}
+}
+
+void Connection::OnResolve(const boost::system::error_code& error,
+		boost::asio::ip::tcp::resolver::iterator endpointIt,
+		ResolverPtr /*resolver*/, unsigned int generation,
+		std::size_t hostIndex)
+{
+	HandlerScope scope(*this);
+	bool failed = false;
+	{
+		boost::lock_guard<boost::mutex> lock(socketMutex_);
+		if (closing_ || generation != connectGeneration_)
+		{
+			return;
+		}
+		--resolvesPending_;
+
+		const Host& host = hosts_[hostIndex];
+		long elapsed = ElapsedMilliseconds(connectStarted_);
+		if (error)
+		{
+			Log << LogLevel::Warning << "Failed to resolve " << host.first
+					<< " after " << elapsed << " ms: " << error.message();
+		}
+		else
+		{
+			std::size_t addresses = 0;
+			for (; endpointIt != boost::asio::ip::tcp::resolver::iterator(); ++endpointIt)
+			{
+				boost::asio::ip::tcp::endpoint endpoint = *endpointIt;
+				if (endpoint.address().is_v6())
+				{
+					ipv6Candidates_.push_back(endpoint);
+				}
+				else
+				{
+					ipv4Candidates_.push_back(endpoint);
+				}
+				++addresses;
+			}
+			Log << LogLevel::Info << "Resolved " << host.first << " to "
+					<< addresses << " addresses in " << elapsed << " ms";
+		}
+
+		if (attempts_.empty())
+		{
+			StartConnectAttempt();
+		}
+		else if (!attemptTimerArmed_)
+		{
+			// Let the new addresses join the race that is already going on
+			ArmConnectAttemptTimer();
+		}
+		failed = attempts_.empty() && resolvesPending_ == 0;
+	}
+	if (failed)
+	{
+		Log << LogLevel::Error << "Failed to connect to " << host_ << ":"
+				<< port_ << ", no usable addresses";
+		ScheduleReconnect();
+	}
+}
+
+void Connection::StartConnectAttempt()
+{
+	// Alternate between the address families so that a broken IPv6 route
+	// costs one attempt delay rather than a timeout per address
+	std::deque<boost::asio::ip::tcp::endpoint>* candidates = 0;
+	if (!ipv6Candidates_.empty() && (preferIpv6_ || ipv4Candidates_.empty()))
+	{
+		candidates = &ipv6Candidates_;
+		preferIpv6_ = false;
+	}
+	else if (!ipv4Candidates_.empty())
+	{
+		candidates = &ipv4Candidates_;
+		preferIpv6_ = true;
+	}
+	else
+	{
+		return;
+	}
+	boost::asio::ip::tcp::endpoint endpoint = candidates->front();
+	candidates->pop_front();
+
+	Log << LogLevel::Debug << "Trying " << endpoint.address().to_string()
+			<< " for " << host_;
+	SocketPtr socket(new boost::asio::ip::tcp::socket(ioService_));
+	attempts_.push_back(socket);
+	pending_.Begin();
+	socket->async_connect(endpoint, strand_.wrap(boost::bind(
+			&Connection::OnConnectAttempt, this, _1, socket, endpoint,
+			connectGeneration_)));
 
-		boost::shared_lock<boost::shared_mutex> lock(callbacksMutex_);
-		// Notify all OnConnect callbacks that the connection was successful
-		OnConnectCallbackContainer::iterator callback =
-				onConnectCallbacks_.begin();
-		while (callback != onConnectCallbacks_.end())
+	if (!ipv6Candidates_.empty() || !ipv4Candidates_.empty()
+			|| resolvesPending_ > 0)
+	{
+		ArmConnectAttemptTimer();
+	}
+}
+
+void Connection::ArmConnectAttemptTimer()
+{
+	// Setting the expiry time cancels any pending wait
+	attemptTimerArmed_ = true;
+	attemptTimer_.expires_from_now(boost::posix_time::milliseconds(
+			CONNECT_ATTEMPT_DELAY));
+	pending_.Begin();
+	attemptTimer_.async_wait(strand_.wrap(boost::bind(
+			&Connection::OnConnectAttemptTimer, this, _1, connectGeneration_)));
+}
+
+void Connection::OnConnectAttemptTimer(const boost::system::error_code& error,
+		unsigned int generation)
+{
+	HandlerScope scope(*this);
+	boost::lock_guard<boost::mutex> lock(socketMutex_);
+	if (error || closing_ || generation != connectGeneration_)
+	{
+		return;
+	}
+	attemptTimerArmed_ = false;
+	StartConnectAttempt();
+}
+
+void Connection::OnConnectAttempt(const boost::system::error_code& error,
+		SocketPtr socket, boost::asio::ip::tcp::endpoint endpoint,
+		unsigned int generation)
+{
+	HandlerScope scope(*this);
+	boost::system::error_code assignError;
+	{
+		boost::lock_guard<boost::mutex> lock(socketMutex_);
+		if (closing_ || generation != connectGeneration_
+				|| error == boost::asio::error::operation_aborted)
+		{
+			return;
+		}
+		attempts_.remove(socket);
+		if (error)
+		{
+			Log << LogLevel::Debug << "Failed to connect to "
+					<< endpoint.address().to_string() << ": "
+					<< error.message();
+			// Do not wait for the timer when we already know this one lost
+			StartConnectAttempt();
+			if (!attempts_.empty() || resolvesPending_ > 0)
+			{
+				return;
+			}
+		}
+		else
 		{
-			if ( OnConnectHandle onConnectCallback = callback->lock() )
+			// The others lost the race
+			CancelConnectAttempts();
+			boost::system::error_code cancelError;
+			reconnectTimer_.cancel(cancelError);
+			socket_.assign(endpoint.protocol(), socket->release(), assignError);
+			if (assignError)
 			{
-				(*onConnectCallback)(*this);
-				++callback;
+				Log << LogLevel::Error << "Failed to take over connection: "
+						<< assignError.message();
 			}
 			else
 			{
-				// If a callback is no longer valid we remove it
-				boost::upgrade_lock<boost::shared_mutex> lock(callbacksMutex_);
-				callback = onConnectCallbacks_.erase(callback);
+				ApplyKeepAlive(socket_, keepAlive_);
+				Log << LogLevel::Info << "Connected to " << host_ << ":"
+						<< port_ << " through "
+						<< endpoint.address().to_string() << " in "
+						<< ElapsedMilliseconds(connectStarted_) << " ms";
 			}
 		}
-		CreateReceiver();
-		Log << LogLevel::Info << "Connected to " << host_ << ":" << port_
-				<< "...";
 	}
-	else if (endpointIt != boost::asio::ip::tcp::resolver::iterator())
+	if (error)
 	{
-		boost::asio::ip::tcp::endpoint endpoint = *endpointIt;
-		socket_.async_connect(endpoint, boost::bind(&Connection::OnConnect,
-				this, boost::asio::placeholders::error, ++endpointIt));
+		Log << LogLevel::Error << "Failed to connect to " << host_ << ":"
+				<< port_ << ": " << error.message();
+		ScheduleReconnect();
+		return;
 	}
-	else
+	if (assignError)
 	{
-		Log << LogLevel::Error << "Failed to connect: " << error.message();
+		// Connected but the socket is of no use, try again
+		ScheduleReconnect();
+		return;
+	}
+	OnConnect(endpoint);
+}
+
+void Connection::CancelConnectAttempts()
+{
+	boost::system::error_code error;
+	for (std::list<SocketPtr>::iterator i = attempts_.begin(); i
+			!= attempts_.end(); ++i)
+	{
+		(*i)->close(error);
+	}
+	attempts_.clear();
+	for (std::vector<ResolverPtr>::iterator i = resolvers_.begin(); i
+			!= resolvers_.end(); ++i)
+	{
+		(*i)->cancel();
+	}
+	resolvers_.clear();
+	attemptTimer_.cancel(error);
+	attemptTimerArmed_ = false;
+	resolvesPending_ = 0;
+}
+
+void Connection::OnConnect(const boost::asio::ip::tcp::endpoint& /*endpoint*/)
+{
+	connected_ = true;
+	lastReception_ = time(0);
+
+	// Notify all OnConnect callbacks that the connection was successful
+	NotifyCallbacks(onConnectCallbacks_);
+	buffer_.Clear();
+	CreateReceiver();
+}
+
+void Connection::OnDisconnect()
+{
+	// Only the first one to notice tells about it
+	{
+		boost::lock_guard<boost::mutex> lock(socketMutex_);
+		if (!*connected_)
+		{
+			return;
+		}
+		connected_ = false;
+	}
+	NotifyCallbacks(onDisconnectCallbacks_);
+}
+
+void Connection::NotifyCallbacks(OnConnectCallbackContainer& callbacks)
+{
+	boost::shared_lock<boost::shared_mutex> lock(callbacksMutex_);
+	OnConnectCallbackContainer::iterator callback = callbacks.begin();
+	while (callback != callbacks.end())
+	{
+		if ( OnConnectHandle onConnectCallback = callback->lock() )
+		{
+			(*onConnectCallback)(*this);
+			++callback;
+		}
+		else
+		{
+			// If a callback is no longer valid we remove it
+			boost::upgrade_lock<boost::shared_mutex> lock(callbacksMutex_);
+			callback = callbacks.erase(callback);
+		}
 	}
 }
 
 void Connection::InitTimer()
 {
-	timer_.cancel();
+	boost::lock_guard<boost::mutex> lock(socketMutex_);
+	if (closing_)
+	{
+		return;
+	}
+	// Setting the expiry time cancels any pending wait
 	timer_.expires_from_now(boost::posix_time::seconds(
 			CONNECTION_TIMEOUT_SECONDS));
-	timer_.async_wait(boost::bind(&Connection::OnTimeOut, this, _1));
+	pending_.Begin();
+	timer_.async_wait(strand_.wrap(boost::bind(&Connection::OnTimeOut, this,
+			_1)));
 }
 
 void Connection::OnTimeOut(const boost::system::error_code& error)
 {
+	HandlerScope scope(*this);
 	if (!error)
 	{
 		CheckConnection();
@@ -213,67 +639,159 @@ void Connection::OnTimeOut(const boost::system::error_code& error)
 void Connection::CreateReceiver()
 {
 	boost::lock_guard<boost::mutex> lock(socketMutex_);
-	socket_.async_read_some(boost::asio::buffer(buffer_), boost::bind(
-			&Connection::Receive, this, _1, _2));
+	if (closing_)
+	{
+		return;
+	}
+	pending_.Begin();
+	socket_.async_read_some(buffer_.Prepare(), strand_.wrap(
+			boost::bind(&Connection::Receive, this, _1, _2)));
 }
 
 void Connection::Receive(const boost::system::error_code& error,
 		const std::size_t& bytes)
 {
+	HandlerScope scope(*this);
 	if (!error)
 	{
 		lastReception_ = time(0);
 		InitTimer();
 
-		std::vector<char> data(bytes);
-		std::copy(buffer_.begin(), buffer_.begin() + bytes, data.begin());
+		buffer_.Commit(bytes);
 
 		boost::shared_lock<boost::shared_mutex> lock(receiversMutex_);
-		for (ReceiverContainer::iterator i = receivers_.begin(); i
-				!= receivers_.end();)
+		boost::string_ref line;
+		while (buffer_.NextLine(line))
 		{
-			if ( boost::shared_ptr<Receiver> receiver = i->lock() )
+			for (ReceiverContainer::iterator i = receivers_.begin(); i
+					!= receivers_.end();)
 			{
-				(*receiver)(*this, data);
-				++i;
-			}
-			else
-			{
-				// If a receiver is no longer valid we remove it
-				boost::upgrade_lock<boost::shared_mutex> lock(receiversMutex_);
-				i = receivers_.erase(i);
+				if ( boost::shared_ptr<Receiver> receiver = i->lock() )
+				{
+					(*receiver)(*this, line);
+					++i;
+				}
+				else
+				{
+					// If a receiver is no longer valid we remove it
+					boost::upgrade_lock<boost::shared_mutex> lock(
+							receiversMutex_);
+					i = receivers_.erase(i);
+				}
 			}
 		}
+		lock.unlock();
 		CreateReceiver();
 	}
-	else
+	else if (error != boost::asio::error::operation_aborted)
 	{
 		Log << LogLevel::Error << "Connection::Receive: " << error.message();
-		ioService_.stop();
+		OnDisconnect();
+		ScheduleReconnect();
 	}
 }
 
-void Connection::Loop()
+void Connection::OnStartWrite()
 {
-	Log << LogLevel::Info << "Connection thread "
-			<< boost::this_thread::get_id() << " starting";
+	HandlerScope scope(*this);
+	boost::lock_guard<boost::mutex> lock(sendMutex_);
+	StartWrite();
+}
 
-	boost::unique_lock<boost::mutex> lock(workAvailableMutex_);
+void Connection::StartWrite()
+{
+	// Gather everything that is queued into one write, Linux will not take
+	// more than IOV_MAX buffers in one call so stay below that
+	const std::size_t maxBuffers = 64;
+	writeBuffers_.clear();
+	for (SendQueue::const_iterator data = sendQueue_.begin(); data
+			!= sendQueue_.end() && writeBuffers_.size() < maxBuffers; ++data)
+	{
+		writeBuffers_.push_back(boost::asio::buffer(*data));
+	}
+	linesInFlight_ = writeBuffers_.size();
 
-	while (run_)
+	boost::lock_guard<boost::mutex> lock(socketMutex_);
+	if (closing_ || linesInFlight_ == 0)
 	{
-		ioService_.run();
-		// If the service returns there's no work to do so check for timeouts
-		CheckConnection();
-		// Reset service flags so that it can be run again
-		ioService_.reset();
-		// Wait for work to do, use timeout to check for reconnects
-		workAvailable_.timed_wait(lock, boost::posix_time::seconds(
-				RECONNECT_TIMEOUT));
+		sendQueue_.clear();
+		linesInFlight_ = 0;
+		writing_ = false;
+		return;
+	}
+	pending_.Begin();
+	boost::asio::async_write(socket_, writeBuffers_, strand_.wrap(boost::bind(
+			&Connection::OnWrite, this, _1, _2)));
+}
+
+void Connection::OnWrite(const boost::system::error_code& error,
+		const std::size_t& /*bytes*/)
+{
+	HandlerScope scope(*this);
+	boost::lock_guard<boost::mutex> lock(sendMutex_);
+	if (!error)
+	{
+		SendQueue::iterator written = sendQueue_.begin();
+		std::advance(written, linesInFlight_);
+		sendQueue_.erase(sendQueue_.begin(), written);
+		linesInFlight_ = 0;
+		if (!sendQueue_.empty())
+		{
+			StartWrite();
+			return;
+		}
+	}
+	else
+	{
+		// The receiver notices the broken connection and reconnects, what
+		// was queued for the old connection is of no use to the new one
+		Log << LogLevel::Error << "Connection::OnWrite: " << error.message();
+		sendQueue_.clear();
+		linesInFlight_ = 0;
+	}
+	writing_ = false;
+}
+
+void Connection::ScheduleReconnect()
+{
+	boost::lock_guard<boost::mutex> lock(socketMutex_);
+	if (closing_)
+	{
+		return;
+	}
+	Log << LogLevel::Info << "Reconnecting to " << host_ << ":" << port_
+			<< " in " << RECONNECT_TIMEOUT << " seconds";
+	reconnectTimer_.expires_from_now(boost::posix_time::seconds(
+			RECONNECT_TIMEOUT));
+	pending_.Begin();
+	reconnectTimer_.async_wait(strand_.wrap(boost::bind(
+			&Connection::OnReconnectTimer, this, _1, connectGeneration_)));
+}
+
+void Connection::OnReconnectTimer(const boost::system::error_code& error,
+		unsigned int generation)
+{
+	HandlerScope scope(*this);
+	{
+		boost::lock_guard<boost::mutex> lock(socketMutex_);
+		// Someone else reconnected meanwhile, that connection is not
+		// the one that failed
+		if (closing_ || generation != connectGeneration_)
+		{
+			return;
+		}
+	}
+	if (!error)
+	{
+		try
+		{
+			Reconnect();
+		} catch (Exception& e)
+		{
+			Log << LogLevel::Error << e.GetMessage();
+			ScheduleReconnect();
+		}
 	}
-	workAvailable_.notify_all();
-	Log << LogLevel::Info << "Connection thread "
-			<< boost::this_thread::get_id() << " ending";
 }
 
 void Connection::CheckConnection()
@@ -287,7 +805,9 @@ void Connection::CheckConnection()
 					<< " seconds, reconnecting";
 			Reconnect();
 		}
-	} catch (Exception&)
+	} catch (Exception& e)
 	{
+		Log << LogLevel::Error << e.GetMessage();
+		ScheduleReconnect();
 	}
 }
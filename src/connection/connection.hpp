@@ -1,22 +1,33 @@
 #ifndef CONNECTION_HPP
 #define CONNECTION_HPP
 
+#include "ioservicepool.hpp"
+#include "linebuffer.hpp"
 #include "../thread_safe.hpp"
 
 #include <string>
 #include <vector>
 #include <list>
+#include <deque>
+#include <utility>
 
 #include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/asio.hpp>
-#include <boost/array.hpp>
 #include <boost/thread.hpp>
 #include <boost/utility.hpp>
 
 #include <unicode/unistr.h>
 
-const std::size_t RECEIVE_BUFFER_SIZE = 1024;
+const std::size_t RECEIVE_BUFFER_SIZE = 16384;
+// Longest line accepted from the other end, room for IRCv3 message tags
+// (8191 bytes) and a regular 512 byte message
+const std::size_t MAX_RECEIVE_LINE_LENGTH = 8192 + 512;
+// Default number of lines that may be waiting to be written
+const std::size_t MAX_SEND_QUEUE_LINES = 1000;
+// Milliseconds to give a connection attempt before racing it with the next
+// address, see RFC 8305
+const long CONNECT_ATTEMPT_DELAY = 250;
 
 class Connection : boost::noncopyable
 {
@@ -25,26 +36,55 @@ public:
     Connection(const UnicodeString& host, const unsigned short port);
     virtual ~Connection();
 
+    typedef std::pair<UnicodeString, unsigned short> Host;
+    typedef std::vector<Host> HostContainer;
+
     /**
-     * @throw Exception if unable to connect
+     * Start connecting and return without waiting for the name lookup or
+     * the connection, OnConnect callbacks are notified once connected.
+     * Failures are logged and retried later.
      */
     void Connect(const UnicodeString& host, const unsigned short port);
 
     /**
-     * @throw Exception if unable to reconnect
+     * Like above but all hosts are looked up at the same time and their
+     * addresses are raced against each other, the first one to accept the
+     * connection is used. The first host is the main one.
+     * @throw Exception if no hosts are given
      */
+    void Connect(const HostContainer& hosts);
+
     void Reconnect();
 
     typedef boost::function<void (Connection&, 
-				  const std::vector<char>&)> Receiver;
+				  boost::string_ref)> Receiver;
     typedef boost::shared_ptr<Receiver> ReceiverHandle;
     /**
      * Register a function as a receiver, the return value is a handle
      * to the receiver, whenever this handle ceases to exist the connection
      * will no longer send data to the corresponding receiver.
+     * Receivers are called once per received line, without the line ending.
+     * The line refers to the receive buffer and is only valid during the call.
      */
     ReceiverHandle RegisterReceiver(Receiver r);
-    void Send(const std::vector<char>& data);
+
+    /**
+     * Queue a line for sending, a CRLF line ending is appended. Returns
+     * without waiting for the socket, lines queued while a write is in
+     * progress are sent together in one gathered write.
+     * @throw Exception if not connected or the line is rejected because
+     *        the send queue is full
+     */
+    void Send(boost::string_ref line);
+
+    enum OverflowPolicy
+    {
+	// Refuse the new line with an exception
+	RejectNewest,
+	// Throw away the oldest line that has not started being written
+	DropOldest
+    };
+    void SetSendQueuePolicy(std::size_t maxLines, OverflowPolicy policy);
 
     typedef boost::function<void (Connection&)> OnConnectCallback;
     typedef boost::shared_ptr<OnConnectCallback> OnConnectHandle;
@@ -57,47 +97,158 @@ public:
      */
     OnConnectHandle RegisterOnConnectCallback(OnConnectCallback c);
 
+    /**
+     * Like above but for when a connection that was made is lost or is
+     * given up for a new one.
+     */
+    OnConnectHandle RegisterOnDisconnectCallback(OnConnectCallback c);
+
+    struct KeepAlive
+    {
+	// Seconds without traffic before the kernel starts probing the
+	// other end, zero leaves TCP keepalive off
+	unsigned int IdleSeconds;
+	unsigned int IntervalSeconds;
+	// Unanswered probes before the connection is dropped
+	unsigned int Probes;
+	// How long sent data may go unacknowledged before the connection is
+	// dropped, zero for the system default
+	unsigned int UserTimeoutMilliseconds;
+    };
+    /**
+     * Socket options for noticing a dead connection, applied from the
+     * next connect.
+     */
+    void SetKeepAlive(const KeepAlive& keepAlive);
+
     bool IsTimedOut() const;
     bool IsConnected() const;
 
+    struct Statistics
+    {
+	// Number of times a handler for this connection was run by the pool
+	unsigned long Wakeups;
+	// CPU time spent in those handlers
+	unsigned long long CpuMicroseconds;
+	// Lines in the send queue, including the ones being written
+	std::size_t QueuedLines;
+	std::size_t QueuedBytes;
+	// Bytes handed to the socket in the write that is in progress
+	std::size_t BytesInFlight;
+	// Lines lost to the overflow policy
+	unsigned long DroppedLines;
+    };
+    Statistics GetStatistics() const;
+
 private:
-    void OnConnect(const boost::system::error_code& error,
-		   boost::asio::ip::tcp::resolver::iterator endpointIt);
+    typedef boost::weak_ptr<OnConnectCallback> OnConnectCallbackPtr;
+    typedef std::list<OnConnectCallbackPtr> OnConnectCallbackContainer;
+
+    /**
+     * Accounts a handler run on the I/O pool to this connection and marks
+     * its asynchronous operation as finished when it goes out of scope.
+     */
+    class HandlerScope : boost::noncopyable
+    {
+    public:
+	explicit HandlerScope(Connection& connection);
+	~HandlerScope();
+    private:
+	Connection& connection_;
+	unsigned long long start_;
+    };
+
+    typedef boost::shared_ptr<boost::asio::ip::tcp::socket> SocketPtr;
+    typedef boost::shared_ptr<boost::asio::ip::tcp::resolver> ResolverPtr;
+
+    void OnStartConnect();
+    void OnResolve(const boost::system::error_code& error,
+		   boost::asio::ip::tcp::resolver::iterator endpointIt,
+		   ResolverPtr resolver, unsigned int generation,
+		   std::size_t hostIndex);
+    void StartConnectAttempt();
+    void ArmConnectAttemptTimer();
+    void OnConnectAttemptTimer(const boost::system::error_code& error,
+			       unsigned int generation);
+    void OnConnectAttempt(const boost::system::error_code& error,
+			  SocketPtr socket,
+			  boost::asio::ip::tcp::endpoint endpoint,
+			  unsigned int generation);
+    void CancelConnectAttempts();
+    void OnConnect(const boost::asio::ip::tcp::endpoint& endpoint);
+    void OnDisconnect();
 
     void InitTimer();
     void OnTimeOut(const boost::system::error_code& error);
 
+    void NotifyCallbacks(OnConnectCallbackContainer& callbacks);
+
     void CreateReceiver();
     void Receive(const boost::system::error_code& error,
 		 const std::size_t& bytes);
 
-    void Loop();
+    void OnStartWrite();
+    void StartWrite();
+    void OnWrite(const boost::system::error_code& error,
+		 const std::size_t& bytes);
+
+    void ScheduleReconnect();
+    // Only reconnects if no connect was started after it was scheduled
+    void OnReconnectTimer(const boost::system::error_code& error,
+			  unsigned int generation);
     void CheckConnection();
 
-    boost::asio::io_service ioService_;
+    boost::asio::io_service& ioService_;
+    boost::asio::io_service::strand strand_;
     boost::asio::ip::tcp::socket socket_;
     boost::asio::deadline_timer timer_;
+    boost::asio::deadline_timer reconnectTimer_;
+    // Guards the socket, the timers and closing_
     boost::mutex socketMutex_;
-    boost::array<char, RECEIVE_BUFFER_SIZE> buffer_;
-
+    bool closing_;
+    PendingOperations pending_;
+    LineBuffer buffer_;
+
+    // Connection establishment, guarded by socketMutex_. Completions from
+    // an earlier Connect carry an older generation and are ignored.
+    boost::asio::deadline_timer attemptTimer_;
+    bool attemptTimerArmed_;
+    unsigned int connectGeneration_;
+    std::size_t resolvesPending_;
+    std::vector<ResolverPtr> resolvers_;
+    std::list<SocketPtr> attempts_;
+    std::deque<boost::asio::ip::tcp::endpoint> ipv6Candidates_;
+    std::deque<boost::asio::ip::tcp::endpoint> ipv4Candidates_;
+    bool preferIpv6_;
+    boost::posix_time::ptime connectStarted_;
+
+    KeepAlive keepAlive_;
+    HostContainer hosts_;
     UnicodeString host_;
     unsigned short port_;
     typedef std::list<boost::weak_ptr<Receiver> > ReceiverContainer;
     ReceiverContainer receivers_;
     boost::shared_mutex receiversMutex_;
-    typedef boost::weak_ptr<OnConnectCallback> OnConnectCallbackPtr;
-    typedef std::list<OnConnectCallbackPtr> OnConnectCallbackContainer;
     OnConnectCallbackContainer onConnectCallbacks_;
+    OnConnectCallbackContainer onDisconnectCallbacks_;
     boost::shared_mutex callbacksMutex_;
     time_t lastReception_;
     thread_safe<bool> connected_;
-    boost::mutex sendMutex_;
-    std::auto_ptr<boost::thread> thread_;
-    boost::mutex constructorMutex_;
-
-    bool run_;
-    boost::condition_variable workAvailable_;
-    boost::mutex workAvailableMutex_;
+    // Guards everything below that has to do with sending
+    mutable boost::mutex sendMutex_;
+    // A list so that lines can be dropped without moving the ones that
+    // are being written
+    typedef std::list<std::string> SendQueue;
+    SendQueue sendQueue_;
+    // Number of lines at the front of the queue that are being written
+    std::size_t linesInFlight_;
+    std::vector<boost::asio::const_buffer> writeBuffers_;
+    bool writing_;
+    std::size_t maxSendQueueLines_;
+    OverflowPolicy overflowPolicy_;
+
+    Statistics statistics_;
+    mutable boost::mutex statisticsMutex_;
 };
 
 #endif
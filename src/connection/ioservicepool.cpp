@@ -0,0 +1,76 @@
+#include "ioservicepool.hpp"
+#include "../exception.hpp"
+#include "../logging/logger.hpp"
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+// Upper bound on the number of threads, connections are mostly idle so more
+// threads than this only adds context switches
+const std::size_t MAX_POOL_THREADS = 4;
+
+IoServicePool& IoServicePool::Instance()
+{
+	static IoServicePool instance;
+	return instance;
+}
+
+IoServicePool::IoServicePool() :
+	work_(new boost::asio::io_service::work(ioService_))
+{
+	std::size_t threadCount = std::max<std::size_t>(1, std::min<std::size_t>(
+			boost::thread::hardware_concurrency(), MAX_POOL_THREADS));
+	for (std::size_t i = 0; i < threadCount; ++i)
+	{
+		threads_.push_back(ThreadPtr(new boost::thread(boost::bind(
+				&IoServicePool::Run, this))));
+	}
+	Log << LogLevel::Info << "I/O service pool started with " << threadCount
+			<< " threads";
+}
+
+IoServicePool::~IoServicePool()
+{
+	work_.reset();
+	ioService_.stop();
+	for (ThreadContainer::iterator thread = threads_.begin(); thread
+			!= threads_.end(); ++thread)
+	{
+		(*thread)->join();
+	}
+}
+
+boost::asio::io_service& IoServicePool::GetIoService()
+{
+	return ioService_;
+}
+
+std::size_t IoServicePool::GetThreadCount() const
+{
+	return threads_.size();
+}
+
+void IoServicePool::Run()
+{
+	Log << LogLevel::Info << "I/O thread " << boost::this_thread::get_id()
+			<< " starting";
+	while (!ioService_.stopped())
+	{
+		try
+		{
+			ioService_.run();
+		} catch (Exception& e)
+		{
+			// A handler threw, keep the thread alive for the other connections
+			Log << LogLevel::Error << "I/O thread caught exception: "
+					<< e.GetMessage();
+		} catch (std::exception& e)
+		{
+			Log << LogLevel::Error << "I/O thread caught exception: "
+					<< e.what();
+		}
+	}
+	Log << LogLevel::Info << "I/O thread " << boost::this_thread::get_id()
+			<< " ending";
+}
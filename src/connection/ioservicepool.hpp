@@ -0,0 +1,80 @@
+#pragma once
+
+#include "ioservicepool.fwd.hpp"
+
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+
+/**
+ * A single io_service shared by every connection and named pipe, run by a
+ * small number of threads sized to the number of cores. Connections keep
+ * their handlers ordered with a strand so the number of threads stays the
+ * same no matter how many servers are configured.
+ */
+class IoServicePool : boost::noncopyable
+{
+public:
+    static IoServicePool& Instance();
+
+    boost::asio::io_service& GetIoService();
+
+    std::size_t GetThreadCount() const;
+
+private:
+    IoServicePool();
+    ~IoServicePool();
+
+    void Run();
+
+    boost::asio::io_service ioService_;
+    std::auto_ptr<boost::asio::io_service::work> work_;
+    typedef boost::shared_ptr<boost::thread> ThreadPtr;
+    typedef std::vector<ThreadPtr> ThreadContainer;
+    ThreadContainer threads_;
+};
+
+/**
+ * Keeps track of asynchronous operations that have been started but whose
+ * handlers have not yet run. Owners of handlers that are bound to this
+ * wait for all of them before they are destroyed.
+ */
+class PendingOperations : boost::noncopyable
+{
+public:
+    PendingOperations() : count_(0)
+    {
+    }
+
+    void Begin()
+    {
+	boost::lock_guard<boost::mutex> lock(mutex_);
+	++count_;
+    }
+
+    void End()
+    {
+	boost::lock_guard<boost::mutex> lock(mutex_);
+	if (--count_ == 0)
+	{
+	    finished_.notify_all();
+	}
+    }
+
+    void WaitForAll()
+    {
+	boost::unique_lock<boost::mutex> lock(mutex_);
+	while (count_ > 0)
+	{
+	    finished_.wait(lock);
+	}
+    }
+
+private:
+    std::size_t count_;
+    boost::mutex mutex_;
+    boost::condition_variable finished_;
+};
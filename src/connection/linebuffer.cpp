@@ -0,0 +1,109 @@
+#include "linebuffer.hpp"
+#include "../logging/logger.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+// Do not bother reading into less space than this, move or grow instead
+const std::size_t MIN_READ_SIZE = 512;
+
+LineBuffer::LineBuffer(std::size_t initialSize, std::size_t maxLineLength) :
+	buffer_(std::max(initialSize, MIN_READ_SIZE)), begin_(0), scanned_(0),
+			end_(0), maxLineLength_(maxLineLength), discarding_(false),
+			discardedLines_(0)
+{
+}
+
+boost::asio::mutable_buffers_1 LineBuffer::Prepare()
+{
+	if (begin_ == end_)
+	{
+		begin_ = scanned_ = end_ = 0;
+	}
+	else if (buffer_.size() - end_ < MIN_READ_SIZE && begin_ > 0)
+	{
+		// Move the partial line to the front, this happens at most once
+		// per read no matter how many lines were in it
+		std::memmove(&buffer_[0], &buffer_[begin_], end_ - begin_);
+		end_ -= begin_;
+		scanned_ -= begin_;
+		begin_ = 0;
+	}
+
+	if (end_ - begin_ > maxLineLength_)
+	{
+		// The partial line is already over the limit, drop what we have
+		// and skip the rest of it once its line ending arrives
+		if (!discarding_)
+		{
+			Log << LogLevel::Warning << "Discarding received line longer than "
+					<< maxLineLength_ << " bytes";
+			++discardedLines_;
+		}
+		discarding_ = true;
+		begin_ = scanned_ = end_ = 0;
+	}
+	else if (buffer_.size() - end_ < MIN_READ_SIZE)
+	{
+		// A line at the limit always fits with room for a read, the buffer
+		// never shrinks if it started out larger than that
+		std::size_t limit = std::max(buffer_.size(), maxLineLength_
+				+ MIN_READ_SIZE);
+		buffer_.resize(std::min(buffer_.size() * 2, limit));
+	}
+	return boost::asio::buffer(&buffer_[end_], buffer_.size() - end_);
+}
+
+void LineBuffer::Commit(std::size_t bytes)
+{
+	end_ = std::min(end_ + bytes, buffer_.size());
+}
+
+void LineBuffer::Clear()
+{
+	begin_ = scanned_ = end_ = 0;
+	discarding_ = false;
+}
+
+bool LineBuffer::NextLine(boost::string_ref& line)
+{
+	while (scanned_ < end_)
+	{
+		const char* data = &buffer_[0];
+		const char* newLine = static_cast<const char*> (std::memchr(data
+				+ scanned_, '\n', end_ - scanned_));
+		if (!newLine)
+		{
+			scanned_ = end_;
+			return false;
+		}
+
+		std::size_t lineEnd = newLine - data;
+		std::size_t lineBegin = begin_;
+		begin_ = scanned_ = lineEnd + 1;
+
+		if (discarding_)
+		{
+			// This was the tail end of a line that was too long
+			discarding_ = false;
+			continue;
+		}
+
+		// Some servers only send LF so the CR is optional
+		if (lineEnd > lineBegin && data[lineEnd - 1] == '\r')
+		{
+			--lineEnd;
+		}
+		if (lineEnd - lineBegin > maxLineLength_)
+		{
+			// Arrived whole in one read but is just as much over the limit
+			Log << LogLevel::Warning << "Discarding received line longer than "
+					<< maxLineLength_ << " bytes";
+			++discardedLines_;
+			continue;
+		}
+		line = boost::string_ref(data + lineBegin, lineEnd - lineBegin);
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "linebuffer.fwd.hpp"
+
+#include <vector>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/utility.hpp>
+#include <boost/utility/string_ref.hpp>
+
+/**
+ * Receive buffer that the socket reads straight into and that hands out
+ * complete lines as references into its own storage. The storage grows
+ * when a partial line does not leave room for another read, up to a hard
+ * limit on the line length. Lines longer than that are dropped.
+ */
+class LineBuffer : boost::noncopyable
+{
+public:
+    LineBuffer(std::size_t initialSize, std::size_t maxLineLength);
+
+    /**
+     * Get the free space at the end of the buffer for the next read.
+     * Invalidates any line previously returned by NextLine().
+     */
+    boost::asio::mutable_buffers_1 Prepare();
+
+    /**
+     * Mark bytes written into the space returned by Prepare() as received.
+     */
+    void Commit(std::size_t bytes);
+
+    /**
+     * Get the next complete line without its line ending (LF or CRLF).
+     * The line stays valid until the next call to Prepare().
+     * @return false if there is no complete line
+     */
+    bool NextLine(boost::string_ref& line);
+
+    /**
+     * Throw away everything received, used when the connection is reset.
+     */
+    void Clear();
+
+    std::size_t GetCapacity() const { return buffer_.size(); }
+
+    // Number of lines thrown away because they exceeded the limit
+    unsigned long GetDiscardedLines() const { return discardedLines_; }
+
+private:
+    std::vector<char> buffer_;
+    // Start of the first line that has not been handed out
+    std::size_t begin_;
+    // Position up to which we know there is no line ending
+    std::size_t scanned_;
+    // End of received data
+    std::size_t end_;
+    std::size_t maxLineLength_;
+    // Set while skipping the remainder of a line that was too long
+    bool discarding_;
+    unsigned long discardedLines_;
+};
@@ -5,7 +5,8 @@
 #include <converter.hpp>
 
 NamedPipe::NamedPipe(const UnicodeString& pipeName) :
-	pipeFd_(open(AsUtf8(pipeName).c_str(), O_RDWR)), pipe_(ioService_)
+	pipeFd_(open(AsUtf8(pipeName).c_str(), O_RDWR)), pipe_(
+			IoServicePool::Instance().GetIoService())
 {
 	boost::system::error_code error;
 	pipe_.assign(pipeFd_, error);
@@ -15,17 +16,14 @@ NamedPipe::NamedPipe(const UnicodeString& pipeName) :
 	}
 
 	CreateReceiver();
-	thread_.reset(new boost::thread(boost::bind(&boost::asio::io_service::run,
-			&ioService_)));
 }
 
 NamedPipe::~NamedPipe()
 {
-	pipe_.close();
-	if (thread_.get())
-	{
-		thread_->join();
-	}
+	boost::system::error_code error;
+	pipe_.close(error);
+	// Wait for the aborted read to be delivered before we go away
+	pending_.WaitForAll();
 }
 
 NamedPipe::ReceiverHandle NamedPipe::RegisterReceiver(Receiver receiver)
@@ -52,14 +50,16 @@ void NamedPipe::OnReceive(const boost::system::error_code& error,
 		}
 		CreateReceiver();
 	}
-	else
+	else if (error != boost::asio::error::operation_aborted)
 	{
 		Log << LogLevel::Error << "Named pipe failed: " << error.message();
 	}
+	pending_.End();
 }
 
 void NamedPipe::CreateReceiver()
 {
+	pending_.Begin();
 	pipe_.async_read_some(boost::asio::buffer(buffer_), boost::bind(
 			&NamedPipe::OnReceive, this, _1, _2));
 }
@@ -1,3 +1,4 @@
+#include "ioservicepool.hpp"
 #include "../exception.fwd.hpp"
 
 #include <list>
@@ -35,9 +36,8 @@ private:
     typedef std::list<ReceiverWeakPtr> ReceiverContainer;
     std::list<ReceiverWeakPtr> receivers_;
     int pipeFd_;
-    boost::asio::io_service ioService_;
     boost::asio::posix::stream_descriptor pipe_;
     boost::array<char, 1024> buffer_;
     std::string data_;
-    std::auto_ptr<boost::thread> thread_;
+    PendingOperations pending_;
 };
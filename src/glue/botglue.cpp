@@ -2,22 +2,44 @@
 #include "gluemanager.hpp"
 #include "../client.hpp"
 #include "../exception.hpp"
+#include "../irc/ircserver.hpp"
 
 #include <boost/bind.hpp>
 #include <converter.hpp>
 
+#ifdef LUA_EXTERN
+extern "C"
+{
+#include <lauxlib.h>
+}
+#else
+#include <lauxlib.h>
+#endif
+
 class BotGlue: public Glue
 {
 public:
 	BotGlue();
 
 	int GetMyNick(lua_State* lua);
+	int GetLag(lua_State* lua);
+	int GetServerStatistics(lua_State* lua);
 private:
 	void AddFunctions();
 };
 
 BotGlue botGlue;
 
+// Names of the send queue lanes in the table GetServerStatistics returns
+static const char* const LANE_NAMES[Irc::SendScheduler::PRIORITY_COUNT] =
+{
+	"ping",
+	"registration",
+	"reply",
+	"channel",
+	"reminder"
+};
+
 BotGlue::BotGlue()
 {
 	GlueManager::Instance().RegisterGlue(this);
@@ -26,6 +48,9 @@ BotGlue::BotGlue()
 void BotGlue::AddFunctions()
 {
 	AddFunction(boost::bind(&BotGlue::GetMyNick, this, _1), "GetMyNick");
+	AddFunction(boost::bind(&BotGlue::GetLag, this, _1), "GetLag");
+	AddFunction(boost::bind(&BotGlue::GetServerStatistics, this, _1),
+				"GetServerStatistics");
 }
 
 int BotGlue::GetMyNick(lua_State* lua)
@@ -42,3 +67,129 @@ int BotGlue::GetMyNick(lua_State* lua)
 	lua_pushstring(lua, AsUtf8(nick).c_str());
 	return 1;
 }
+
+/**
+ * Lag to the server in seconds, nil if it is not known yet
+ */
+int BotGlue::GetLag(lua_State* lua)
+{
+	UnicodeString server;
+	if (lua_gettop(lua) >= 1)
+	{
+		CheckArgument(lua, 1, LUA_TSTRING);
+		server = AsUnicode(lua_tostring(lua, 1));
+	}
+
+	long lag = 0;
+	try
+	{
+		lag = client_->GetLag(server);
+	} catch (Exception& e)
+	{
+		return luaL_error(lua, AsUtf8(e.GetMessage()).c_str());
+	}
+
+	if (lag < 0)
+	{
+		lua_pushnil(lua);
+	}
+	else
+	{
+		lua_pushnumber(lua, lag / 1000.0);
+	}
+	return 1;
+}
+
+/**
+ * Netsplits and netjoins seen on an IRC server, how long lines wait in
+ * each lane of its send queue and the lag measured to it
+ */
+int BotGlue::GetServerStatistics(lua_State* lua)
+{
+	UnicodeString server;
+	if (lua_gettop(lua) >= 1)
+	{
+		CheckArgument(lua, 1, LUA_TSTRING);
+		server = AsUnicode(lua_tostring(lua, 1));
+	}
+
+	Irc::BurstAggregator::Statistics bursts;
+	Irc::SendScheduler::LaneStatistics lanes[Irc::SendScheduler::PRIORITY_COUNT];
+	Irc::LagMonitor::Statistics lag;
+	try
+	{
+		const Irc::IrcServer& ircServer = client_->GetIrcServer(server);
+		bursts = ircServer.GetBurstStatistics();
+		lag = ircServer.GetLagStatistics();
+		for (std::size_t i = 0; i < Irc::SendScheduler::PRIORITY_COUNT; ++i)
+		{
+			lanes[i] = ircServer.GetSendStatistics(
+				static_cast<Irc::SendScheduler::Priority>(i));
+		}
+	} catch (Exception& e)
+	{
+		return luaL_error(lua, AsUtf8(e.GetMessage()).c_str());
+	}
+
+	lua_newtable(lua);
+	lua_pushinteger(lua, bursts.Netsplits);
+	lua_setfield(lua, -2, "netsplits");
+	lua_pushinteger(lua, bursts.Netjoins);
+	lua_setfield(lua, -2, "netjoins");
+	lua_pushinteger(lua, bursts.SplitQuits);
+	lua_setfield(lua, -2, "splitquits");
+	lua_pushinteger(lua, bursts.NetjoinJoins);
+	lua_setfield(lua, -2, "netjoinjoins");
+	lua_pushinteger(lua, bursts.LargestBurst);
+	lua_setfield(lua, -2, "largestburst");
+
+	lua_createtable(lua, 0, Irc::SendScheduler::PRIORITY_COUNT);
+	for (std::size_t i = 0; i < Irc::SendScheduler::PRIORITY_COUNT; ++i)
+	{
+		lua_createtable(lua, 0, 4);
+		lua_pushinteger(lua, lanes[i].QueuedLines);
+		lua_setfield(lua, -2, "queued");
+		lua_pushinteger(lua, lanes[i].SentLines);
+		lua_setfield(lua, -2, "sent");
+		lua_pushnumber(lua, lanes[i].AverageLatencyMilliseconds);
+		lua_setfield(lua, -2, "latency");
+		lua_pushnumber(lua, lanes[i].MaxLatencyMilliseconds);
+		lua_setfield(lua, -2, "maxlatency");
+		lua_setfield(lua, -2, LANE_NAMES[i]);
+	}
+	lua_setfield(lua, -2, "send");
+
+	// In milliseconds, negative until the first PONG
+	lua_createtable(lua, 0, 7);
+	lua_pushinteger(lua, lag.CurrentLagMilliseconds);
+	lua_setfield(lua, -2, "current");
+	lua_pushinteger(lua, lag.MinLagMilliseconds);
+	lua_setfield(lua, -2, "min");
+	lua_pushinteger(lua, lag.MaxLagMilliseconds);
+	lua_setfield(lua, -2, "max");
+	lua_pushnumber(lua, lag.AverageLagMilliseconds);
+	lua_setfield(lua, -2, "average");
+	lua_pushinteger(lua, lag.Samples);
+	lua_setfield(lua, -2, "samples");
+	lua_pushinteger(lua, lag.Timeouts);
+	lua_setfield(lua, -2, "timeouts");
+	// Each bucket counts round trips shorter than its limit, the last one
+	// has no limit
+	lua_createtable(lua, Irc::LagMonitor::HISTOGRAM_BUCKETS, 0);
+	for (std::size_t i = 0; i < Irc::LagMonitor::HISTOGRAM_BUCKETS; ++i)
+	{
+		lua_createtable(lua, 0, 2);
+		long limit = Irc::LagMonitor::GetBucketLimit(i);
+		if (limit >= 0)
+		{
+			lua_pushinteger(lua, limit);
+			lua_setfield(lua, -2, "limit");
+		}
+		lua_pushinteger(lua, lag.Histogram[i]);
+		lua_setfield(lua, -2, "count");
+		lua_rawseti(lua, -2, i + 1);
+	}
+	lua_setfield(lua, -2, "histogram");
+	lua_setfield(lua, -2, "lag");
+	return 1;
+}
@@ -22,8 +22,17 @@ public:
 	int JoinChannel(lua_State* lua);
 	int Kick(lua_State* lua);
 	int GetChannelNicks(lua_State* lua);
+	int GetChannelTopic(lua_State* lua);
+	int GetChannelModes(lua_State* lua);
+	int GetNickPrefixes(lua_State* lua);
+	int GetNickInfo(lua_State* lua);
 private:
 	void AddFunctions();
+	// The channel and server are optional arguments from the given index
+	ChannelSnapshotPtr GetChannel(lua_State* lua, int index);
+	// Null if the nick in the first argument is not in the channel
+	const ChannelSnapshot::Member* GetMember(lua_State* lua,
+			ChannelSnapshotPtr& snapshot);
 };
 
 ChannelGlue channelGlue;
@@ -39,6 +48,14 @@ void ChannelGlue::AddFunctions()
 	AddFunction(boost::bind(&ChannelGlue::Kick, this, _1), "Kick");
 	AddFunction(boost::bind(&ChannelGlue::GetChannelNicks, this, _1),
 			"GetChannelNicks");
+	AddFunction(boost::bind(&ChannelGlue::GetChannelTopic, this, _1),
+			"GetChannelTopic");
+	AddFunction(boost::bind(&ChannelGlue::GetChannelModes, this, _1),
+			"GetChannelModes");
+	AddFunction(boost::bind(&ChannelGlue::GetNickPrefixes, this, _1),
+			"GetNickPrefixes");
+	AddFunction(boost::bind(&ChannelGlue::GetNickInfo, this, _1),
+			"GetNickInfo");
 }
 
 int ChannelGlue::JoinChannel(lua_State* lua)
@@ -129,20 +146,174 @@ int ChannelGlue::GetChannelNicks(lua_State* lua)
 		}
 	}
 
-	const std::set<std::string>& nicks = client_->GetChannelNicks(channel,
-			server);
-
-	int count = std::distance(nicks.begin(), nicks.end());
+	// Held on to, the network thread can publish a new one meanwhile
+	ChannelSnapshotPtr snapshot;
+	try
+	{
+		snapshot = client_->GetChannel(channel, server);
+	}
+	catch (Exception& e)
+	{
+		return luaL_error(lua, AsUtf8(e.GetMessage()).c_str());
+	}
+	const std::vector<std::string>& nicks = snapshot->Nicks;
 
-	lua_createtable(lua, count, 0);
+	lua_createtable(lua, nicks.size(), 0);
 	int mainTableIndex = lua_gettop(lua);
 
-	for (std::set<std::string>::const_iterator nick = nicks.begin(); nick
-			!= nicks.end(); ++nick)
+	for (std::size_t nick = 0; nick < nicks.size(); ++nick)
+	{
+		lua_pushstring(lua, nicks[nick].c_str());
+		lua_rawseti(lua, mainTableIndex, nick + 1);
+	}
+	return 1;
+}
+
+ChannelSnapshotPtr ChannelGlue::GetChannel(lua_State* lua, int index)
+{
+	UnicodeString server;
+	std::string channel;
+	int argumentCount = lua_gettop(lua);
+	if (argumentCount >= index)
+	{
+		CheckArgument(lua, index, LUA_TSTRING);
+		channel = lua_tostring(lua, index);
+		if (argumentCount >= index + 1)
+		{
+			CheckArgument(lua, index + 1, LUA_TSTRING);
+			server = AsUnicode(lua_tostring(lua, index + 1));
+		}
+	}
+	return client_->GetChannel(channel, server);
+}
+
+const ChannelSnapshot::Member* ChannelGlue::GetMember(lua_State* lua,
+		ChannelSnapshotPtr& snapshot)
+{
+	CheckArgument(lua, 1, LUA_TSTRING);
+	std::string nick = lua_tostring(lua, 1);
+	snapshot = GetChannel(lua, 2);
+	return snapshot->FindMember(nick);
+}
+
+int ChannelGlue::GetChannelTopic(lua_State* lua)
+{
+	ChannelSnapshotPtr snapshot;
+	try
+	{
+		snapshot = GetChannel(lua, 1);
+	}
+	catch (Exception& e)
+	{
+		return luaL_error(lua, AsUtf8(e.GetMessage()).c_str());
+	}
+	lua_pushlstring(lua, snapshot->Topic.data(), snapshot->Topic.size());
+	if (snapshot->TopicSetBy.empty())
+	{
+		lua_pushnil(lua);
+	}
+	else
+	{
+		lua_pushstring(lua, snapshot->TopicSetBy.c_str());
+	}
+	if (snapshot->TopicSetAt == 0)
+	{
+		lua_pushnil(lua);
+	}
+	else
+	{
+		lua_pushnumber(lua, snapshot->TopicSetAt);
+	}
+	return 3;
+}
+
+int ChannelGlue::GetChannelModes(lua_State* lua)
+{
+	ChannelSnapshotPtr snapshot;
+	try
+	{
+		snapshot = GetChannel(lua, 1);
+	}
+	catch (Exception& e)
+	{
+		return luaL_error(lua, AsUtf8(e.GetMessage()).c_str());
+	}
+
+	// Mode letter to its parameter, or true for modes without one
+	lua_createtable(lua, 0, snapshot->Modes.size());
+	int tableIndex = lua_gettop(lua);
+	for (std::map<char, std::string>::const_iterator mode =
+			snapshot->Modes.begin();
+		 mode != snapshot->Modes.end();
+		 ++mode)
 	{
-		lua_pushstring(lua, nick->c_str());
-		int currentMainIndex = std::distance(nicks.begin(), nick) + 1;
-		lua_rawseti(lua, mainTableIndex, currentMainIndex);
+		lua_pushlstring(lua, &mode->first, 1);
+		if (mode->second.empty())
+		{
+			lua_pushboolean(lua, 1);
+		}
+		else
+		{
+			lua_pushstring(lua, mode->second.c_str());
+		}
+		lua_rawset(lua, tableIndex);
 	}
 	return 1;
 }
+
+int ChannelGlue::GetNickPrefixes(lua_State* lua)
+{
+	ChannelSnapshotPtr snapshot;
+	const ChannelSnapshot::Member* member = 0;
+	try
+	{
+		member = GetMember(lua, snapshot);
+	}
+	catch (Exception& e)
+	{
+		return luaL_error(lua, AsUtf8(e.GetMessage()).c_str());
+	}
+	if (member)
+	{
+		lua_pushstring(lua, member->Prefixes.c_str());
+	}
+	else
+	{
+		lua_pushnil(lua);
+	}
+	return 1;
+}
+
+int ChannelGlue::GetNickInfo(lua_State* lua)
+{
+	ChannelSnapshotPtr snapshot;
+	const ChannelSnapshot::Member* member = 0;
+	try
+	{
+		member = GetMember(lua, snapshot);
+	}
+	catch (Exception& e)
+	{
+		return luaL_error(lua, AsUtf8(e.GetMessage()).c_str());
+	}
+	if (!member)
+	{
+		lua_pushnil(lua);
+		return 1;
+	}
+	// Nil for what is not known
+	const std::string* values[] =
+		{ &member->User, &member->Host, &member->Account };
+	for (std::size_t i = 0; i < sizeof(values) / sizeof(*values); ++i)
+	{
+		if (values[i]->empty())
+		{
+			lua_pushnil(lua);
+		}
+		else
+		{
+			lua_pushstring(lua, values[i]->c_str());
+		}
+	}
+	return 3;
+}
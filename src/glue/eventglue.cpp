@@ -9,6 +9,7 @@
 #include <list>
 #include <map>
 
+#include <boost/utility/string_ref.hpp>
 #include <unicode/unistr.h>
 #include <converter.hpp>
 
@@ -23,6 +24,11 @@ extern "C"
 
 const unsigned int MAX_RESULT_LINES = 10;
 
+static void PushRef(lua_State* lua, boost::string_ref text)
+{
+    lua_pushlstring(lua, text.data(), text.size());
+}
+
 class EventGlue: public Glue
 {
 public:
@@ -75,13 +81,14 @@ EventGlue::StringContainerPtr EventGlue::CallEventHandlers(
 
         int argCount = 4;
         lua_pushstring(lua, AsUtf8(server).c_str());
-        lua_pushstring(lua, message.GetPrefix().GetNick().c_str());
-        lua_pushstring(lua, message.GetPrefix().GetUser().c_str());
-        lua_pushstring(lua, message.GetPrefix().GetHost().c_str());
-        for (Message::const_iterator param = message.begin(); param
-                != message.end(); ++param, ++argCount)
+        // Straight from the received line, nothing is copied on the way
+        PushRef(lua, message.GetNickRef());
+        PushRef(lua, message.GetUserRef());
+        PushRef(lua, message.GetHostRef());
+        for (std::size_t param = 0; param < message.size();
+                ++param, ++argCount)
         {
-            lua_pushstring(lua, param->c_str());
+            PushRef(lua, message.GetParameterRef(param));
         }
         if (lua_->FunctionCall(lua, argCount, LUA_MULTRET) == 0)
         {
@@ -1,12 +1,24 @@
 #include "glue.hpp"
 #include "gluemanager.hpp"
 #include "../client.hpp"
+#include "../chatlogwriter.hpp"
 #include "../exception.hpp"
 
+#include <algorithm>
+
 #include <boost/bind.hpp>
 #include <unicode/unistr.h>
 #include <converter.hpp>
 
+#ifdef LUA_EXTERN
+extern "C"
+{
+#include <lauxlib.h>
+}
+#else
+#include <lauxlib.h>
+#endif
+
 class LogGlue: public Glue
 {
 public:
@@ -14,12 +26,43 @@ public:
 
 	int GetLogName(lua_State* lua);
 	int GetLastLine(lua_State* lua);
+	int GetChatLogStatistics(lua_State* lua);
+	int LogSearch(lua_State* lua);
+	int GetChannelStats(lua_State* lua);
+	int GetNickStats(lua_State* lua);
+	int GetScrollback(lua_State* lua);
 private:
 	void AddFunctions();
+	// The iterator GetScrollback returns
+	static int NextScrollbackLine(lua_State* lua);
 };
 
 LogGlue logGlue;
 
+// Leaves a table with the counters on the stack, hours[1] is midnight to one
+static void PushCounters(lua_State* lua,
+						 const ChannelStatistics::Counters& counters)
+{
+	lua_createtable(lua, 0, 6);
+	lua_pushnumber(lua, counters.Messages);
+	lua_setfield(lua, -2, "messages");
+	lua_pushnumber(lua, counters.Words);
+	lua_setfield(lua, -2, "words");
+	lua_pushnumber(lua, counters.Characters);
+	lua_setfield(lua, -2, "characters");
+	lua_pushinteger(lua, counters.FirstSeen);
+	lua_setfield(lua, -2, "firstseen");
+	lua_pushinteger(lua, counters.LastSeen);
+	lua_setfield(lua, -2, "lastseen");
+	lua_createtable(lua, ChannelStatistics::HOURS, 0);
+	for (std::size_t hour = 0; hour < ChannelStatistics::HOURS; ++hour)
+	{
+		lua_pushinteger(lua, counters.Hours[hour]);
+		lua_rawseti(lua, -2, hour + 1);
+	}
+	lua_setfield(lua, -2, "hours");
+}
+
 LogGlue::LogGlue()
 {
 	GlueManager::Instance().RegisterGlue(this);
@@ -29,6 +72,15 @@ void LogGlue::AddFunctions()
 {
 	AddFunction(boost::bind(&LogGlue::GetLogName, this, _1), "GetLogName");
 	AddFunction(boost::bind(&LogGlue::GetLastLine, this, _1), "GetLastLine");
+	AddFunction(boost::bind(&LogGlue::GetChatLogStatistics, this, _1),
+				"GetChatLogStatistics");
+	AddFunction(boost::bind(&LogGlue::LogSearch, this, _1), "LogSearch");
+	AddFunction(boost::bind(&LogGlue::GetChannelStats, this, _1),
+				"GetChannelStats");
+	AddFunction(boost::bind(&LogGlue::GetNickStats, this, _1),
+				"GetNickStats");
+	AddFunction(boost::bind(&LogGlue::GetScrollback, this, _1),
+				"GetScrollback");
 }
 
 int LogGlue::GetLogName(lua_State* lua)
@@ -91,3 +143,250 @@ int LogGlue::GetLastLine(lua_State* lua)
 	return 3;
 }
 
+int LogGlue::GetChatLogStatistics(lua_State* lua)
+{
+	ChatLogWriter::Statistics statistics =
+		ChatLogWriter::Instance().GetStatistics();
+
+	lua_newtable(lua);
+	lua_pushinteger(lua, statistics.QueueDepth);
+	lua_setfield(lua, -2, "queued");
+	lua_pushinteger(lua, statistics.MaxQueueDepth);
+	lua_setfield(lua, -2, "maxqueued");
+	lua_pushinteger(lua, statistics.Lines);
+	lua_setfield(lua, -2, "lines");
+	lua_pushinteger(lua, statistics.Batches);
+	lua_setfield(lua, -2, "batches");
+	lua_pushinteger(lua, statistics.Writes);
+	lua_setfield(lua, -2, "writes");
+	lua_pushinteger(lua, statistics.Syncs);
+	lua_setfield(lua, -2, "syncs");
+	lua_pushinteger(lua, statistics.Errors);
+	lua_setfield(lua, -2, "errors");
+	lua_pushnumber(lua, statistics.AverageLatencyMilliseconds);
+	lua_setfield(lua, -2, "latency");
+	lua_pushinteger(lua, statistics.MaxLatencyMilliseconds);
+	lua_setfield(lua, -2, "maxlatency");
+	lua_pushinteger(lua, statistics.OpenFiles);
+	lua_setfield(lua, -2, "files");
+	lua_pushinteger(lua, statistics.FileHits);
+	lua_setfield(lua, -2, "filehits");
+	lua_pushinteger(lua, statistics.FileMisses);
+	lua_setfield(lua, -2, "filemisses");
+	lua_pushinteger(lua, statistics.FileEvictions);
+	lua_setfield(lua, -2, "fileevictions");
+	lua_pushinteger(lua, statistics.IdleFileCloses);
+	lua_setfield(lua, -2, "idlecloses");
+	lua_pushinteger(lua, statistics.SegmentsClosed);
+	lua_setfield(lua, -2, "segmentsclosed");
+	lua_pushinteger(lua, statistics.SegmentsCompressed);
+	lua_setfield(lua, -2, "segmentscompressed");
+	lua_pushnumber(lua, statistics.UncompressedBytes);
+	lua_setfield(lua, -2, "uncompressedbytes");
+	lua_pushnumber(lua, statistics.CompressedBytes);
+	lua_setfield(lua, -2, "compressedbytes");
+	return 1;
+}
+
+int LogGlue::LogSearch(lua_State* lua)
+{
+	const std::size_t DEFAULT_LIMIT = 10;
+	const std::size_t MAX_LIMIT = 100;
+
+	UnicodeString server;
+	std::string query, channel;
+	std::size_t limit = DEFAULT_LIMIT;
+	int argumentCount = lua_gettop(lua);
+	CheckArgument(lua, 1, LUA_TSTRING);
+	query = lua_tostring(lua, 1);
+	// The channel may be nil to search the current channel with a limit
+	if (argumentCount >= 2 && !lua_isnil(lua, 2))
+	{
+		CheckArgument(lua, 2, LUA_TSTRING);
+		channel = lua_tostring(lua, 2);
+	}
+	if (argumentCount >= 3 && !lua_isnil(lua, 3))
+	{
+		CheckArgument(lua, 3, LUA_TNUMBER);
+		lua_Integer requested = lua_tointeger(lua, 3);
+		limit = requested < 1 ? 1 : std::min<std::size_t>(requested, MAX_LIMIT);
+	}
+	if (argumentCount >= 4)
+	{
+		CheckArgument(lua, 4, LUA_TSTRING);
+		server = AsUnicode(lua_tostring(lua, 4));
+	}
+
+	LogSearchIndex::HitContainer hits;
+	try
+	{
+		client_->SearchLogs(query, limit, hits, channel, server);
+	}
+	catch (Exception& e)
+	{
+		return luaL_error(lua, AsUtf8(e.GetMessage()).c_str());
+	}
+
+	lua_createtable(lua, hits.size(), 0);
+	int mainTableIndex = lua_gettop(lua);
+	for (std::size_t hit = 0; hit < hits.size(); ++hit)
+	{
+		const LogSearchIndex::Hit& found = hits[hit];
+		std::string::size_type slash = found.File.rfind('/');
+		lua_createtable(lua, 0, 4);
+		lua_pushinteger(lua, found.Time);
+		lua_setfield(lua, -2, "time");
+		lua_pushstring(lua, found.Nick.c_str());
+		lua_setfield(lua, -2, "nick");
+		lua_pushstring(lua, found.Line.c_str());
+		lua_setfield(lua, -2, "line");
+		lua_pushstring(lua, slash == std::string::npos
+			? found.File.c_str() : found.File.c_str() + slash + 1);
+		lua_setfield(lua, -2, "log");
+		lua_rawseti(lua, mainTableIndex, hit + 1);
+	}
+	return 1;
+}
+
+int LogGlue::GetChannelStats(lua_State* lua)
+{
+	UnicodeString server;
+	std::string channel;
+	int argumentCount = lua_gettop(lua);
+	if (argumentCount >= 1 && !lua_isnil(lua, 1))
+	{
+		CheckArgument(lua, 1, LUA_TSTRING);
+		channel = lua_tostring(lua, 1);
+	}
+	if (argumentCount >= 2)
+	{
+		CheckArgument(lua, 2, LUA_TSTRING);
+		server = AsUnicode(lua_tostring(lua, 2));
+	}
+
+	ChannelStatistics::Channel statistics;
+	try
+	{
+		if (!client_->GetChannelStatistics(statistics, channel, server))
+		{
+			return 0;
+		}
+	}
+	catch (Exception& e)
+	{
+		return luaL_error(lua, AsUtf8(e.GetMessage()).c_str());
+	}
+
+	PushCounters(lua, statistics.Total);
+	lua_pushinteger(lua, statistics.Nicks);
+	lua_setfield(lua, -2, "nicks");
+	lua_createtable(lua, statistics.Top.size(), 0);
+	for (std::size_t talker = 0; talker < statistics.Top.size(); ++talker)
+	{
+		lua_createtable(lua, 0, 2);
+		lua_pushstring(lua, statistics.Top[talker].Nick.c_str());
+		lua_setfield(lua, -2, "nick");
+		lua_pushnumber(lua, statistics.Top[talker].Messages);
+		lua_setfield(lua, -2, "messages");
+		lua_rawseti(lua, -2, talker + 1);
+	}
+	lua_setfield(lua, -2, "top");
+	return 1;
+}
+
+int LogGlue::GetNickStats(lua_State* lua)
+{
+	UnicodeString server;
+	std::string nick, channel;
+	int argumentCount = lua_gettop(lua);
+	CheckArgument(lua, 1, LUA_TSTRING);
+	nick = lua_tostring(lua, 1);
+	if (argumentCount >= 2 && !lua_isnil(lua, 2))
+	{
+		CheckArgument(lua, 2, LUA_TSTRING);
+		channel = lua_tostring(lua, 2);
+	}
+	if (argumentCount >= 3)
+	{
+		CheckArgument(lua, 3, LUA_TSTRING);
+		server = AsUnicode(lua_tostring(lua, 3));
+	}
+
+	ChannelStatistics::Counters statistics;
+	try
+	{
+		if (!client_->GetNickStatistics(nick, statistics, channel, server))
+		{
+			return 0;
+		}
+	}
+	catch (Exception& e)
+	{
+		return luaL_error(lua, AsUtf8(e.GetMessage()).c_str());
+	}
+
+	PushCounters(lua, statistics);
+	return 1;
+}
+
+int LogGlue::GetScrollback(lua_State* lua)
+{
+	UnicodeString server;
+	std::string channel;
+	int argumentCount = lua_gettop(lua);
+	if (argumentCount >= 1 && !lua_isnil(lua, 1))
+	{
+		CheckArgument(lua, 1, LUA_TSTRING);
+		channel = lua_tostring(lua, 1);
+	}
+	if (argumentCount >= 2)
+	{
+		CheckArgument(lua, 2, LUA_TSTRING);
+		server = AsUnicode(lua_tostring(lua, 2));
+	}
+
+	std::string name;
+	const Scrollback* scrollback = 0;
+	unsigned long long first = 0;
+	unsigned long long end = 0;
+	try
+	{
+		scrollback = &client_->GetScrollback(name, channel, server);
+	}
+	catch (Exception& e)
+	{
+		return luaL_error(lua, AsUtf8(e.GetMessage()).c_str());
+	}
+	scrollback->GetRange(name, first, end);
+
+	// Newest line first, each call reads one line so a script that stops
+	// early has not copied the rest. Lines said meanwhile are not seen.
+	// The scrollback lives as long as the client, which outlives the state.
+	lua_pushlightuserdata(lua, const_cast<Scrollback*>(scrollback));
+	lua_pushstring(lua, name.c_str());
+	lua_pushnumber(lua, static_cast<lua_Number>(end));
+	lua_pushcclosure(lua, &LogGlue::NextScrollbackLine, 3);
+	return 1;
+}
+
+int LogGlue::NextScrollbackLine(lua_State* lua)
+{
+	const Scrollback* scrollback = static_cast<const Scrollback*>(
+		lua_touserdata(lua, lua_upvalueindex(1)));
+	const char* name = lua_tostring(lua, lua_upvalueindex(2));
+	unsigned long long end = static_cast<unsigned long long>(
+		lua_tonumber(lua, lua_upvalueindex(3)));
+	Scrollback::Line line;
+	// Lines dropped since the iterator was made end it early
+	if (end == 0 || !scrollback->Find(name, end - 1, line))
+	{
+		return 0;
+	}
+
+	lua_pushnumber(lua, static_cast<lua_Number>(end - 1));
+	lua_replace(lua, lua_upvalueindex(3));
+	lua_pushinteger(lua, line.Time);
+	lua_pushstring(lua, line.Nick.c_str());
+	lua_pushlstring(lua, line.Text.data(), line.Text.size());
+	return 3;
+}
@@ -3,6 +3,7 @@
 #include "../client.hpp"
 #include "../exception.hpp"
 #include "../message.hpp"
+#include "../netburst.hpp"
 #include "../lua/luafunction.hpp"
 #include "../logging/logger.hpp"
 
@@ -41,6 +42,7 @@ private:
     void AddFunctions();
 
     void OnEvent(const UnicodeString& server, const Message& message);
+    void OnBurst(const UnicodeString& server, const NetBurst& burst);
 
     typedef std::list<UnicodeString> StringContainer;
     typedef boost::shared_ptr<StringContainer> StringContainerPtr;
@@ -73,6 +75,7 @@ private:
     BlockingCallContainer blockingCalls_;
 
     Client::EventReceiverHandle eventHandle_;
+    Client::BurstReceiverHandle burstHandle_;
     int recursions_;
 
     UnicodeString lastServer_;
@@ -107,6 +110,8 @@ void MessageGlue::Reset(boost::shared_ptr<Lua> lua, Client* client)
     Glue::Reset(lua, client);
     eventHandle_ = client_->RegisterForEvent(boost::bind(&MessageGlue::OnEvent,
                                                          this, _1, _2));
+    burstHandle_ = client_->RegisterForBursts(boost::bind(&MessageGlue::OnBurst,
+                                                          this, _1, _2));
 }
 
 int MessageGlue::Send(lua_State* lua)
@@ -207,14 +212,16 @@ int MessageGlue::RegisterForEvent(lua_State* lua)
 
     std::string event = lua_tostring(lua, 1);
 
-    if (std::string("ON_MESSAGE") == event)
+    // A netsplit or netjoin comes as one call for the whole burst
+    if (std::string("ON_MESSAGE") == event || std::string("NETSPLIT") == event
+        || std::string("NETJOIN") == event)
     {
         try
         {
             lua_pushvalue(lua, 2);
             FunctionStatePair function(LuaFunction(lua), lua);
             lua_pop(lua, 1);
-            eventFunctions_["ON_MESSAGE"].push_back(function);
+            eventFunctions_[AsUnicode(event)].push_back(function);
         } catch (Exception& e)
         {
             return luaL_error(lua, AsUtf8(e.GetMessage()).c_str());
@@ -331,6 +338,48 @@ void MessageGlue::OnEvent(const UnicodeString& server,
     }
 }
 
+void MessageGlue::OnBurst(const UnicodeString& server, const NetBurst& burst)
+{
+    FunctionContainer& handlers =
+        eventFunctions_[burst.Type == NetBurstType::Netsplit
+                        ? "NETSPLIT" : "NETJOIN"];
+    for (FunctionContainer::iterator handler = handlers.begin();
+         handler != handlers.end();
+         ++handler)
+    {
+        lua_State* lua = handler->second;
+        if (!lua || lua_status(lua) != 0)
+        {
+            continue;
+        }
+        handler->first.Push();
+
+        // server, servers, { nicks }, { channels }, lines
+        lua_pushstring(lua, AsUtf8(server).c_str());
+        lua_pushstring(lua, burst.Servers.c_str());
+        const std::vector<std::string>* lists[] =
+            { &burst.Nicks, &burst.Channels };
+        for (std::size_t list = 0; list < 2; ++list)
+        {
+            lua_createtable(lua, lists[list]->size(), 0);
+            int tableIndex = lua_gettop(lua);
+            for (std::size_t i = 0; i < lists[list]->size(); ++i)
+            {
+                lua_pushstring(lua, (*lists[list])[i].c_str());
+                lua_rawseti(lua, tableIndex, i + 1);
+            }
+        }
+        lua_pushnumber(lua, burst.Lines);
+        if (lua_->FunctionCall(lua, 5, 0) != 0)
+        {
+            const char* error = lua_tostring(lua, -1);
+            Log << LogLevel::Error << "Netsplit handler failed: "
+                << (error ? error : "unknown error");
+        }
+        lua_pop(lua, lua_gettop(lua));
+    }
+}
+
 MessageGlue::StringContainerPtr MessageGlue::ProcessMessageEvent(
         const UnicodeString& server, const std::string& fromNick,
         const UnicodeString& fromUser, const UnicodeString& fromHost,
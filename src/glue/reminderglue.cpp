@@ -44,7 +44,7 @@ void ReminderGlue::Reset(boost::shared_ptr<Lua> lua, Client* client)
 	Glue::Reset(lua, client);
 	reminderManager_.reset(new ReminderManager(
 			client_->GetConfig().GetRemindersFilename(), boost::bind(
-					&Client::SendMessage, client_, _1, _2, _3)));
+					&Client::SendLowPriorityMessage, client_, _1, _2, _3)));
 }
 
 int ReminderGlue::AddReminder(lua_State* lua)
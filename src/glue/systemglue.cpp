@@ -1,5 +1,6 @@
 #include "glue.hpp"
 #include "gluemanager.hpp"
+#include "../chatlogwriter.hpp"
 #include "../client.hpp"
 #include "../exception.hpp"
 #include "../forkcommand.hpp"
@@ -40,6 +41,10 @@ int SystemGlue::RunCommand(lua_State* lua)
 
 	const char* command = lua_tostring(lua, 1);
 
+	// The command may read the logs that \l names in a reply. It runs on
+	// this thread until it exits, waiting for the writer as well costs
+	// little next to that.
+	ChatLogWriter::Instance().Flush();
 	std::string result = ForkCommand(command);
 
 	std::string::size_type pos = result.find('\n');
@@ -0,0 +1,121 @@
+#include "identifiertable.hpp"
+
+#include <boost/functional/hash.hpp>
+
+const IdentifierTable::Id IdentifierTable::NO_ID = static_cast<Id>(-1);
+
+// Longer than any nick or channel a server allows
+const std::size_t FOLD_BUFFER_SIZE = 256;
+
+std::size_t IdentifierTable::Hash::operator()(boost::string_ref name) const
+{
+    return boost::hash_range(name.begin(), name.end());
+}
+
+IdentifierTable::IdentifierTable(CaseMapping::CaseMapping mapping)
+    : mapping_(mapping)
+{
+}
+
+void IdentifierTable::SetCaseMapping(CaseMapping::CaseMapping mapping)
+{
+    if (mapping == mapping_)
+    {
+	return;
+    }
+    mapping_ = mapping;
+    ids_.clear();
+    // Every id that is not free is in the map, in the order it was given
+    std::vector<bool> isFree(entries_.size(), false);
+    for (std::size_t i = 0; i < free_.size(); ++i)
+    {
+	isFree[free_[i]] = true;
+    }
+    for (Id id = 0; id < entries_.size(); ++id)
+    {
+	if (!isFree[id])
+	{
+	    Entry& entry = entries_[id];
+	    entry.Folded = CaseMapping::Fold(entry.Name, mapping_);
+	    ids_.insert(IdMap::value_type(entry.Folded, id));
+	}
+    }
+}
+
+IdentifierTable::Id IdentifierTable::Intern(boost::string_ref name)
+{
+    Id id = Find(name);
+    if (id != NO_ID)
+    {
+	return id;
+    }
+
+    if (free_.empty())
+    {
+	id = entries_.size();
+	entries_.push_back(Entry());
+    }
+    else
+    {
+	id = free_.back();
+	free_.pop_back();
+    }
+    Entry& entry = entries_[id];
+    entry.Name.assign(name.begin(), name.end());
+    entry.Folded = CaseMapping::Fold(name, mapping_);
+    ids_.insert(IdMap::value_type(entry.Folded, id));
+    return id;
+}
+
+IdentifierTable::Id IdentifierTable::Find(boost::string_ref name) const
+{
+    char buffer[FOLD_BUFFER_SIZE];
+    IdMap::const_iterator id;
+    if (CaseMapping::Fold(name, mapping_, buffer, sizeof(buffer)))
+    {
+	id = ids_.find(boost::string_ref(buffer, name.size()), Hash(), Equal());
+    }
+    else
+    {
+	id = ids_.find(CaseMapping::Fold(name, mapping_));
+    }
+    return id == ids_.end() ? NO_ID : id->second;
+}
+
+bool IdentifierTable::Rename(Id id, boost::string_ref name)
+{
+    Id existing = Find(name);
+    if (existing != NO_ID && existing != id)
+    {
+	return false;
+    }
+    Entry& entry = entries_[id];
+    if (existing == NO_ID)
+    {
+	Unmap(id);
+	entry.Folded = CaseMapping::Fold(name, mapping_);
+	ids_.insert(IdMap::value_type(entry.Folded, id));
+    }
+    // The same nick with other case only changes how it is written
+    entry.Name.assign(name.begin(), name.end());
+    return true;
+}
+
+void IdentifierTable::Forget(Id id)
+{
+    Unmap(id);
+    Entry& entry = entries_[id];
+    entry.Name.clear();
+    entry.Folded.clear();
+    free_.push_back(id);
+}
+
+void IdentifierTable::Unmap(Id id)
+{
+    // After a new case mapping an id can have lost its name to another
+    IdMap::iterator mapped = ids_.find(entries_[id].Folded);
+    if (mapped != ids_.end() && mapped->second == id)
+    {
+	ids_.erase(mapped);
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "casemapping.hpp"
+
+#include <string>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+#include <boost/utility/string_ref.hpp>
+
+/**
+ * Interns nicks or channels to small ids. Names are folded with the
+ * server's case mapping when they are interned, so Foo and foo get the same
+ * id and comparing two identifiers is comparing two integers. Ids of
+ * forgotten names are reused.
+ * Not thread safe, the owner has to lock around it.
+ */
+class IdentifierTable
+{
+public:
+    typedef unsigned int Id;
+    static const Id NO_ID;
+
+    explicit IdentifierTable(
+	CaseMapping::CaseMapping mapping = CaseMapping::Rfc1459);
+
+    /**
+     * Fold the names again with another case mapping. Names that are
+     * equal with the new mapping keep the id that was given first.
+     */
+    void SetCaseMapping(CaseMapping::CaseMapping mapping);
+    CaseMapping::CaseMapping GetCaseMapping() const { return mapping_; }
+
+    /**
+     * @return the id of the name, a new one if it is not known
+     */
+    Id Intern(boost::string_ref name);
+
+    /**
+     * Look up a name without allocating.
+     * @return NO_ID if it is not known
+     */
+    Id Find(boost::string_ref name) const;
+
+    /**
+     * Give an id another name, as it is written by the server.
+     * @return false if the new name already has another id
+     */
+    bool Rename(Id id, boost::string_ref name);
+
+    void Forget(Id id);
+
+    /**
+     * The name as it was last interned or renamed, not folded.
+     */
+    const std::string& GetName(Id id) const { return entries_[id].Name; }
+
+    std::size_t size() const { return ids_.size(); }
+
+    // Ids are below this, for tables indexed by id
+    std::size_t GetIdLimit() const { return entries_.size(); }
+
+private:
+    struct Entry
+    {
+	std::string Name;
+	std::string Folded;
+    };
+
+    // Hashes folded names whether they are strings or refs
+    struct Hash
+    {
+	std::size_t operator()(boost::string_ref name) const;
+    };
+    struct Equal
+    {
+	bool operator()(boost::string_ref a, boost::string_ref b) const
+	{
+	    return a == b;
+	}
+    };
+    typedef boost::unordered_map<std::string, Id, Hash, Equal> IdMap;
+
+    void Unmap(Id id);
+
+    CaseMapping::CaseMapping mapping_;
+    std::vector<Entry> entries_;
+    std::vector<Id> free_;
+    IdMap ids_;
+};
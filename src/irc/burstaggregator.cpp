@@ -0,0 +1,255 @@
+#include "burstaggregator.hpp"
+#include "../exception.hpp"
+#include "../logging/logger.hpp"
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+using boost::posix_time::ptime;
+using boost::posix_time::microsec_clock;
+using boost::posix_time::milliseconds;
+
+/**
+ * Host names, or masks like *.net that some networks show instead.
+ */
+static bool IsServerName(boost::string_ref name)
+{
+    if (name.empty() || name[0] == '.' || name[name.size() - 1] == '.'
+        || name.find('.') == boost::string_ref::npos)
+    {
+        return false;
+    }
+    for (std::size_t i = 0; i < name.size(); ++i)
+    {
+        char c = name[i];
+        // Not isalnum, the reason is not in the locale's character set
+        if (!(c >= 'a' && c <= 'z') && !(c >= 'A' && c <= 'Z')
+            && !(c >= '0' && c <= '9')
+            && c != '.' && c != '-' && c != '_' && c != '*')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+Irc::BurstAggregator::BurstAggregator(BurstCallback onBurst,
+                                      const Settings& settings)
+    : onBurst_(onBurst)
+    , settings_(settings)
+    , timer_(IoServicePool::Instance().GetIoService())
+    , timerArmed_(false)
+    , closing_(false)
+{
+    statistics_.Netsplits = 0;
+    statistics_.Netjoins = 0;
+    statistics_.SplitQuits = 0;
+    statistics_.NetjoinJoins = 0;
+    statistics_.LargestBurst = 0;
+}
+
+Irc::BurstAggregator::~BurstAggregator()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        closing_ = true;
+        boost::system::error_code error;
+        timer_.cancel(error);
+    }
+    pending_.WaitForAll();
+}
+
+void Irc::BurstAggregator::SetSettings(const Settings& settings)
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    settings_ = settings;
+}
+
+bool Irc::BurstAggregator::IsSplitReason(boost::string_ref reason)
+{
+    boost::string_ref::size_type space = reason.find(' ');
+    if (space == boost::string_ref::npos)
+    {
+        return false;
+    }
+    boost::string_ref first = reason.substr(0, space);
+    boost::string_ref second = reason.substr(space + 1);
+    return IsServerName(first) && IsServerName(second) && first != second;
+}
+
+bool Irc::BurstAggregator::OnQuit(const std::string& nick,
+                                  boost::string_ref reason,
+                                  const std::vector<std::string>& channels)
+{
+    if (!IsSplitReason(reason))
+    {
+        return false;
+    }
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    if (settings_.BurstWindowMilliseconds == 0)
+    {
+        return false;
+    }
+    ptime now = microsec_clock::universal_time();
+    std::string servers(reason.begin(), reason.end());
+    Add(NetBurstType::Netsplit, servers, nick,
+        channels.empty() ? 0 : &channels[0], channels.size(), now);
+    ++statistics_.SplitQuits;
+
+    // Remembered so that its JOINs are known as the netjoin
+    SplitNick& split = splitNicks_[nick];
+    split.Servers = servers;
+    split.SplitAt = now;
+    return true;
+}
+
+bool Irc::BurstAggregator::OnJoin(const std::string& nick,
+                                  const std::string& channel)
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    if (settings_.BurstWindowMilliseconds == 0 || splitNicks_.empty())
+    {
+        return false;
+    }
+    SplitNickMap::const_iterator split = splitNicks_.find(nick);
+    if (split == splitNicks_.end())
+    {
+        return false;
+    }
+    ptime now = microsec_clock::universal_time();
+    if (now - split->second.SplitAt
+        > milliseconds(settings_.NetjoinWindowMilliseconds))
+    {
+        // Came back too late to be part of the netjoin
+        splitNicks_.erase(split);
+        return false;
+    }
+    // A nick comes back to each of its channels, so it is remembered
+    // until the netjoin window is over
+    Add(NetBurstType::Netjoin, split->second.Servers, nick, &channel, 1, now);
+    ++statistics_.NetjoinJoins;
+    return true;
+}
+
+void Irc::BurstAggregator::Clear()
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    bursts_.clear();
+    splitNicks_.clear();
+}
+
+Irc::BurstAggregator::Statistics Irc::BurstAggregator::GetStatistics() const
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return statistics_;
+}
+
+void Irc::BurstAggregator::Add(NetBurstType::NetBurstType type,
+                               const std::string& servers,
+                               const std::string& nick,
+                               const std::string* channels,
+                               std::size_t channelCount,
+                               ptime now)
+{
+    PendingBurst& burst = bursts_[BurstKey(type, servers)];
+    burst.Nicks.insert(nick);
+    burst.Channels.insert(channels, channels + channelCount);
+    ++burst.Lines;
+    burst.LastLine = now;
+    Arm();
+}
+
+void Irc::BurstAggregator::Arm()
+{
+    if (timerArmed_ || closing_ || bursts_.empty())
+    {
+        return;
+    }
+    // Bursts only ever end later than this, waking up early is harmless
+    ptime wakeUp = bursts_.begin()->second.LastLine;
+    for (PendingBurstMap::const_iterator burst = bursts_.begin();
+         burst != bursts_.end();
+         ++burst)
+    {
+        wakeUp = std::min(wakeUp, burst->second.LastLine);
+    }
+    timerArmed_ = true;
+    timer_.expires_at(wakeUp + milliseconds(settings_.BurstWindowMilliseconds));
+    pending_.Begin();
+    timer_.async_wait(boost::bind(&BurstAggregator::OnTimer, this, _1));
+}
+
+void Irc::BurstAggregator::OnTimer(const boost::system::error_code& error)
+{
+    std::vector<NetBurst> ended;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        timerArmed_ = false;
+        if (!error && !closing_)
+        {
+            ptime now = microsec_clock::universal_time();
+            milliseconds window(settings_.BurstWindowMilliseconds);
+            for (PendingBurstMap::iterator burst = bursts_.begin();
+                 burst != bursts_.end();)
+            {
+                if (now - burst->second.LastLine < window)
+                {
+                    ++burst;
+                    continue;
+                }
+                ended.push_back(NetBurst());
+                NetBurst& netBurst = ended.back();
+                netBurst.Type = burst->first.first;
+                netBurst.Servers = burst->first.second;
+                netBurst.Nicks.assign(burst->second.Nicks.begin(),
+                                      burst->second.Nicks.end());
+                netBurst.Channels.assign(burst->second.Channels.begin(),
+                                         burst->second.Channels.end());
+                netBurst.Lines = burst->second.Lines;
+
+                if (netBurst.Type == NetBurstType::Netsplit)
+                {
+                    ++statistics_.Netsplits;
+                }
+                else
+                {
+                    ++statistics_.Netjoins;
+                }
+                statistics_.LargestBurst = std::max(statistics_.LargestBurst,
+                                                    netBurst.Lines);
+                bursts_.erase(burst++);
+            }
+
+            // Nicks that have not come back by now are not part of a netjoin
+            milliseconds netjoinWindow(settings_.NetjoinWindowMilliseconds);
+            for (SplitNickMap::iterator split = splitNicks_.begin();
+                 split != splitNicks_.end();)
+            {
+                if (now - split->second.SplitAt > netjoinWindow)
+                {
+                    split = splitNicks_.erase(split);
+                }
+                else
+                {
+                    ++split;
+                }
+            }
+            Arm();
+        }
+    }
+
+    for (std::vector<NetBurst>::const_iterator burst = ended.begin();
+         burst != ended.end();
+         ++burst)
+    {
+        try
+        {
+            onBurst_(*burst);
+        } catch (Exception& e)
+        {
+            Log << LogLevel::Error << e.GetMessage();
+        }
+    }
+    pending_.End();
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "../netburst.hpp"
+#include "../connection/ioservicepool.hpp"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/utility.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace Irc
+{
+
+/**
+ * Recognises the QUITs of a netsplit and the JOINs of the netjoin that
+ * follows, and collects each burst of them into one NetBurst. A burst is
+ * handed on once no line has been added to it for the burst window.
+ */
+class BurstAggregator : boost::noncopyable
+{
+public:
+    struct Settings
+    {
+	// Quiet time that ends a burst, zero turns aggregation off
+	unsigned int BurstWindowMilliseconds;
+	// How long after a split the JOINs of the nicks that left are taken
+	// as the netjoin
+	unsigned int NetjoinWindowMilliseconds;
+    };
+
+    struct Statistics
+    {
+	unsigned long Netsplits;
+	unsigned long Netjoins;
+	// Lines that went into a burst instead of being handled one by one
+	unsigned long SplitQuits;
+	unsigned long NetjoinJoins;
+	// Most lines in one burst
+	unsigned long LargestBurst;
+    };
+
+    typedef boost::function<void (const NetBurst&)> BurstCallback;
+
+    /**
+     * @param onBurst called from an I/O thread when a burst has ended
+     */
+    BurstAggregator(BurstCallback onBurst, const Settings& settings);
+    ~BurstAggregator();
+
+    void SetSettings(const Settings& settings);
+
+    /**
+     * A netsplit QUIT has the two servers as its reason, like
+     * "hub.example.net leaf.example.net". Servers put "Quit: " in front of
+     * reasons users give, so users cannot fake one.
+     */
+    static bool IsSplitReason(boost::string_ref reason);
+
+    /**
+     * @param channels the channels the nick was in
+     * @return true if the QUIT was taken into a netsplit
+     */
+    bool OnQuit(const std::string& nick,
+                boost::string_ref reason,
+                const std::vector<std::string>& channels);
+
+    /**
+     * @return true if the JOIN was taken into a netjoin
+     */
+    bool OnJoin(const std::string& nick, const std::string& channel);
+
+    /**
+     * Forget bursts in progress and the nicks that split, used when a new
+     * connection is made.
+     */
+    void Clear();
+
+    Statistics GetStatistics() const;
+
+private:
+    struct PendingBurst
+    {
+	PendingBurst() : Lines(0) {}
+
+	std::set<std::string> Nicks;
+	std::set<std::string> Channels;
+	unsigned long Lines;
+	boost::posix_time::ptime LastLine;
+    };
+    typedef std::pair<NetBurstType::NetBurstType, std::string> BurstKey;
+    typedef std::map<BurstKey, PendingBurst> PendingBurstMap;
+
+    struct SplitNick
+    {
+	std::string Servers;
+	boost::posix_time::ptime SplitAt;
+    };
+    typedef boost::unordered_map<std::string, SplitNick> SplitNickMap;
+
+    void Add(NetBurstType::NetBurstType type,
+             const std::string& servers,
+             const std::string& nick,
+             const std::string* channels,
+             std::size_t channelCount,
+             boost::posix_time::ptime now);
+    void Arm();
+    void OnTimer(const boost::system::error_code& error);
+
+    BurstCallback onBurst_;
+    Settings settings_;
+
+    PendingBurstMap bursts_;
+    SplitNickMap splitNicks_;
+
+    Statistics statistics_;
+
+    boost::asio::deadline_timer timer_;
+    bool timerArmed_;
+    bool closing_;
+    PendingOperations pending_;
+    mutable boost::mutex mutex_;
+};
+
+} // namespace Irc
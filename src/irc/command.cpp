@@ -0,0 +1,115 @@
+#include "command.hpp"
+
+#include <cstring>
+
+namespace
+{
+
+// Indexed by the enum, which is generated from the same list
+const char* const COMMAND_NAMES[] =
+{
+    "UNKNOWN_COMMAND",
+#define IRC_COMMAND_NAME(name, text) text,
+    IRC_COMMANDS(IRC_COMMAND_NAME)
+#undef IRC_COMMAND_NAME
+};
+
+// Enough room for the word commands to rarely need more than one probe
+const std::size_t WORD_TABLE_SIZE = 256;
+// No word command is longer, anything longer is unknown without hashing
+const std::size_t MAX_WORD_LENGTH = 16;
+
+inline std::size_t HashWord(boost::string_ref word)
+{
+    // FNV-1a
+    std::size_t hash = 2166136261u;
+    for (boost::string_ref::const_iterator c = word.begin();
+         c != word.end();
+         ++c)
+    {
+        hash = (hash ^ static_cast<unsigned char>(*c)) * 16777619u;
+    }
+    return hash & (WORD_TABLE_SIZE - 1);
+}
+
+inline bool IsNumeric(boost::string_ref text)
+{
+    return text.size() == 3
+        && text[0] >= '0' && text[0] <= '9'
+        && text[1] >= '0' && text[1] <= '9'
+        && text[2] >= '0' && text[2] <= '9';
+}
+
+inline std::size_t DecodeNumeric(boost::string_ref text)
+{
+    return (text[0] - '0') * 100 + (text[1] - '0') * 10 + (text[2] - '0');
+}
+
+/**
+ * Both tables hold enum values, UNKNOWN_COMMAND for empty slots. They are
+ * filled once from the list when the program starts and only read after.
+ */
+struct CommandTables
+{
+    CommandTables()
+    {
+	std::memset(Numerics, 0, sizeof(Numerics));
+	std::memset(Words, 0, sizeof(Words));
+	for (int i = 1; i < Irc::Command::COMMAND_COUNT; ++i)
+	{
+	    boost::string_ref text(COMMAND_NAMES[i]);
+	    if (IsNumeric(text))
+	    {
+		Numerics[DecodeNumeric(text)] = i;
+		continue;
+	    }
+	    // Open addressing, the table is never close to full
+	    std::size_t slot = HashWord(text);
+	    while (Words[slot] != Irc::Command::UNKNOWN_COMMAND)
+	    {
+		slot = (slot + 1) & (WORD_TABLE_SIZE - 1);
+	    }
+	    Words[slot] = i;
+	}
+    }
+
+    unsigned short Numerics[1000];
+    unsigned short Words[WORD_TABLE_SIZE];
+};
+
+const CommandTables tables;
+
+} // namespace
+
+Irc::Command::Command Irc::CommandFromString(boost::string_ref text)
+{
+    if (IsNumeric(text))
+    {
+	return static_cast<Command::Command>(
+	    tables.Numerics[DecodeNumeric(text)]);
+    }
+    if (text.empty() || text.size() > MAX_WORD_LENGTH)
+    {
+	return Command::UNKNOWN_COMMAND;
+    }
+    for (std::size_t slot = HashWord(text);
+	 tables.Words[slot] != Command::UNKNOWN_COMMAND;
+	 slot = (slot + 1) & (WORD_TABLE_SIZE - 1))
+    {
+	unsigned short command = tables.Words[slot];
+	if (text == COMMAND_NAMES[command])
+	{
+	    return static_cast<Command::Command>(command);
+	}
+    }
+    return Command::UNKNOWN_COMMAND;
+}
+
+const char* Irc::CommandName(Command::Command command)
+{
+    if (command < Command::UNKNOWN_COMMAND || command >= Command::COMMAND_COUNT)
+    {
+	return COMMAND_NAMES[Command::UNKNOWN_COMMAND];
+    }
+    return COMMAND_NAMES[command];
+}
@@ -1,68 +1,55 @@
 #include "ircmessage.hpp"
+#include "messageparser.hpp"
 #include "../exception.hpp"
 
 #include <converter.hpp>
 
-#include <sstream>
-
-#include <boost/regex/icu.hpp>
-
-boost::regex Irc::IrcMessage::dataRegex_;
-
-Irc::IrcMessage::IrcMessage(const std::string& data)
+Irc::IrcMessage::IrcMessage(boost::string_ref data)
     : command_(Command::UNKNOWN_COMMAND)
     , isCtcp_(false)
 {
-    try
+    line_ = data;
+    tags_ = MakeSpan(boost::string_ref());
+
+    ParsedLine parsed;
+    // Longer lines than the spans can hold are never received
+    if (data.size() <= 0xffff && ParseLine(data, parsed))
     {
-        if (dataRegex_.empty())
+        tags_ = MakeSpan(parsed.Tags);
+        nick_ = MakeSpan(parsed.Nick);
+        user_ = MakeSpan(parsed.User);
+        host_ = MakeSpan(parsed.Host);
+        command_ = CommandFromString(parsed.Command);
+
+        parameterCount_ = parsed.ParameterCount;
+        for (std::size_t i = 0; i < parsed.ParameterCount; ++i)
         {
-            // First match prefix, then command, then non-space parameters
-            // and finally any last parameter preceeded by colon
-            dataRegex_ = boost::regex(
-                    "(?::([^ ]+) )?([^ ]+)(?: ([^:]+))?(?: :(.*))?");
+            parameters_[i] = MakeSpan(parsed.Parameters[i]);
         }
+        CheckCtcp();
+    }
+}
 
-        boost::smatch matches;
-        if (boost::regex_match(data, matches, dataRegex_))
+bool Irc::IrcMessage::GetTag(boost::string_ref key, std::string& value) const
+{
+    boost::string_ref tags(GetRef(tags_));
+    boost::string_ref tagKey, tagValue;
+    while (NextTag(tags, tagKey, tagValue))
+    {
+        if (tagKey == key)
         {
-            // matches[0] is the entire match, submatches start at 1
-            prefix_ = Prefix(matches[1].str());
-            try
-            {
-                command_ = Commands.at(matches[2].str());
-            }
-            catch (std::out_of_range&)
-            {
-                command_ = Command::UNKNOWN_COMMAND;
-            }
-
-            // The non-space parameters are matched as an entire string.
-            // Since boost might not support captures for each match
-            // we will have to split this string ourselves
-            std::stringstream stream(matches[3]);
-            std::copy(std::istream_iterator<std::string>(stream),
-                    std::istream_iterator<std::string>(), std::back_inserter(
-                            parameters_));
-
-            // Last parameter if any
-            if (matches[4].matched)
-            {
-                parameters_.push_back(matches[4]);
-            }
-            CheckCtcp();
+            UnescapeTagValue(tagValue, value);
+            return true;
         }
-    } catch (boost::regex_error& e)
-    {
-        throw Exception(__FILE__, __LINE__, e.what());
     }
+    return false;
 }
 
 const std::string& Irc::IrcMessage::GetTarget() const
 {
     if (GetCommand() == Command::PRIVMSG)
     {
-        return parameters_[0];
+        return (*this)[0];
     }
     throw Exception(__FILE__, __LINE__, AsUnicode(
             "Invalid call to Irc::IrcMessage::GetTarget() for message of type "
@@ -73,7 +60,7 @@ const std::string& Irc::IrcMessage::GetText() const
 {
     if (GetCommand() == Command::PRIVMSG)
     {
-        return parameters_[1];
+        return (*this)[1];
     }
     throw Exception(__FILE__, __LINE__, AsUnicode(
             "Invalid call to Irc::Message::GetText() for message of type "
@@ -93,13 +80,20 @@ const std::string& Irc::IrcMessage::GetReplyTo() const
 
 void Irc::IrcMessage::CheckCtcp()
 {
-    if(command_ == Irc::Command::PRIVMSG && parameters_.size() >= 2 && parameters_[1].find("\1") == 0){
+    if (command_ != Command::PRIVMSG || parameterCount_ < 2)
+    {
+        return;
+    }
+    // Leave the \1 markers out of the text
+    Span& text = parameters_[1];
+    if (text.Length > 0 && line_[text.Begin] == '\1')
+    {
         isCtcp_ = true;
-        parameters_[1].erase(0, 1);
-        std::string::size_type pos = parameters_[1].rfind("\1");
-        if(pos == parameters_[1].size() - 1){
-            parameters_[1].erase(pos);
+        ++text.Begin;
+        --text.Length;
+        if (text.Length > 0 && line_[text.Begin + text.Length - 1] == '\1')
+        {
+            --text.Length;
         }
     }
-
 }
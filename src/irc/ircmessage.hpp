@@ -3,8 +3,7 @@
 #include "../message.hpp"
 #include "command.hpp"
 
-#include <vector>
-#include <boost/regex.hpp>
+#include <boost/utility/string_ref.hpp>
 #include <unicode/unistr.h>
 
 namespace Irc
@@ -14,39 +13,34 @@ class IrcMessage : public Message
 {
 public:
     /**
-     * @throw Exception if analyzing of the data fails catastrophically.
+     * A line that can not be parsed gives a message without prefix and
+     * parameters and with an unknown command.
+     * @param data has to outlive the message, nothing is copied out of it
+     *        until it is asked for
      */
-    explicit IrcMessage(const std::string& data);
+    explicit IrcMessage(boost::string_ref data);
 
-    typedef std::vector<std::string> ParameterContainer;
-    typedef std::pair<ParameterContainer::const_iterator,
-                      ParameterContainer::const_iterator> ParameterIterators;
-
-    const Prefix& GetPrefix() const { return prefix_; }
     const Command::Command& GetCommand() const { return command_; }
 
-    typedef ParameterContainer::const_iterator const_iterator;
-
-    const_iterator begin() const { return parameters_.begin(); }
-    const_iterator end() const { return parameters_.end(); }
-
-    template<class T>
-    std::string operator[](T index) const { return parameters_[index]; }
-    ParameterContainer::size_type size() const { return parameters_.size(); }
-
     virtual const std::string& GetTarget() const;
     virtual const std::string& GetText() const;
     virtual const std::string& GetReplyTo() const;
 
     bool IsCtcp() const { return isCtcp_; }
 
+    /**
+     * Look up an IRCv3 message tag, tags without a value give an empty
+     * value.
+     * @return false if the message has no such tag
+     */
+    bool GetTag(boost::string_ref key, std::string& value) const;
+
 private:
     void CheckCtcp();
 
     Command::Command command_;
     bool isCtcp_;
-
-    static boost::regex dataRegex_;
+    Span tags_;
 };
 
 } // namespace Irc
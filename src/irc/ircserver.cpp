@@ -1,5 +1,6 @@
 #include "ircserver.hpp"
 #include "ircmessage.hpp"
+#include "messageparser.hpp"
 #include "../logging/logger.hpp"
 #include "../exception.hpp"
 
@@ -10,6 +11,7 @@
 #include <boost/filesystem/convenience.hpp>
 #include <boost/filesystem/exception.hpp>
 #include <boost/algorithm/string/trim.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #include <sys/utsname.h>
 
@@ -17,6 +19,103 @@ const std::string VersionName = "Uno";
 const std::string VersionVersion = "$Revision$";
 std::string VersionEnvironment = "Unknown";
 
+// Until configured otherwise outgoing traffic is not limited
+static Irc::SendScheduler::Limits NoFloodControl()
+{
+    Irc::SendScheduler::Limits limits = { 0, 0, 0, 0 };
+    return limits;
+}
+
+/**
+ * Pick the scheduler lane for an outgoing line and the target it is
+ * competing with other lines for.
+ */
+static Irc::SendScheduler::Priority ClassifyLine(const std::string& data,
+                                                 std::string& target)
+{
+    std::string::size_type commandEnd = data.find(' ');
+    std::string command = data.substr(0, commandEnd);
+    target.clear();
+    if (commandEnd != std::string::npos)
+    {
+        std::string::size_type targetEnd = data.find(' ', commandEnd + 1);
+        target = data.substr(commandEnd + 1,
+                             targetEnd == std::string::npos
+                             ? std::string::npos
+                             : targetEnd - commandEnd - 1);
+    }
+
+    if (command == "PING" || command == "PONG")
+    {
+        return Irc::SendScheduler::Ping;
+    }
+    else if (command == "PASS" || command == "NICK" || command == "USER"
+             || command == "CAP" || command == "JOIN" || command == "PART"
+             || command == "QUIT")
+    {
+        return Irc::SendScheduler::Registration;
+    }
+    else if ((command == "PRIVMSG" || command == "NOTICE")
+             && target.find_first_of("#&") == 0)
+    {
+        return Irc::SendScheduler::Channel;
+    }
+    return Irc::SendScheduler::Reply;
+}
+
+// Capabilities asked for when the server offers them
+static const char* const WANTED_CAPABILITIES[] =
+{
+    "multi-prefix",
+    "userhost-in-names",
+    "extended-join",
+    "account-notify",
+    "chghost"
+};
+
+// Until RPL_ISUPPORT says otherwise, what most servers have
+static const char* const DEFAULT_MEMBER_MODES = "qaohv";
+static const char* const DEFAULT_MEMBER_PREFIXES = "~&@%+";
+static const char* const DEFAULT_CHANNEL_MODES = "beI,k,l,imnpst";
+
+// Marks our WHOX replies, any number up to three digits
+static const char* const WHOX_TOKEN = "152";
+
+/**
+ * Split CHANMODES=A,B,C,D into the list modes, the modes that always take a
+ * parameter and the modes that only take one when set. Type D modes never
+ * take one and are all the others.
+ */
+static void ParseChannelModes(boost::string_ref modes,
+                              std::string& listModes,
+                              std::string& parameterModes,
+                              std::string& setParameterModes)
+{
+    std::string* types[] = { &listModes, &parameterModes, &setParameterModes };
+    for (std::size_t i = 0; i < sizeof(types) / sizeof(*types); ++i)
+    {
+        boost::string_ref::size_type comma = modes.find(',');
+        boost::string_ref type = modes.substr(0, comma);
+        types[i]->assign(type.begin(), type.end());
+        modes = comma == boost::string_ref::npos
+            ? boost::string_ref() : modes.substr(comma + 1);
+    }
+}
+
+// Until configured otherwise the lag is not monitored
+static Irc::LagMonitor::Settings NoLagMonitor()
+{
+    Irc::LagMonitor::Settings settings = { 0, 0 };
+    return settings;
+}
+
+// Until configured otherwise every QUIT and JOIN is handled by itself
+static Irc::BurstAggregator::Settings NoBurstAggregation()
+{
+    Irc::BurstAggregator::Settings settings = { 0, 0 };
+    return settings;
+}
+
 Irc::IrcServer::IrcServer(const UnicodeString& id,
                const UnicodeString& host,
                unsigned int port,
@@ -24,7 +123,18 @@ Irc::IrcServer::IrcServer(const UnicodeString& id,
                const UnicodeString& nick,
                const UnicodeString& serverPassword)
     : Server(id, host, port, logDirectory, nick, serverPassword)
-    , appendingChannelNicks_(false)
+    , scheduler_(boost::bind(&Irc::IrcServer::Write, this, _1),
+                 NoFloodControl())
+    , lagMonitor_(boost::bind(&Irc::IrcServer::SendPing, this, _1),
+                  boost::bind(&Irc::IrcServer::OnLagTimeout, this),
+                  NoLagMonitor())
+    , memberModes_(DEFAULT_MEMBER_MODES)
+    , memberPrefixes_(DEFAULT_MEMBER_PREFIXES)
+    , hasWhox_(false)
+    , negotiatingCapabilities_(false)
+    , lineInBurst_(false)
+    , burstAggregator_(boost::bind(&Irc::IrcServer::OnBurst, this, _1),
+                       NoBurstAggregation())
 {
     struct utsname name;
     if (uname(&name) == 0)
@@ -33,6 +143,8 @@ Irc::IrcServer::IrcServer(const UnicodeString& id,
         ss << name.sysname << " " << name.release;
         VersionEnvironment = ss.str();
     }
+    ParseChannelModes(DEFAULT_CHANNEL_MODES, listModes_, parameterModes_,
+                      setParameterModes_);
 
     RegisterSelfAsReceiver();
 }
@@ -45,18 +157,37 @@ Irc::IrcServer::~IrcServer()
 
 void Irc::IrcServer::IrcServer::Connect()
 {
-    connection_.Connect(GetHostName(), GetPort());
+    Connection::HostContainer hosts(1, Connection::Host(GetHostName(),
+                                                        GetPort()));
+    hosts.insert(hosts.end(), fallbackHosts_.begin(), fallbackHosts_.end());
+    connection_.Connect(hosts);
+}
+
+void Irc::IrcServer::AddFallbackHost(const UnicodeString& host,
+                                     unsigned int port)
+{
+    fallbackHosts_.push_back(Connection::Host(host, port));
 }
 
 void Irc::IrcServer::Send(const std::string& data)
 {
-    std::vector<char> buffer;
-    std::copy(data.begin(), data.end(), std::back_inserter(buffer));
-    buffer.push_back('\r');
-    buffer.push_back('\n');
+    std::string target;
+    SendScheduler::Priority priority = ClassifyLine(data, target);
+    Send(data, priority, target);
+}
+
+void Irc::IrcServer::Send(const std::string& data,
+                          SendScheduler::Priority priority,
+                          const std::string& target)
+{
+    scheduler_.Send(data, priority, target);
+}
+
+void Irc::IrcServer::Write(const std::string& data)
+{
     try
     {
-        connection_.Send(buffer);
+        connection_.Send(data);
     } catch (Exception& e)
     {
         Log << LogLevel::Error << e.GetMessage();
@@ -64,25 +195,106 @@ void Irc::IrcServer::Send(const std::string& data)
     Log << LogLevel::Debug << GetHost() << "> " << data;
 }
 
-void Irc::IrcServer::Receive(Connection& /*connection*/,
-                             const std::vector<char>& data)
+void Irc::IrcServer::SendPing(const std::string& data)
 {
-    boost::lock_guard<boost::mutex> lock(callbackMutex_);
-    // Copy everything but '\r' as some irc servers don't comply
-    std::remove_copy(data.begin(), data.end(), std::back_inserter(
-            receiveBuffer_), '\r');
+    Send(data, SendScheduler::Ping, std::string());
+}
 
-    for (std::string::size_type pos = receiveBuffer_.find('\n');
-         pos != std::string::npos;
-         pos = receiveBuffer_.find('\n'))
+void Irc::IrcServer::OnLagTimeout()
+{
+    // A broken connection is already being taken care of
+    if (connection_.IsConnected())
     {
-        OnText(receiveBuffer_.substr(0, pos));
-        receiveBuffer_.erase(0, pos + 1);
+        Log << LogLevel::Warning << "Lag to " << GetHostName()
+            << " is too high, reconnecting";
+        connection_.Reconnect();
     }
 }
 
+void Irc::IrcServer::OnBurst(const NetBurst& burst)
+{
+    Log << LogLevel::Info
+        << (burst.Type == NetBurstType::Netsplit ? "Netsplit " : "Netjoin ")
+        << burst.Servers << ": " << burst.Nicks.size() << " nicks in "
+        << burst.Channels.size() << " channels, " << burst.Lines
+        << " lines handled as one";
+    // Handled like a received line, never at the same time as one
+    boost::lock_guard<boost::mutex> lock(callbackMutex_);
+    PublishChannels();
+    NotifyBurstReceiver(burst);
+}
+
+void Irc::IrcServer::SetLagSettings(const LagMonitor::Settings& settings)
+{
+    lagMonitor_.SetSettings(settings);
+}
+
+void Irc::IrcServer::SetKeepAlive(const Connection::KeepAlive& keepAlive)
+{
+    connection_.SetKeepAlive(keepAlive);
+}
+
+long Irc::IrcServer::GetLag() const
+{
+    return lagMonitor_.GetLag();
+}
+
+Irc::LagMonitor::Statistics Irc::IrcServer::GetLagStatistics() const
+{
+    return lagMonitor_.GetStatistics();
+}
+
+void Irc::IrcServer::SetBurstSettings(
+    const BurstAggregator::Settings& settings)
+{
+    burstAggregator_.SetSettings(settings);
+}
+
+Irc::BurstAggregator::Statistics Irc::IrcServer::GetBurstStatistics() const
+{
+    return burstAggregator_.GetStatistics();
+}
+
+void Irc::IrcServer::SetFloodControl(const SendScheduler::Limits& limits)
+{
+    scheduler_.SetLimits(limits);
+}
+
+Irc::SendScheduler::LaneStatistics
+Irc::IrcServer::GetSendStatistics(SendScheduler::Priority priority) const
+{
+    return scheduler_.GetStatistics(priority);
+}
+
+void Irc::IrcServer::Receive(Connection& /*connection*/,
+                             boost::string_ref line)
+{
+    boost::lock_guard<boost::mutex> lock(callbackMutex_);
+    OnText(line);
+}
+
 void Irc::IrcServer::OnConnect(Connection& /*connection*/)
 {
+    // Whatever was waiting was meant for the old connection
+    scheduler_.Clear();
+    registrationStarted_ = boost::posix_time::microsec_clock::universal_time();
+    // Not started until registered, servers do not answer PINGs before that
+    lagMonitor_.Stop();
+    pendingNames_.clear();
+    burstAggregator_.Clear();
+    // The new server tells what it has in RPL_ISUPPORT
+    memberModes_ = DEFAULT_MEMBER_MODES;
+    memberPrefixes_ = DEFAULT_MEMBER_PREFIXES;
+    SetMemberPrefixSymbols(memberPrefixes_);
+    ParseChannelModes(DEFAULT_CHANNEL_MODES, listModes_, parameterModes_,
+                      setParameterModes_);
+    hasWhox_ = false;
+    capabilities_.clear();
+    capabilityRequest_.clear();
+    // Servers without capability negotiation ignore this and register us
+    // right away, the others wait for CAP END
+    negotiatingCapabilities_ = true;
+    Send("CAP LS 302");
     const UnicodeString& password = GetServerPassword();
     if (password.length() > 0)
     {
@@ -94,6 +306,11 @@ void Irc::IrcServer::OnConnect(Connection& /*connection*/)
     JoinAllChannels();
 }
 
+void Irc::IrcServer::OnDisconnect(Connection& /*connection*/)
+{
+    lagMonitor_.Stop();
+}
+
 void Irc::IrcServer::JoinChannel(const std::string& channel, const UnicodeString& key)
 {
     AddChannel(channel, key);
@@ -135,6 +352,22 @@ void Irc::IrcServer::SendUserString(const UnicodeString& user, const UnicodeStri
 }
 
 void Irc::IrcServer::SendMessage(const std::string& target, const UnicodeString& message)
+{
+    SendScheduler::Priority priority = target.find_first_of("#&") == 0
+        ? SendScheduler::Channel
+        : SendScheduler::Reply;
+    SendPrivMsg(target, message, priority);
+}
+
+void Irc::IrcServer::SendLowPriorityMessage(const std::string& target,
+                                            const UnicodeString& message)
+{
+    SendPrivMsg(target, message, SendScheduler::Reminder);
+}
+
+void Irc::IrcServer::SendPrivMsg(const std::string& target,
+                                 const UnicodeString& message,
+                                 SendScheduler::Priority priority)
 {
     std::string scrubbedMessage = AsUtf8(message);
     std::string::size_type pos = std::string::npos;
@@ -145,15 +378,11 @@ void Irc::IrcServer::SendMessage(const std::string& target, const UnicodeString&
 
     if (scrubbedMessage.size() > 0)
     {
-        Send("PRIVMSG " + target + " :" + scrubbedMessage);
-
-        scrubbedMessage = CleanMessageForDisplay(AsUtf8(GetNick()), scrubbedMessage, scrubbedMessage.find('\1') == 0);
+        Send("PRIVMSG " + target + " :" + scrubbedMessage, priority, target);
 
-        std::stringstream ss;
-        ss.imbue(std::locale::classic());
-        ss << time(0) << " " << target << ": <" << AsUtf8(GetNick()) << "> "
-                << scrubbedMessage;
-        LogMessage(target, ss.str());
+        std::string nick = AsUtf8(GetNick());
+        scrubbedMessage = CleanMessageForDisplay(nick, scrubbedMessage, scrubbedMessage.find('\1') == 0);
+        LogMessage(GetLogName(target), target, nick, scrubbedMessage);
     }
 }
 
@@ -164,124 +393,600 @@ void Irc::IrcServer::Kick(const std::string& channel, const std::string& user,
             + std::string(" :") + (message.isEmpty() ? "" : AsUtf8(message)));
 }
 
-template<class T>
-bool IsIrcNameStatus(const T& v)
+const Irc::IrcServer::MessageHandlers Irc::IrcServer::messageHandlers_;
+
+Irc::IrcServer::MessageHandlers::MessageHandlers()
 {
-    return v == '@' || v == '+';
+    for (int i = 0; i < Command::COMMAND_COUNT; ++i)
+    {
+        Handlers[i] = 0;
+    }
+    Handlers[Command::PING] = &IrcServer::OnPing;
+    Handlers[Command::PONG] = &IrcServer::OnPong;
+    Handlers[Command::RPL_WELCOME] = &IrcServer::OnWelcome;
+    Handlers[Command::RPL_ISUPPORT] = &IrcServer::OnISupport;
+    Handlers[Command::CAP] = &IrcServer::OnCap;
+    Handlers[Command::PRIVMSG] = &IrcServer::OnPrivMsg;
+    Handlers[Command::RPL_NAMREPLY] = &IrcServer::OnNamReply;
+    Handlers[Command::RPL_ENDOFNAMES] = &IrcServer::OnEndOfNames;
+    Handlers[Command::PART] = &IrcServer::OnPart;
+    Handlers[Command::QUIT] = &IrcServer::OnQuit;
+    Handlers[Command::JOIN] = &IrcServer::OnJoin;
+    Handlers[Command::NICK] = &IrcServer::OnNick;
+    Handlers[Command::KICK] = &IrcServer::OnKick;
+    Handlers[Command::MODE] = &IrcServer::OnMode;
+    Handlers[Command::RPL_CHANNELMODEIS] = &IrcServer::OnChannelModeIs;
+    Handlers[Command::TOPIC] = &IrcServer::OnTopic;
+    Handlers[Command::RPL_NOTOPIC] = &IrcServer::OnTopicReply;
+    Handlers[Command::RPL_TOPIC] = &IrcServer::OnTopicReply;
+    Handlers[Command::RPL_TOPICWHOTIME] = &IrcServer::OnTopicWhoTime;
+    Handlers[Command::RPL_WHOREPLY] = &IrcServer::OnWhoReply;
+    Handlers[Command::RPL_WHOSPCRPL] = &IrcServer::OnWhoxReply;
+    Handlers[Command::ACCOUNT] = &IrcServer::OnAccount;
+    Handlers[Command::CHGHOST] = &IrcServer::OnChgHost;
 }
 
-void Irc::IrcServer::OnText(const std::string& text)
+void Irc::IrcServer::OnText(boost::string_ref text)
 {
     Log << LogLevel::Debug << GetHostName() << "< " << text;
     IrcMessage message(text);
 
-    if (message.GetCommand() == Irc::Command::PING)
+    MessageHandler handler = messageHandlers_.Handlers[message.GetCommand()];
+    if (handler)
     {
-        Send("PONG " + AsUtf8(GetHostName()));
+        (this->*handler)(message);
+        if (lineInBurst_)
+        {
+            lineInBurst_ = false;
+        }
+        else
+        {
+            PublishChannels();
+        }
     }
-    else if (message.GetCommand() == Irc::Command::RPL_WELCOME)
+}
+
+void Irc::IrcServer::OnPing(const IrcMessage& /*message*/)
+{
+    Send("PONG " + AsUtf8(GetHostName()));
+}
+
+void Irc::IrcServer::OnPong(const IrcMessage& message)
+{
+    if (message.size() >= 1)
     {
-        JoinAllChannels();
+        // The token is the last parameter, after the server name if any
+        lagMonitor_.OnPong(message[message.size() - 1]);
     }
-    else if (message.IsCtcp() &&
-             message.size() >= 1 &&
-             message[1] == "\1VERSION")
+}
+
+void Irc::IrcServer::OnWelcome(const IrcMessage& /*message*/)
+{
+    Log << LogLevel::Info << "Registered with " << GetHostName()
+        << " in " << (boost::posix_time::microsec_clock::universal_time()
+                      - registrationStarted_).total_milliseconds()
+        << " ms";
+    lagMonitor_.Start();
+    JoinAllChannels();
+}
+
+void Irc::IrcServer::OnISupport(const IrcMessage& message)
+{
+    // Our nick first and a human readable text last, tokens in between
+    for (std::size_t i = 1; i + 1 < message.size(); ++i)
     {
-        SendMessage(message.GetPrefix().GetNick(),
-                    AsUnicode("\1VERSION " + VersionName + " "
-                + VersionVersion + " running on " + VersionEnvironment));
+        boost::string_ref token = message.GetParameterRef(i);
+        const boost::string_ref caseMapping("CASEMAPPING=");
+        const boost::string_ref prefix("PREFIX=");
+        const boost::string_ref channelModes("CHANMODES=");
+        if (token.starts_with(prefix))
+        {
+            // PREFIX=(modes)symbols, or nothing if there are no member modes
+            token.remove_prefix(prefix.size());
+            boost::string_ref::size_type close = token.find(')');
+            if (token.empty())
+            {
+                memberModes_.clear();
+                memberPrefixes_.clear();
+            }
+            else if (token[0] == '(' && close != boost::string_ref::npos
+                     && token.size() - close - 1 == close - 1)
+            {
+                boost::string_ref modes = token.substr(1, close - 1);
+                boost::string_ref symbols = token.substr(close + 1);
+                memberModes_.assign(modes.begin(), modes.end());
+                memberPrefixes_.assign(symbols.begin(), symbols.end());
+            }
+            else
+            {
+                Log << LogLevel::Warning << GetHostName()
+                    << " gives a malformed " << token
+                    << ", keeping the member modes in use";
+                continue;
+            }
+            SetMemberPrefixSymbols(memberPrefixes_);
+        }
+        else if (token.starts_with(channelModes))
+        {
+            token.remove_prefix(channelModes.size());
+            ParseChannelModes(token, listModes_, parameterModes_,
+                              setParameterModes_);
+        }
+        else if (token == "WHOX")
+        {
+            hasWhox_ = true;
+        }
+        else if (token.starts_with(caseMapping))
+        {
+            CaseMapping::CaseMapping mapping;
+            token.remove_prefix(caseMapping.size());
+            if (CaseMapping::FromString(token, mapping))
+            {
+                SetCaseMapping(mapping);
+            }
+            else
+            {
+                Log << LogLevel::Warning << GetHostName()
+                    << " uses unknown case mapping " << token
+                    << ", keeping the one in use";
+            }
+        }
     }
-    else if (message.GetCommand() == Irc::Command::PRIVMSG && message.size() >= 2)
-    {
-        // Log messages
-        const std::string& from = message.GetPrefix().GetNick();
-        const std::string& to = message[0];
-        const std::string& replyTo = to.find_first_of("#&") == 0 ? to : from;
-        std::stringstream ss;
-        ss.imbue(std::locale::classic());
-        ss << time(0) << " " << replyTo << ": <" << from << "> "
-           << CleanMessageForDisplay(from, message[1], message.IsCtcp());
-        UnicodeString logMessage = AsUnicode(ss.str());
-        LogMessage(replyTo, AsUtf8(logMessage));
+}
 
-        // Notify receivers
-        NotifyReceiver(message);
-    }
-    else if (message.GetCommand() == Irc::Command::RPL_NAMREPLY
-            && message.size() >= 4)
+void Irc::IrcServer::OnCap(const IrcMessage& message)
+{
+    // CAP <nick> <subcommand> [*] :<capabilities>
+    if (message.size() < 3)
     {
-        std::string channel = message[2];
+        return;
+    }
+    boost::string_ref subcommand = message.GetParameterRef(1);
+    boost::string_ref capabilities =
+        message.GetParameterRef(message.size() - 1);
+    boost::string_ref capability;
 
-        if (channel.find_first_of("#&") == 0)
+    if (subcommand == "LS" && negotiatingCapabilities_)
+    {
+        while (NextWord(capabilities, capability))
         {
-            if (!appendingChannelNicks_)
+            // Version 302 gives values after =
+            capability = capability.substr(0, capability.find('='));
+            for (std::size_t i = 0;
+                 i < sizeof(WANTED_CAPABILITIES) / sizeof(*WANTED_CAPABILITIES);
+                 ++i)
             {
-                ClearAllChannelNicks(channel);
-                appendingChannelNicks_ = true;
+                if (capability == WANTED_CAPABILITIES[i])
+                {
+                    if (!capabilityRequest_.empty())
+                    {
+                        capabilityRequest_ += " ";
+                    }
+                    capabilityRequest_.append(capability.begin(),
+                                              capability.end());
+                }
             }
-
-            std::stringstream stream(message[3]);
-
-            while (stream.good())
+        }
+        // A * before the list means more lists follow
+        if (message.size() >= 4 && message.GetParameterRef(2) == "*")
+        {
+            return;
+        }
+        if (capabilityRequest_.empty())
+        {
+            negotiatingCapabilities_ = false;
+            Send("CAP END");
+        }
+        else
+        {
+            Send("CAP REQ :" + capabilityRequest_);
+        }
+    }
+    else if (subcommand == "ACK" || subcommand == "NAK")
+    {
+        if (subcommand == "ACK")
+        {
+            while (NextWord(capabilities, capability))
             {
-                std::string nick;
-                stream >> nick;
-                if (nick.find_first_of("@+") == 0)
+                // A - in front means it was turned off
+                if (capability.starts_with("-"))
                 {
-                    nick.erase(0, 1);
+                    capability.remove_prefix(1);
+                    capabilities_.erase(std::string(capability.begin(),
+                                                    capability.end()));
                 }
-
-                if (nick.size() > 0)
+                else
                 {
-                    AddChannelNick(channel, nick);
+                    capabilities_.insert(std::string(capability.begin(),
+                                                     capability.end()));
                 }
             }
+            Log << LogLevel::Info << GetHostName() << " enabled "
+                << message.GetParameterRef(message.size() - 1);
         }
+        if (negotiatingCapabilities_)
+        {
+            negotiatingCapabilities_ = false;
+            Send("CAP END");
+        }
+    }
+}
+
+void Irc::IrcServer::OnPrivMsg(const IrcMessage& message)
+{
+    if (message.size() < 2)
+    {
+        return;
+    }
+
+    // The CTCP markers are already stripped off the text
+    if (message.IsCtcp() && message.GetParameterRef(1) == "VERSION")
+    {
+        const std::string& from = message.GetPrefix().GetNick();
+        // CTCP replies are notices so that they are never answered
+        Send("NOTICE " + from + " :\1VERSION " + VersionName + " "
+             + VersionVersion + " running on " + VersionEnvironment + "\1",
+             SendScheduler::Reply, from);
+        return;
+    }
+
+    // Log messages
+    const std::string& from = message.GetPrefix().GetNick();
+    const std::string& to = message[0];
+    const std::string& replyTo = to.find_first_of("#&") == 0 ? to : from;
+    // Through UnicodeString so that broken UTF-8 is not logged
+    std::string text = AsUtf8(AsUnicode(CleanMessageForDisplay(
+        from, message[1], message.IsCtcp())));
+    std::string logName = GetLogName(replyTo);
+    LogMessage(logName, replyTo, from, text);
+    AddToScrollback(logName, replyTo, from, text);
+
+    // Actions are talk too, other CTCP requests are not
+    boost::string_ref said = message.GetParameterRef(1);
+    if (!message.IsCtcp())
+    {
+        CountMessage(logName, from, said);
+    }
+    else if (said.starts_with("ACTION "))
+    {
+        CountMessage(logName, from, said.substr(7));
+    }
+
+    // Notify receivers
+    NotifyReceiver(message);
+}
+
+void Irc::IrcServer::OnNamReply(const IrcMessage& message)
+{
+    // RPL_NAMREPLY <nick> <type> <channel> :<entries>
+    if (message.size() < 4)
+    {
+        return;
+    }
+
+    boost::string_ref channel = message.GetParameterRef(2);
+    if (channel.empty() || (channel[0] != '#' && channel[0] != '&'))
+    {
+        return;
     }
-    else if (message.GetCommand() == Irc::Command::RPL_ENDOFNAMES)
+
+    // Replies for several channels can be interleaved
+    ChannelMembers::NamesContainer& members =
+        pendingNames_[std::string(channel.begin(), channel.end())];
+
+    boost::string_ref entries = message.GetParameterRef(3);
+    boost::string_ref entry, prefixes, nick, user, host;
+    while (NextWord(entries, entry))
     {
-        appendingChannelNicks_ = false;
+        if (ParseNamesEntry(entry, memberPrefixes_, prefixes, nick, user,
+                            host))
+        {
+            members.push_back(ChannelMembers::NamesEntry());
+            ChannelMembers::NamesEntry& member = members.back();
+            member.Nick.assign(nick.begin(), nick.end());
+            member.Prefixes = GetPrefixBits(prefixes);
+            member.User.assign(user.begin(), user.end());
+            member.Host.assign(host.begin(), host.end());
+        }
     }
-    else if (message.GetCommand() == Irc::Command::PART && message.size() >= 1)
+}
+
+void Irc::IrcServer::OnEndOfNames(const IrcMessage& message)
+{
+    // RPL_ENDOFNAMES <nick> <channel> :End of /NAMES list
+    if (message.size() < 2)
+    {
+        return;
+    }
+    NamesContainer::iterator names = pendingNames_.find(message[1]);
+    if (names != pendingNames_.end())
+    {
+        // All of the channel is swapped in at once
+        SetChannelMembers(names->first, names->second);
+        pendingNames_.erase(names);
+    }
+}
+
+void Irc::IrcServer::OnPart(const IrcMessage& message)
+{
+    if (message.size() >= 1)
     {
         const std::string& nick = message.GetPrefix().GetNick();
         const std::string& channel = message[0];
         RemoveChannelNick(channel, nick);
     }
-    else if (message.GetCommand() == Irc::Command::QUIT)
+}
+
+void Irc::IrcServer::OnQuit(const IrcMessage& message)
+{
+    const std::string& nick = message.GetPrefix().GetNick();
+    if (message.size() >= 1
+        && BurstAggregator::IsSplitReason(message.GetParameterRef(0)))
     {
-        const std::string& nick = message.GetPrefix().GetNick();
-        RemoveChannelNick(nick);
+        std::vector<std::string> channels;
+        GetNickChannels(nick, channels);
+        lineInBurst_ = burstAggregator_.OnQuit(nick,
+                                               message.GetParameterRef(0),
+                                               channels);
     }
-    else if (message.GetCommand() == Irc::Command::JOIN && message.size() >= 1)
+    RemoveChannelNick(nick);
+}
+
+void Irc::IrcServer::OnJoin(const IrcMessage& message)
+{
+    if (message.size() >= 1)
     {
         const std::string& nick = message.GetPrefix().GetNick();
         const std::string& channel = message[0];
         AddChannelNick(channel, nick);
+        boost::string_ref user = message.GetUserRef();
+        boost::string_ref host = message.GetHostRef();
+        SetNickUserAndHost(nick, std::string(user.begin(), user.end()),
+                           std::string(host.begin(), host.end()));
+        // With extended-join the account follows, * if not logged in
+        if (message.size() >= 3 && capabilities_.count("extended-join"))
+        {
+            const std::string& account = message[1];
+            SetNickAccount(nick, account == "*" ? std::string() : account);
+        }
+
+        if (!IsOwnNick(nick))
+        {
+            lineInBurst_ = burstAggregator_.OnJoin(nick, channel);
+        }
+        else
+        {
+            // The topic and the members come by themselves
+            Send("MODE " + channel, SendScheduler::Reminder, channel);
+            RequestWho(channel);
+        }
     }
-    else if (message.GetCommand() == Irc::Command::NICK && message.size() >= 1)
+}
+
+void Irc::IrcServer::OnNick(const IrcMessage& message)
+{
+    if (message.size() >= 1)
     {
         const std::string& oldNick = message.GetPrefix().GetNick();
         const std::string& newNick = message[0];
         ChangeChannelNick(oldNick, newNick);
     }
-    else if (message.GetCommand() == Irc::Command::KICK && message.size() >= 2)
+}
+
+void Irc::IrcServer::OnKick(const IrcMessage& message)
+{
+    if (message.size() < 2)
+    {
+        return;
+    }
+
+    const std::string& channel = message[0];
+    const std::string& victim = message[1];
+
+    RemoveChannelNick(channel, victim);
+
+    if (IsOwnNick(victim))
+    {
+        // We've been kicked
+        // Remove channel, we'll get a new list of nicks if we rejoin
+        RemoveChannelNickChannel(channel);
+        // Rejoin
+        const UnicodeString* key = GetChannelKey(channel);
+        JoinChannel(channel, key ? *key : "");
+    }
+}
+
+void Irc::IrcServer::OnMode(const IrcMessage& message)
+{
+    // MODE <target> <modes> [parameters], we only follow channels
+    if (message.size() >= 2 && message[0].find_first_of("#&") == 0)
+    {
+        ApplyChannelModes(message, 0);
+    }
+}
+
+void Irc::IrcServer::OnChannelModeIs(const IrcMessage& message)
+{
+    // RPL_CHANNELMODEIS <nick> <channel> <modes> [parameters]
+    if (message.size() >= 3)
+    {
+        // The reply has all that is set
+        ClearChannelModes(message[1]);
+        ApplyChannelModes(message, 1);
+    }
+}
+
+void Irc::IrcServer::ApplyChannelModes(const IrcMessage& message,
+                                       std::size_t first)
+{
+    const std::string& channel = message[first];
+    boost::string_ref modes = message.GetParameterRef(first + 1);
+    std::size_t parameter = first + 2;
+    bool set = true;
+    for (std::size_t i = 0; i < modes.size(); ++i)
+    {
+        char mode = modes[i];
+        if (mode == '+' || mode == '-')
+        {
+            set = mode == '+';
+            continue;
+        }
+
+        std::string::size_type prefix = memberModes_.find(mode);
+        bool hasParameter = prefix != std::string::npos
+            || listModes_.find(mode) != std::string::npos
+            || parameterModes_.find(mode) != std::string::npos
+            || (set && setParameterModes_.find(mode) != std::string::npos);
+        std::string value;
+        if (hasParameter)
+        {
+            if (parameter >= message.size())
+            {
+                Log << LogLevel::Warning << GetHostName()
+                    << " gave mode " << mode << " without its parameter";
+                return;
+            }
+            value = message[parameter++];
+        }
+
+        if (prefix != std::string::npos)
+        {
+            SetChannelNickPrefix(channel, value, prefix, set);
+        }
+        else if (listModes_.find(mode) != std::string::npos)
+        {
+            // Bans and such are not kept
+        }
+        else if (set)
+        {
+            SetChannelMode(channel, mode, value);
+        }
+        else
+        {
+            UnsetChannelMode(channel, mode);
+        }
+    }
+}
+
+void Irc::IrcServer::OnTopic(const IrcMessage& message)
+{
+    // TOPIC <channel> :<topic>
+    if (message.size() >= 2)
     {
         const std::string& channel = message[0];
-        const std::string& victim = message[1];
+        SetChannelTopic(channel, message[1]);
+        SetChannelTopicSetter(channel, message.GetPrefix().GetNick(),
+                              time(0));
+    }
+}
 
-        RemoveChannelNick(channel, victim);
+void Irc::IrcServer::OnTopicReply(const IrcMessage& message)
+{
+    // RPL_TOPIC <nick> <channel> :<topic>, or RPL_NOTOPIC with some text
+    if (message.size() < 2)
+    {
+        return;
+    }
+    const std::string& channel = message[1];
+    if (message.GetCommand() == Command::RPL_TOPIC && message.size() >= 3)
+    {
+        SetChannelTopic(channel, message[2]);
+    }
+    else
+    {
+        SetChannelTopic(channel, std::string());
+        SetChannelTopicSetter(channel, std::string(), 0);
+    }
+}
 
-        if (victim == AsUtf8(GetNick()))
+void Irc::IrcServer::OnTopicWhoTime(const IrcMessage& message)
+{
+    // RPL_TOPICWHOTIME <nick> <channel> <set by> <set at>
+    if (message.size() >= 4)
+    {
+        std::stringstream ss(message[3]);
+        ss.imbue(std::locale::classic());
+        time_t setAt = 0;
+        if ((ss >> setAt).fail())
+        {
+            setAt = 0;
+        }
+        SetChannelTopicSetter(message[1], message[2], setAt);
+    }
+}
+
+void Irc::IrcServer::RequestWho(const std::string& channel)
+{
+    // Nobody is waiting for it, so it goes after everything else
+    if (hasWhox_)
+    {
+        Send("WHO " + channel + " %tcuhnfa," + WHOX_TOKEN,
+             SendScheduler::Reminder, channel);
+    }
+    else
+    {
+        Send("WHO " + channel, SendScheduler::Reminder, channel);
+    }
+}
+
+void Irc::IrcServer::OnWhoReply(const IrcMessage& message)
+{
+    // RPL_WHOREPLY <nick> <channel> <user> <host> <server> <nick> <flags>
+    //              :<hops> <real name>
+    if (message.size() >= 6)
+    {
+        SetNickUserAndHost(message[5], message[2], message[3]);
+    }
+}
+
+void Irc::IrcServer::OnWhoxReply(const IrcMessage& message)
+{
+    // RPL_WHOSPCRPL <nick> <token> <channel> <user> <host> <nick> <flags>
+    //               <account>, as asked for in RequestWho
+    if (message.size() >= 8 && message.GetParameterRef(1) == WHOX_TOKEN)
+    {
+        const std::string& nick = message[5];
+        SetNickUserAndHost(nick, message[3], message[4]);
+        // 0 if not logged in
+        const std::string& account = message[7];
+        SetNickAccount(nick, account == "0" ? std::string() : account);
+    }
+}
+
+void Irc::IrcServer::OnAccount(const IrcMessage& message)
+{
+    // ACCOUNT <account>, * when logged out
+    if (message.size() >= 1)
+    {
+        const std::string& account = message[0];
+        SetNickAccount(message.GetPrefix().GetNick(),
+                       account == "*" ? std::string() : account);
+    }
+}
+
+void Irc::IrcServer::OnChgHost(const IrcMessage& message)
+{
+    // CHGHOST <new user> <new host>
+    if (message.size() >= 2)
+    {
+        SetNickUserAndHost(message.GetPrefix().GetNick(), message[0],
+                           message[1]);
+    }
+}
+
+ChannelMembers::PrefixBits
+Irc::IrcServer::GetPrefixBits(boost::string_ref prefixes) const
+{
+    ChannelMembers::PrefixBits bits = 0;
+    for (std::size_t i = 0; i < prefixes.size(); ++i)
+    {
+        std::string::size_type prefix = memberPrefixes_.find(prefixes[i]);
+        if (prefix < ChannelMembers::MAX_PREFIXES)
         {
-            // We've been kicked
-            // Remove channel, we'll get a new list of nicks if we rejoin
-            RemoveChannelNickChannel(channel);
-            // Rejoin
-            const UnicodeString* key = GetChannelKey(channel);
-            JoinChannel(channel, key ? *key : "");
+            bits |= 1 << prefix;
         }
     }
+    return bits;
 }
 
 void Irc::IrcServer::RegisterSelfAsReceiver()
@@ -290,6 +995,8 @@ void Irc::IrcServer::RegisterSelfAsReceiver()
             &Irc::IrcServer::Receive, this, _1, _2));
     onConnectCallback_ = connection_.RegisterOnConnectCallback(boost::bind(
             &Irc::IrcServer::OnConnect, this, _1));
+    onDisconnectCallback_ = connection_.RegisterOnDisconnectCallback(
+        boost::bind(&Irc::IrcServer::OnDisconnect, this, _1));
 }
 
 std::string Irc::IrcServer::CleanMessageForDisplay(const std::string& nick,
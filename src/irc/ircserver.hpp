@@ -1,6 +1,10 @@
 #ifndef IRC_SERVER_HPP
 #define IRC_SERVER_HPP
 
+#include "sendscheduler.hpp"
+#include "lagmonitor.hpp"
+#include "burstaggregator.hpp"
+#include "command.hpp"
 #include "../connection/connection.hpp"
 #include "../server.hpp"
 
@@ -18,9 +22,13 @@
 #include <boost/function.hpp>
 #include <boost/thread.hpp>
 #include <boost/utility.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 
 namespace Irc {
 
+class IrcMessage;
+
 class IrcServer : public Server
 {
 public:
@@ -44,23 +52,94 @@ public:
     virtual void ChangeNick(const UnicodeString& nick);
     virtual void SendMessage(const std::string& target,
                              const UnicodeString& message);
+    virtual void SendLowPriorityMessage(const std::string& target,
+                                        const UnicodeString& message);
     virtual void Kick(const std::string& channel,
                       const std::string& user,
                       const UnicodeString& message);
 
     /**
-     * @throw Exception if channel not found
+     * Add a host that is raced against the main one on every connect.
      */
-    const std::set<std::string>& GetChannelNicks(const std::string& channel) const;
+    void AddFallbackHost(const UnicodeString& host, unsigned int port);
+
+    void SetFloodControl(const SendScheduler::Limits& limits);
+    SendScheduler::LaneStatistics
+    GetSendStatistics(SendScheduler::Priority priority) const;
+
+    void SetLagSettings(const LagMonitor::Settings& settings);
+    void SetKeepAlive(const Connection::KeepAlive& keepAlive);
+    virtual long GetLag() const;
+    LagMonitor::Statistics GetLagStatistics() const;
+
+    void SetBurstSettings(const BurstAggregator::Settings& settings);
+    BurstAggregator::Statistics GetBurstStatistics() const;
 
 private:
+    void Send(const std::string& data,
+              SendScheduler::Priority priority,
+              const std::string& target);
+    void Write(const std::string& data);
+    void SendPing(const std::string& data);
+    void OnLagTimeout();
+    void OnBurst(const NetBurst& burst);
+
+    void SendPrivMsg(const std::string& target,
+                     const UnicodeString& message,
+                     SendScheduler::Priority priority);
+
     void SendPassString(const UnicodeString& password);
     void SendUserString(const UnicodeString& user, const UnicodeString& name);
 
-    void Receive(Connection& connection, const std::vector<char>& data);
+    void Receive(Connection& connection, boost::string_ref line);
     void OnConnect(Connection& connection);
+    void OnDisconnect(Connection& connection);
+
+    void OnText(boost::string_ref text);
+
+    void OnPing(const IrcMessage& message);
+    void OnPong(const IrcMessage& message);
+    void OnWelcome(const IrcMessage& message);
+    void OnISupport(const IrcMessage& message);
+    void OnCap(const IrcMessage& message);
+    void OnPrivMsg(const IrcMessage& message);
+    void OnNamReply(const IrcMessage& message);
+    void OnEndOfNames(const IrcMessage& message);
+    void OnPart(const IrcMessage& message);
+    void OnQuit(const IrcMessage& message);
+    void OnJoin(const IrcMessage& message);
+    void OnNick(const IrcMessage& message);
+    void OnKick(const IrcMessage& message);
+    void OnMode(const IrcMessage& message);
+    void OnChannelModeIs(const IrcMessage& message);
+    void OnTopic(const IrcMessage& message);
+    void OnTopicReply(const IrcMessage& message);
+    void OnTopicWhoTime(const IrcMessage& message);
+    void OnWhoReply(const IrcMessage& message);
+    void OnWhoxReply(const IrcMessage& message);
+    void OnAccount(const IrcMessage& message);
+    void OnChgHost(const IrcMessage& message);
 
-    void OnText(const std::string& text);
+    /**
+     * Apply the mode changes in a MODE message or RPL_CHANNELMODEIS.
+     * @param first index of the channel, the modes and their parameters
+     *        follow it
+     */
+    void ApplyChannelModes(const IrcMessage& message, std::size_t first);
+    // The member modes of the symbols in front of a nick in NAMES replies
+    ChannelMembers::PrefixBits GetPrefixBits(boost::string_ref prefixes) const;
+    // Fill in members' user, host and account after joining a channel
+    void RequestWho(const std::string& channel);
+
+    typedef void (IrcServer::*MessageHandler)(const IrcMessage& message);
+    // What OnText does with each command, commands without a handler are
+    // only passed on to the logs
+    struct MessageHandlers
+    {
+        MessageHandlers();
+        MessageHandler Handlers[Command::COMMAND_COUNT];
+    };
+    static const MessageHandlers messageHandlers_;
 
     void RegisterSelfAsReceiver();
 
@@ -69,15 +148,44 @@ private:
                                        bool isCtcp);
 
     Connection connection_;
+    Connection::HostContainer fallbackHosts_;
+    SendScheduler scheduler_;
+    LagMonitor lagMonitor_;
 
     Connection::ReceiverHandle connectionReceiver_;
     Connection::OnConnectHandle onConnectCallback_;
+    Connection::OnConnectHandle onDisconnectCallback_;
 
-    std::string receiveBuffer_;
     boost::mutex callbackMutex_;
 
     CharsetDetector detector_;
-    bool appendingChannelNicks_;
+    // NAMES replies collected for each channel until RPL_ENDOFNAMES
+    typedef std::map<std::string, ChannelMembers::NamesContainer>
+        NamesContainer;
+    NamesContainer pendingNames_;
+    // From PREFIX in RPL_ISUPPORT, the member modes and the symbols in
+    // front of nicks in NAMES replies, in the same order
+    std::string memberModes_;
+    std::string memberPrefixes_;
+    // From CHANMODES in RPL_ISUPPORT, the channel modes that always take a
+    // parameter, that only take one when set, and the list modes
+    std::string parameterModes_;
+    std::string setParameterModes_;
+    std::string listModes_;
+    // If WHO can be asked for the account too
+    bool hasWhox_;
+    // Capabilities being asked for while registering, see OnCap
+    std::string capabilityRequest_;
+    bool negotiatingCapabilities_;
+    std::set<std::string> capabilities_;
+    // When the connection was made, to log how long registration takes
+    boost::posix_time::ptime registrationStarted_;
+    // The line being handled went into a netsplit or netjoin, its channel
+    // changes are published when the burst ends
+    bool lineInBurst_;
+
+    // Last, so it is gone before anything its callback uses
+    BurstAggregator burstAggregator_;
 };
 
 }  // namespace Irc
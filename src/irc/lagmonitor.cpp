@@ -0,0 +1,220 @@
+#include "lagmonitor.hpp"
+#include "../exception.hpp"
+#include "../logging/logger.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+#include <boost/bind.hpp>
+
+using boost::posix_time::ptime;
+using boost::posix_time::microsec_clock;
+using boost::posix_time::milliseconds;
+
+// Upper limits of the histogram buckets in milliseconds
+static const long BUCKET_LIMITS[Irc::LagMonitor::HISTOGRAM_BUCKETS - 1] =
+    { 50, 100, 200, 500, 1000, 2000, 5000, 10000, 30000 };
+
+Irc::LagMonitor::LagMonitor(Sink sink, TimeoutCallback onTimeout,
+                            const Settings& settings)
+    : sink_(sink)
+    , onTimeout_(onTimeout)
+    , settings_(settings)
+    , running_(false)
+    , sequence_(0)
+    , awaitingPong_(false)
+    , lastLag_(-1)
+    , totalLagMilliseconds_(0)
+    , timer_(IoServicePool::Instance().GetIoService())
+    , closing_(false)
+{
+    statistics_.CurrentLagMilliseconds = -1;
+    statistics_.MinLagMilliseconds = -1;
+    statistics_.MaxLagMilliseconds = -1;
+    statistics_.AverageLagMilliseconds = 0;
+    statistics_.Samples = 0;
+    statistics_.Timeouts = 0;
+    statistics_.Histogram.assign(0);
+}
+
+Irc::LagMonitor::~LagMonitor()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        closing_ = true;
+        boost::system::error_code error;
+        timer_.cancel(error);
+    }
+    pending_.WaitForAll();
+}
+
+void Irc::LagMonitor::SetSettings(const Settings& settings)
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    settings_ = settings;
+    if (running_)
+    {
+        nextPing_ = microsec_clock::universal_time()
+            + milliseconds(settings_.PingIntervalMilliseconds);
+        Arm();
+    }
+}
+
+void Irc::LagMonitor::Start()
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    running_ = true;
+    awaitingPong_ = false;
+    lastLag_ = -1;
+    // Ask right away so the lag is known soon after connecting
+    nextPing_ = microsec_clock::universal_time();
+    Arm();
+}
+
+void Irc::LagMonitor::Stop()
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    running_ = false;
+    awaitingPong_ = false;
+    boost::system::error_code error;
+    timer_.cancel(error);
+}
+
+bool Irc::LagMonitor::OnPong(boost::string_ref token)
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    if (!awaitingPong_ || token != expectedToken_)
+    {
+        return false;
+    }
+    awaitingPong_ = false;
+    lastLag_ = (microsec_clock::universal_time() - pingSent_)
+        .total_milliseconds();
+
+    ++statistics_.Samples;
+    totalLagMilliseconds_ += lastLag_;
+    if (statistics_.MinLagMilliseconds < 0
+        || lastLag_ < statistics_.MinLagMilliseconds)
+    {
+        statistics_.MinLagMilliseconds = lastLag_;
+    }
+    statistics_.MaxLagMilliseconds = std::max(statistics_.MaxLagMilliseconds,
+                                              lastLag_);
+    std::size_t bucket = std::upper_bound(BUCKET_LIMITS,
+                                          BUCKET_LIMITS
+                                          + HISTOGRAM_BUCKETS - 1,
+                                          lastLag_) - BUCKET_LIMITS;
+    ++statistics_.Histogram[bucket];
+
+    // Wait for the next PING instead of the deadline of this one
+    Arm();
+    return true;
+}
+
+long Irc::LagMonitor::GetLag() const
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    if (awaitingPong_)
+    {
+        long waiting = (microsec_clock::universal_time() - pingSent_)
+            .total_milliseconds();
+        if (waiting > lastLag_)
+        {
+            return waiting;
+        }
+    }
+    return lastLag_;
+}
+
+Irc::LagMonitor::Statistics Irc::LagMonitor::GetStatistics() const
+{
+    Statistics statistics;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        statistics = statistics_;
+        statistics.AverageLagMilliseconds = statistics_.Samples > 0
+            ? totalLagMilliseconds_ / statistics_.Samples : 0;
+    }
+    statistics.CurrentLagMilliseconds = GetLag();
+    return statistics;
+}
+
+long Irc::LagMonitor::GetBucketLimit(std::size_t bucket)
+{
+    return bucket < HISTOGRAM_BUCKETS - 1 ? BUCKET_LIMITS[bucket] : -1;
+}
+
+void Irc::LagMonitor::Arm()
+{
+    if (closing_ || !running_ || settings_.PingIntervalMilliseconds == 0)
+    {
+        return;
+    }
+    // While a PING is unanswered the next one waits, so the only thing to
+    // wake up for is its deadline
+    ptime wakeUp = awaitingPong_
+        ? pingSent_ + milliseconds(settings_.MaxLagMilliseconds)
+        : nextPing_;
+    // Setting the expiry time cancels any pending wait
+    timer_.expires_at(wakeUp);
+    pending_.Begin();
+    timer_.async_wait(boost::bind(&LagMonitor::OnTimer, this, _1));
+}
+
+void Irc::LagMonitor::OnTimer(const boost::system::error_code& error)
+{
+    std::string ping;
+    bool timedOut = false;
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        ptime now = microsec_clock::universal_time();
+        if (error || closing_ || !running_)
+        {
+            // Cancelled by a newer wait or shutting down
+        }
+        else if (awaitingPong_ && now - pingSent_
+                 >= milliseconds(settings_.MaxLagMilliseconds))
+        {
+            Log << LogLevel::Warning << "No PONG after "
+                << (now - pingSent_).total_milliseconds()
+                << " ms, the connection is considered dead";
+            ++statistics_.Timeouts;
+            running_ = false;
+            awaitingPong_ = false;
+            timedOut = true;
+        }
+        else if (!awaitingPong_ && now >= nextPing_)
+        {
+            std::stringstream token;
+            token.imbue(std::locale::classic());
+            token << "LAG" << ++sequence_;
+            expectedToken_ = token.str();
+            ping = "PING :" + expectedToken_;
+            awaitingPong_ = true;
+            pingSent_ = now;
+            nextPing_ = now + milliseconds(settings_.PingIntervalMilliseconds);
+            Arm();
+        }
+        else
+        {
+            // Woke up early
+            Arm();
+        }
+    }
+
+    try
+    {
+        if (!ping.empty())
+        {
+            sink_(ping);
+        }
+        if (timedOut)
+        {
+            onTimeout_();
+        }
+    } catch (Exception& e)
+    {
+        Log << LogLevel::Error << e.GetMessage();
+    }
+    pending_.End();
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "../connection/ioservicepool.hpp"
+
+#include <string>
+
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/utility.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace Irc
+{
+
+/**
+ * Sends our own PINGs to the server and times the PONGs that come back.
+ * When a PONG is later than allowed the connection is considered dead,
+ * which is noticed long before the connection timeout would.
+ */
+class LagMonitor : boost::noncopyable
+{
+public:
+    struct Settings
+    {
+	// Time between PINGs, zero turns the monitor off
+	unsigned int PingIntervalMilliseconds;
+	// Lag at which the connection is given up
+	unsigned int MaxLagMilliseconds;
+    };
+
+    static const std::size_t HISTOGRAM_BUCKETS = 10;
+
+    struct Statistics
+    {
+	// Negative until the first PONG has arrived
+	long CurrentLagMilliseconds;
+	long MinLagMilliseconds;
+	long MaxLagMilliseconds;
+	double AverageLagMilliseconds;
+	unsigned long Samples;
+	// Number of times the lag was too high
+	unsigned long Timeouts;
+	// Bucket i counts round trips shorter than GetBucketLimit(i)
+	boost::array<unsigned long, HISTOGRAM_BUCKETS> Histogram;
+    };
+
+    typedef boost::function<void (const std::string&)> Sink;
+    typedef boost::function<void ()> TimeoutCallback;
+
+    /**
+     * @param sink sends a line to the server
+     * @param onTimeout called when a PONG is later than allowed, the
+     *        monitor stops until Start is called again
+     */
+    LagMonitor(Sink sink, TimeoutCallback onTimeout, const Settings& settings);
+    ~LagMonitor();
+
+    void SetSettings(const Settings& settings);
+
+    /**
+     * Start sending PINGs, used once registered with the server since
+     * servers do not answer PINGs before that.
+     */
+    void Start();
+
+    /**
+     * Stop sending PINGs, used when the connection is lost.
+     */
+    void Stop();
+
+    /**
+     * @return true if the PONG was an answer to our PING
+     */
+    bool OnPong(boost::string_ref token);
+
+    /**
+     * Time since the last PING was sent if it is still unanswered and that
+     * is longer than the last round trip, otherwise the last round trip.
+     * Negative if unknown.
+     */
+    long GetLag() const;
+
+    Statistics GetStatistics() const;
+
+    /**
+     * Upper limit in milliseconds of a histogram bucket, the last bucket
+     * has no limit and returns a negative value.
+     */
+    static long GetBucketLimit(std::size_t bucket);
+
+private:
+    void Arm();
+    void OnTimer(const boost::system::error_code& error);
+
+    Sink sink_;
+    TimeoutCallback onTimeout_;
+    Settings settings_;
+
+    bool running_;
+    unsigned long sequence_;
+    bool awaitingPong_;
+    std::string expectedToken_;
+    boost::posix_time::ptime pingSent_;
+    boost::posix_time::ptime nextPing_;
+    long lastLag_;
+
+    Statistics statistics_;
+    double totalLagMilliseconds_;
+
+    boost::asio::deadline_timer timer_;
+    bool closing_;
+    PendingOperations pending_;
+    mutable boost::mutex mutex_;
+};
+
+} // namespace Irc
@@ -0,0 +1,178 @@
+#include "messageparser.hpp"
+#include "../prefix.hpp"
+
+#include <cstring>
+
+namespace
+{
+
+// Position of the first space at or after begin, or end
+inline const char* FindSpace(const char* begin, const char* end)
+{
+    const void* space = std::memchr(begin, ' ', end - begin);
+    return space ? static_cast<const char*>(space) : end;
+}
+
+inline const char* SkipSpaces(const char* begin, const char* end)
+{
+    while (begin != end && *begin == ' ')
+    {
+        ++begin;
+    }
+    return begin;
+}
+
+inline boost::string_ref MakeRef(const char* begin, const char* end)
+{
+    return boost::string_ref(begin, end - begin);
+}
+
+} // namespace
+
+bool Irc::ParseLine(boost::string_ref line, ParsedLine& parsed)
+{
+    const char* p = line.data();
+    const char* end = p + line.size();
+    const char* wordEnd;
+
+    parsed.Tags.clear();
+    parsed.Prefix.clear();
+    parsed.Nick.clear();
+    parsed.User.clear();
+    parsed.Host.clear();
+    parsed.ParameterCount = 0;
+
+    if (p != end && *p == '@')
+    {
+        wordEnd = FindSpace(p, end);
+        parsed.Tags = MakeRef(p + 1, wordEnd);
+        p = SkipSpaces(wordEnd, end);
+    }
+
+    if (p != end && *p == ':')
+    {
+        wordEnd = FindSpace(p, end);
+        parsed.Prefix = MakeRef(p + 1, wordEnd);
+        ::Prefix::Split(parsed.Prefix, parsed.Nick, parsed.User, parsed.Host);
+        p = SkipSpaces(wordEnd, end);
+    }
+
+    wordEnd = FindSpace(p, end);
+    parsed.Command = MakeRef(p, wordEnd);
+    if (parsed.Command.empty())
+    {
+        return false;
+    }
+    p = wordEnd;
+
+    std::size_t count = 0;
+    while (true)
+    {
+        p = SkipSpaces(p, end);
+        if (p == end)
+        {
+            break;
+        }
+        if (*p == ':')
+        {
+            parsed.Parameters[count++] = MakeRef(p + 1, end);
+            break;
+        }
+        if (count == ParsedLine::MAX_PARAMETERS - 1)
+        {
+            // No room to split any further
+            parsed.Parameters[count++] = MakeRef(p, end);
+            break;
+        }
+        wordEnd = FindSpace(p, end);
+        parsed.Parameters[count++] = MakeRef(p, wordEnd);
+        p = wordEnd;
+    }
+    parsed.ParameterCount = count;
+    return true;
+}
+
+bool Irc::NextTag(boost::string_ref& tags,
+                  boost::string_ref& key,
+                  boost::string_ref& value)
+{
+    while (!tags.empty())
+    {
+        boost::string_ref::size_type tagEnd = tags.find(';');
+        boost::string_ref tag = tags.substr(0, tagEnd);
+        tags.remove_prefix(tagEnd == boost::string_ref::npos
+                           ? tags.size() : tagEnd + 1);
+        if (tag.empty())
+        {
+            continue;
+        }
+        boost::string_ref::size_type equals = tag.find('=');
+        key = tag.substr(0, equals);
+        value = equals == boost::string_ref::npos
+            ? boost::string_ref() : tag.substr(equals + 1);
+        return true;
+    }
+    return false;
+}
+
+void Irc::UnescapeTagValue(boost::string_ref value, std::string& unescaped)
+{
+    unescaped.clear();
+    unescaped.reserve(value.size());
+    for (std::size_t i = 0; i < value.size(); ++i)
+    {
+        char c = value[i];
+        if (c != '\\')
+        {
+            unescaped += c;
+            continue;
+        }
+        if (++i == value.size())
+        {
+            // A lone backslash at the end is dropped
+            break;
+        }
+        switch (value[i])
+        {
+        case ':': unescaped += ';'; break;
+        case 's': unescaped += ' '; break;
+        case 'r': unescaped += '\r'; break;
+        case 'n': unescaped += '\n'; break;
+        default: unescaped += value[i]; break;
+        }
+    }
+}
+
+bool Irc::ParseNamesEntry(boost::string_ref entry,
+                          boost::string_ref prefixSymbols,
+                          boost::string_ref& prefixes,
+                          boost::string_ref& nick,
+                          boost::string_ref& user,
+                          boost::string_ref& host)
+{
+    std::size_t prefixLength = 0;
+    while (prefixLength < entry.size()
+           && prefixSymbols.find(entry[prefixLength])
+           != boost::string_ref::npos)
+    {
+        ++prefixLength;
+    }
+    prefixes = entry.substr(0, prefixLength);
+    ::Prefix::Split(entry.substr(prefixLength), nick, user, host);
+    return !nick.empty();
+}
+
+bool Irc::NextWord(boost::string_ref& words, boost::string_ref& word)
+{
+    const char* begin = SkipSpaces(words.data(), words.data() + words.size());
+    const char* end = words.data() + words.size();
+    if (begin == end)
+    {
+        words.clear();
+        return false;
+    }
+    const char* wordEnd = FindSpace(begin, end);
+    word = MakeRef(begin, wordEnd);
+    words = MakeRef(wordEnd, end);
+    return true;
+}
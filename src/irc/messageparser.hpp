@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+
+#include <boost/utility/string_ref.hpp>
+
+namespace Irc
+{
+
+/**
+ * The parts of a received line as it is laid out in RFC 1459 with the
+ * IRCv3 message tags in front:
+ *   [@tags] [:prefix] command [parameters] [:trailing parameter]
+ * All parts refer into the line, which has to outlive this.
+ */
+struct ParsedLine
+{
+    // RFC 1459 allows 14 middle parameters and a trailing one
+    static const std::size_t MAX_PARAMETERS = 15;
+
+    // Without the leading @, see NextTag
+    boost::string_ref Tags;
+    // Without the leading colon, split as by Prefix::Split
+    boost::string_ref Prefix;
+    boost::string_ref Nick;
+    boost::string_ref User;
+    boost::string_ref Host;
+    boost::string_ref Command;
+    boost::string_ref Parameters[MAX_PARAMETERS];
+    std::size_t ParameterCount;
+};
+
+/**
+ * Split a line in one pass without allocating. More parameters than
+ * MAX_PARAMETERS are left unsplit in the last one.
+ * @return false if there is no command
+ */
+bool ParseLine(boost::string_ref line, ParsedLine& parsed);
+
+/**
+ * Take the first tag off a list of tags.
+ * @param value still escaped, see UnescapeTagValue
+ * @return false if there are no more tags
+ */
+bool NextTag(boost::string_ref& tags,
+             boost::string_ref& key,
+             boost::string_ref& value);
+
+/**
+ * Undo the escaping of a tag value, \: for ; and \s for space and so on.
+ */
+void UnescapeTagValue(boost::string_ref value, std::string& unescaped);
+
+/**
+ * Split an entry of a NAMES reply, [prefixes]nick[!user@host], without
+ * copying. Several prefixes come with multi-prefix, the user and host with
+ * userhost-in-names.
+ * @param prefixSymbols the symbols a member can have in front, like @+
+ * @return false if there is no nick
+ */
+bool ParseNamesEntry(boost::string_ref entry,
+                     boost::string_ref prefixSymbols,
+                     boost::string_ref& prefixes,
+                     boost::string_ref& nick,
+                     boost::string_ref& user,
+                     boost::string_ref& host);
+
+/**
+ * Take the first word off a list of words separated by spaces.
+ * @return false if there are no more words
+ */
+bool NextWord(boost::string_ref& words, boost::string_ref& word);
+
+} // namespace Irc
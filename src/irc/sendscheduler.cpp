@@ -0,0 +1,208 @@
+#include "sendscheduler.hpp"
+#include "../exception.hpp"
+#include "../logging/logger.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <boost/bind.hpp>
+
+using boost::posix_time::ptime;
+using boost::posix_time::microsec_clock;
+
+Irc::SendScheduler::SendScheduler(Sink sink, const Limits& limits)
+    : sink_(sink)
+    , limits_(limits)
+    , lineTokens_(limits.BurstLines)
+    , byteTokens_(limits.BurstBytes)
+    , lastRefill_(microsec_clock::universal_time())
+    , queuedLines_(0)
+    , timer_(IoServicePool::Instance().GetIoService())
+    , timerArmed_(false)
+    , closing_(false)
+{
+    for (std::size_t i = 0; i < PRIORITY_COUNT; ++i)
+    {
+        lanes_[i].QueuedLines = 0;
+        lanes_[i].SentLines = 0;
+        lanes_[i].TotalLatencyMilliseconds = 0;
+        lanes_[i].MaxLatencyMilliseconds = 0;
+    }
+}
+
+Irc::SendScheduler::~SendScheduler()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        closing_ = true;
+        boost::system::error_code error;
+        timer_.cancel(error);
+    }
+    pending_.WaitForAll();
+}
+
+void Irc::SendScheduler::SetLimits(const Limits& limits)
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    limits_ = limits;
+    lineTokens_ = std::min<double>(lineTokens_, limits_.BurstLines);
+    byteTokens_ = std::min<double>(byteTokens_, limits_.BurstBytes);
+}
+
+void Irc::SendScheduler::Send(const std::string& line, Priority priority,
+                              const std::string& target)
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    Lane& lane = lanes_[priority];
+    EntryQueue& queue = lane.Targets[target];
+    if (queue.empty())
+    {
+        lane.Turns.push_back(target);
+    }
+    Entry entry = { line, microsec_clock::universal_time() };
+    queue.push_back(entry);
+    ++lane.QueuedLines;
+    ++queuedLines_;
+
+    Drain();
+}
+
+void Irc::SendScheduler::Clear()
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    for (std::size_t i = 0; i < PRIORITY_COUNT; ++i)
+    {
+        lanes_[i].Targets.clear();
+        lanes_[i].Turns.clear();
+        lanes_[i].QueuedLines = 0;
+    }
+    queuedLines_ = 0;
+    lineTokens_ = limits_.BurstLines;
+    byteTokens_ = limits_.BurstBytes;
+    lastRefill_ = microsec_clock::universal_time();
+}
+
+Irc::SendScheduler::LaneStatistics
+Irc::SendScheduler::GetStatistics(Priority priority) const
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    const Lane& lane = lanes_[priority];
+    LaneStatistics statistics;
+    statistics.QueuedLines = lane.QueuedLines;
+    statistics.SentLines = lane.SentLines;
+    statistics.AverageLatencyMilliseconds = lane.SentLines > 0
+        ? lane.TotalLatencyMilliseconds / lane.SentLines : 0;
+    statistics.MaxLatencyMilliseconds = lane.MaxLatencyMilliseconds;
+    return statistics;
+}
+
+void Irc::SendScheduler::Refill(const ptime& now)
+{
+    double seconds = (now - lastRefill_).total_microseconds() / 1000000.0;
+    lastRefill_ = now;
+    lineTokens_ = std::min<double>(lineTokens_
+        + seconds * limits_.LinesPerSecond, limits_.BurstLines);
+    byteTokens_ = std::min<double>(byteTokens_
+        + seconds * limits_.BytesPerSecond, limits_.BurstBytes);
+}
+
+bool Irc::SendScheduler::HasTokens(std::size_t bytes) const
+{
+    // A bucket with no rate is not limited. The byte bucket accepts a line
+    // larger than the burst size once it is full, or it would never go out.
+    bool lineOk = limits_.LinesPerSecond <= 0 || lineTokens_ >= 1;
+    bool byteOk = limits_.BytesPerSecond <= 0 || byteTokens_ >= bytes
+        || byteTokens_ >= limits_.BurstBytes;
+    return lineOk && byteOk;
+}
+
+void Irc::SendScheduler::Drain()
+{
+    ptime now = microsec_clock::universal_time();
+    Refill(now);
+
+    while (queuedLines_ > 0)
+    {
+        std::size_t priority = 0;
+        while (lanes_[priority].QueuedLines == 0)
+        {
+            ++priority;
+        }
+        Lane& lane = lanes_[priority];
+        Lane::TargetQueueMap::iterator target = lane.Targets.find(
+            lane.Turns.front());
+        Entry& entry = target->second.front();
+        std::size_t bytes = entry.Line.size() + 2;
+
+        // Answering a PING is never held back, a late PONG gets us
+        // disconnected which is worse than the server's flood penalty
+        if (priority != Ping && !HasTokens(bytes))
+        {
+            break;
+        }
+        lineTokens_ -= 1;
+        byteTokens_ -= bytes;
+
+        double latency = (now - entry.Queued).total_microseconds() / 1000.0;
+        lane.TotalLatencyMilliseconds += latency;
+        lane.MaxLatencyMilliseconds = std::max(lane.MaxLatencyMilliseconds,
+                                               latency);
+        ++lane.SentLines;
+
+        try
+        {
+            sink_(entry.Line);
+        } catch (Exception& e)
+        {
+            Log << LogLevel::Error << e.GetMessage();
+        }
+
+        target->second.pop_front();
+        --lane.QueuedLines;
+        --queuedLines_;
+        // Let the next target in this lane have a go
+        std::string turn = lane.Turns.front();
+        lane.Turns.pop_front();
+        if (target->second.empty())
+        {
+            lane.Targets.erase(target);
+        }
+        else
+        {
+            lane.Turns.push_back(turn);
+        }
+    }
+
+    if (queuedLines_ > 0 && !timerArmed_ && !closing_)
+    {
+        // Wake up when there is room for roughly one more line
+        double seconds = 0.1;
+        if (limits_.LinesPerSecond > 0 && lineTokens_ < 1)
+        {
+            seconds = std::max(seconds, (1 - lineTokens_)
+                / limits_.LinesPerSecond);
+        }
+        if (limits_.BytesPerSecond > 0 && byteTokens_ < 0)
+        {
+            seconds = std::max(seconds, -byteTokens_ / limits_.BytesPerSecond);
+        }
+        timerArmed_ = true;
+        timer_.expires_from_now(boost::posix_time::microseconds(
+            static_cast<long>(std::ceil(seconds * 1000000))));
+        pending_.Begin();
+        timer_.async_wait(boost::bind(&SendScheduler::OnTimer, this, _1));
+    }
+}
+
+void Irc::SendScheduler::OnTimer(const boost::system::error_code& error)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutex_);
+        timerArmed_ = false;
+        if (!error && !closing_)
+        {
+            Drain();
+        }
+    }
+    pending_.End();
+}
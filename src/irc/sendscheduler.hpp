@@ -0,0 +1,122 @@
+#pragma once
+
+#include "../connection/ioservicepool.hpp"
+
+#include <string>
+#include <deque>
+#include <list>
+#include <map>
+
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/utility.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace Irc
+{
+
+/**
+ * Flood control for outgoing lines. Lines are put in one of several
+ * priority lanes and taken out highest priority first, but only as fast as
+ * a token bucket on lines and bytes per second allows. Within a lane the
+ * targets (channels and nicks) take turns so one busy target can not starve
+ * the others.
+ */
+class SendScheduler : boost::noncopyable
+{
+public:
+    // Lanes, in the order they are served
+    enum Priority
+    {
+	Ping,
+	Registration,
+	Reply,
+	Channel,
+	Reminder
+    };
+    static const std::size_t PRIORITY_COUNT = Reminder + 1;
+
+    struct Limits
+    {
+	// A rate of zero disables that bucket
+	double LinesPerSecond;
+	double BytesPerSecond;
+	// Number of lines/bytes that may be sent at once after being idle
+	unsigned int BurstLines;
+	unsigned int BurstBytes;
+    };
+
+    struct LaneStatistics
+    {
+	std::size_t QueuedLines;
+	unsigned long SentLines;
+	// Time between queuing and sending a line
+	double AverageLatencyMilliseconds;
+	double MaxLatencyMilliseconds;
+    };
+
+    typedef boost::function<void (const std::string&)> Sink;
+
+    SendScheduler(Sink sink, const Limits& limits);
+    ~SendScheduler();
+
+    void SetLimits(const Limits& limits);
+
+    /**
+     * Queue a line and send it as soon as the limits allow, which may be
+     * before this returns.
+     */
+    void Send(const std::string& line, Priority priority,
+              const std::string& target);
+
+    /**
+     * Throw away everything that is queued and refill the buckets, used
+     * when a new connection is made.
+     */
+    void Clear();
+
+    LaneStatistics GetStatistics(Priority priority) const;
+
+private:
+    struct Entry
+    {
+	std::string Line;
+	boost::posix_time::ptime Queued;
+    };
+    typedef std::deque<Entry> EntryQueue;
+
+    struct Lane
+    {
+	typedef std::map<std::string, EntryQueue> TargetQueueMap;
+	TargetQueueMap Targets;
+	// Targets with queued lines, the front one is served next
+	std::list<std::string> Turns;
+	std::size_t QueuedLines;
+	unsigned long SentLines;
+	double TotalLatencyMilliseconds;
+	double MaxLatencyMilliseconds;
+    };
+
+    void Refill(const boost::posix_time::ptime& now);
+    bool HasTokens(std::size_t bytes) const;
+    void Drain();
+    void OnTimer(const boost::system::error_code& error);
+
+    Sink sink_;
+    Limits limits_;
+    double lineTokens_;
+    double byteTokens_;
+    boost::posix_time::ptime lastRefill_;
+
+    Lane lanes_[PRIORITY_COUNT];
+    std::size_t queuedLines_;
+
+    boost::asio::deadline_timer timer_;
+    bool timerArmed_;
+    bool closing_;
+    PendingOperations pending_;
+    mutable boost::mutex mutex_;
+};
+
+} // namespace Irc
@@ -0,0 +1,340 @@
+#include "lastseenindex.hpp"
+#include "chatlogfiles.hpp"
+#include "chatlogreader.hpp"
+#include "chatlogsegments.hpp"
+#include "logging/logger.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+using boost::posix_time::ptime;
+using boost::posix_time::microsec_clock;
+
+// Checkpoints start with this, a new layout gets a new number
+static const char CHECKPOINT_MAGIC[4] = { 'L', 'S', 'I', '1' };
+const std::size_t SCAN_BUFFER_SIZE = 1 << 20;
+
+LastSeenIndex::LastSeenIndex(const std::string& checkpoint,
+                             unsigned int checkpointIntervalMilliseconds)
+    : ready_(true)
+    , stopping_(false)
+    , checkpoint_(checkpoint,
+                  checkpointIntervalMilliseconds,
+                  boost::bind(&LastSeenIndex::Serialize, this, _1))
+{
+    checkpoint_.Start();
+}
+
+LastSeenIndex::~LastSeenIndex()
+{
+    checkpoint_.Stop();
+
+    stopping_ = true;
+    if (rebuildThread_.joinable())
+    {
+        rebuildThread_.join();
+    }
+    Save();
+}
+
+void LastSeenIndex::Rebuild(const std::string& logsDirectory)
+{
+    ready_ = false;
+    rebuildThread_ = boost::thread(boost::bind(&LastSeenIndex::RunRebuild,
+                                               this,
+                                               logsDirectory));
+}
+
+bool LastSeenIndex::IsReady() const
+{
+    return ready_;
+}
+
+void LastSeenIndex::Update(const std::string& logFile,
+                           const std::string& nick,
+                           std::time_t time,
+                           const std::string& line)
+{
+    boost::unique_lock<boost::shared_mutex> lock(filesMutex_);
+    Entry& entry = files_[logFile][nick];
+    entry.Time = time;
+    entry.Line = line;
+}
+
+bool LastSeenIndex::Find(const std::string& logFile,
+                         const std::string& nick,
+                         Entry& entry) const
+{
+    boost::shared_lock<boost::shared_mutex> lock(filesMutex_);
+    FileMap::const_iterator file = files_.find(logFile);
+    if (file == files_.end())
+    {
+        return false;
+    }
+    NickMap::const_iterator found = file->second.find(nick);
+    if (found == file->second.end())
+    {
+        return false;
+    }
+    entry = found->second;
+    return true;
+}
+
+void LastSeenIndex::Save()
+{
+    checkpoint_.Save();
+}
+
+bool LastSeenIndex::Serialize(std::string& data) const
+{
+    if (!ready_)
+    {
+        return false;
+    }
+
+    // Sizes first, a line is indexed before it is written so everything
+    // up to them is in the index when it is copied below. Lines after them
+    // are read again on start, which does no harm.
+    std::vector<std::string> paths;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(filesMutex_);
+        paths.reserve(files_.size());
+        for (FileMap::const_iterator file = files_.begin();
+             file != files_.end();
+             ++file)
+        {
+            paths.push_back(file->first);
+        }
+    }
+    OffsetMap offsets;
+    for (std::vector<std::string>::const_iterator path = paths.begin();
+         path != paths.end();
+         ++path)
+    {
+        offsets[*path] = ChatLogSegments::GetSize(*path);
+    }
+
+    // Copied so that logging does not wait for the whole checkpoint
+    FileMap files;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(filesMutex_);
+        files = files_;
+    }
+
+    data.assign(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    Checkpoint::WriteNumber(data, files.size());
+    for (FileMap::const_iterator file = files.begin();
+         file != files.end();
+         ++file)
+    {
+        // Files added since the sizes were taken are read from the start
+        OffsetMap::const_iterator offset = offsets.find(file->first);
+        Checkpoint::WriteString(data, file->first);
+        Checkpoint::WriteNumber(data,
+                                offset == offsets.end() ? 0 : offset->second);
+        Checkpoint::WriteNumber(data, file->second.size());
+        for (NickMap::const_iterator nick = file->second.begin();
+             nick != file->second.end();
+             ++nick)
+        {
+            Checkpoint::WriteString(data, nick->first);
+            Checkpoint::WriteNumber(data, nick->second.Time);
+            Checkpoint::WriteString(data, nick->second.Line);
+        }
+    }
+    return true;
+}
+
+void LastSeenIndex::RunRebuild(const std::string& logsDirectory)
+{
+    ptime started = microsec_clock::universal_time();
+    OffsetMap offsets;
+    Load(offsets);
+
+    std::vector<std::string> paths;
+    ChatLogFiles::List(logsDirectory, paths);
+    // A checkpoint configured to be among the logs is not one of them
+    paths.erase(std::remove(paths.begin(), paths.end(), checkpoint_.GetPath()),
+                paths.end());
+
+    boost::atomic<std::size_t> next(0);
+    boost::atomic<unsigned long long> bytes(0);
+    std::size_t threads = std::max(1u, boost::thread::hardware_concurrency());
+    threads = std::min(threads, std::max<std::size_t>(paths.size(), 1));
+    boost::thread_group scanners;
+    for (std::size_t i = 0; i < threads; ++i)
+    {
+        scanners.create_thread(boost::bind(&LastSeenIndex::ScanFiles,
+                                           this,
+                                           boost::cref(paths),
+                                           boost::cref(offsets),
+                                           boost::ref(next),
+                                           boost::ref(bytes)));
+    }
+    scanners.join_all();
+
+    if (stopping_)
+    {
+        return;
+    }
+    ready_ = true;
+    Log << LogLevel::Info << "Last seen index ready after "
+        << (microsec_clock::universal_time() - started).total_milliseconds()
+        << " ms, read " << bytes.load() << " bytes of " << paths.size()
+        << " logs on " << threads << " threads";
+    Save();
+}
+
+void LastSeenIndex::Load(OffsetMap& offsets)
+{
+    if (checkpoint_.GetPath().empty())
+    {
+        return;
+    }
+    std::ifstream in(checkpoint_.GetPath().c_str(), std::ios::binary);
+    if (!in)
+    {
+        Log << LogLevel::Info << "No last seen checkpoint, reading all logs";
+        return;
+    }
+
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    boost::uint64_t fileCount = 0;
+    bool valid = in.read(magic, sizeof(magic))
+        && std::equal(magic, magic + sizeof(magic), CHECKPOINT_MAGIC)
+        && Checkpoint::ReadNumber(in, fileCount);
+    for (boost::uint64_t i = 0; valid && i < fileCount; ++i)
+    {
+        std::string path;
+        boost::uint64_t offset = 0;
+        boost::uint64_t nickCount = 0;
+        valid = Checkpoint::ReadString(in, path)
+            && Checkpoint::ReadNumber(in, offset)
+            && Checkpoint::ReadNumber(in, nickCount);
+        NickMap nicks;
+        for (boost::uint64_t j = 0; valid && j < nickCount; ++j)
+        {
+            std::string nick;
+            boost::uint64_t time = 0;
+            Entry entry;
+            valid = Checkpoint::ReadString(in, nick)
+                && Checkpoint::ReadNumber(in, time)
+                && Checkpoint::ReadString(in, entry.Line);
+            entry.Time = static_cast<std::time_t>(time);
+            nicks[nick] = entry;
+        }
+        if (valid)
+        {
+            offsets[path] = offset;
+            Merge(path, nicks);
+        }
+    }
+    if (!valid)
+    {
+        // What was read is still right, the rest of the logs is read again
+        Log << LogLevel::Warning << "Last seen checkpoint '"
+            << checkpoint_.GetPath()
+            << "' is broken, reading the logs it does not cover";
+    }
+}
+
+void LastSeenIndex::ScanFiles(const std::vector<std::string>& paths,
+                              const OffsetMap& offsets,
+                              boost::atomic<std::size_t>& next,
+                              boost::atomic<unsigned long long>& bytes)
+{
+    for (std::size_t i = next++; i < paths.size() && !stopping_; i = next++)
+    {
+        OffsetMap::const_iterator offset = offsets.find(paths[i]);
+        bytes += ScanFile(paths[i],
+                          offset == offsets.end() ? 0 : offset->second);
+    }
+}
+
+unsigned long long LastSeenIndex::ScanFile(const std::string& path,
+                                           unsigned long long offset)
+{
+    ChatLogReader in(path);
+    if (!in.Exists())
+    {
+        return 0;
+    }
+    unsigned long long size = in.GetSize();
+    // A log that shrank has been replaced, read all of it
+    if (offset > size)
+    {
+        offset = 0;
+    }
+
+    NickMap nicks;
+    std::vector<char> buffer(SCAN_BUFFER_SIZE);
+    // A line cut by the end of the buffer is moved to its start
+    std::size_t kept = 0;
+    unsigned long long left = size - offset;
+    while (left > 0 && !stopping_)
+    {
+        std::size_t wanted = std::min<unsigned long long>(left,
+                                                          buffer.size() - kept);
+        if (wanted == 0)
+        {
+            // A line longer than the buffer is nobody's chat line
+            kept = 0;
+            continue;
+        }
+        if (in.Read(size - left, &buffer[kept], wanted) != wanted)
+        {
+            break;
+        }
+        left -= wanted;
+        const char* begin = &buffer[0];
+        const char* end = begin + kept + wanted;
+        for (const char* newline = std::find(begin, end, '\n');
+             newline != end;
+             newline = std::find(begin, end, '\n'))
+        {
+            std::time_t time;
+            boost::string_ref nick;
+            boost::string_ref text;
+            if (ChatLogFiles::ParseLine(boost::string_ref(begin,
+                                                          newline - begin),
+                          time, nick, text))
+            {
+                // Later lines are newer, the last one wins
+                Entry& entry = nicks[std::string(nick.begin(), nick.end())];
+                entry.Time = time;
+                entry.Line.assign(text.begin(), text.end());
+            }
+            begin = newline + 1;
+        }
+        kept = end - begin;
+        std::copy(begin, end, buffer.begin());
+    }
+
+    if (!nicks.empty())
+    {
+        Merge(path, nicks);
+    }
+    return size - offset - left;
+}
+
+void LastSeenIndex::Merge(const std::string& path, const NickMap& nicks)
+{
+    boost::unique_lock<boost::shared_mutex> lock(filesMutex_);
+    NickMap& known = files_[path];
+    for (NickMap::const_iterator nick = nicks.begin();
+         nick != nicks.end();
+         ++nick)
+    {
+        // Lines logged while rebuilding are newer than what is read
+        std::pair<NickMap::iterator, bool> inserted = known.insert(*nick);
+        if (!inserted.second && inserted.first->second.Time < nick->second.Time)
+        {
+            inserted.first->second = nick->second;
+        }
+    }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "checkpoint.hpp"
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/utility.hpp>
+
+/**
+ * The last line each nick said in each chat log, kept up to date as lines
+ * are logged so nobody has to search the logs for it. The index is saved
+ * to a checkpoint now and then along with how much of each log it covers,
+ * on start the checkpoint is loaded and only what has been logged since is
+ * read. Without a checkpoint every log is read, several at a time.
+ */
+class LastSeenIndex : boost::noncopyable
+{
+public:
+    struct Entry
+    {
+	Entry() : Time(0) {}
+
+	std::time_t Time;
+	// What the nick said, without the time, target and nick
+	std::string Line;
+    };
+
+    /**
+     * @param checkpoint where the index is saved, empty to never save it
+     * @param checkpointIntervalMilliseconds zero only saves it when the
+     *        index goes away
+     */
+    LastSeenIndex(const std::string& checkpoint,
+		  unsigned int checkpointIntervalMilliseconds);
+    /**
+     * Stops a rebuild that is still going on and saves the index if it is
+     * complete.
+     */
+    ~LastSeenIndex();
+
+    /**
+     * Load the checkpoint and read what has been logged since, on threads
+     * of its own. Lines can be added meanwhile.
+     * @param logsDirectory every file under it is a chat log
+     */
+    void Rebuild(const std::string& logsDirectory);
+
+    /**
+     * @return false while the index is being rebuilt
+     */
+    bool IsReady() const;
+
+    /**
+     * Called for every line that is logged, before it is written.
+     */
+    void Update(const std::string& logFile,
+		const std::string& nick,
+		std::time_t time,
+		const std::string& line);
+
+    /**
+     * @return false if the nick has said nothing in the log
+     */
+    bool Find(const std::string& logFile,
+	      const std::string& nick,
+	      Entry& entry) const;
+
+    /**
+     * Save the checkpoint now, nothing is saved while rebuilding.
+     */
+    void Save();
+
+private:
+    typedef boost::unordered_map<std::string, Entry> NickMap;
+    typedef boost::unordered_map<std::string, NickMap> FileMap;
+    typedef boost::unordered_map<std::string, unsigned long long> OffsetMap;
+
+    void RunRebuild(const std::string& logsDirectory);
+    // @param offsets gets how much of each log the checkpoint covers
+    void Load(OffsetMap& offsets);
+    // Every thread takes the next log until there are none left
+    void ScanFiles(const std::vector<std::string>& paths,
+		   const OffsetMap& offsets,
+		   boost::atomic<std::size_t>& next,
+		   boost::atomic<unsigned long long>& bytes);
+    // Read a log from where the checkpoint left it, @return bytes read
+    unsigned long long ScanFile(const std::string& path,
+				unsigned long long offset);
+    // Keeps whichever line is newest
+    void Merge(const std::string& path, const NickMap& nicks);
+    bool Serialize(std::string& data) const;
+
+    FileMap files_;
+    mutable boost::shared_mutex filesMutex_;
+
+    boost::atomic<bool> ready_;
+    boost::atomic<bool> stopping_;
+    boost::thread rebuildThread_;
+
+    Checkpoint checkpoint_;
+};
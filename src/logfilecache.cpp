@@ -0,0 +1,153 @@
+#include "logfilecache.hpp"
+#include "logging/logger.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <boost/filesystem/convenience.hpp>
+#include <boost/filesystem/exception.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+LogFileCache::LogFileCache(std::size_t maxFiles,
+                           unsigned int idleMilliseconds,
+                           CloseHandler onClose)
+    : maxFiles_(std::max<std::size_t>(maxFiles, 1))
+    , idleMilliseconds_(idleMilliseconds)
+    , onClose_(onClose)
+{
+    statistics_.Hits = 0;
+    statistics_.Misses = 0;
+    statistics_.Evictions = 0;
+    statistics_.IdleCloses = 0;
+    statistics_.OpenFiles = 0;
+}
+
+LogFileCache::~LogFileCache()
+{
+    while (!entries_.empty())
+    {
+        CloseLast();
+    }
+}
+
+void LogFileCache::SetLimits(std::size_t maxFiles,
+                             unsigned int idleMilliseconds)
+{
+    maxFiles_ = std::max<std::size_t>(maxFiles, 1);
+    idleMilliseconds_ = idleMilliseconds;
+    while (entries_.size() > maxFiles_)
+    {
+        CloseLast();
+        ++statistics_.Evictions;
+    }
+}
+
+int LogFileCache::Get(const std::string& path,
+                      const boost::posix_time::ptime& now)
+{
+    EntryMap::iterator found = paths_.find(path);
+    if (found != paths_.end())
+    {
+        ++statistics_.Hits;
+        entries_.splice(entries_.begin(), entries_, found->second);
+        found->second->LastUsed = now;
+        return found->second->Fd;
+    }
+
+    ++statistics_.Misses;
+    int fd = Open(path);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (entries_.size() >= maxFiles_)
+    {
+        CloseLast();
+        ++statistics_.Evictions;
+    }
+    Entry entry;
+    entry.Path = path;
+    entry.Fd = fd;
+    entry.LastUsed = now;
+    entries_.push_front(entry);
+    paths_[path] = entries_.begin();
+    statistics_.OpenFiles = entries_.size();
+    return fd;
+}
+
+int LogFileCache::Find(const std::string& path) const
+{
+    EntryMap::const_iterator found = paths_.find(path);
+    return found == paths_.end() ? -1 : found->second->Fd;
+}
+
+void LogFileCache::Close(const std::string& path)
+{
+    EntryMap::iterator found = paths_.find(path);
+    if (found != paths_.end())
+    {
+        // Move it last so there is only one way files are closed
+        entries_.splice(entries_.end(), entries_, found->second);
+        CloseLast();
+    }
+}
+
+void LogFileCache::CloseIdle(const boost::posix_time::ptime& now)
+{
+    if (idleMilliseconds_ == 0)
+    {
+        return;
+    }
+    boost::posix_time::milliseconds idle(idleMilliseconds_);
+    while (!entries_.empty() && now - entries_.back().LastUsed >= idle)
+    {
+        Log << LogLevel::Debug << "Closing idle '" << entries_.back().Path
+            << "' log file";
+        CloseLast();
+        ++statistics_.IdleCloses;
+    }
+}
+
+int LogFileCache::Open(const std::string& path)
+{
+    Log << LogLevel::Debug << "Opening '" << path << "' log file";
+    const int flags = O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC;
+    int fd = open(path.c_str(), flags, 0644);
+    if (fd < 0 && errno == ENOENT)
+    {
+        // Only the first line of a new target gets here
+        try
+        {
+            boost::filesystem::create_directories(
+                boost::filesystem::path(path).parent_path());
+        } catch (boost::filesystem::filesystem_error& e)
+        {
+            Log << LogLevel::Error << "Could not create directories for '"
+                << path << "': " << e.what();
+        }
+        fd = open(path.c_str(), flags, 0644);
+    }
+    if (fd < 0)
+    {
+        Log << LogLevel::Error << "Could not open '" << path << "': "
+            << strerror(errno);
+    }
+    return fd;
+}
+
+void LogFileCache::CloseLast()
+{
+    const Entry& entry = entries_.back();
+    if (onClose_)
+    {
+        onClose_(entry.Path, entry.Fd);
+    }
+    close(entry.Fd);
+    paths_.erase(entry.Path);
+    entries_.pop_back();
+    statistics_.OpenFiles = entries_.size();
+}
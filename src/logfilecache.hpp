@@ -0,0 +1,93 @@
+#pragma once
+
+#include <list>
+#include <string>
+
+#include <boost/function.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/utility.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+/**
+ * Open chat log files by path, at most a set number of them. The file used
+ * the longest time ago is closed to make room for a new one and files
+ * that have not been used for a while are closed when asked to. Files are
+ * opened for appending and their directories are made when needed.
+ * Not thread safe, the chat log writer is its only user.
+ */
+class LogFileCache : boost::noncopyable
+{
+public:
+    /**
+     * Called right before a file is closed.
+     */
+    typedef boost::function<void (const std::string& path, int fd)> CloseHandler;
+
+    struct Statistics
+    {
+	// Files that were already open when asked for
+	unsigned long Hits;
+	unsigned long Misses;
+	// Files closed to stay within the limit
+	unsigned long Evictions;
+	unsigned long IdleCloses;
+	std::size_t OpenFiles;
+    };
+
+    /**
+     * @param maxFiles at least one file is always kept open
+     * @param idleMilliseconds zero keeps files open until evicted
+     */
+    LogFileCache(std::size_t maxFiles,
+		 unsigned int idleMilliseconds,
+		 CloseHandler onClose);
+    ~LogFileCache();
+
+    /**
+     * Files over the new limit are closed right away.
+     */
+    void SetLimits(std::size_t maxFiles, unsigned int idleMilliseconds);
+
+    /**
+     * Get the file, opening it if it is not open, and mark it as used.
+     * @return -1 if the file can not be opened
+     */
+    int Get(const std::string& path,
+	    const boost::posix_time::ptime& now);
+
+    /**
+     * Like Get but does not open files or mark them as used.
+     */
+    int Find(const std::string& path) const;
+
+    void Close(const std::string& path);
+
+    /**
+     * Close the files that have not been used for the idle time.
+     */
+    void CloseIdle(const boost::posix_time::ptime& now);
+
+    const Statistics& GetStatistics() const { return statistics_; }
+
+private:
+    struct Entry
+    {
+	std::string Path;
+	int Fd;
+	boost::posix_time::ptime LastUsed;
+    };
+    // Most recently used first
+    typedef std::list<Entry> EntryList;
+    typedef boost::unordered_map<std::string, EntryList::iterator> EntryMap;
+
+    // -1 on failure
+    static int Open(const std::string& path);
+    void CloseLast();
+
+    std::size_t maxFiles_;
+    unsigned int idleMilliseconds_;
+    CloseHandler onClose_;
+    EntryList entries_;
+    EntryMap paths_;
+    Statistics statistics_;
+};
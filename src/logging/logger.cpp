@@ -1,8 +1,52 @@
 #include "logger.hpp"
 
+#include <algorithm>
+#include <cstdio>
+
 Logger Log;
 
 Logger::Logger()
 {
 
 }
+
+void Logger::LoggerProxy::Append(const char* text, std::size_t size)
+{
+    // Whatever does not fit is cut
+    size = std::min(size, sizeof(text_) - size_);
+    std::char_traits<char>::copy(text_ + size_, text, size);
+    size_ += size;
+}
+
+void Logger::LoggerProxy::Append(double value)
+{
+    // What a stream writes with its default precision
+    char digits[32];
+    int size = std::snprintf(digits, sizeof(digits), "%g", value);
+    Append(digits, std::min<std::size_t>(size, sizeof(digits) - 1));
+}
+
+void Logger::LoggerProxy::AppendSigned(long long value)
+{
+    if (value < 0)
+    {
+	Append('-');
+	// The most negative number has no positive counterpart
+	AppendUnsigned(0ULL - static_cast<unsigned long long>(value));
+	return;
+    }
+    AppendUnsigned(static_cast<unsigned long long>(value));
+}
+
+void Logger::LoggerProxy::AppendUnsigned(unsigned long long value)
+{
+    char digits[24];
+    char* end = digits + sizeof(digits);
+    char* begin = end;
+    do
+    {
+	*--begin = static_cast<char>('0' + value % 10);
+	value /= 10;
+    } while (value != 0);
+    Append(begin, end - begin);
+}
@@ -2,70 +2,118 @@
 #include "loglevel.hpp"
 #include "logmanager.hpp"
 
+#include <cstddef>
 #include <sstream>
+#include <string>
 
-#include <boost/utility.hpp>
-#include <boost/shared_ptr.hpp>
+#include <boost/utility/string_ref.hpp>
 
 #include <converter.hpp>
 
 class Logger
 {
 public:
+    /**
+     * Formats one record on the stack and hands it to the log manager when
+     * the statement ends. Nothing is formatted for records below the level.
+     */
     class LoggerProxy
     {
     public:
-	explicit LoggerProxy(LogSinkPtr sink)
-	    : impl_(new LoggerProxyImpl(sink))
+	LoggerProxy(LogLevel::LogLevel level, bool enabled)
+	    : level_(level)
+	    , enabled_(enabled)
+	    , size_(0)
 	{
 	}
 
-	template<class T>
-	LoggerProxy& operator<<(const T& rhs)
+	// The copy takes the record over, only one of them submits it
+	LoggerProxy(const LoggerProxy& other)
+	    : level_(other.level_)
+	    , enabled_(other.enabled_)
+	    , size_(other.size_)
 	{
-	    (*impl_)<<rhs;
-	    return *this;
+	    std::char_traits<char>::copy(text_, other.text_, size_);
+	    other.enabled_ = false;
 	}
-    private:
-	class LoggerProxyImpl : boost::noncopyable
+
+	~LoggerProxy()
 	{
-	public:
-	    explicit LoggerProxyImpl(LogSinkPtr sink)
-		: sink_(sink)
-	    {
-	    }
-	    
-	    virtual ~LoggerProxyImpl()
-	    {
-		    (*sink_)<<buffer_.str();
-	    }
-	    
-	    template<class T>
-	    LoggerProxyImpl& operator<<(const T& rhs)
+	    if (enabled_)
 	    {
-		    buffer_<<rhs;
-		    return *this;
+		LogManager::Instance().Submit(level_, text_, size_);
 	    }
+	}
 
-	    LoggerProxyImpl& operator<<(const UnicodeString& rhs)
+	template<class T>
+	LoggerProxy& operator<<(const T& rhs)
+	{
+	    if (enabled_)
 	    {
-		    buffer_<<AsUtf8(rhs);
-		    return *this;
+		Append(rhs);
 	    }
-	private:
-	    LogSinkPtr sink_;
-	    std::stringstream buffer_;
-	};
+	    return *this;
+	}
+
+    private:
+	LoggerProxy& operator=(const LoggerProxy&);
+
+	void Append(const char* text, std::size_t size);
+	void Append(const char* text)
+	{
+	    Append(text, std::char_traits<char>::length(text));
+	}
+	void Append(const std::string& text)
+	{
+	    Append(text.data(), text.size());
+	}
+	void Append(boost::string_ref text)
+	{
+	    Append(text.data(), text.size());
+	}
+	void Append(const UnicodeString& text)
+	{
+	    Append(AsUtf8(text));
+	}
+	void Append(char c)
+	{
+	    Append(&c, 1);
+	}
+	void Append(bool value)
+	{
+	    Append(value ? "1" : "0", 1);
+	}
+	void Append(int value) { AppendSigned(value); }
+	void Append(long value) { AppendSigned(value); }
+	void Append(long long value) { AppendSigned(value); }
+	void Append(unsigned int value) { AppendUnsigned(value); }
+	void Append(unsigned long value) { AppendUnsigned(value); }
+	void Append(unsigned long long value) { AppendUnsigned(value); }
+	void Append(double value);
+	// Anything else is written the way it streams
+	template<class T>
+	void Append(const T& rhs)
+	{
+	    std::ostringstream out;
+	    out << rhs;
+	    Append(out.str());
+	}
+
+	void AppendSigned(long long value);
+	void AppendUnsigned(unsigned long long value);
 
-	boost::shared_ptr<LoggerProxyImpl> impl_;
+	LogLevel::LogLevel level_;
+	mutable bool enabled_;
+	std::size_t size_;
+	char text_[LogManager::MAX_RECORD_SIZE];
     };
 
     Logger();
 
     LoggerProxy operator<<(const LogLevel::LogLevel logLevel)
     {
-	LoggerProxy proxy(LogManager::Instance().GetSink(logLevel));
-	return proxy;
+	return LoggerProxy(logLevel,
+			   LogManager::Instance().IsEnabled(logLevel));
     }
 };
 
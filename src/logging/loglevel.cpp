@@ -0,0 +1,31 @@
+#include "loglevel.hpp"
+
+#include <boost/algorithm/string/predicate.hpp>
+
+static const char* const LEVEL_NAMES[] =
+{
+    "trace",
+    "debug",
+    "info",
+    "warning",
+    "error",
+    "critical"
+};
+
+bool LogLevel::FromString(const std::string& name, LogLevel& level)
+{
+    for (int i = Trace; i <= Critical; ++i)
+    {
+        if (boost::iequals(name, LEVEL_NAMES[i]))
+        {
+            level = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* LogLevel::ToString(LogLevel level)
+{
+    return level >= Trace && level <= Critical ? LEVEL_NAMES[level] : "unknown";
+}
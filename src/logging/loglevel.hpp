@@ -1,5 +1,7 @@
 #pragma once
 
+#include <string>
+
 namespace LogLevel
 {
     enum LogLevel
@@ -12,4 +14,10 @@ namespace LogLevel
 	Critical
     };
 
+    /**
+     * @return false if the name is not one of trace, debug, info, warning,
+     *         error and critical
+     */
+    bool FromString(const std::string& name, LogLevel& level);
+    const char* ToString(LogLevel level);
 }
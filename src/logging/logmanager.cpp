@@ -1,4 +1,21 @@
 #include "logmanager.hpp"
+#include "stdoutsink.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <sys/time.h>
+
+#include <boost/bind.hpp>
+
+// Everything is logged in debug builds, from info and up otherwise
+#ifdef DEBUG
+const LogLevel::LogLevel DEFAULT_LEVEL = LogLevel::Trace;
+#else
+const LogLevel::LogLevel DEFAULT_LEVEL = LogLevel::Info;
+#endif
 
 LogManager& LogManager::Instance()
 {
@@ -8,9 +25,171 @@ LogManager& LogManager::Instance()
 }
 
 LogManager::LogManager()
-	: stdOutSink_(new StdOutSink())
-	, nullSink_(new NullSink())
+	: level_(DEFAULT_LEVEL)
+	, sink_(new StdOutSink())
+	, slots_(new Slot[RING_SIZE])
+	, enqueue_(0)
+	, dequeue_(0)
+	, cachedSecond_(-1)
+	, dropped_(0)
+	, sleeping_(false)
+	, stopping_(false)
+{
+    for (std::size_t i = 0; i < RING_SIZE; ++i)
+    {
+	slots_[i].Sequence.store(i, boost::memory_order_relaxed);
+    }
+    line_.reserve(MAX_RECORD_SIZE + 64);
+    thread_ = boost::thread(boost::bind(&LogManager::Run, this));
+}
+
+LogManager::~LogManager()
+{
+    {
+	boost::lock_guard<boost::mutex> lock(mutex_);
+	stopping_ = true;
+	wake_.notify_all();
+    }
+    thread_.join();
+}
+
+void LogManager::SetLevel(LogLevel::LogLevel level)
+{
+    level_.store(level, boost::memory_order_relaxed);
+}
+
+LogLevel::LogLevel LogManager::GetLevel() const
+{
+    return static_cast<LogLevel::LogLevel>(
+	level_.load(boost::memory_order_relaxed));
+}
+
+void LogManager::Submit(LogLevel::LogLevel level,
+			const char* text,
+			std::size_t size)
 {
-    
+    timeval now;
+    gettimeofday(&now, 0);
 
+    // Claim the next slot unless the log thread has not emptied it yet
+    std::size_t position = enqueue_.load(boost::memory_order_relaxed);
+    Slot* slot;
+    for (;;)
+    {
+	slot = &slots_[position & (RING_SIZE - 1)];
+	std::size_t sequence = slot->Sequence.load(boost::memory_order_acquire);
+	if (sequence == position)
+	{
+	    if (enqueue_.compare_exchange_weak(position, position + 1,
+					       boost::memory_order_relaxed))
+	    {
+		break;
+	    }
+	}
+	else if (sequence < position)
+	{
+	    ++dropped_;
+	    return;
+	}
+	else
+	{
+	    position = enqueue_.load(boost::memory_order_relaxed);
+	}
+    }
+
+    slot->Time = static_cast<boost::int64_t>(now.tv_sec) * 1000000
+	+ now.tv_usec;
+    slot->Level = level;
+    slot->Size = std::min(size, MAX_RECORD_SIZE);
+    std::memcpy(slot->Text, text, slot->Size);
+    // Sequentially consistent with the check of sleeping_ below, so either
+    // the log thread sees the record or it is woken up
+    slot->Sequence.store(position + 1);
+    if (sleeping_.load())
+    {
+	boost::lock_guard<boost::mutex> lock(mutex_);
+	wake_.notify_one();
+    }
+}
+
+void LogManager::Run()
+{
+    for (;;)
+    {
+	Drain();
+	sink_->Flush();
+
+	boost::unique_lock<boost::mutex> lock(mutex_);
+	if (stopping_)
+	{
+	    break;
+	}
+	sleeping_.store(true);
+	while (!IsReady() && !stopping_)
+	{
+	    wake_.wait(lock);
+	}
+	sleeping_.store(false);
+    }
+    // Records logged while stopping
+    Drain();
+    sink_->Flush();
+}
+
+bool LogManager::IsReady() const
+{
+    const Slot& slot = slots_[dequeue_ & (RING_SIZE - 1)];
+    return slot.Sequence.load() == dequeue_ + 1;
+}
+
+void LogManager::Drain()
+{
+    while (IsReady())
+    {
+	Slot& slot = slots_[dequeue_ & (RING_SIZE - 1)];
+	line_.clear();
+	AppendTime(line_, slot.Time);
+	line_ += ' ';
+	line_.append(slot.Text, slot.Size);
+	sink_->Write(line_);
+	// Free for the producer one lap ahead
+	slot.Sequence.store(dequeue_ + RING_SIZE, boost::memory_order_release);
+	++dequeue_;
+    }
+
+    unsigned long dropped = dropped_.exchange(0);
+    if (dropped > 0)
+    {
+	timeval now;
+	gettimeofday(&now, 0);
+	char text[64];
+	std::sprintf(text, " %lu log records dropped, the log was full",
+		     dropped);
+	line_.clear();
+	AppendTime(line_, static_cast<boost::int64_t>(now.tv_sec) * 1000000
+		   + now.tv_usec);
+	line_ += text;
+	sink_->Write(line_);
+    }
+}
+
+void LogManager::AppendTime(std::string& line, boost::int64_t time)
+{
+    boost::int64_t second = time / 1000000;
+    if (second != cachedSecond_)
+    {
+	std::time_t seconds = static_cast<std::time_t>(second);
+	struct tm local;
+	char text[32];
+	if (localtime_r(&seconds, &local)
+	    && std::strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &local))
+	{
+	    cachedTime_ = text;
+	    cachedSecond_ = second;
+	}
+    }
+    char fraction[8];
+    std::sprintf(fraction, ".%06d", static_cast<int>(time % 1000000));
+    line += cachedTime_;
+    line += fraction;
 }
@@ -1,42 +1,91 @@
 #pragma once
 #include "loglevel.hpp"
-#include "stdoutsink.hpp"
-#include "nullsink.hpp"
 #include "logsink.hpp"
 
+#include <cstddef>
+#include <string>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread.hpp>
+
+/**
+ * Takes log records from every thread and writes them to the sink on a
+ * thread of its own. Records are copied into a ring of slots made when
+ * the manager is, so logging never allocates or waits for the sink, and
+ * records that find the ring full are counted and dropped. Records below
+ * the level are never formatted at all.
+ */
 class LogManager
 {
 public:
+    // Longer records are cut
+    static const std::size_t MAX_RECORD_SIZE = 1000;
+    // A power of two
+    static const std::size_t RING_SIZE = 1024;
+
     static LogManager& Instance();
 
-    LogSinkPtr GetSink(const LogLevel::LogLevel logLevel)
+    bool IsEnabled(LogLevel::LogLevel level) const
     {
-    switch(logLevel)
-    {
-    case LogLevel::Trace:
-    case LogLevel::Debug:
-#ifdef DEBUG
-        return stdOutSink_;
-#else
-        break;
-#endif
-    case LogLevel::Info:
-    case LogLevel::Warning:
-    case LogLevel::Error:
-    case LogLevel::Critical:
-    default:
-        return stdOutSink_;
-        break;
-    }
-    return nullSink_;
+	return level >= level_.load(boost::memory_order_relaxed);
     }
 
+    /**
+     * Records below the level are dropped from now on.
+     */
+    void SetLevel(LogLevel::LogLevel level);
+    LogLevel::LogLevel GetLevel() const;
+
+    /**
+     * Queue a record for the sink, never waits.
+     */
+    void Submit(LogLevel::LogLevel level, const char* text, std::size_t size);
 
 private:
     LogManager();
+    ~LogManager();
     LogManager(const LogManager&);
     LogManager& operator=(const LogManager&);
 
-    LogSinkPtr stdOutSink_;
-    LogSinkPtr nullSink_;
+    struct Slot
+    {
+	// Its position in the ring when it is free for that position,
+	// one more once the record in it is written
+	boost::atomic<std::size_t> Sequence;
+	// Microseconds since the epoch
+	boost::int64_t Time;
+	LogLevel::LogLevel Level;
+	std::size_t Size;
+	char Text[MAX_RECORD_SIZE];
+    };
+
+    void Run();
+    // @return false if the next record has not been written yet
+    bool IsReady() const;
+    // Write every record in the ring to the sink
+    void Drain();
+    // The time the way ISO 8601 extended writes it, in local time
+    void AppendTime(std::string& line, boost::int64_t time);
+
+    boost::atomic<int> level_;
+    LogSinkPtr sink_;
+
+    boost::scoped_array<Slot> slots_;
+    boost::atomic<std::size_t> enqueue_;
+    // Only used by the log thread
+    std::size_t dequeue_;
+    std::string line_;
+    // The time of day is only worked out again when the second changes
+    boost::int64_t cachedSecond_;
+    std::string cachedTime_;
+
+    boost::atomic<unsigned long> dropped_;
+    // Producers only take the mutex to wake the log thread when it sleeps
+    boost::atomic<bool> sleeping_;
+    bool stopping_;
+    boost::mutex mutex_;
+    boost::condition_variable wake_;
+    boost::thread thread_;
 };
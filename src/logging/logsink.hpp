@@ -3,19 +3,17 @@
 
 #include <string>
 
+/**
+ * Where log records end up. Sinks are only written to from the log
+ * thread, one line at a time, and flushed whenever it has nothing left.
+ */
 class LogSink
 {
 public:
     LogSink();
     virtual ~LogSink();
 
-    virtual LogSink& operator<<(const std::string& rhs) = 0;
-
-protected:
-    std::string GetPrefix() const;
-    std::string GetSuffix() const;
-
-private:
-    
-
+    // The line has its time in front and no line end
+    virtual void Write(const std::string& line) = 0;
+    virtual void Flush();
 };
@@ -1,14 +1,20 @@
 #include "stdoutsink.hpp"
 
-#include <iostream>
+#include <cstdio>
 
 StdOutSink::StdOutSink()
 {
 
 }
 
-StdOutSink& StdOutSink::operator<<(const std::string& rhs)
+void StdOutSink::Write(const std::string& line)
 {
-    std::cout<<GetPrefix()<<rhs<<GetSuffix()<<std::endl;
-    return *this;
+    // Lines go out together when the log thread flushes
+    std::fwrite(line.data(), 1, line.size(), stdout);
+    std::fputc('\n', stdout);
+}
+
+void StdOutSink::Flush()
+{
+    std::fflush(stdout);
 }
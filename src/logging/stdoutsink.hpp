@@ -6,5 +6,6 @@ class StdOutSink : public LogSink
 public:
     StdOutSink();
 
-    StdOutSink& operator<<(const std::string& rhs);
+    void Write(const std::string& line);
+    void Flush();
 };
@@ -0,0 +1,288 @@
+#include "logscanner.hpp"
+#include "chatlogreader.hpp"
+#include "logging/logger.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/utility/string_ref.hpp>
+
+// How much of the log is read at a time, a window without a line ending
+// is made larger until the line fits
+const std::size_t SCAN_WINDOW_SIZE = 4 << 20;
+
+namespace
+{
+    struct Hash
+    {
+        std::size_t operator()(boost::string_ref nick) const
+        {
+            return boost::hash_range(nick.begin(), nick.end());
+        }
+    };
+    struct Equal
+    {
+        bool operator()(boost::string_ref a, boost::string_ref b) const
+        {
+            return a == b;
+        }
+    };
+    // Nicks to the first of their matches
+    typedef boost::unordered_map<std::string, std::size_t, Hash, Equal>
+        NickMap;
+
+    // @return the last line ending before end, null if there is none
+    const char* FindLastNewline(const char* begin, const char* end)
+    {
+#ifdef __SSE2__
+        const __m128i newlines = _mm_set1_epi8('\n');
+        while (end - begin >= 16)
+        {
+            __m128i block = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(end - 16));
+            int found = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newlines));
+            if (found != 0)
+            {
+                return end - 16 + (31 - __builtin_clz(found));
+            }
+            end -= 16;
+        }
+#endif
+        while (end != begin)
+        {
+            --end;
+            if (*end == '\n')
+            {
+                return end;
+            }
+        }
+        return 0;
+    }
+
+    // @return false if the line does not start with a time
+    bool ParseTime(const char* begin, const char* end, std::time_t now,
+                   std::time_t& time)
+    {
+        const char* position = begin;
+        time = 0;
+        while (position != end && *position >= '0' && *position <= '9')
+        {
+            time = time * 10 + (*position - '0');
+            ++position;
+        }
+        if (position != begin && position != end && *position == ' ')
+        {
+            return true;
+        }
+
+        // Very old logs have the time of day as 12:34
+        if (end - begin < 5 || position - begin != 2 || *position != ':'
+            || begin[3] < '0' || begin[3] > '9'
+            || begin[4] < '0' || begin[4] > '9')
+        {
+            return false;
+        }
+        struct tm today;
+        localtime_r(&now, &today);
+        today.tm_hour = (begin[0] - '0') * 10 + (begin[1] - '0');
+        today.tm_min = (begin[3] - '0') * 10 + (begin[4] - '0');
+        today.tm_sec = 0;
+        time = mktime(&today);
+        while (time >= now)
+        {
+            time -= 60 * 60 * 24;
+        }
+        return true;
+    }
+
+    class Scanner
+    {
+    public:
+        Scanner(const std::vector<std::string>& nicks,
+                LogScanner::MatchContainer& matches)
+            : matches_(matches)
+            , minNickSize_(std::string::npos)
+            , maxNickSize_(0)
+            , now_(std::time(0))
+        {
+            std::memset(firstCharacters_, 0, sizeof(firstCharacters_));
+            matches_.assign(nicks.size(), LogScanner::Match());
+            for (std::size_t i = 0; i < nicks.size(); ++i)
+            {
+                const std::string& nick = nicks[i];
+                if (nick.empty() || !nicks_.insert(
+                        NickMap::value_type(nick, i)).second)
+                {
+                    continue;
+                }
+                minNickSize_ = std::min(minNickSize_, nick.size());
+                maxNickSize_ = std::max(maxNickSize_, nick.size());
+                firstCharacters_[static_cast<unsigned char>(nick[0])] = true;
+            }
+            remaining_ = nicks_.size();
+        }
+
+        bool Scan(const std::string& path);
+
+        // Nicks that were asked for more than once share their match
+        void CopyRepeated(const std::vector<std::string>& nicks)
+        {
+            for (std::size_t i = 0; i < nicks.size(); ++i)
+            {
+                NickMap::const_iterator first = nicks_.find(nicks[i]);
+                if (first != nicks_.end() && first->second != i)
+                {
+                    matches_[i] = matches_[first->second];
+                }
+            }
+        }
+
+    private:
+        void ScanLine(const char* begin, const char* end);
+
+        LogScanner::MatchContainer& matches_;
+        NickMap nicks_;
+        std::size_t remaining_;
+        // Most lines are by nicks that are not asked for, these turn them
+        // away before the nick is hashed
+        std::size_t minNickSize_;
+        std::size_t maxNickSize_;
+        bool firstCharacters_[256];
+        std::time_t now_;
+    };
+
+    bool Scanner::Scan(const std::string& path)
+    {
+        ChatLogReader log(path);
+        if (!log.Exists())
+        {
+            return false;
+        }
+
+        std::vector<char> buffer;
+        std::size_t windowSize = SCAN_WINDOW_SIZE;
+        // Where the line that is looked at next ends
+        unsigned long long end = log.GetSize();
+        while (end > 0 && remaining_ > 0)
+        {
+            unsigned long long begin = end > windowSize ? end - windowSize : 0;
+            std::size_t size = end - begin;
+            buffer.resize(size);
+            if (log.Read(begin, &buffer[0], size) != size)
+            {
+                Log << LogLevel::Error << "Could not read '" << path
+                    << "' at " << begin;
+                return false;
+            }
+
+            const char* data = &buffer[0];
+            const char* lineEnd = data + size;
+            const char* newline;
+            while (remaining_ > 0
+                   && (newline = FindLastNewline(data, lineEnd)) != 0)
+            {
+                ScanLine(newline + 1, lineEnd);
+                lineEnd = newline;
+            }
+            if (begin == 0 && remaining_ > 0)
+            {
+                ScanLine(data, lineEnd);
+            }
+            unsigned long long lineEndOffset = begin + (lineEnd - data);
+
+            if (begin == 0)
+            {
+                break;
+            }
+            if (lineEndOffset == end)
+            {
+                windowSize *= 2;
+            }
+            end = lineEndOffset;
+        }
+        return true;
+    }
+
+    void Scanner::ScanLine(const char* begin, const char* end)
+    {
+        if (end - begin < 4)
+        {
+            return;
+        }
+        // The nick is in the first < after the target and its colon
+        const char* open = begin + 2;
+        while ((open = static_cast<const char*>(
+                    std::memchr(open, '<', end - open))) != 0
+               && (open[-1] != ' ' || open[-2] != ':'))
+        {
+            ++open;
+        }
+        if (open == 0)
+        {
+            return;
+        }
+
+        const char* nick = open + 1;
+        std::size_t rest = end - nick;
+        if (rest <= minNickSize_ + 1
+            || !firstCharacters_[static_cast<unsigned char>(*nick)])
+        {
+            return;
+        }
+        const char* close = static_cast<const char*>(std::memchr(
+            nick, '>', std::min(rest, maxNickSize_ + 1)));
+        if (close == 0 || close + 1 == end || close[1] != ' '
+            || static_cast<std::size_t>(close - nick) < minNickSize_)
+        {
+            return;
+        }
+        NickMap::const_iterator found = nicks_.find(
+            boost::string_ref(nick, close - nick), Hash(), Equal());
+        if (found == nicks_.end())
+        {
+            return;
+        }
+
+        LogScanner::Match& match = matches_[found->second];
+        if (match.Found || !ParseTime(begin, end, now_, match.Time))
+        {
+            return;
+        }
+        match.Found = true;
+        match.Line.assign(close + 2, end);
+        --remaining_;
+    }
+} // namespace
+
+bool LogScanner::FindLastLines(const std::string& path,
+                               const std::vector<std::string>& nicks,
+                               MatchContainer& matches)
+{
+    Scanner scanner(nicks, matches);
+    if (!scanner.Scan(path))
+    {
+        return false;
+    }
+    scanner.CopyRepeated(nicks);
+    return true;
+}
+
+bool LogScanner::FindLastLine(const std::string& path,
+                              const std::string& nick,
+                              Match& match)
+{
+    std::vector<std::string> nicks(1, nick);
+    MatchContainer matches;
+    if (!FindLastLines(path, nicks, matches) || !matches[0].Found)
+    {
+        return false;
+    }
+    match = matches[0];
+    return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+/**
+ * Finds the last lines nicks said in a chat log by reading it from the end,
+ * a window at a time, until every nick has been found. Line endings are
+ * looked for sixteen bytes at a time and each line's nick is looked up
+ * once, however many nicks are asked for, so a batch of nicks costs one
+ * pass over the log. Logs of any size can be read, and logs kept in
+ * segments are read through all of them.
+ */
+namespace LogScanner
+{
+    struct Match
+    {
+	Match() : Found(false), Time(0) {}
+
+	bool Found;
+	std::time_t Time;
+	// What the nick said, without the time, target and nick
+	std::string Line;
+    };
+    typedef std::vector<Match> MatchContainer;
+
+    /**
+     * Nicks are compared as they are written. Lines from very old logs
+     * with only the time of day are taken to be from the last day that
+     * time has been.
+     * @param matches gets one match for each nick, in the same order
+     * @return false if the log could not be read
+     */
+    bool FindLastLines(const std::string& path,
+		       const std::vector<std::string>& nicks,
+		       MatchContainer& matches);
+
+    /**
+     * @return false if the log could not be read or the nick is not in it
+     */
+    bool FindLastLine(const std::string& path,
+		      const std::string& nick,
+		      Match& match);
+} // namespace LogScanner
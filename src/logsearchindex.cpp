@@ -0,0 +1,794 @@
+#include "logsearchindex.hpp"
+#include "chatlogfiles.hpp"
+#include "chatlogreader.hpp"
+#include "exception.hpp"
+#include "logging/logger.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/filesystem/convenience.hpp>
+#include <boost/filesystem/exception.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+using boost::posix_time::ptime;
+using boost::posix_time::microsec_clock;
+
+static const char MANIFEST_MAGIC[] = "LSM1";
+// Lines in memory are written as a segment once they have this many words
+const std::size_t MEMORY_SEGMENT_POSTINGS = 500000;
+// Reading the logs on start waits for segments to be written beyond this
+const std::size_t MAX_MEMORY_POSTINGS = 2 * MEMORY_SEGMENT_POSTINGS;
+// Segments are merged into one when there are more than this
+const std::size_t MAX_SEGMENTS = 8;
+// How often the thread looks for segments to merge when not woken
+const unsigned int MAINTENANCE_INTERVAL = 60;
+// Words shorter than this are too common to be worth looking up
+const std::size_t MIN_TOKEN_SIZE = 2;
+const std::size_t MAX_TOKEN_SIZE = 64;
+const std::size_t DEFAULT_CANDIDATES = 40;
+// No chat line is longer than this
+const std::size_t MAX_LINE_SIZE = 4096;
+const std::size_t CATCH_UP_BUFFER_SIZE = 1 << 20;
+
+namespace
+{
+    void Intersect(SearchPostingList& postings, const SearchPostingList& other)
+    {
+        SearchPostingList::iterator end =
+            std::set_intersection(postings.begin(), postings.end(),
+                                  other.begin(), other.end(),
+                                  postings.begin());
+        postings.erase(end, postings.end());
+    }
+
+    void SortPostings(SearchPostingList& postings)
+    {
+        std::sort(postings.begin(), postings.end());
+        postings.erase(std::unique(postings.begin(), postings.end()),
+                       postings.end());
+    }
+
+    char ToLower(char c)
+    {
+        return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+    }
+
+    // Newest first among lines with the same score
+    struct RankedHit
+    {
+        int Score;
+        LogSearchIndex::Hit Hit;
+
+        bool operator<(const RankedHit& other) const
+        {
+            return Score > other.Score
+                || (Score == other.Score && Hit.Time > other.Hit.Time);
+        }
+    };
+}
+
+LogSearchIndex::LogSearchIndex(const std::string& directory)
+    : directory_(directory)
+    , memoryPostings_(0)
+    , catchingUp_(false)
+    , nextSegment_(1)
+    , stopping_(false)
+{
+    if (!directory_.empty() && directory_[directory_.size() - 1] != '/')
+    {
+        directory_ += '/';
+    }
+    Load();
+    maintenanceThread_ = boost::thread(
+        boost::bind(&LogSearchIndex::RunMaintenance, this));
+}
+
+LogSearchIndex::~LogSearchIndex()
+{
+    stopping_ = true;
+    {
+        boost::lock_guard<boost::mutex> lock(wakeMutex_);
+        wake_.notify_all();
+        written_.notify_all();
+    }
+    if (catchUpThread_.joinable())
+    {
+        catchUpThread_.join();
+    }
+    maintenanceThread_.join();
+}
+
+void LogSearchIndex::CatchUp(const std::string& logsDirectory)
+{
+    {
+        boost::unique_lock<boost::shared_mutex> lock(mutex_);
+        catchingUp_ = true;
+    }
+    catchUpThread_ = boost::thread(boost::bind(&LogSearchIndex::RunCatchUp,
+                                               this,
+                                               logsDirectory));
+}
+
+void LogSearchIndex::AddLine(const std::string& path,
+                             unsigned long long offset,
+                             boost::string_ref line)
+{
+    boost::unique_lock<boost::shared_mutex> lock(mutex_);
+    if (catchingUp_)
+    {
+        PendingLine pending;
+        pending.Path = path;
+        pending.Offset = offset;
+        pending.Line.assign(line.begin(), line.end());
+        pending_.push_back(pending);
+        return;
+    }
+    AddLocked(path, offset, line);
+    if (memoryPostings_ >= MEMORY_SEGMENT_POSTINGS)
+    {
+        lock.unlock();
+        boost::lock_guard<boost::mutex> wakeLock(wakeMutex_);
+        wake_.notify_all();
+    }
+}
+
+void LogSearchIndex::Search(const std::string& query,
+                            const std::string& file,
+                            std::size_t limit,
+                            HitContainer& hits) const
+{
+    std::vector<std::string> tokens;
+    Tokenize(query, tokens);
+    std::sort(tokens.begin(), tokens.end());
+    tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+    if (tokens.empty() || limit == 0)
+    {
+        return;
+    }
+
+    // Lines in memory are copied, segments are searched without the lock
+    std::vector<SearchPostingList> postings(tokens.size());
+    std::vector<SearchSegmentPtr> segments;
+    std::vector<std::string> files;
+    long fileId = -1;
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mutex_);
+        if (!file.empty())
+        {
+            boost::unordered_map<std::string, boost::uint32_t>::const_iterator
+                found = fileIds_.find(file);
+            if (found == fileIds_.end())
+            {
+                return;
+            }
+            fileId = found->second;
+        }
+        segments = segments_;
+        files = files_;
+        const TermMap* maps[] = { &memory_, writing_.get() };
+        for (std::size_t i = 0; i < tokens.size(); ++i)
+        {
+            for (std::size_t j = 0; j < sizeof(maps) / sizeof(maps[0]); ++j)
+            {
+                if (!maps[j])
+                {
+                    continue;
+                }
+                TermMap::const_iterator term = maps[j]->find(tokens[i]);
+                if (term == maps[j]->end())
+                {
+                    continue;
+                }
+                for (SearchPostingList::const_iterator posting =
+                         term->second.begin();
+                     posting != term->second.end();
+                     ++posting)
+                {
+                    if (fileId < 0
+                        || posting->File == static_cast<unsigned long>(fileId))
+                    {
+                        postings[i].push_back(*posting);
+                    }
+                }
+            }
+        }
+    }
+
+    SearchPostingList matches;
+    for (std::size_t i = 0; i < tokens.size(); ++i)
+    {
+        for (std::vector<SearchSegmentPtr>::const_iterator segment =
+                 segments.begin();
+             segment != segments.end();
+             ++segment)
+        {
+            (*segment)->Find(tokens[i], fileId, postings[i]);
+        }
+        SortPostings(postings[i]);
+        if (i == 0)
+        {
+            matches.swap(postings[i]);
+        }
+        else
+        {
+            Intersect(matches, postings[i]);
+        }
+        if (matches.empty())
+        {
+            return;
+        }
+    }
+
+    // Only the newest matches of each log are read and ranked, later
+    // offsets in a log are newer lines
+    std::string phrase(query);
+    std::transform(phrase.begin(), phrase.end(), phrase.begin(), ToLower);
+    std::size_t candidates = std::max(DEFAULT_CANDIDATES, limit * 4);
+    std::vector<RankedHit> ranked;
+    std::vector<char> buffer(MAX_LINE_SIZE);
+    boost::scoped_ptr<ChatLogReader> log;
+    long openFile = -1;
+    std::size_t fileCandidates = 0;
+    for (SearchPostingList::const_reverse_iterator match = matches.rbegin();
+         match != matches.rend();
+         ++match)
+    {
+        if (static_cast<long>(match->File) != openFile)
+        {
+            openFile = match->File;
+            log.reset(match->File < files.size()
+                      ? new ChatLogReader(files[match->File]) : 0);
+            fileCandidates = 0;
+        }
+        if (!log || fileCandidates >= candidates)
+        {
+            continue;
+        }
+        ++fileCandidates;
+
+        std::size_t size = log->Read(match->Offset, &buffer[0],
+                                     buffer.size());
+        if (size == 0)
+        {
+            continue;
+        }
+        boost::string_ref line(&buffer[0], size);
+        std::size_t end = line.find('\n');
+        if (end != boost::string_ref::npos)
+        {
+            line = line.substr(0, end);
+        }
+        RankedHit hit;
+        boost::string_ref nick;
+        boost::string_ref text;
+        // A log that has been replaced no longer has the line
+        if (!ChatLogFiles::ParseLine(line, hit.Hit.Time, nick, text))
+        {
+            continue;
+        }
+        hit.Hit.File = files[match->File];
+        hit.Hit.Nick.assign(nick.begin(), nick.end());
+        hit.Hit.Line.assign(text.begin(), text.end());
+        std::string lowered(hit.Hit.Line);
+        std::transform(lowered.begin(), lowered.end(), lowered.begin(),
+                       ToLower);
+        hit.Score = lowered.find(phrase) != std::string::npos ? 1 : 0;
+        ranked.push_back(hit);
+    }
+
+    std::sort(ranked.begin(), ranked.end());
+    for (std::size_t i = 0; i < ranked.size() && hits.size() < limit; ++i)
+    {
+        hits.push_back(ranked[i].Hit);
+    }
+}
+
+void LogSearchIndex::Tokenize(boost::string_ref text,
+                              std::vector<std::string>& tokens)
+{
+    std::string token;
+    for (std::size_t i = 0; i <= text.size(); ++i)
+    {
+        char c = i < text.size() ? text[i] : ' ';
+        if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9')
+            || (c & 0x80))
+        {
+            token += c;
+        }
+        else if (c >= 'A' && c <= 'Z')
+        {
+            token += ToLower(c);
+        }
+        else
+        {
+            if (token.size() >= MIN_TOKEN_SIZE
+                && token.size() <= MAX_TOKEN_SIZE)
+            {
+                tokens.push_back(token);
+            }
+            token.clear();
+        }
+    }
+}
+
+void LogSearchIndex::Load()
+{
+    try
+    {
+        boost::filesystem::create_directories(directory_);
+    } catch (boost::filesystem::filesystem_error& e)
+    {
+        Log << LogLevel::Error << "Could not create search index directory '"
+            << directory_ << "': " << e.what();
+    }
+
+    std::ifstream in((directory_ + "manifest").c_str());
+    std::string magic;
+    if (!in || !std::getline(in, magic) || magic != MANIFEST_MAGIC)
+    {
+        Log << LogLevel::Info << "No search index in '" << directory_
+            << "', all logs are indexed";
+        return;
+    }
+
+    std::vector<std::string> listed;
+    try
+    {
+        std::string line;
+        while (std::getline(in, line))
+        {
+            std::istringstream fields(line);
+            fields.imbue(std::locale::classic());
+            std::string kind;
+            fields >> kind;
+            if (kind == "next")
+            {
+                fields >> nextSegment_;
+            }
+            else if (kind == "segment")
+            {
+                std::string name;
+                fields >> name;
+                listed.push_back(name);
+                segments_.push_back(
+                    SearchSegmentPtr(new SearchSegment(directory_ + name)));
+            }
+            else if (kind == "file")
+            {
+                unsigned long long end = 0;
+                fields >> end;
+                fields.get();
+                std::string path;
+                std::getline(fields, path);
+                fileIds_[path] = files_.size();
+                files_.push_back(path);
+                indexedEnds_.push_back(end);
+            }
+        }
+    } catch (Exception& e)
+    {
+        // Starting over costs reading the logs, it is never wrong
+        Log << LogLevel::Error << e.GetMessage()
+            << ", the search index is started over";
+        fileIds_.clear();
+        files_.clear();
+        indexedEnds_.clear();
+        segments_.clear();
+        listed.clear();
+    }
+    writtenEnds_ = indexedEnds_;
+
+    // Segments of a write or merge that was cut short
+    try
+    {
+        boost::filesystem::directory_iterator end;
+        for (boost::filesystem::directory_iterator file(directory_);
+             file != end;
+             ++file)
+        {
+            std::string name = file->path().filename().string();
+            if (name.compare(0, 8, "segment-") == 0
+                && std::find(listed.begin(), listed.end(), name)
+                   == listed.end())
+            {
+                boost::filesystem::remove(file->path());
+            }
+        }
+    } catch (boost::filesystem::filesystem_error& e)
+    {
+        Log << LogLevel::Warning << "Could not clean up '" << directory_
+            << "': " << e.what();
+    }
+    Log << LogLevel::Info << "Search index has " << segments_.size()
+        << " segments for " << files_.size() << " logs";
+}
+
+boost::uint32_t LogSearchIndex::InternFile(const std::string& path)
+{
+    std::pair<boost::unordered_map<std::string, boost::uint32_t>::iterator,
+              bool> inserted =
+        fileIds_.insert(std::make_pair(path, files_.size()));
+    if (inserted.second)
+    {
+        files_.push_back(path);
+        indexedEnds_.push_back(0);
+    }
+    return inserted.first->second;
+}
+
+void LogSearchIndex::AddLocked(const std::string& path,
+                               unsigned long long offset,
+                               boost::string_ref line)
+{
+    boost::uint32_t file = InternFile(path);
+    if (offset < indexedEnds_[file])
+    {
+        return;
+    }
+    indexedEnds_[file] = offset + line.size() + 1;
+
+    std::time_t time;
+    boost::string_ref nick;
+    boost::string_ref text;
+    if (!ChatLogFiles::ParseLine(line, time, nick, text))
+    {
+        return;
+    }
+    std::vector<std::string> tokens;
+    Tokenize(text, tokens);
+    std::sort(tokens.begin(), tokens.end());
+    tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+    SearchPosting posting = { file, offset };
+    for (std::vector<std::string>::const_iterator token = tokens.begin();
+         token != tokens.end();
+         ++token)
+    {
+        memory_[*token].push_back(posting);
+    }
+    memoryPostings_ += tokens.size();
+}
+
+void LogSearchIndex::RunCatchUp(const std::string& logsDirectory)
+{
+    ptime started = microsec_clock::universal_time();
+    std::vector<std::string> paths;
+    ChatLogFiles::List(logsDirectory, paths);
+
+    boost::atomic<std::size_t> next(0);
+    std::size_t threads = std::max(1u, boost::thread::hardware_concurrency());
+    threads = std::min(threads, std::max<std::size_t>(paths.size(), 1));
+    boost::thread_group readers;
+    for (std::size_t i = 0; i < threads; ++i)
+    {
+        readers.create_thread(boost::bind(&LogSearchIndex::CatchUpFiles,
+                                          this,
+                                          boost::cref(paths),
+                                          boost::ref(next)));
+    }
+    readers.join_all();
+
+    std::size_t pending = 0;
+    {
+        boost::unique_lock<boost::shared_mutex> lock(mutex_);
+        // Lines that were read above are skipped. When stopping early the
+        // logs are not read to the end and the lines are read next time.
+        for (std::vector<PendingLine>::const_iterator line = pending_.begin();
+             line != pending_.end() && !stopping_;
+             ++line)
+        {
+            AddLocked(line->Path, line->Offset, line->Line);
+        }
+        pending = pending_.size();
+        std::vector<PendingLine>().swap(pending_);
+        catchingUp_ = false;
+    }
+    if (!stopping_)
+    {
+        Log << LogLevel::Info << "Search index caught up with "
+            << paths.size() << " logs in "
+            << (microsec_clock::universal_time() - started)
+               .total_milliseconds()
+            << " ms, " << pending << " lines logged meanwhile";
+    }
+    boost::lock_guard<boost::mutex> lock(wakeMutex_);
+    wake_.notify_all();
+}
+
+void LogSearchIndex::CatchUpFiles(const std::vector<std::string>& paths,
+                                  boost::atomic<std::size_t>& next)
+{
+    for (std::size_t i = next++; i < paths.size() && !stopping_; i = next++)
+    {
+        CatchUpFile(paths[i]);
+    }
+}
+
+void LogSearchIndex::CatchUpFile(const std::string& path)
+{
+    unsigned long long offset = 0;
+    {
+        boost::unique_lock<boost::shared_mutex> lock(mutex_);
+        offset = indexedEnds_[InternFile(path)];
+    }
+
+    ChatLogReader in(path);
+    unsigned long long size = in.GetSize();
+    if (size < offset)
+    {
+        // A log that shrank has been replaced, its old lines can not be
+        // told apart from the new ones and stay in the index
+        offset = 0;
+    }
+
+    std::vector<char> buffer(CATCH_UP_BUFFER_SIZE);
+    std::size_t kept = 0;
+    while (offset + kept < size && !stopping_)
+    {
+        std::size_t wanted = std::min<unsigned long long>(
+            size - offset - kept, buffer.size() - kept);
+        if (wanted == 0)
+        {
+            // Nobody's chat line is that long
+            offset += kept;
+            kept = 0;
+            continue;
+        }
+        if (in.Read(offset + kept, &buffer[kept], wanted) != wanted)
+        {
+            break;
+        }
+        const char* begin = &buffer[0];
+        const char* end = begin + kept + wanted;
+        // One lock for all the whole lines in the buffer
+        boost::unique_lock<boost::shared_mutex> lock(mutex_);
+        for (const char* newline = std::find(begin, end, '\n');
+             newline != end;
+             newline = std::find(begin, end, '\n'))
+        {
+            AddLocked(path, offset, boost::string_ref(begin, newline - begin));
+            offset += newline + 1 - begin;
+            begin = newline + 1;
+        }
+        lock.unlock();
+        kept = end - begin;
+        std::copy(begin, end, buffer.begin());
+        WaitForMemory();
+    }
+}
+
+bool LogSearchIndex::IsMemoryFull(std::size_t postings) const
+{
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+    return memoryPostings_ >= postings;
+}
+
+void LogSearchIndex::WaitForMemory()
+{
+    boost::unique_lock<boost::mutex> lock(wakeMutex_);
+    if (IsMemoryFull(MEMORY_SEGMENT_POSTINGS))
+    {
+        wake_.notify_all();
+    }
+    // The logs are read faster than segments are written
+    while (!stopping_ && IsMemoryFull(MAX_MEMORY_POSTINGS))
+    {
+        written_.wait(lock);
+    }
+}
+
+void LogSearchIndex::RunMaintenance()
+{
+    for (;;)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(wakeMutex_);
+            if (!stopping_ && !IsMemoryFull(MEMORY_SEGMENT_POSTINGS))
+            {
+                wake_.timed_wait(lock,
+                                 boost::posix_time::seconds(
+                                     MAINTENANCE_INTERVAL));
+            }
+        }
+
+        try
+        {
+            std::size_t postings;
+            {
+                boost::shared_lock<boost::shared_mutex> lock(mutex_);
+                postings = memoryPostings_;
+            }
+            // Lines logged while catching up wait in pending_ and are past
+            // the ends, so the ends are covered then too. Lines lost in a
+            // crash are read from the logs again on start.
+            if (postings > 0
+                && (postings >= MEMORY_SEGMENT_POSTINGS || stopping_))
+            {
+                WriteMemorySegment();
+            }
+            if (stopping_)
+            {
+                break;
+            }
+            if (segments_.size() > MAX_SEGMENTS)
+            {
+                MergeSegments();
+            }
+        } catch (Exception& e)
+        {
+            Log << LogLevel::Error << e.GetMessage();
+            if (stopping_)
+            {
+                break;
+            }
+        }
+    }
+}
+
+void LogSearchIndex::WriteMemorySegment()
+{
+    boost::shared_ptr<TermMap> terms(new TermMap());
+    OffsetContainer ends;
+    {
+        boost::unique_lock<boost::shared_mutex> lock(mutex_);
+        terms->swap(memory_);
+        memoryPostings_ = 0;
+        ends = indexedEnds_;
+        // Lines of several logs are mixed in the order they were written
+        for (TermMap::iterator term = terms->begin();
+             term != terms->end();
+             ++term)
+        {
+            std::sort(term->second.begin(), term->second.end());
+        }
+        writing_ = terms;
+    }
+    {
+        boost::lock_guard<boost::mutex> lock(wakeMutex_);
+        written_.notify_all();
+    }
+
+    std::vector<const TermMap::value_type*> sorted;
+    sorted.reserve(terms->size());
+    for (TermMap::const_iterator term = terms->begin();
+         term != terms->end();
+         ++term)
+    {
+        sorted.push_back(&*term);
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              boost::bind(&TermMap::value_type::first, _1)
+              < boost::bind(&TermMap::value_type::first, _2));
+
+    std::string path = GetSegmentPath(nextSegment_++);
+    SearchSegmentPtr segment;
+    try
+    {
+        SearchSegment::Writer writer(path);
+        for (std::size_t i = 0; i < sorted.size(); ++i)
+        {
+            writer.Add(sorted[i]->first, sorted[i]->second);
+        }
+        writer.Close();
+        segment.reset(new SearchSegment(path));
+    } catch (Exception&)
+    {
+        // Keep the lines in memory so they can still be found
+        boost::unique_lock<boost::shared_mutex> lock(mutex_);
+        for (TermMap::const_iterator term = terms->begin();
+             term != terms->end();
+             ++term)
+        {
+            SearchPostingList& postings = memory_[term->first];
+            postings.insert(postings.end(), term->second.begin(),
+                            term->second.end());
+            memoryPostings_ += term->second.size();
+        }
+        writing_.reset();
+        throw;
+    }
+
+    {
+        boost::unique_lock<boost::shared_mutex> lock(mutex_);
+        segments_.push_back(segment);
+        writing_.reset();
+    }
+    WriteManifest(ends);
+    writtenEnds_ = ends;
+    Log << LogLevel::Debug << "Wrote search segment '" << path << "' with "
+        << sorted.size() << " words";
+}
+
+void LogSearchIndex::MergeSegments()
+{
+    // The smallest ones, the largest is left alone until the others have
+    // grown as large
+    std::vector<SearchSegmentPtr> merged(segments_);
+    std::sort(merged.begin(), merged.end(),
+              boost::bind(&SearchSegment::GetSize, _1)
+              < boost::bind(&SearchSegment::GetSize, _2));
+    merged.resize(segments_.size() - MAX_SEGMENTS / 2);
+
+    std::string path = GetSegmentPath(nextSegment_++);
+    SearchSegment::Merge(merged, path);
+    SearchSegmentPtr segment(new SearchSegment(path));
+
+    {
+        boost::unique_lock<boost::shared_mutex> lock(mutex_);
+        for (std::vector<SearchSegmentPtr>::iterator old = merged.begin();
+             old != merged.end();
+             ++old)
+        {
+            segments_.erase(std::find(segments_.begin(), segments_.end(),
+                                      *old));
+        }
+        segments_.push_back(segment);
+    }
+    WriteManifest(writtenEnds_);
+    // Removed once the last search using them is done
+    for (std::vector<SearchSegmentPtr>::iterator old = merged.begin();
+         old != merged.end();
+         ++old)
+    {
+        (*old)->SetObsolete();
+    }
+    Log << LogLevel::Debug << "Merged " << merged.size()
+        << " search segments into '" << path << "'";
+}
+
+void LogSearchIndex::WriteManifest(const OffsetContainer& ends)
+{
+    std::ostringstream manifest;
+    manifest.imbue(std::locale::classic());
+    manifest << MANIFEST_MAGIC << "\n" << "next " << nextSegment_ << "\n";
+    {
+        boost::shared_lock<boost::shared_mutex> lock(mutex_);
+        for (std::vector<SearchSegmentPtr>::const_iterator segment =
+                 segments_.begin();
+             segment != segments_.end();
+             ++segment)
+        {
+            manifest << "segment "
+                     << boost::filesystem::path((*segment)->GetPath())
+                        .filename().string()
+                     << "\n";
+        }
+        // Files that are only in memory are read from the start
+        for (std::size_t i = 0; i < files_.size(); ++i)
+        {
+            manifest << "file " << (i < ends.size() ? ends[i] : 0) << " "
+                     << files_[i] << "\n";
+        }
+    }
+
+    std::string path = directory_ + "manifest";
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary.c_str(), std::ios::trunc);
+        out << manifest.str();
+        if (!out.flush())
+        {
+            throw Exception(__FILE__, __LINE__,
+                            ("Could not write search index manifest '"
+                             + temporary + "'").c_str());
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        throw Exception(__FILE__, __LINE__,
+                        ("Could not replace search index manifest '" + path
+                         + "'").c_str());
+    }
+}
+
+std::string LogSearchIndex::GetSegmentPath(unsigned long number) const
+{
+    std::ostringstream path;
+    path.imbue(std::locale::classic());
+    path << directory_ << "segment-" << number << ".seg";
+    return path.str();
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "searchsegment.hpp"
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/utility.hpp>
+#include <boost/utility/string_ref.hpp>
+
+/**
+ * Full text index of the chat logs, from each word to the lines it is in.
+ * The log writer hands over every line it writes, new lines are kept in
+ * memory and written out as a segment once there are enough of them. A
+ * thread of its own writes the segments and merges them when there are
+ * too many. A manifest in the index directory lists the segments and how
+ * much of each log they cover, the rest is read from the logs on start.
+ */
+class LogSearchIndex : boost::noncopyable
+{
+public:
+    struct Hit
+    {
+	// The log the line is in
+	std::string File;
+	std::time_t Time;
+	std::string Nick;
+	std::string Line;
+    };
+    typedef std::vector<Hit> HitContainer;
+
+    /**
+     * Loads the segments the manifest lists, a broken index is started
+     * over.
+     */
+    explicit LogSearchIndex(const std::string& directory);
+    /**
+     * Writes the lines that are only in memory to a segment.
+     */
+    ~LogSearchIndex();
+
+    /**
+     * Read what the index does not cover from the logs, on threads of its
+     * own. Lines written meanwhile are added once that is done.
+     */
+    void CatchUp(const std::string& logsDirectory);
+
+    /**
+     * Called by the log writer for every line it has written.
+     * @param offset where in the log the line starts, closed segments
+     *        included
+     */
+    void AddLine(const std::string& path,
+		 unsigned long long offset,
+		 boost::string_ref line);
+
+    /**
+     * Lines with every word of the query, those with the query as it is
+     * written first and then the newest first.
+     * @param file only lines of this log, or of all logs if empty
+     */
+    void Search(const std::string& query,
+		const std::string& file,
+		std::size_t limit,
+		HitContainer& hits) const;
+
+    /**
+     * Split text into the words that are indexed, in lower case. Letters
+     * beyond ASCII are kept as they are.
+     */
+    static void Tokenize(boost::string_ref text,
+			 std::vector<std::string>& tokens);
+
+private:
+    typedef boost::unordered_map<std::string, SearchPostingList> TermMap;
+    typedef std::vector<unsigned long long> OffsetContainer;
+
+    struct PendingLine
+    {
+	std::string Path;
+	unsigned long long Offset;
+	std::string Line;
+    };
+
+    void Load();
+    // The file's id, new files are given one
+    boost::uint32_t InternFile(const std::string& path);
+    // Needs the lock, lines before where the file is indexed to are skipped
+    void AddLocked(const std::string& path,
+		   unsigned long long offset,
+		   boost::string_ref line);
+
+    void RunCatchUp(const std::string& logsDirectory);
+    void CatchUpFiles(const std::vector<std::string>& paths,
+		      boost::atomic<std::size_t>& next);
+    void CatchUpFile(const std::string& path);
+    bool IsMemoryFull(std::size_t postings) const;
+    // Until the lines in memory have been written down to a segment or so
+    void WaitForMemory();
+
+    void RunMaintenance();
+    void WriteMemorySegment();
+    void MergeSegments();
+    // @throw Exception if it can not be written
+    void WriteManifest(const OffsetContainer& ends);
+    std::string GetSegmentPath(unsigned long number) const;
+
+    std::string directory_;
+
+    // Everything below is guarded by the mutex
+    boost::unordered_map<std::string, boost::uint32_t> fileIds_;
+    std::vector<std::string> files_;
+    // Where each file is indexed to
+    OffsetContainer indexedEnds_;
+    TermMap memory_;
+    std::size_t memoryPostings_;
+    // Being written to a segment, still searched
+    boost::shared_ptr<const TermMap> writing_;
+    std::vector<SearchSegmentPtr> segments_;
+    bool catchingUp_;
+    std::vector<PendingLine> pending_;
+    mutable boost::shared_mutex mutex_;
+
+    // Only used by the maintenance thread once it runs
+    unsigned long nextSegment_;
+    // Where the segments cover each file to
+    OffsetContainer writtenEnds_;
+
+    boost::atomic<bool> stopping_;
+    boost::mutex wakeMutex_;
+    boost::condition_variable wake_;
+    // Memory has been taken for a segment
+    boost::condition_variable written_;
+    boost::thread catchUpThread_;
+    boost::thread maintenanceThread_;
+};
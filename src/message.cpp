@@ -0,0 +1,51 @@
+#include "message.hpp"
+
+Message::Message()
+    : parameterCount_(0)
+{
+    nick_ = user_ = host_ = MakeSpan(boost::string_ref());
+}
+
+const Prefix& Message::GetPrefix() const
+{
+    Copies& copies = GetCopies();
+    if (!copies.HasPrefix)
+    {
+        copies.From = Prefix(GetNickRef(), GetUserRef(), GetHostRef());
+        copies.HasPrefix = true;
+    }
+    return copies.From;
+}
+
+const std::string& Message::operator[](std::size_t index) const
+{
+    Copies& copies = GetCopies();
+    unsigned int bit = 1u << index;
+    if (!(copies.CopiedParameters & bit))
+    {
+        boost::string_ref parameter = GetParameterRef(index);
+        copies.Parameters[index].assign(parameter.begin(), parameter.end());
+        copies.CopiedParameters |= bit;
+    }
+    return copies.Parameters[index];
+}
+
+Message::Span Message::MakeSpan(boost::string_ref part) const
+{
+    Span span = { 0, 0 };
+    if (!part.empty())
+    {
+        span.Begin = static_cast<unsigned short>(part.data() - line_.data());
+        span.Length = static_cast<unsigned short>(part.size());
+    }
+    return span;
+}
+
+Message::Copies& Message::GetCopies() const
+{
+    if (!copies_)
+    {
+        copies_.reset(new Copies());
+    }
+    return *copies_;
+}
@@ -2,37 +2,95 @@
 
 #include "prefix.hpp"
 
-#include <vector>
+#include <string>
+#include <boost/scoped_ptr.hpp>
+#include <boost/utility.hpp>
+#include <boost/utility/string_ref.hpp>
 #include <unicode/unistr.h>
 
-class Message
+/**
+ * A received line and where its parts are in it. Nothing is copied out of
+ * the line until it is asked for, so a message that is only classified and
+ * then dropped costs no more than finding its parts.
+ * A message refers to the line it was made from, which has to outlive it.
+ * Receivers are only given a message for the duration of the call.
+ */
+class Message : boost::noncopyable
 {
 public:
+    // RFC 1459 allows 14 middle parameters and a trailing one
+    static const std::size_t MAX_PARAMETERS = 15;
+
+    Message();
+    virtual ~Message() {}
+
     /**
-     * @throw Exception if analyzing of the data fails catastrophically.
+     * The line as it was received, without the line ending.
      */
-    Message() {}
+    boost::string_ref GetLine() const { return line_; }
 
-    typedef std::vector<std::string> ParameterContainer;
-    typedef std::pair<ParameterContainer::const_iterator,
-                      ParameterContainer::const_iterator> ParameterIterators;
+    /**
+     * Copied out of the line the first time it is asked for.
+     */
+    const Prefix& GetPrefix() const;
 
-    const Prefix& GetPrefix() const { return prefix_; }
+    boost::string_ref GetNickRef() const { return GetRef(nick_); }
+    boost::string_ref GetUserRef() const { return GetRef(user_); }
+    boost::string_ref GetHostRef() const { return GetRef(host_); }
 
-    typedef ParameterContainer::const_iterator const_iterator;
+    std::size_t size() const { return parameterCount_; }
 
-    const_iterator begin() const { return parameters_.begin(); }
-    const_iterator end() const { return parameters_.end(); }
+    boost::string_ref GetParameterRef(std::size_t index) const
+    {
+        return GetRef(parameters_[index]);
+    }
 
-    template<class T>
-    const std::string& operator[](T index) const { return parameters_[index]; }
-    ParameterContainer::size_type size() const { return parameters_.size(); }
+    /**
+     * Copied out of the line the first time it is asked for.
+     */
+    const std::string& operator[](std::size_t index) const;
 
     virtual const std::string& GetTarget() const = 0;
     virtual const std::string& GetText() const = 0;
     virtual const std::string& GetReplyTo() const = 0;
+
 protected:
-    Prefix prefix_;
-    ParameterContainer parameters_;
-};
+    // Lines are never long enough to need more than 16 bits
+    struct Span
+    {
+        unsigned short Begin;
+        unsigned short Length;
+    };
 
+    /**
+     * @param part has to be inside the line
+     */
+    Span MakeSpan(boost::string_ref part) const;
+    boost::string_ref GetRef(const Span& span) const
+    {
+        return line_.substr(span.Begin, span.Length);
+    }
+
+    boost::string_ref line_;
+    Span nick_;
+    Span user_;
+    Span host_;
+    Span parameters_[MAX_PARAMETERS];
+    std::size_t parameterCount_;
+
+private:
+    // What has been copied out of the line, only made once something is
+    struct Copies
+    {
+        Copies() : HasPrefix(false), CopiedParameters(0) {}
+
+        bool HasPrefix;
+        Prefix From;
+        // One bit for each parameter that has been copied
+        unsigned int CopiedParameters;
+        std::string Parameters[MAX_PARAMETERS];
+    };
+    Copies& GetCopies() const;
+
+    mutable boost::scoped_ptr<Copies> copies_;
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace NetBurstType
+{
+    enum NetBurstType
+    {
+	Netsplit,
+	Netjoin
+    };
+} // namespace NetBurstType
+
+/**
+ * Many users leaving or coming back at once because two servers split or
+ * joined again, handed on as one event instead of a QUIT or JOIN for each.
+ */
+struct NetBurst
+{
+    NetBurstType::NetBurstType Type;
+    // The two servers, as given in the QUIT reason of the split
+    std::string Servers;
+    // Sorted
+    std::vector<std::string> Nicks;
+    // The channels the nicks left or joined, sorted
+    std::vector<std::string> Channels;
+    // QUIT or JOIN lines that made up the burst
+    unsigned long Lines;
+};
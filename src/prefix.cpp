@@ -1,27 +1,45 @@
 #include "prefix.hpp"
-#include "exception.hpp"
-
-boost::regex Prefix::textRegex_;
 
 Prefix::Prefix(const std::string& text)
 {
-    try
+    boost::string_ref nick, user, host;
+    Split(text, nick, user, host);
+    nick_.assign(nick.begin(), nick.end());
+    user_.assign(user.begin(), user.end());
+    host_.assign(host.begin(), host.end());
+}
+
+Prefix::Prefix(boost::string_ref nick, boost::string_ref user,
+               boost::string_ref host)
+    : nick_(nick.begin(), nick.end())
+    , user_(user.begin(), user.end())
+    , host_(host.begin(), host.end())
+{
+}
+
+void Prefix::Split(boost::string_ref text,
+                   boost::string_ref& nick,
+                   boost::string_ref& user,
+                   boost::string_ref& host)
+{
+    nick.clear();
+    user.clear();
+    host.clear();
+
+    boost::string_ref::size_type bang = text.find('!');
+    if (bang == boost::string_ref::npos)
     {
-        if (textRegex_.empty())
-        {
-            textRegex_ = "([^!]+)(?:!([^@]+)@(.+))?";
-        }
-        boost::smatch matches;
-        if (boost::regex_match(text, matches, textRegex_))
-        {
-            // matches[0] is the entire match, submatches start at 1
-            nick_ = matches[1];
-            user_ = matches[2];
-            host_ = matches[3];
-        }
-    } catch (boost::regex_error& e)
+        nick = text;
+        return;
+    }
+    boost::string_ref userAndHost = text.substr(bang + 1);
+    boost::string_ref::size_type at = userAndHost.find('@');
+    if (bang == 0 || at == boost::string_ref::npos || at == 0
+        || at + 1 == userAndHost.size())
     {
-        throw Exception(__FILE__, __LINE__, e.what());
+        return;
     }
+    nick = text.substr(0, bang);
+    user = userAndHost.substr(0, at);
+    host = userAndHost.substr(at + 1);
 }
-
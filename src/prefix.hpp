@@ -2,26 +2,32 @@
 
 #include <string>
 
-#include <boost/regex.hpp>
+#include <boost/utility/string_ref.hpp>
 
 class Prefix
 {
 public:
-    /**
-     * @throw Exception if parsing of the prefix fails catastrophically.
-     */
     Prefix() {};
     explicit Prefix(const std::string& text);
+    Prefix(boost::string_ref nick, boost::string_ref user,
+           boost::string_ref host);
 
     const std::string& GetNick() const { return nick_; }
     const std::string& GetUser() const { return user_; }
     const std::string& GetHost() const { return host_; }
 
+    /**
+     * Split nick!user@host without copying. Anything without a user and
+     * host is a nick or a server name, an incomplete user@host leaves all
+     * three empty.
+     */
+    static void Split(boost::string_ref text,
+                      boost::string_ref& nick,
+                      boost::string_ref& user,
+                      boost::string_ref& host);
+
 private:
     std::string nick_;
     std::string user_;
     std::string host_;
-
-    static boost::regex textRegex_;
 };
-
@@ -0,0 +1,141 @@
+#include "scrollback.hpp"
+
+Scrollback::Scrollback(std::size_t maxLines,
+                       std::size_t channelBytes,
+                       std::size_t totalBytes)
+    : maxLines_(maxLines)
+    , channelBytes_(channelBytes)
+    , totalBytes_(totalBytes)
+    , order_(0)
+    , bytes_(0)
+{
+}
+
+void Scrollback::Add(const std::string& channel,
+                     const std::string& nick,
+                     std::time_t time,
+                     boost::string_ref text)
+{
+    if (maxLines_ == 0)
+    {
+        return;
+    }
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    Channel& lines = channels_[channel];
+    if (lines.Entries.empty())
+    {
+        // The whole ring at once, lines only ever replace each other in it
+        lines.Entries.resize(maxLines_);
+        bytes_ += maxLines_ * sizeof(Entry);
+    }
+    if (lines.Size == maxLines_)
+    {
+        DropOldest(lines);
+    }
+
+    IdentifierTable::Id nickId = nicks_.Intern(nick);
+    if (nickId >= nickLines_.size())
+    {
+        nickLines_.resize(nicks_.GetIdLimit(), 0);
+    }
+    ++nickLines_[nickId];
+
+    Entry& entry = lines.Entries[(lines.First + lines.Size) % maxLines_];
+    entry.Time = time;
+    entry.Nick = nickId;
+    entry.Order = order_++;
+    entry.Text.assign(text.begin(), text.end());
+    ++lines.Size;
+    lines.TextBytes += text.size();
+    bytes_ += text.size();
+
+    // The line just said is kept whatever its size
+    while (lines.TextBytes > channelBytes_ && lines.Size > 1)
+    {
+        DropOldest(lines);
+    }
+    while (bytes_ > totalBytes_ && DropOldestOfAll())
+    {
+    }
+}
+
+bool Scrollback::GetRange(const std::string& channel,
+                          unsigned long long& first,
+                          unsigned long long& end) const
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    ChannelMap::const_iterator lines = channels_.find(channel);
+    if (lines == channels_.end() || lines->second.Size == 0)
+    {
+        return false;
+    }
+    first = lines->second.First;
+    end = lines->second.First + lines->second.Size;
+    return true;
+}
+
+bool Scrollback::Find(const std::string& channel,
+                      unsigned long long number,
+                      Line& line) const
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    ChannelMap::const_iterator lines = channels_.find(channel);
+    if (lines == channels_.end()
+        || number < lines->second.First
+        || number >= lines->second.First + lines->second.Size)
+    {
+        return false;
+    }
+    const Entry& entry = lines->second.Entries[number % maxLines_];
+    line.Time = entry.Time;
+    line.Nick = nicks_.GetName(entry.Nick);
+    line.Text = entry.Text;
+    return true;
+}
+
+std::size_t Scrollback::GetBytes() const
+{
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    return bytes_;
+}
+
+void Scrollback::DropOldest(Channel& channel)
+{
+    Entry& entry = channel.Entries[channel.First % maxLines_];
+    if (--nickLines_[entry.Nick] == 0)
+    {
+        nicks_.Forget(entry.Nick);
+    }
+    channel.TextBytes -= entry.Text.size();
+    bytes_ -= entry.Text.size();
+    // Give the memory back, the limits count what is kept
+    std::string().swap(entry.Text);
+    ++channel.First;
+    --channel.Size;
+}
+
+bool Scrollback::DropOldestOfAll()
+{
+    // Only reached once all channels together are full, and there are
+    // rarely more than a few dozen channels to look at
+    Channel* oldest = 0;
+    for (ChannelMap::iterator lines = channels_.begin();
+         lines != channels_.end();
+         ++lines)
+    {
+        Channel& channel = lines->second;
+        if (channel.Size > 0
+            && (!oldest
+                || channel.Entries[channel.First % maxLines_].Order
+                   < oldest->Entries[oldest->First % maxLines_].Order))
+        {
+            oldest = &channel;
+        }
+    }
+    if (!oldest)
+    {
+        return false;
+    }
+    DropOldest(*oldest);
+    return true;
+}
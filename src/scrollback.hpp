@@ -0,0 +1,109 @@
+#pragma once
+
+#include "identifiertable.hpp"
+
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/utility.hpp>
+#include <boost/utility/string_ref.hpp>
+
+/**
+ * The last lines said in each channel, kept in memory for scripts that
+ * need what was just said without reading the logs. Each channel has a
+ * ring of lines, and the oldest lines are dropped when a channel or all
+ * channels together go over their byte limits. Nicks are kept as ids, a
+ * nick that said many lines is stored once.
+ *
+ * Lines are numbered from the first line a channel got, so a reader can
+ * walk a channel one line at a time while lines are added and dropped.
+ */
+class Scrollback : boost::noncopyable
+{
+public:
+    struct Line
+    {
+	std::time_t Time;
+	std::string Nick;
+	std::string Text;
+    };
+
+    /**
+     * @param maxLines lines kept for each channel, zero keeps none
+     * @param channelBytes text kept for each channel
+     * @param totalBytes everything kept, the rings of all channels included
+     */
+    Scrollback(std::size_t maxLines,
+	       std::size_t channelBytes,
+	       std::size_t totalBytes);
+
+    /**
+     * @param text what the nick said, in UTF-8
+     */
+    void Add(const std::string& channel,
+	     const std::string& nick,
+	     std::time_t time,
+	     boost::string_ref text);
+
+    /**
+     * @param first gets the number of the oldest line kept
+     * @param end gets the number the next line will get
+     * @return false if the channel has no lines
+     */
+    bool GetRange(const std::string& channel,
+		  unsigned long long& first,
+		  unsigned long long& end) const;
+
+    /**
+     * @return false if the line has been dropped or not said yet
+     */
+    bool Find(const std::string& channel,
+	      unsigned long long number,
+	      Line& line) const;
+
+    // Bytes kept for all channels
+    std::size_t GetBytes() const;
+
+private:
+    struct Entry
+    {
+	Entry() : Time(0), Nick(IdentifierTable::NO_ID), Order(0) {}
+
+	std::time_t Time;
+	IdentifierTable::Id Nick;
+	// When it was added among all channels, to find the oldest line
+	unsigned long long Order;
+	std::string Text;
+    };
+
+    struct Channel
+    {
+	Channel() : First(0), Size(0), TextBytes(0) {}
+
+	// Line number n is at n % maxLines_
+	std::vector<Entry> Entries;
+	unsigned long long First;
+	std::size_t Size;
+	std::size_t TextBytes;
+    };
+    typedef boost::unordered_map<std::string, Channel> ChannelMap;
+
+    void DropOldest(Channel& channel);
+    // @return false if no channel has any lines
+    bool DropOldestOfAll();
+
+    std::size_t maxLines_;
+    std::size_t channelBytes_;
+    std::size_t totalBytes_;
+
+    ChannelMap channels_;
+    IdentifierTable nicks_;
+    // Lines kept of each nick id, the id is forgotten with its last line
+    std::vector<unsigned int> nickLines_;
+    unsigned long long order_;
+    std::size_t bytes_;
+    mutable boost::mutex mutex_;
+};
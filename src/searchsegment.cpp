@@ -0,0 +1,341 @@
+#include "searchsegment.hpp"
+#include "exception.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char SEGMENT_MAGIC[4] = { 'L', 'S', 'X', '1' };
+
+namespace
+{
+    struct Header
+    {
+        char Magic[4];
+        boost::uint32_t Reserved;
+        boost::uint64_t TermCount;
+        boost::uint64_t EntriesOffset;
+        boost::uint64_t TermsOffset;
+    };
+
+    void AppendVarint(std::string& data, boost::uint64_t value)
+    {
+        while (value >= 0x80)
+        {
+            data += static_cast<char>((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        data += static_cast<char>(value);
+    }
+
+    // @return false at the end of the data or if the varint is broken
+    bool ReadVarint(const char*& data, const char* end, boost::uint64_t& value)
+    {
+        value = 0;
+        for (unsigned int shift = 0; data != end && shift < 64; shift += 7)
+        {
+            unsigned char byte = static_cast<unsigned char>(*data++);
+            value |= static_cast<boost::uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+struct SearchSegment::Entry
+{
+    boost::uint64_t TermOffset;
+    boost::uint64_t PostingsOffset;
+    boost::uint32_t TermLength;
+    boost::uint32_t PostingCount;
+};
+
+SearchSegment::Writer::Writer(const std::string& path)
+    : path_(path)
+    , file_(std::fopen(path.c_str(), "wb"))
+    , written_(sizeof(Header))
+{
+    if (!file_)
+    {
+        throw Exception(__FILE__, __LINE__,
+                        ("Could not create search segment '" + path + "': "
+                         + strerror(errno)).c_str());
+    }
+    // The header is written last, when it is known
+    Header header = Header();
+    std::fwrite(&header, sizeof(header), 1, file_);
+}
+
+SearchSegment::Writer::~Writer()
+{
+    if (file_)
+    {
+        std::fclose(file_);
+        std::remove(path_.c_str());
+    }
+}
+
+void SearchSegment::Writer::Add(boost::string_ref term,
+                                const SearchPostingList& postings)
+{
+    Entry entry;
+    entry.TermOffset = terms_.size();
+    entry.PostingsOffset = written_;
+    entry.TermLength = term.size();
+    entry.PostingCount = postings.size();
+    entries_.push_back(entry);
+    terms_.append(term.begin(), term.end());
+
+    buffer_.clear();
+    SearchPosting previous = { 0, 0 };
+    for (SearchPostingList::const_iterator posting = postings.begin();
+         posting != postings.end();
+         ++posting)
+    {
+        AppendVarint(buffer_, posting->File - previous.File);
+        AppendVarint(buffer_, posting->File == previous.File
+                     ? posting->Offset - previous.Offset
+                     : posting->Offset);
+        previous = *posting;
+    }
+    std::fwrite(buffer_.data(), 1, buffer_.size(), file_);
+    written_ += buffer_.size();
+}
+
+void SearchSegment::Writer::Close()
+{
+    // Entries are read in place, keep them aligned
+    static const char padding[8] = { 0 };
+    std::size_t paddingSize = (8 - written_ % 8) % 8;
+    std::fwrite(padding, 1, paddingSize, file_);
+    written_ += paddingSize;
+
+    Header header = Header();
+    std::memcpy(header.Magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+    header.TermCount = entries_.size();
+    header.EntriesOffset = written_;
+    header.TermsOffset = written_ + entries_.size() * sizeof(Entry);
+
+    if (!entries_.empty())
+    {
+        std::fwrite(&entries_[0], sizeof(Entry), entries_.size(), file_);
+    }
+    std::fwrite(terms_.data(), 1, terms_.size(), file_);
+    std::fseek(file_, 0, SEEK_SET);
+    std::fwrite(&header, sizeof(header), 1, file_);
+
+    bool failed = std::ferror(file_) != 0;
+    failed = std::fflush(file_) != 0 || failed;
+    failed = fsync(fileno(file_)) != 0 || failed;
+    failed = std::fclose(file_) != 0 || failed;
+    file_ = 0;
+    if (failed)
+    {
+        std::remove(path_.c_str());
+        throw Exception(__FILE__, __LINE__,
+                        ("Could not write search segment '" + path_
+                         + "'").c_str());
+    }
+}
+
+SearchSegment::SearchSegment(const std::string& path)
+    : path_(path)
+    , data_(0)
+    , size_(0)
+    , termCount_(0)
+    , entriesOffset_(0)
+    , termsOffset_(0)
+    , obsolete_(false)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        throw Exception(__FILE__, __LINE__,
+                        ("Could not open search segment '" + path + "'")
+                        .c_str());
+    }
+    size_ = status.st_size;
+    void* data = size_ > 0
+        ? mmap(0, size_, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        throw Exception(__FILE__, __LINE__,
+                        ("Could not map search segment '" + path + "'")
+                        .c_str());
+    }
+    data_ = static_cast<const char*>(data);
+
+    Header header;
+    bool valid = size_ >= sizeof(header);
+    if (valid)
+    {
+        std::memcpy(&header, data_, sizeof(header));
+        valid = std::equal(SEGMENT_MAGIC,
+                           SEGMENT_MAGIC + sizeof(SEGMENT_MAGIC),
+                           header.Magic)
+            && header.EntriesOffset <= size_
+            && header.TermCount <= (size_ - header.EntriesOffset)
+                                   / sizeof(Entry)
+            && header.TermsOffset == header.EntriesOffset
+                                     + header.TermCount * sizeof(Entry);
+    }
+    if (!valid)
+    {
+        munmap(const_cast<char*>(data_), size_);
+        throw Exception(__FILE__, __LINE__,
+                        ("Broken search segment '" + path + "'").c_str());
+    }
+    termCount_ = header.TermCount;
+    entriesOffset_ = header.EntriesOffset;
+    termsOffset_ = header.TermsOffset;
+}
+
+SearchSegment::~SearchSegment()
+{
+    munmap(const_cast<char*>(data_), size_);
+    if (obsolete_)
+    {
+        std::remove(path_.c_str());
+    }
+}
+
+SearchSegment::Entry SearchSegment::GetEntry(std::size_t index) const
+{
+    Entry entry;
+    std::memcpy(&entry, data_ + entriesOffset_ + index * sizeof(Entry),
+                sizeof(entry));
+    return entry;
+}
+
+boost::string_ref SearchSegment::GetTerm(std::size_t index) const
+{
+    Entry entry = GetEntry(index);
+    if (termsOffset_ + entry.TermOffset + entry.TermLength > size_)
+    {
+        return boost::string_ref();
+    }
+    return boost::string_ref(data_ + termsOffset_ + entry.TermOffset,
+                             entry.TermLength);
+}
+
+void SearchSegment::Find(boost::string_ref term,
+                         long file,
+                         SearchPostingList& postings) const
+{
+    // Binary search in the dictionary
+    std::size_t low = 0;
+    std::size_t high = termCount_;
+    while (low < high)
+    {
+        std::size_t middle = low + (high - low) / 2;
+        int order = GetTerm(middle).compare(term);
+        if (order == 0)
+        {
+            GetPostings(middle, file, postings);
+            return;
+        }
+        if (order < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+}
+
+void SearchSegment::GetPostings(std::size_t index,
+                                long file,
+                                SearchPostingList& postings) const
+{
+    Entry entry = GetEntry(index);
+    if (entry.PostingsOffset > entriesOffset_)
+    {
+        return;
+    }
+    const char* data = data_ + entry.PostingsOffset;
+    const char* end = data_ + entriesOffset_;
+    SearchPosting posting = { 0, 0 };
+    for (boost::uint32_t i = 0; i < entry.PostingCount; ++i)
+    {
+        boost::uint64_t fileDelta;
+        boost::uint64_t offset;
+        if (!ReadVarint(data, end, fileDelta)
+            || !ReadVarint(data, end, offset))
+        {
+            return;
+        }
+        posting.File += fileDelta;
+        posting.Offset = fileDelta == 0 ? posting.Offset + offset : offset;
+        if (file < 0 || posting.File == static_cast<unsigned long>(file))
+        {
+            postings.push_back(posting);
+        }
+        else if (posting.File > static_cast<unsigned long>(file))
+        {
+            // Sorted by file, there is nothing more of it
+            return;
+        }
+    }
+}
+
+void SearchSegment::Merge(const std::vector<SearchSegmentPtr>& segments,
+                          const std::string& path)
+{
+    Writer writer(path);
+    std::vector<std::size_t> next(segments.size(), 0);
+    SearchPostingList postings;
+    for (;;)
+    {
+        // The smallest term any segment has left
+        boost::string_ref term;
+        bool found = false;
+        for (std::size_t i = 0; i < segments.size(); ++i)
+        {
+            if (next[i] < segments[i]->GetTermCount())
+            {
+                boost::string_ref candidate = segments[i]->GetTerm(next[i]);
+                if (!found || candidate < term)
+                {
+                    term = candidate;
+                    found = true;
+                }
+            }
+        }
+        if (!found)
+        {
+            break;
+        }
+
+        postings.clear();
+        for (std::size_t i = 0; i < segments.size(); ++i)
+        {
+            if (next[i] < segments[i]->GetTermCount()
+                && segments[i]->GetTerm(next[i]) == term)
+            {
+                segments[i]->GetPostings(next[i], -1, postings);
+                ++next[i];
+            }
+        }
+        std::sort(postings.begin(), postings.end());
+        postings.erase(std::unique(postings.begin(), postings.end()),
+                       postings.end());
+        writer.Add(term, postings);
+    }
+    writer.Close();
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/utility.hpp>
+#include <boost/utility/string_ref.hpp>
+
+/**
+ * Where a line is, a chat log and the byte the line starts at.
+ */
+struct SearchPosting
+{
+    boost::uint32_t File;
+    boost::uint64_t Offset;
+
+    bool operator<(const SearchPosting& other) const
+    {
+	return File < other.File
+	    || (File == other.File && Offset < other.Offset);
+    }
+    bool operator==(const SearchPosting& other) const
+    {
+	return File == other.File && Offset == other.Offset;
+    }
+};
+
+// Sorted
+typedef std::vector<SearchPosting> SearchPostingList;
+
+/**
+ * A search index segment, a file with a sorted dictionary of terms and for
+ * each a delta encoded list of the lines it is in. Segments are never
+ * changed once written, they are memory mapped and read from any thread.
+ *
+ * The file is a header, the posting lists, the dictionary entries and
+ * then the terms. Posting lists are varints, the file delta and then the
+ * offset delta, or the offset itself when the file changed.
+ */
+class SearchSegment : boost::noncopyable
+{
+public:
+    /**
+     * Writes a segment term by term, the terms have to come in order.
+     */
+    class Writer : boost::noncopyable
+    {
+    public:
+	/**
+	 * @throw Exception if the file can not be made
+	 */
+	explicit Writer(const std::string& path);
+	~Writer();
+
+	void Add(boost::string_ref term, const SearchPostingList& postings);
+
+	/**
+	 * @throw Exception if the file could not be written
+	 */
+	void Close();
+
+    private:
+	struct Entry
+	{
+	    boost::uint64_t TermOffset;
+	    boost::uint64_t PostingsOffset;
+	    boost::uint32_t TermLength;
+	    boost::uint32_t PostingCount;
+	};
+
+	std::string path_;
+	std::FILE* file_;
+	boost::uint64_t written_;
+	std::vector<Entry> entries_;
+	std::string terms_;
+	std::string buffer_;
+    };
+
+    /**
+     * @throw Exception if the file can not be mapped or is broken
+     */
+    explicit SearchSegment(const std::string& path);
+    /**
+     * Removes the file if the segment is obsolete.
+     */
+    ~SearchSegment();
+
+    /**
+     * Add the lines the term is in to the postings, in order.
+     * @param file only lines of this file, or of all files if negative
+     */
+    void Find(boost::string_ref term,
+	      long file,
+	      SearchPostingList& postings) const;
+
+    std::size_t GetTermCount() const { return termCount_; }
+    boost::string_ref GetTerm(std::size_t index) const;
+    void GetPostings(std::size_t index,
+		     long file,
+		     SearchPostingList& postings) const;
+
+    const std::string& GetPath() const { return path_; }
+    std::size_t GetSize() const { return size_; }
+
+    /**
+     * The file goes away with the segment, once nobody reads it.
+     */
+    void SetObsolete() { obsolete_ = true; }
+
+    /**
+     * Write the terms of all the segments to a new segment, postings of
+     * the same term are merged.
+     * @throw Exception if the new segment can not be written
+     */
+    static void Merge(const std::vector<boost::shared_ptr<SearchSegment> >&
+		      segments,
+		      const std::string& path);
+
+private:
+    struct Entry;
+    Entry GetEntry(std::size_t index) const;
+
+    std::string path_;
+    const char* data_;
+    std::size_t size_;
+    std::size_t termCount_;
+    boost::uint64_t entriesOffset_;
+    boost::uint64_t termsOffset_;
+    bool obsolete_;
+};
+
+typedef boost::shared_ptr<SearchSegment> SearchSegmentPtr;
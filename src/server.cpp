@@ -1,28 +1,14 @@
 #include "server.hpp"
 #include "message.hpp"
+#include "chatlogwriter.hpp"
 #include "logging/logger.hpp"
 #include "exception.hpp"
 
-#include <sstream>
-#include <fstream>
+#include <ctime>
 
 #include <boost/bind.hpp>
-#include <boost/filesystem/convenience.hpp>
-#include <boost/filesystem/exception.hpp>
 #include <boost/algorithm/string/trim.hpp>
 
-static void EnsureDirectoryExists(const std::string& directory)
-{
-    try
-    {
-        boost::filesystem::create_directories(directory);
-    } catch (boost::filesystem::filesystem_error&)
-    {
-        Log << LogLevel::Error << "Could not create directories '" << directory
-                << "'";
-    }
-}
-
 Server::Server(const UnicodeString& id,
                const UnicodeString& host,
                unsigned int port,
@@ -33,9 +19,14 @@ Server::Server(const UnicodeString& id,
     , host_(host)
     , port_(port)
     , nick_(nick)
+    , ownNick_(AsUtf8(nick))
+    , caseMapping_(CaseMapping::Rfc1459)
     , serverPassword_(serverPassword)
     , logDirectory_(logDirectory)
 {
+    boost::shared_ptr<PublishedChannels> published(new PublishedChannels());
+    published->Mapping = caseMapping_;
+    publishedChannels_ = published;
 }
 
 Server::~Server()
@@ -63,6 +54,12 @@ const UnicodeString& Server::GetNick() const
     return nick_;
 }
 
+bool Server::IsOwnNick(boost::string_ref nick) const
+{
+    boost::shared_lock<boost::shared_mutex> lock(nickMutex_);
+    return CaseMapping::Equals(ownNick_, nick, caseMapping_);
+}
+
 Server::ReceiverHandle Server::RegisterReceiver(Receiver receiver)
 {
     boost::upgrade_lock<boost::shared_mutex> lock(receiversMutex_);
@@ -71,6 +68,15 @@ Server::ReceiverHandle Server::RegisterReceiver(Receiver receiver)
     return handle;
 }
 
+Server::BurstReceiverHandle
+Server::RegisterBurstReceiver(BurstReceiver receiver)
+{
+    boost::upgrade_lock<boost::shared_mutex> lock(receiversMutex_);
+    boost::shared_ptr<BurstReceiver> handle(new BurstReceiver(receiver));
+    burstReceivers_.push_back(boost::weak_ptr<BurstReceiver>(handle));
+    return handle;
+}
+
 std::string Server::GetLogName(const std::string& target) const
 {
     std::string logFile = logDirectory_;
@@ -78,11 +84,26 @@ std::string Server::GetLogName(const std::string& target) const
     {
         logFile += "/";
     }
-    EnsureDirectoryExists(logFile);
-    logFile += target;
+    ChannelSnapshotPtr channel = GetChannel(target);
+    logFile += channel ? channel->Name : target;
     return logFile;
 }
 
+void Server::SetLastSeenIndex(boost::shared_ptr<LastSeenIndex> index)
+{
+    lastSeen_ = index;
+}
+
+void Server::SetChannelStatistics(boost::shared_ptr<ChannelStatistics> statistics)
+{
+    statistics_ = statistics;
+}
+
+void Server::SetScrollback(boost::shared_ptr<Scrollback> scrollback)
+{
+    scrollback_ = scrollback;
+}
+
 void Server::AddChannel(const std::string& channel, const UnicodeString& key)
 {
     boost::upgrade_lock<boost::shared_mutex> lock(channelsMutex_);
@@ -114,68 +135,211 @@ const UnicodeString* Server::GetChannelKey(const std::string& channel) const
 void Server::SetNick(const UnicodeString& nick)
 {
     Send("NICK " + AsUtf8(nick));
-    boost::upgrade_lock<boost::shared_mutex> lock(nickMutex_);
+    boost::unique_lock<boost::shared_mutex> lock(nickMutex_);
     nick_ = nick;
+    ownNick_ = AsUtf8(nick);
 }
 
-const std::set<std::string>&
-Server::GetChannelNicks(const std::string& channel) const
+void Server::SetCaseMapping(CaseMapping::CaseMapping mapping)
 {
-    boost::shared_lock<boost::shared_mutex> lock(channelsMutex_);
-    ChannelNicksContainer::const_iterator channelNicks = channelNicks_.find(
-            channel);
-    if (channelNicks != channelNicks_.end())
     {
-        return channelNicks->second;
+        boost::unique_lock<boost::shared_mutex> lock(nickMutex_);
+        caseMapping_ = mapping;
+    }
+    boost::lock_guard<boost::mutex> lock(channelNicksMutex_);
+    channelNicks_.SetCaseMapping(mapping);
+}
+
+ChannelSnapshotPtr Server::GetChannel(const std::string& channel) const
+{
+    PublishedChannelsPtr published = boost::atomic_load(&publishedChannels_);
+    std::map<std::string, ChannelSlotPtr>::const_iterator slot =
+        published->Channels.find(CaseMapping::Fold(channel,
+                                                   published->Mapping));
+    if (slot == published->Channels.end())
+    {
+        return ChannelSnapshotPtr();
     }
-    throw Exception(__FILE__, __LINE__, AsUnicode(
-            "Could not get nicks for channel '" + channel + "'"));
+    return boost::atomic_load(&slot->second->Snapshot);
 }
 
 void Server::RemoveChannelNickChannel(const std::string& channel)
 {
-    boost::upgrade_lock<boost::shared_mutex> lock(channelNicksMutex_);
-    channelNicks_.erase(channel);
+    boost::lock_guard<boost::mutex> lock(channelNicksMutex_);
+    channelNicks_.RemoveChannel(channel);
 }
 
-void Server::ClearAllChannelNicks(const std::string& channel)
+void Server::SetChannelMembers(const std::string& channel,
+                               const ChannelMembers::NamesContainer& members)
 {
-    boost::upgrade_lock<boost::shared_mutex> lock(channelNicksMutex_);
-    channelNicks_[channel].clear();
+    boost::lock_guard<boost::mutex> lock(channelNicksMutex_);
+    channelNicks_.ReplaceChannel(channel, members);
 }
 
 void Server::AddChannelNick(const std::string& channel, const std::string& nick)
 {
-    boost::upgrade_lock<boost::shared_mutex> lock(channelNicksMutex_);
-    channelNicks_[channel].insert(nick);
+    boost::lock_guard<boost::mutex> lock(channelNicksMutex_);
+    channelNicks_.Add(channel, nick);
 }
 
 void Server::ChangeChannelNick(const std::string& oldNick, const std::string& newNick)
 {
-    boost::upgrade_lock<boost::shared_mutex> lock(channelNicksMutex_);
-    for (ChannelNicksContainer::iterator channel = channelNicks_.begin();
-         channel != channelNicks_.end();
-         ++channel)
+    boost::lock_guard<boost::mutex> lock(channelNicksMutex_);
+    channelNicks_.RenameNick(oldNick, newNick);
+}
+
+void Server::RemoveChannelNick(const std::string& nick)
+{
+    boost::lock_guard<boost::mutex> lock(channelNicksMutex_);
+    channelNicks_.RemoveNick(nick);
+}
+
+void Server::RemoveChannelNick(const std::string& channel, const std::string& nick)
+{
+    boost::lock_guard<boost::mutex> lock(channelNicksMutex_);
+    channelNicks_.Remove(channel, nick);
+}
+
+void Server::GetNickChannels(const std::string& nick,
+                             std::vector<std::string>& channels)
+{
+    boost::lock_guard<boost::mutex> lock(channelNicksMutex_);
+    channelNicks_.GetNickChannels(nick, channels);
+}
+
+void Server::SetMemberPrefixSymbols(const std::string& symbols)
+{
+    boost::lock_guard<boost::mutex> lock(channelNicksMutex_);
+    channelNicks_.SetPrefixSymbols(symbols);
+}
+
+void Server::SetChannelNickPrefix(const std::string& channel,
+                                  const std::string& nick,
+                                  std::size_t prefix,
+                                  bool set)
+{
+    boost::lock_guard<boost::mutex> lock(channelNicksMutex_);
+    channelNicks_.SetPrefix(channel, nick, prefix, set);
+}
+
+void Server::SetNickUserAndHost(const std::string& nick,
+                                const std::string& user,
+                                const std::string& host)
+{
+    boost::lock_guard<boost::mutex> lock(channelNicksMutex_);
+    channelNicks_.SetUserAndHost(nick, user, host);
+}
+
+void Server::SetNickAccount(const std::string& nick,
+                            const std::string& account)
+{
+    boost::lock_guard<boost::mutex> lock(channelNicksMutex_);
+    channelNicks_.SetAccount(nick, account);
+}
+
+void Server::SetChannelTopic(const std::string& channel,
+                             const std::string& topic)
+{
+    boost::lock_guard<boost::mutex> lock(channelNicksMutex_);
+    channelNicks_.SetTopic(channel, topic);
+}
+
+void Server::SetChannelTopicSetter(const std::string& channel,
+                                   const std::string& setBy,
+                                   time_t setAt)
+{
+    boost::lock_guard<boost::mutex> lock(channelNicksMutex_);
+    channelNicks_.SetTopicSetter(channel, setBy, setAt);
+}
+
+void Server::SetChannelMode(const std::string& channel,
+                            char mode,
+                            const std::string& parameter)
+{
+    boost::lock_guard<boost::mutex> lock(channelNicksMutex_);
+    channelNicks_.SetMode(channel, mode, parameter);
+}
+
+void Server::UnsetChannelMode(const std::string& channel, char mode)
+{
+    boost::lock_guard<boost::mutex> lock(channelNicksMutex_);
+    channelNicks_.UnsetMode(channel, mode);
+}
+
+void Server::ClearChannelModes(const std::string& channel)
+{
+    boost::lock_guard<boost::mutex> lock(channelNicksMutex_);
+    channelNicks_.ClearModes(channel);
+}
+
+void Server::PublishChannels()
+{
+    boost::lock_guard<boost::mutex> lock(channelNicksMutex_);
+    std::vector<std::string> changed;
+    channelNicks_.TakeChangedChannels(changed);
+
+    // Only this thread publishes
+    PublishedChannelsPtr published = boost::atomic_load(&publishedChannels_);
+    CaseMapping::CaseMapping mapping = channelNicks_.GetCaseMapping();
+    // Copied the first time a channel comes or goes
+    boost::shared_ptr<PublishedChannels> next;
+    if (published->Mapping != mapping)
     {
-        channel->second.erase(oldNick);
-        channel->second.insert(newNick);
+        // Every channel has to be filed under its new folded name
+        next.reset(new PublishedChannels());
+        next->Mapping = mapping;
+        channelNicks_.GetChannels(changed);
+    }
+    if (changed.empty() && !next)
+    {
+        return;
     }
-}
 
-void Server::RemoveChannelNick(const std::string& nick) {
-    boost::upgrade_lock<boost::shared_mutex> lock(channelNicksMutex_);
-    for (ChannelNicksContainer::iterator channel = channelNicks_.begin();
-         channel != channelNicks_.end();
+    for (std::vector<std::string>::const_iterator channel = changed.begin();
+         channel != changed.end();
          ++channel)
     {
-        channelNicks_[channel->first].erase(nick);
+        std::string key = CaseMapping::Fold(*channel, mapping);
+        const PublishedChannels& current = next ? *next : *published;
+        std::map<std::string, ChannelSlotPtr>::const_iterator slot =
+            current.Channels.find(key);
+
+        boost::shared_ptr<ChannelSnapshot> snapshot(new ChannelSnapshot());
+        if (!channelNicks_.GetSnapshot(*channel, *snapshot))
+        {
+            // Removed
+            if (slot != current.Channels.end())
+            {
+                if (!next)
+                {
+                    next.reset(new PublishedChannels(*published));
+                }
+                next->Channels.erase(key);
+            }
+            continue;
+        }
+
+        if (slot != current.Channels.end())
+        {
+            boost::atomic_store(&slot->second->Snapshot,
+                                ChannelSnapshotPtr(snapshot));
+        }
+        else
+        {
+            if (!next)
+            {
+                next.reset(new PublishedChannels(*published));
+            }
+            ChannelSlotPtr newSlot(new ChannelSlot());
+            newSlot->Snapshot = snapshot;
+            next->Channels[key] = newSlot;
+        }
     }
-}
 
-void Server::RemoveChannelNick(const std::string& channel, const std::string& nick)
-{
-    boost::upgrade_lock<boost::shared_mutex> lock(channelNicksMutex_);
-    channelNicks_[channel].erase(nick);
+    if (next)
+    {
+        boost::atomic_store(&publishedChannels_, PublishedChannelsPtr(next));
+    }
 }
 
 const UnicodeString& Server::GetServerPassword() const
@@ -204,50 +368,70 @@ void Server::NotifyReceiver(const Message& message)
     }
 }
 
-void Server::LogMessage(const std::string& target, const std::string& text)
+void Server::NotifyBurstReceiver(const NetBurst& burst)
 {
-    boost::lock_guard<boost::mutex> lock(logMutex_);
-    std::string logFile = GetLogName(target);
-
-    time_t currentTime = time(0);
-    LogStreamMap::iterator stream = logStreams_.find(logFile);
-    if (stream == logStreams_.end())
+    boost::shared_lock<boost::shared_mutex> lock(receiversMutex_);
+    for (BurstReceiverContainer::iterator i = burstReceivers_.begin();
+         i != burstReceivers_.end();)
     {
-        Log << LogLevel::Debug << "Creating '" << logFile << "' log stream";
-        OfstreamPtr
-                newStream(new std::ofstream(logFile.c_str(), std::ios::app));
-        logStreams_[logFile] = OfstreamAndTimestamp(newStream, currentTime);
-        stream = logStreams_.find(logFile);
+        if (BurstReceiverHandle receiver = i->lock())
+        {
+            (*receiver)(*this, burst);
+            ++i;
+        }
+        else
+        {
+            boost::upgrade_lock<boost::shared_mutex> lock(receiversMutex_);
+            i = burstReceivers_.erase(i);
+        }
     }
-    if (stream != logStreams_.end())
+}
+
+void Server::LogMessage(const std::string& logName,
+                        const std::string& target,
+                        const std::string& nick,
+                        const std::string& text)
+{
+    std::time_t now = std::time(0);
+    if (lastSeen_)
     {
-        (*stream->second.first) << text << std::endl;
-        stream->second.second = currentTime;
+        lastSeen_->Update(logName, nick, now, text);
     }
+
+    std::string line;
+    line.reserve(target.size() + nick.size() + text.size() + 16);
+    ChatLogWriter::AppendTimestamp(line, now);
+    line += ' ';
+    line += target;
+    line += ": <";
+    line += nick;
+    line += "> ";
+    line += text;
+    ChatLogWriter::Instance().Append(logName, line);
 }
 
-const UnicodeString& Server::GetHost() const
+void Server::CountMessage(const std::string& logName,
+                          const std::string& nick,
+                          boost::string_ref text)
 {
-    return host_;
+    if (statistics_)
+    {
+        statistics_->Update(logName, nick, std::time(0), text);
+    }
 }
 
-void Server::ManageLogStreams()
+void Server::AddToScrollback(const std::string& logName,
+                             const std::string& target,
+                             const std::string& nick,
+                             boost::string_ref text)
 {
-    time_t currentTime = time(0);
-    for (LogStreamMap::iterator i = logStreams_.begin(); i != logStreams_.end();)
+    if (scrollback_ && target.find_first_of("#&") == 0)
     {
-        // Only keep logstreams alive for a certain amount of time
-        if (i->second.second + 30 * 60 < currentTime)
-        {
-            Log << LogLevel::Debug << "Closing '" << i->first << "' log stream";
-            LogStreamMap::iterator next = i;
-            std::advance(next, 1), logStreams_.erase(i);
-            i = next;
-        }
-        else
-        {
-            ++i;
-        }
+        scrollback_->Add(logName, nick, std::time(0), text);
     }
 }
 
+const UnicodeString& Server::GetHost() const
+{
+    return host_;
+}
@@ -5,6 +5,10 @@
 #include <boost/function.hpp>
 
 class Server;
+struct NetBurst;
 
 typedef boost::function<void (Server&, const Message&)> ServerReceiver;
 typedef boost::shared_ptr<ServerReceiver> ServerReceiverHandle;
+
+typedef boost::function<void (Server&, const NetBurst&)> ServerBurstReceiver;
+typedef boost::shared_ptr<ServerBurstReceiver> ServerBurstReceiverHandle;
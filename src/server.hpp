@@ -2,19 +2,26 @@
 #define SERVER_HPP
 
 #include "server.fwd.hpp"
+#include "channelstatistics.hpp"
+#include "lastseenindex.hpp"
+#include "scrollback.hpp"
 
 #include "message.hpp"
+#include "channelmembers.hpp"
+#include "casemapping.hpp"
+#include "channelsnapshot.hpp"
 
 #include <unicode/unistr.h>
 
 #include <string>
 #include <list>
 #include <map>
-#include <set>
+#include <vector>
 
 #include <boost/shared_ptr.hpp>
 #include <boost/weak_ptr.hpp>
 #include <boost/thread.hpp>
+#include <boost/utility/string_ref.hpp>
 
 class Server : boost::noncopyable
 {
@@ -37,6 +44,12 @@ public:
     virtual const UnicodeString& GetHostName() const;
     virtual unsigned int GetPort() const;
     virtual const UnicodeString& GetNick() const;
+    /**
+     * Compare with our nick the way the server does, without allocating.
+     */
+    bool IsOwnNick(boost::string_ref nick) const;
+    // Round trip time to the server in milliseconds, negative if unknown
+    virtual long GetLag() const = 0;
 
     typedef ServerReceiver Receiver;
     typedef ServerReceiverHandle ReceiverHandle;
@@ -48,12 +61,38 @@ public:
      */
     ReceiverHandle RegisterReceiver(Receiver receiver);
 
+    typedef ServerBurstReceiver BurstReceiver;
+    typedef ServerBurstReceiverHandle BurstReceiverHandle;
+
+    /**
+     * Like RegisterReceiver but for netsplits and netjoins, which are
+     * given as one event for each burst instead of a message for each line.
+     */
+    BurstReceiverHandle RegisterBurstReceiver(BurstReceiver receiver);
+
     /**
      * Get path to log file for the given target which can be a channel or
-     * a nick.
+     * a nick. A channel we are in is logged under the name it was first
+     * written as, whatever case it is given in.
      */
     std::string GetLogName(const std::string& target) const;
 
+    /**
+     * Index that is told about every line that is logged, set before
+     * connecting.
+     */
+    void SetLastSeenIndex(boost::shared_ptr<LastSeenIndex> index);
+
+    /**
+     * Statistics that count every message received, set before connecting.
+     */
+    void SetChannelStatistics(boost::shared_ptr<ChannelStatistics> statistics);
+
+    /**
+     * Where the lines said in channels are kept, set before connecting.
+     */
+    void SetScrollback(boost::shared_ptr<Scrollback> scrollback);
+
     // Add a channel to the list of channels to maintain membership of.
     // This means the channel will be automatically joined on connecting
     // and when being removed from the channel.
@@ -65,19 +104,51 @@ public:
     virtual void ChangeNick(const UnicodeString& nick) = 0;
     virtual void SendMessage(const std::string& target,
                              const UnicodeString& message) = 0;
+    // Send a message nobody is waiting for, it goes out after all other
+    // traffic when the server is throttling us
+    virtual void SendLowPriorityMessage(const std::string& target,
+                                        const UnicodeString& message) = 0;
     virtual void Kick(const std::string& channel,
                       const std::string& user,
                       const UnicodeString& message) = 0;
 
     /**
-     * @throw Exception if channel not found
+     * The channel as it was after the last received line was handled.
+     * Never waits for the network thread.
+     * @return null if we are not in the channel
      */
-    const std::set<std::string>& GetChannelNicks(const std::string& channel) const;
+    ChannelSnapshotPtr GetChannel(const std::string& channel) const;
 
 protected:
-    void LogMessage(const std::string& target,
+    /**
+     * Queue a line for the target's chat log, never waits for the disk.
+     * @param logName GetLogName(target), worked out once by the caller for
+     *        everything done with a message
+     * @param text what the nick said, in UTF-8
+     */
+    void LogMessage(const std::string& logName,
+                    const std::string& target,
+                    const std::string& nick,
                     const std::string& text);
+    /**
+     * Count a received message in the statistics of a log.
+     * @param text what the nick said, in UTF-8
+     */
+    void CountMessage(const std::string& logName,
+                      const std::string& nick,
+                      boost::string_ref text);
+    /**
+     * Keep a line said in a channel in its scrollback, lines to nicks are
+     * not kept.
+     * @param text what the nick said, in UTF-8
+     */
+    void AddToScrollback(const std::string& logName,
+                         const std::string& target,
+                         const std::string& nick,
+                         boost::string_ref text);
     void SetNick(const UnicodeString& nick);
+    // From CASEMAPPING in RPL_ISUPPORT, until then RFC 1459 is assumed
+    void SetCaseMapping(CaseMapping::CaseMapping mapping);
 
     void JoinAllChannels();
     // Get the key for a given channel, returns NULL if there is no key stored
@@ -85,48 +156,93 @@ protected:
     const UnicodeString* GetChannelKey(const std::string& channel) const;
 
     void RemoveChannelNickChannel(const std::string& channel);
-    void ClearAllChannelNicks(const std::string& channel);
+    // Replace all members of a channel at once
+    void SetChannelMembers(const std::string& channel,
+                           const ChannelMembers::NamesContainer& members);
     void AddChannelNick(const std::string& channel, const std::string& nick);
     void ChangeChannelNick(const std::string& oldNick, const std::string& newNick);
     // Remove nick from ALL channels
     void RemoveChannelNick(const std::string& nick);
     // Remove nick from specified channel
     void RemoveChannelNick(const std::string& channel, const std::string& nick);
+    // The channels a nick is in, as first written
+    void GetNickChannels(const std::string& nick,
+                         std::vector<std::string>& channels);
+    // From PREFIX in RPL_ISUPPORT, the symbols of the member modes
+    void SetMemberPrefixSymbols(const std::string& symbols);
+    // Give or take the member mode with the given index in the symbols
+    void SetChannelNickPrefix(const std::string& channel,
+                              const std::string& nick,
+                              std::size_t prefix,
+                              bool set);
+    // Empty values are not known and are left alone
+    void SetNickUserAndHost(const std::string& nick,
+                            const std::string& user,
+                            const std::string& host);
+    void SetNickAccount(const std::string& nick, const std::string& account);
+    void SetChannelTopic(const std::string& channel, const std::string& topic);
+    void SetChannelTopicSetter(const std::string& channel,
+                               const std::string& setBy,
+                               time_t setAt);
+    void SetChannelMode(const std::string& channel,
+                        char mode,
+                        const std::string& parameter);
+    void UnsetChannelMode(const std::string& channel, char mode);
+    void ClearChannelModes(const std::string& channel);
+    // Make the channel changes since the last call visible to GetChannel,
+    // done once for each received line
+    void PublishChannels();
 
     const UnicodeString& GetServerPassword() const;
 
     void NotifyReceiver(const Message& message);
+    void NotifyBurstReceiver(const NetBurst& burst);
 protected:
     const UnicodeString& GetHost() const;
 
 private:
-    void ManageLogStreams();
-
     typedef std::list<boost::weak_ptr<Receiver> > ReceiverContainer;
     ReceiverContainer receivers_;
+    typedef std::list<boost::weak_ptr<BurstReceiver> > BurstReceiverContainer;
+    BurstReceiverContainer burstReceivers_;
     boost::shared_mutex receiversMutex_;
 
     UnicodeString id_;
     UnicodeString host_;
     unsigned int port_;
     UnicodeString nick_;
+    // The nick in UTF-8, to compare received nicks with
+    std::string ownNick_;
+    CaseMapping::CaseMapping caseMapping_;
     UnicodeString serverPassword_;
     std::string logDirectory_;
+    boost::shared_ptr<LastSeenIndex> lastSeen_;
+    boost::shared_ptr<ChannelStatistics> statistics_;
+    boost::shared_ptr<Scrollback> scrollback_;
     mutable boost::shared_mutex nickMutex_;
 
-    typedef boost::shared_ptr<std::ofstream> OfstreamPtr;
-    typedef std::pair<OfstreamPtr,time_t> OfstreamAndTimestamp;
-    typedef std::map<std::string, OfstreamAndTimestamp> LogStreamMap;
-    LogStreamMap logStreams_;
-    boost::mutex logMutex_;
-
     typedef std::map<std::string, UnicodeString> ChannelKeyMap;
     ChannelKeyMap channels_;
     mutable boost::shared_mutex channelsMutex_;
 
-    typedef std::map<std::string,std::set<std::string> > ChannelNicksContainer;
-    ChannelNicksContainer channelNicks_;
-    boost::shared_mutex channelNicksMutex_;
+    ChannelMembers channelNicks_;
+    boost::mutex channelNicksMutex_;
+
+    // Each slot is swapped atomically when its channel changes, the map
+    // only when channels come or go
+    struct ChannelSlot
+    {
+        ChannelSnapshotPtr Snapshot;
+    };
+    typedef boost::shared_ptr<ChannelSlot> ChannelSlotPtr;
+    struct PublishedChannels
+    {
+        CaseMapping::CaseMapping Mapping;
+        // By folded name
+        std::map<std::string, ChannelSlotPtr> Channels;
+    };
+    typedef boost::shared_ptr<const PublishedChannels> PublishedChannelsPtr;
+    PublishedChannelsPtr publishedChannels_;
 };
 
 #endif
@@ -27,13 +27,9 @@ void ConnectionTest::TestConstructor()
     receiverReady_.wait(lock);
 }
 
-void ConnectionTest::Receive(Connection& connection, const std::vector<char>& data)
+void ConnectionTest::Receive(Connection& connection, boost::string_ref line)
 {
-    std::vector<char>::const_iterator t=std::find(data.begin(), data.end(), 0);
-    
-    CPPUNIT_ASSERT(t != data.end());
-    
-    std::string receivedString = &data[0];
+    std::string receivedString(line.begin(), line.end());
 
     CPPUNIT_ASSERT(receivedString == TEST_SERVER_WELCOME_MESSAGE);
 
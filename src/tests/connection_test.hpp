@@ -19,7 +19,7 @@ public:
 
     void TestConstructor();
 
-    void Receive(Connection& connection, const std::vector<char>& data);
+    void Receive(Connection& connection, boost::string_ref line);
 
 private:
 
@@ -29,7 +29,7 @@ void TestServer::OnConnect(const boost::system::error_code& error)
     {
 	boost::system::error_code writeError;
 	boost::asio::write(socket_,
-			   boost::asio::buffer(TEST_SERVER_WELCOME_MESSAGE),
+			   boost::asio::buffer(TEST_SERVER_WELCOME_MESSAGE + "\r\n"),
 			   boost::asio::transfer_all(),
 			   writeError);
 	StartAccept();
@@ -48,7 +48,7 @@ void TestServer::Run()
 
 	boost::system::error_code error;
 	boost::asio::write(socket,
-			   boost::asio::buffer(TEST_SERVER_WELCOME_MESSAGE),
+			   boost::asio::buffer(TEST_SERVER_WELCOME_MESSAGE + "\r\n"),
 			   boost::asio::transfer_all(),
 			   error);
     }